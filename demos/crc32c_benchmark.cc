@@ -0,0 +1,158 @@
+#include <bits/stdc++.h>
+#include <sys/socket.h>
+
+#include "absl/strings/numbers.h"
+#include "servercc.h"
+
+using namespace std;
+using ostp::servercc::crc32cAccelerated;
+using ostp::servercc::extendCrc32c;
+using ostp::servercc::extendCrc32cPortable;
+using ostp::servercc::FrameChecksums;
+using ostp::servercc::Message;
+using ostp::servercc::SocketLink;
+using ostp::servercc::WireFormat;
+
+// Benchmark of the CRC32C frame checksums.
+//
+// The benchmark first compares the throughput of the checksum, with the CRC32 instructions of the
+// CPU if it has them and with the table-driven fallback, against memcpy over buffers of several
+// sizes. It then measures the overhead checksums add to links in the compact wire format by sending
+// the same messages over a pair of connected sockets without them, with checksums of the headers
+// and with checksums of the bodies too. Every link is measured several times in turn and keeps its
+// best throughput so that the scheduling of the writer and the reader does not drown the overhead.
+//
+// Usage:
+//     crc32c_benchmark [--bytes=268435456] [--messages=200000] [--trials=5]
+
+namespace {
+
+// Returns the seconds taken by the specified function.
+template <typename F>
+double timeIt(F function) {
+    auto start = chrono::steady_clock::now();
+    function();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Returns the messages per second a link carries from a writer thread to a reader.
+//
+// Arguments:
+//     checksums: The checksums of the links.
+//     length: The length of the body of the messages.
+//     count: The number of messages to send.
+double linkThroughput(FrameChecksums checksums, size_t length, size_t count) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    SocketLink writer(fds[0], WireFormat::kCompact, {}, checksums);
+    SocketLink reader(fds[1], WireFormat::kCompact, {}, checksums);
+    vector<uint8_t> body(length, 0x5a);
+    auto seconds = timeIt([&]() {
+        thread writing([&]() {
+            for (size_t i = 0; i < count; i++) {
+                auto message = make_unique<Message>();
+                message->header = {(uint32_t)length, 0x30};
+                message->body.data = body;
+                if (!writer.write(std::move(message)).ok()) {
+                    cerr << "Failed to write message" << endl;
+                    exit(1);
+                }
+            }
+        });
+        for (size_t i = 0; i < count; i++) {
+            auto [status, message] = reader.read();
+            if (!status.ok()) {
+                cerr << "Failed to read message: " << status << endl;
+                exit(1);
+            }
+        }
+        writing.join();
+    });
+    close(fds[0]);
+    close(fds[1]);
+    return count / seconds;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    size_t bytes = 256 << 20;
+    size_t messages = 200000;
+    size_t trials = 5;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto eq = arg.find('=');
+        string key = arg.substr(0, eq);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+        bool ok = false;
+        if (key == "--bytes") {
+            ok = absl::SimpleAtoi(value, &bytes) && bytes > 0;
+        } else if (key == "--messages") {
+            ok = absl::SimpleAtoi(value, &messages) && messages > 0;
+        } else if (key == "--trials") {
+            ok = absl::SimpleAtoi(value, &trials) && trials > 0;
+        }
+        if (!ok) {
+            cerr << "Usage: " << argv[0] << " [--bytes=N] [--messages=N] [--trials=N]" << endl;
+            return 1;
+        }
+    }
+
+    // Checksum throughput against memcpy.
+    cout << "CRC32 instructions: " << (crc32cAccelerated() ? "yes" : "no") << endl;
+    cout << setw(10) << "size" << setw(14) << "memcpy GB/s" << setw(14) << "crc32c GB/s"
+         << setw(16) << "portable GB/s" << endl;
+    for (size_t size : {64, 256, 1024, 4096, 16384, 65536, 1 << 20}) {
+        vector<uint8_t> source(size), destination(size);
+        mt19937 random(size);
+        generate(source.begin(), source.end(), [&]() { return random(); });
+        auto rounds = max<size_t>(bytes / size, 1);
+        volatile uint32_t sink = 0;
+        auto copySeconds = timeIt([&]() {
+            for (size_t round = 0; round < rounds; round++) {
+                source[0] = round;
+                memcpy(destination.data(), source.data(), size);
+                sink = sink + destination[size - 1];
+            }
+        });
+        auto crcSeconds = timeIt([&]() {
+            for (size_t round = 0; round < rounds; round++) {
+                source[0] = round;
+                sink = sink + extendCrc32c(0, source.data(), size);
+            }
+        });
+        auto portableSeconds = timeIt([&]() {
+            for (size_t round = 0; round < rounds; round++) {
+                source[0] = round;
+                sink = sink + extendCrc32cPortable(0, source.data(), size);
+            }
+        });
+        double total = (double)rounds * size / 1e9;
+        cout << fixed << setprecision(2) << setw(10) << size << setw(14) << total / copySeconds
+             << setw(14) << total / crcSeconds << setw(16) << total / portableSeconds << endl;
+    }
+
+    // Overhead of checksums on a link.
+    cout << endl
+         << setw(10) << "size" << setw(16) << "plain msg/s" << setw(16) << "headers msg/s"
+         << setw(12) << "overhead" << setw(16) << "full msg/s" << setw(12) << "overhead" << endl;
+    for (size_t size : {64, 1024, 16384, 262144}) {
+        auto count = max<size_t>(min(messages, bytes / size), 1000);
+        double plain = 0;
+        double headers = 0;
+        double full = 0;
+        for (size_t trial = 0; trial < trials; trial++) {
+            plain = max(plain, linkThroughput(FrameChecksums::kNone, size, count));
+            headers = max(headers, linkThroughput(FrameChecksums::kHeaders, size, count));
+            full = max(full, linkThroughput(FrameChecksums::kFull, size, count));
+        }
+        cout << fixed << setprecision(0) << setw(10) << size << setw(16) << plain << setw(16)
+             << headers << setprecision(1) << setw(11) << 100 * (plain - headers) / plain << "%"
+             << setprecision(0) << setw(16) << full << setprecision(1) << setw(11)
+             << 100 * (plain - full) / plain << "%" << endl;
+    }
+    return 0;
+}
@@ -12,7 +12,10 @@
 #include "servercc.h"
 
 using ostp::servercc::DistributedServer;
+using ostp::servercc::Member;
+using ostp::servercc::MemberState;
 using ostp::servercc::Message;
+using ostp::servercc::PeerAddress;
 using ostp::servercc::Request;
 using namespace std;
 
@@ -69,18 +72,15 @@ int main(int argc, char *argv[]) {
     // ========================== ADD CALLBACKS ============================ //
     // ===================================================================== //
 
-    // Callback function for when a peer connects.
-    function onPeerConnect = [&](in_addr_t ip, DistributedServer &server) {
+    // Callback function for when the state of a peer changes.
+    function onViewChange = [&](const Member &member, DistributedServer &server) {
         char ipStr[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &ip, ipStr, INET_ADDRSTRLEN);
-        LOG(INFO) << "Peer connected: '" << ipStr << "'";
-    };
-
-    // Callback function for when a peer disconnects.
-    function onPeerDisconnect = [&](in_addr_t ip, DistributedServer &server) {
-        char ipStr[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &ip, ipStr, INET_ADDRSTRLEN);
-        LOG(INFO) << "Peer disconnected: '" << ipStr << "'";
+        inet_ntop(AF_INET, &member.address, ipStr, INET_ADDRSTRLEN);
+        const char *state = member.state == MemberState::kAlive     ? "alive"
+                            : member.state == MemberState::kSuspect ? "suspect"
+                                                                    : "dead";
+        LOG(INFO) << "Peer '" << ipStr << ":" << member.port << "' is " << state
+                  << " (incarnation " << member.incarnation << ")";
     };
 
     // ===================================================================== //
@@ -91,7 +91,7 @@ int main(int argc, char *argv[]) {
     DistributedServer server(
         interface, group, {interface_ip}, port,
         [](std::unique_ptr<Request> request) -> absl::Status { return absl::OkStatus(); },
-        onPeerConnect, onPeerDisconnect);
+        onViewChange);
 
     // ===================================================================== //
     // ========================== ADD HANDLERS ============================= //
@@ -126,11 +126,18 @@ int main(int argc, char *argv[]) {
     while (cout << "servercc-shell> " && getline(cin, line)) {
         if (line == "e") {
             cout << "Starting echo service. Send empty message to stop." << endl;
-            cout << "Enter ip: ";
+            cout << "Enter ip[:port]: ";
             string ip = "";
             getline(cin, ip);
-            in_addr_t ipAddr;
-            inet_pton(AF_INET, ip.c_str(), &ipAddr);
+
+            // Servers sharing a host are told apart by their port, which defaults to the port of
+            // this server.
+            PeerAddress peer = {0, (uint16_t)port};
+            if (auto colon = ip.find(':'); colon != string::npos) {
+                peer.port = stoi(ip.substr(colon + 1));
+                ip = ip.substr(0, colon);
+            }
+            inet_pton(AF_INET, ip.c_str(), &peer.address);
 
             while (true) {
                 string message = "";
@@ -145,7 +152,7 @@ int main(int argc, char *argv[]) {
                 echoMessage->body.data = vector<uint8_t>(message.begin(), message.end());
 
 
-                auto [status, request] = server.sendInternalRequest(ipAddr);
+                auto [status, request] = server.sendInternalRequest(peer);
                 if (!status.ok()) {
                     cout << "Failed to open channel to peer: " << status.message() << endl;
                     break;
@@ -0,0 +1,924 @@
+#include <arpa/inet.h>
+#include <bits/stdc++.h>
+#include <netinet/tcp.h>
+
+#include "absl/base/log_severity.h"
+#include "absl/log/globals.h"
+#include "absl/log/initialize.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "servercc.h"
+
+using namespace std;
+using ostp::servercc::AdmissionOptions;
+using ostp::servercc::AsyncLogSink;
+using ostp::servercc::BatchOptions;
+using ostp::servercc::Compression;
+using ostp::servercc::CompressionOptions;
+using ostp::servercc::Connector;
+using ostp::servercc::DistributedServer;
+using ostp::servercc::handler_t;
+using ostp::servercc::HeartbeatOptions;
+using ostp::servercc::Histogram;
+using ostp::servercc::HistogramSnapshot;
+using ostp::servercc::kOverloadedProtocol;
+using ostp::servercc::LoopbackNetwork;
+using ostp::servercc::LoopbackOptions;
+using ostp::servercc::LoopbackTransport;
+using ostp::servercc::Member;
+using ostp::servercc::MembershipOptions;
+using ostp::servercc::MemberState;
+using ostp::servercc::Message;
+using ostp::servercc::MessageLink;
+using ostp::servercc::MetricsRegistry;
+using ostp::servercc::PeerAddress;
+using ostp::servercc::protocol_t;
+using ostp::servercc::Request;
+using ostp::servercc::RequestBatcher;
+using ostp::servercc::ShmLink;
+using ostp::servercc::SocketLink;
+using ostp::servercc::TcpClient;
+using ostp::servercc::TcpServer;
+using ostp::servercc::Tracer;
+using ostp::servercc::WireFormat;
+
+// Load generator for TcpServer, Connector and DistributedServer based clusters.
+//
+// The generator drives an in-process target over loopback and reports throughput and latency
+// percentiles. It supports a closed loop where every stream keeps `depth` requests outstanding, and
+// an open loop where requests are issued on a fixed schedule. In the open loop the latency of a
+// request is measured from the time it was scheduled to be sent rather than from the time it was
+// actually sent so that a stalled target is not hidden by the generator backing off (coordinated
+// omission).
+//
+// Usage:
+//     load_generator [--mode=tcp|cluster|loopback] [--port=7100] [--nodes=3] [--connections=8]
+//                    [--depth=1] [--rate=0] [--duration=10] [--warmup=2]
+//                    [--sizes=64[:weight],...] [--protocols=0x30[:weight],...] [--per-request]
+//                    [--metrics] [--transport=tcp|compact|compressed|shm] [--latency=0]
+//                    [--bandwidth=0] [--loss=0] [--peer-connections=1] [--admission]
+//                    [--service-time=0] [--batch-window=US] [--random-payload]
+//
+// In tcp mode every connection is a TcpClient to a TcpServer echoing messages back. In cluster mode
+// `nodes` connectors are linked in a full mesh over loopback TCP exactly like DistributedServer
+// peers are, and every connection is an internal request channel between two distinct nodes. With
+// --per-request a new connection (tcp) or single-shot channel (cluster) is opened for every
+// request. With --metrics the metrics of the process are printed in the text exposition format
+// after the run. With --transport=shm the cluster nodes exchange messages over shared memory links
+// instead of their TCP connections as co-located DistributedServer peers do, and with
+// --transport=compact over their TCP connections in the compact wire format, which
+// --transport=compressed combines with deflate. The bodies of the requests are zeros past their
+// timestamp, and random bytes which do not compress with --random-payload. With
+// --peer-connections every pair of nodes is linked by that many connections across which the
+// channels are striped.
+//
+// With --admission the target sheds the requests above its adaptive concurrency limit and the shed
+// requests are counted apart from the errors. --service-time (us) makes the echo handlers hold a
+// resource shared by the whole target for that long per message so that requests queue behind it.
+//
+// With --batch-window the cluster nodes send every request through a RequestBatcher which gathers
+// the requests to the same peer made within the window into one internal request. A request is
+// then answered with its batch so combine it with --per-request and many connections.
+//
+// In loopback mode `nodes` DistributedServers run on a LoopbackNetwork in the process. They
+// discover each other through the membership protocol and every connection is an internal request
+// between two distinct servers, so no interface, multicast group or port is needed. --latency (us),
+// --bandwidth (bytes/s) and --loss (datagram loss rate) set the conditions of the network.
+
+namespace {
+
+// The length of the timestamp and sequence number prepended to every request body.
+constexpr size_t kPayloadPrefixLength = 2 * sizeof(uint64_t);
+
+// Options of the load generator.
+struct Options {
+    // Either "tcp", "cluster" or "loopback".
+    string mode = "tcp";
+
+    // The first port used by the target.
+    int port = 7100;
+
+    // The number of nodes in cluster mode.
+    int nodes = 3;
+
+    // The number of concurrent streams.
+    int connections = 8;
+
+    // The number of connections between every pair of nodes in cluster and loopback modes.
+    int peerConnections = 1;
+
+    // The number of outstanding requests per stream.
+    int depth = 1;
+
+    // The total arrival rate in requests per second. Zero runs a closed loop.
+    double rate = 0;
+
+    // The measured duration in seconds.
+    double duration = 10;
+
+    // The warmup duration in seconds excluded from the results.
+    double warmup = 2;
+
+    // Weighted message body sizes.
+    vector<pair<size_t, uint32_t>> sizes = {{64, 1}};
+
+    // Weighted request protocols.
+    vector<pair<protocol_t, uint32_t>> protocols = {{0x30, 1}};
+
+    // Whether a new connection or channel is opened for every request.
+    bool perRequest = false;
+
+    // Whether the metrics of the process are printed after the run.
+    bool metrics = false;
+
+    // Either "tcp", "compact", "compressed" or "shm", the transport between the nodes in cluster
+    // mode.
+    string transport = "tcp";
+
+    // Whether the bodies of the requests are filled with random bytes.
+    bool randomPayload = false;
+
+    // The conditions of the network in loopback mode.
+    LoopbackOptions loopback;
+
+    // Whether the target sheds requests above its concurrency limit.
+    bool admission = false;
+
+    // The time the echo handlers hold the shared resource per message.
+    chrono::microseconds serviceTime = chrono::microseconds(0);
+
+    // The window of the request batchers of the cluster nodes if requests are batched.
+    optional<chrono::microseconds> batchWindow;
+};
+
+// Parses a list of `value[:weight]` pairs.
+//
+// Arguments:
+//     text: The text to parse.
+//     parse: The function used to parse a single value.
+// Returns:
+//     The parsed pairs or nullopt if the text is malformed.
+template <typename T>
+optional<vector<pair<T, uint32_t>>> parseWeighted(absl::string_view text,
+                                                  function<optional<T>(absl::string_view)> parse) {
+    vector<pair<T, uint32_t>> result;
+    for (absl::string_view entry : absl::StrSplit(text, ',', absl::SkipEmpty())) {
+        vector<absl::string_view> parts = absl::StrSplit(entry, ':');
+        uint32_t weight = 1;
+        auto value = parse(parts[0]);
+        if (!value || parts.size() > 2 || (parts.size() == 2 && !absl::SimpleAtoi(parts[1], &weight))) {
+            return nullopt;
+        }
+        result.emplace_back(*value, weight);
+    }
+    if (result.empty()) {
+        return nullopt;
+    }
+    return result;
+}
+
+// Parses the command line into options exiting on malformed arguments.
+Options parseOptions(int argc, char *argv[]) {
+    Options options;
+    auto usage = [&]() {
+        cerr << "Usage: " << argv[0]
+             << " [--mode=tcp|cluster|loopback] [--port=N] [--nodes=N] [--connections=N]"
+                " [--depth=N] [--rate=REQ_PER_SEC] [--duration=SEC] [--warmup=SEC]"
+                " [--sizes=BYTES[:W],...] [--protocols=P[:W],...] [--per-request] [--metrics]"
+                " [--transport=tcp|compact|compressed|shm] [--latency=US]"
+                " [--bandwidth=BYTES_PER_SEC] [--loss=RATE] [--peer-connections=N] [--admission]"
+                " [--service-time=US] [--batch-window=US] [--random-payload]"
+             << endl;
+        exit(1);
+    };
+    auto parseSize = [](absl::string_view text) -> optional<size_t> {
+        size_t value;
+        return absl::SimpleAtoi(text, &value) ? optional(max(value, kPayloadPrefixLength))
+                                              : nullopt;
+    };
+    auto parseProtocol = [](absl::string_view text) -> optional<protocol_t> {
+        uint32_t value;
+        return absl::SimpleHexAtoi(text, &value) ? optional(value) : nullopt;
+    };
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto eq = arg.find('=');
+        string key = arg.substr(0, eq);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+        bool ok = true;
+        if (key == "--mode") {
+            options.mode = value;
+            ok = value == "tcp" || value == "cluster" || value == "loopback";
+        } else if (key == "--port") {
+            ok = absl::SimpleAtoi(value, &options.port);
+        } else if (key == "--nodes") {
+            ok = absl::SimpleAtoi(value, &options.nodes) && options.nodes >= 2;
+        } else if (key == "--connections") {
+            ok = absl::SimpleAtoi(value, &options.connections) && options.connections > 0;
+        } else if (key == "--peer-connections") {
+            ok = absl::SimpleAtoi(value, &options.peerConnections) && options.peerConnections > 0;
+        } else if (key == "--depth") {
+            ok = absl::SimpleAtoi(value, &options.depth) && options.depth > 0;
+        } else if (key == "--rate") {
+            ok = absl::SimpleAtod(value, &options.rate) && options.rate >= 0;
+        } else if (key == "--duration") {
+            ok = absl::SimpleAtod(value, &options.duration) && options.duration > 0;
+        } else if (key == "--warmup") {
+            ok = absl::SimpleAtod(value, &options.warmup) && options.warmup >= 0;
+        } else if (key == "--sizes") {
+            auto sizes = parseWeighted<size_t>(value, parseSize);
+            ok = sizes.has_value();
+            if (ok) options.sizes = *sizes;
+        } else if (key == "--protocols") {
+            auto protocols = parseWeighted<protocol_t>(value, parseProtocol);
+            ok = protocols.has_value();
+            if (ok) options.protocols = *protocols;
+        } else if (key == "--per-request") {
+            options.perRequest = true;
+        } else if (key == "--metrics") {
+            options.metrics = true;
+        } else if (key == "--admission") {
+            options.admission = true;
+        } else if (key == "--service-time") {
+            int64_t serviceTime;
+            ok = absl::SimpleAtoi(value, &serviceTime) && serviceTime >= 0;
+            options.serviceTime = chrono::microseconds(serviceTime);
+        } else if (key == "--batch-window") {
+            int64_t window;
+            ok = absl::SimpleAtoi(value, &window) && window >= 0;
+            options.batchWindow = chrono::microseconds(window);
+        } else if (key == "--transport") {
+            options.transport = value;
+            ok = value == "tcp" || value == "compact" || value == "compressed" || value == "shm";
+        } else if (key == "--random-payload") {
+            options.randomPayload = true;
+        } else if (key == "--latency") {
+            int64_t latency;
+            ok = absl::SimpleAtoi(value, &latency) && latency >= 0;
+            options.loopback.latency = chrono::microseconds(latency);
+        } else if (key == "--bandwidth") {
+            ok = absl::SimpleAtoi(value, &options.loopback.bandwidth);
+        } else if (key == "--loss") {
+            ok = absl::SimpleAtod(value, &options.loopback.lossRate) &&
+                 options.loopback.lossRate >= 0 && options.loopback.lossRate < 1;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            cerr << "Invalid argument '" << arg << "'" << endl;
+            usage();
+        }
+    }
+    return options;
+}
+
+// Picks values according to their weights.
+template <typename T>
+class WeightedChoice {
+   public:
+    WeightedChoice(const vector<pair<T, uint32_t>> &entries) {
+        uint64_t total = 0;
+        for (auto &[value, weight] : entries) {
+            total += weight;
+            values.push_back(value);
+            cumulative.push_back(total);
+        }
+    }
+
+    // Picks a value using the specified random generator.
+    T pick(mt19937_64 &random) const {
+        auto point = random() % cumulative.back();
+        return values[upper_bound(cumulative.begin(), cumulative.end(), point) -
+                      cumulative.begin()];
+    }
+
+   private:
+    vector<T> values;
+    vector<uint64_t> cumulative;
+};
+
+// Returns the current monotonic time in nanoseconds.
+uint64_t nowNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// A bidirectional ordered stream of messages to the target.
+class Stream {
+   public:
+    virtual ~Stream() = default;
+
+    // Sends a message.
+    virtual absl::Status send(unique_ptr<Message> message) = 0;
+
+    // Blocks until a message is received.
+    virtual pair<absl::Status, unique_ptr<Message>> receive() = 0;
+
+    // Unblocks any pending receive.
+    virtual void shutdown() = 0;
+};
+
+// A stream over a TCP connection.
+class TcpStream : public Stream {
+   public:
+    TcpStream(unique_ptr<TcpClient> client) : client(std::move(client)) {}
+
+    absl::Status send(unique_ptr<Message> message) final {
+        return client->sendMessage(std::move(message));
+    }
+
+    pair<absl::Status, unique_ptr<Message>> receive() final { return client->receiveMessage(); }
+
+    void shutdown() final { ::shutdown(client->getClientFd(), SHUT_RDWR); }
+
+   private:
+    unique_ptr<TcpClient> client;
+};
+
+// A stream over an internal request channel or any other request.
+class RequestStream : public Stream {
+   public:
+    RequestStream(unique_ptr<Request> request) : request(std::move(request)) {}
+
+    absl::Status send(unique_ptr<Message> message) final {
+        return request->sendMessage(std::move(message));
+    }
+
+    pair<absl::Status, unique_ptr<Message>> receive() final { return request->receiveMessage(); }
+
+    void shutdown() final { request->terminate(); }
+
+   private:
+    unique_ptr<Request> request;
+};
+
+// A stream whose every message is a request sent through a request batcher.
+class BatchedStream : public Stream {
+   public:
+    BatchedStream(RequestBatcher &batcher, PeerAddress peer) : batcher(batcher), peer(peer) {}
+
+    absl::Status send(unique_ptr<Message> message) final {
+        pending.push_back(std::move(message));
+        return absl::OkStatus();
+    }
+
+    pair<absl::Status, unique_ptr<Message>> receive() final {
+        if (pending.empty()) {
+            return {absl::FailedPreconditionError("No request was sent"), nullptr};
+        }
+        auto message = std::move(pending.front());
+        pending.pop_front();
+        return batcher.call(peer, std::move(message));
+    }
+
+    void shutdown() final {}
+
+   private:
+    RequestBatcher &batcher;
+    const PeerAddress peer;
+    deque<unique_ptr<Message>> pending;
+};
+
+// Opens a new stream to the target.
+typedef function<pair<absl::Status, unique_ptr<Stream>>()> stream_factory_t;
+
+// The results collected by a single worker.
+struct WorkerResult {
+    unique_ptr<Histogram> latency = make_unique<Histogram>();
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t shed = 0;
+};
+
+// The results of every worker.
+struct RunResult {
+    HistogramSnapshot latency;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t shed = 0;
+
+    // Adds the results of a worker.
+    void merge(const WorkerResult &result) {
+        latency.merge(result.latency->snapshot());
+        bytes += result.bytes;
+        errors += result.errors;
+        shed += result.shed;
+    }
+
+    // Adds the results of another run.
+    void merge(const RunResult &result) {
+        latency.merge(result.latency);
+        bytes += result.bytes;
+        errors += result.errors;
+        shed += result.shed;
+    }
+};
+
+// Shared state of a load run.
+class LoadRun {
+   public:
+    LoadRun(const Options &options)
+        : options(options),
+          sizes(options.sizes),
+          protocols(options.protocols),
+          start(nowNanos()),
+          measureStart(start + uint64_t(options.warmup * 1e9)),
+          end(measureStart + uint64_t(options.duration * 1e9)),
+          interval(options.rate > 0 ? uint64_t(1e9 * options.connections / options.rate) : 0) {}
+
+    const Options &options;
+    const WeightedChoice<size_t> sizes;
+    const WeightedChoice<protocol_t> protocols;
+
+    // The start of the run, the start of the measured period and the end of the run.
+    const uint64_t start, measureStart, end;
+
+    // The interval between two requests of a single stream in the open loop.
+    const uint64_t interval;
+
+    // Creates a request scheduled at the specified time.
+    unique_ptr<Message> makeRequest(mt19937_64 &random, uint64_t scheduled, uint64_t sequence,
+                                    protocol_t protocol) const {
+        auto message = make_unique<Message>();
+        message->header.protocol = protocol;
+        message->body.data.resize(sizes.pick(random));
+        message->header.length = message->body.data.size();
+        if (options.randomPayload) {
+            for (size_t i = 0; i < message->body.data.size(); i += sizeof(uint64_t)) {
+                uint64_t bytes = random();
+                memcpy(message->body.data.data() + i, &bytes,
+                       min(sizeof(uint64_t), message->body.data.size() - i));
+            }
+        }
+        memcpy(message->body.data.data(), &scheduled, sizeof(uint64_t));
+        memcpy(message->body.data.data() + sizeof(uint64_t), &sequence, sizeof(uint64_t));
+        return message;
+    }
+
+    // Records the response to a request.
+    void recordResponse(WorkerResult &result, const Message &response) const {
+        if (response.header.protocol == kOverloadedProtocol) {
+            result.shed++;
+            return;
+        }
+        uint64_t scheduled;
+        if (response.body.data.size() < kPayloadPrefixLength) {
+            result.errors++;
+            return;
+        }
+        memcpy(&scheduled, response.body.data.data(), sizeof(uint64_t));
+        if (scheduled >= measureStart && scheduled < end) {
+            result.latency->record(nowNanos() - scheduled);
+            result.bytes += response.body.data.size();
+        }
+    }
+
+    // Returns the time the specified request of a stream should be sent at. In the closed loop
+    // requests are sent as soon as possible.
+    uint64_t scheduleOf(uint64_t sequence, uint64_t offset) const {
+        return interval == 0 ? nowNanos() : start + offset + sequence * interval;
+    }
+};
+
+// Sleeps until the specified monotonic time.
+void sleepUntil(uint64_t nanos) {
+    auto now = nowNanos();
+    if (nanos > now) {
+        this_thread::sleep_for(chrono::nanoseconds(nanos - now));
+    }
+}
+
+// Runs a pipelined stream with up to `depth` requests in flight and returns the results.
+//
+// Arguments:
+//     run: The load run.
+//     stream: The stream to drive.
+//     seed: The seed of the stream.
+RunResult runPipelined(const LoadRun &run, unique_ptr<Stream> stream, uint64_t seed) {
+    WorkerResult result;
+    counting_semaphore<> window(run.options.depth);
+    atomic<uint64_t> outstanding = 0;
+    atomic<bool> sending = true;
+
+    // The receiver completes requests in order and reopens the window.
+    thread receiver([&]() {
+        while (sending || outstanding > 0) {
+            auto [status, response] = stream->receive();
+            if (!status.ok()) {
+                break;
+            }
+            run.recordResponse(result, *response);
+            outstanding--;
+            window.release();
+        }
+    });
+
+    // All requests of a stream share its protocol as a stream maps to a single handler.
+    mt19937_64 random(seed);
+    auto protocol = run.protocols.pick(random);
+    auto offset = run.interval == 0 ? 0 : random() % run.interval;
+    for (uint64_t sequence = 0;; sequence++) {
+        auto scheduled = run.scheduleOf(sequence, offset);
+        if (scheduled >= run.end) {
+            break;
+        }
+        sleepUntil(scheduled);
+        window.acquire();
+        outstanding++;
+        if (!stream->send(run.makeRequest(random, scheduled, sequence, protocol)).ok()) {
+            outstanding--;
+            result.errors++;
+            break;
+        }
+    }
+    sending = false;
+
+    // Give the outstanding requests a grace period before unblocking the receiver.
+    auto grace = nowNanos() + 1'000'000'000;
+    while (outstanding > 0 && nowNanos() < grace) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    result.errors += outstanding;
+    stream->shutdown();
+    receiver.join();
+    RunResult runResult;
+    runResult.merge(result);
+    return runResult;
+}
+
+// Runs `depth` workers each opening a new stream for every request and returns the results.
+//
+// Arguments:
+//     run: The load run.
+//     factory: The factory used to open the streams.
+//     seed: The seed of the workers.
+RunResult runPerRequest(const LoadRun &run, const stream_factory_t &factory, uint64_t seed) {
+    vector<WorkerResult> results(run.options.depth);
+    vector<thread> workers;
+    atomic<uint64_t> next = 0;
+    for (int worker = 0; worker < run.options.depth; worker++) {
+        workers.emplace_back([&, worker]() {
+            auto &result = results[worker];
+            mt19937_64 random(seed * run.options.depth + worker);
+            auto offset = run.interval == 0 ? 0 : random() % run.interval;
+            while (true) {
+                auto sequence = next++;
+                auto scheduled = run.scheduleOf(sequence, offset);
+                if (scheduled >= run.end) {
+                    break;
+                }
+                sleepUntil(scheduled);
+                auto [status, stream] = factory();
+                auto protocol = run.protocols.pick(random);
+                if (!status.ok() ||
+                    !stream->send(run.makeRequest(random, scheduled, sequence, protocol)).ok()) {
+                    result.errors++;
+                    continue;
+                }
+                auto [rcvStatus, response] = stream->receive();
+                if (!rcvStatus.ok()) {
+                    result.errors++;
+                    continue;
+                }
+                run.recordResponse(result, *response);
+            }
+        });
+    }
+    RunResult merged;
+    for (int worker = 0; worker < run.options.depth; worker++) {
+        workers[worker].join();
+        merged.merge(results[worker]);
+    }
+    return merged;
+}
+
+// The time the echo handlers hold the resource shared by the target per message.
+chrono::microseconds serviceTime;
+
+// The resource shared by the echo handlers of the target.
+mutex serviceMutex;
+
+// A handler echoing every message of a request back on a dedicated thread so that the server
+// can keep accepting while requests are processed.
+absl::Status echoHandler(unique_ptr<Request> request) {
+    thread([request = std::move(request)]() {
+        while (true) {
+            auto [status, message] = request->receiveMessage();
+            if (!status.ok()) {
+                break;
+            }
+            if (serviceTime.count() > 0) {
+                lock_guard lock(serviceMutex);
+                this_thread::sleep_for(serviceTime);
+            }
+            if (!request->sendMessage(std::move(message)).ok()) {
+                break;
+            }
+        }
+    }).detach();
+    return absl::OkStatus();
+}
+
+// Starts a TcpServer echoing every protocol and returns a factory for connections to it.
+stream_factory_t startTcpTarget(const Options &options) {
+    // The server runs for the lifetime of the process.
+    auto *server = new TcpServer(options.port, echoHandler);
+    if (options.admission) {
+        server->setAdmissionControl(AdmissionOptions());
+    }
+    for (auto &[protocol, weight] : options.protocols) {
+        if (!server->addHandler(protocol, echoHandler).ok()) {
+            cerr << "Failed to add handler for protocol " << protocol << endl;
+            exit(1);
+        }
+    }
+    thread([server]() { server->run(); }).detach();
+
+    return [port = options.port]() -> pair<absl::Status, unique_ptr<Stream>> {
+        auto client = make_unique<TcpClient>("127.0.0.1", port);
+        auto status = client->openSocket();
+        if (!status.ok()) {
+            return {status, nullptr};
+        }
+        return {absl::OkStatus(), make_unique<TcpStream>(std::move(client))};
+    };
+}
+
+// Returns the loopback address identifying the specified cluster node.
+in_addr_t nodeAddress(int node) { return htonl(INADDR_LOOPBACK + node); }
+
+// Opens a connected pair of loopback TCP sockets through the specified listening socket.
+pair<int, int> connectPair(int listenFd, const sockaddr_in &listenAddr) {
+    int dialFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (dialFd < 0 || connect(dialFd, (sockaddr *)&listenAddr, sizeof(listenAddr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int acceptFd = accept(listenFd, nullptr, nullptr);
+    if (acceptFd < 0) {
+        perror("accept");
+        exit(1);
+    }
+    return {dialFd, acceptFd};
+}
+
+// Starts a cluster of connectors linked in a full mesh over loopback TCP and returns a factory
+// for channels between each ordered pair of distinct nodes.
+vector<stream_factory_t> startClusterTarget(const Options &options) {
+    // The connectors run for the lifetime of the process.
+    vector<Connector *> nodes;
+    for (int node = 0; node < options.nodes; node++) {
+        nodes.push_back(new Connector(
+            echoHandler,
+            [node](PeerAddress) { cerr << "Node " << node << " lost a peer" << endl; },
+            HeartbeatOptions(), options.peerConnections));
+        if (options.admission) {
+            nodes.back()->setAdmissionControl(AdmissionOptions());
+        }
+        for (auto &[protocol, weight] : options.protocols) {
+            if (!nodes.back()->addHandler(protocol, echoHandler).ok()) {
+                cerr << "Failed to add handler for protocol " << protocol << endl;
+                exit(1);
+            }
+        }
+    }
+
+    // Link every pair of nodes as DistributedServer does after a connect handshake.
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in listenAddr = {};
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listenAddr.sin_port = htons(options.port);
+    if (listenFd < 0 || bind(listenFd, (sockaddr *)&listenAddr, sizeof(listenAddr)) < 0 ||
+        listen(listenFd, options.nodes * options.peerConnections) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    for (int a = 0; a < options.nodes; a++) {
+        for (int b = a + 1; b < options.nodes; b++) {
+            for (int connection = 0; connection < options.peerConnections; connection++) {
+                auto [fdA, fdB] = connectPair(listenFd, listenAddr);
+                sockaddr_in addrA = {};
+                addrA.sin_family = AF_INET;
+                addrA.sin_addr.s_addr = nodeAddress(a);
+                sockaddr_in addrB = {};
+                addrB.sin_family = AF_INET;
+                addrB.sin_addr.s_addr = nodeAddress(b);
+                shared_ptr<MessageLink> linkA, linkB;
+                if (options.transport == "compact" || options.transport == "compressed") {
+                    CompressionOptions compression;
+                    if (options.transport == "compressed") {
+                        compression.codec = Compression::kDeflate;
+                    }
+                    linkA = make_shared<SocketLink>(fdA, WireFormat::kCompact, compression);
+                    linkB = make_shared<SocketLink>(fdB, WireFormat::kCompact, compression);
+                } else if (options.transport == "shm") {
+                    auto [createStatus, created] = ShmLink::create(fdA);
+                    auto [openStatus, opened] =
+                        createStatus.ok() ? ShmLink::open(created->getName(), fdB)
+                                          : make_pair(createStatus, shared_ptr<ShmLink>());
+                    if (!openStatus.ok()) {
+                        cerr << "Failed to create shared memory link: " << openStatus << endl;
+                        exit(1);
+                    }
+                    created->unlink();
+                    linkA = std::move(created);
+                    linkB = std::move(opened);
+                }
+                auto statusA = nodes[a]->addClient(
+                    make_unique<TcpClient>(fdA, "127.0.0.1", options.port, *(sockaddr *)&addrB),
+                    linkA);
+                auto statusB = nodes[b]->addClient(
+                    make_unique<TcpClient>(fdB, "127.0.0.1", options.port, *(sockaddr *)&addrA),
+                    linkB);
+                if (!statusA.ok() || !statusB.ok()) {
+                    cerr << "Failed to link nodes " << a << " and " << b << endl;
+                    exit(1);
+                }
+            }
+        }
+    }
+    close(listenFd);
+
+    vector<stream_factory_t> factories;
+    for (int a = 0; a < options.nodes; a++) {
+        RequestBatcher *batcher = nullptr;
+        if (options.batchWindow.has_value()) {
+            batcher = new RequestBatcher(*nodes[a], BatchOptions{*options.batchWindow});
+        }
+        for (int b = 0; b < options.nodes; b++) {
+            if (a == b) {
+                continue;
+            }
+            PeerAddress peer = {nodeAddress(b), 0};
+            if (batcher != nullptr) {
+                factories.push_back([batcher, peer]() -> pair<absl::Status, unique_ptr<Stream>> {
+                    return {absl::OkStatus(), make_unique<BatchedStream>(*batcher, peer)};
+                });
+                continue;
+            }
+            factories.push_back(
+                [node = nodes[a], peer,
+                 singleShot = options.perRequest]() -> pair<absl::Status, unique_ptr<Stream>> {
+                    auto [status, request] = node->sendRequest(peer, singleShot);
+                    if (!status.ok()) {
+                        return {status, nullptr};
+                    }
+                    return {absl::OkStatus(), make_unique<RequestStream>(std::move(request))};
+                });
+        }
+    }
+    return factories;
+}
+
+// Starts a cluster of DistributedServers on a loopback network, waits until every server knows
+// every other one and returns a factory for internal requests between each ordered pair of
+// distinct servers.
+vector<stream_factory_t> startLoopbackTarget(const Options &options) {
+    // The network and the servers run for the lifetime of the process.
+    auto *network = new LoopbackNetwork(options.loopback);
+    vector<DistributedServer *> nodes;
+    for (int node = 0; node < options.nodes; node++) {
+        auto address = inet_addr(("10.0.0." + to_string(node + 1)).c_str());
+        nodes.push_back(new DistributedServer(
+            make_unique<LoopbackTransport>(*network, address, options.port), echoHandler,
+            [](const Member &, DistributedServer &) {}, HeartbeatOptions(),
+            MembershipOptions(), options.peerConnections));
+        if (options.admission) {
+            nodes.back()->setAdmissionControl(AdmissionOptions());
+        }
+        for (auto &[protocol, weight] : options.protocols) {
+            if (!nodes.back()->addHandler(protocol, echoHandler).ok()) {
+                cerr << "Failed to add handler for protocol " << protocol << endl;
+                exit(1);
+            }
+        }
+        if (!nodes.back()->run().ok()) {
+            cerr << "Failed to run node " << node << endl;
+            exit(1);
+        }
+    }
+
+    // Wait for the membership to converge.
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(30);
+    auto converged = [&]() {
+        for (auto *node : nodes) {
+            auto members = node->members();
+            if (count_if(members.begin(), members.end(), [](const Member &member) {
+                    return member.state == MemberState::kAlive;
+                }) < options.nodes - 1) {
+                return false;
+            }
+        }
+        return true;
+    };
+    while (!converged()) {
+        if (chrono::steady_clock::now() > deadline) {
+            cerr << "Loopback cluster did not converge" << endl;
+            exit(1);
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
+    vector<stream_factory_t> factories;
+    for (int a = 0; a < options.nodes; a++) {
+        for (int b = 0; b < options.nodes; b++) {
+            if (a == b) {
+                continue;
+            }
+            PeerAddress peer = {inet_addr(("10.0.0." + to_string(b + 1)).c_str()),
+                                (uint16_t)options.port};
+            factories.push_back(
+                [node = nodes[a], peer]() -> pair<absl::Status, unique_ptr<Stream>> {
+                    auto [status, request] = node->sendInternalRequest(peer);
+                    if (!status.ok()) {
+                        return {status, nullptr};
+                    }
+                    return {absl::OkStatus(), make_unique<RequestStream>(std::move(request))};
+                });
+        }
+    }
+    return factories;
+}
+
+// Prints the results of a run.
+void report(const Options &options, const RunResult &result) {
+    auto seconds = options.duration;
+    auto us = [](uint64_t nanos) { return nanos / 1000.0; };
+    cout << fixed << setprecision(1);
+    cout << "mode=" << options.mode << " connections=" << options.connections
+         << " depth=" << options.depth << " per-request=" << options.perRequest << " loop="
+         << (options.rate > 0 ? "open" : "closed") << endl;
+    if (options.rate > 0) {
+        cout << "target rate:  " << options.rate << " req/s" << endl;
+    }
+    cout << "throughput:   " << result.latency.count() / seconds << " req/s, "
+         << result.bytes / seconds / (1 << 20) << " MiB/s" << endl;
+    cout << "errors:       " << result.errors << endl;
+    cout << "shed:         " << result.shed << endl;
+    cout << "latency (us): p50=" << us(result.latency.percentile(50))
+         << " p90=" << us(result.latency.percentile(90))
+         << " p99=" << us(result.latency.percentile(99))
+         << " p99.9=" << us(result.latency.percentile(99.9))
+         << " p99.99=" << us(result.latency.percentile(99.99))
+         << " max=" << us(result.latency.max()) << endl;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    absl::SetStderrThreshold(absl::LogSeverity::kWarning);
+    absl::InitializeLog();
+    auto options = parseOptions(argc, argv);
+    serviceTime = options.serviceTime;
+
+    // Start the target.
+    vector<stream_factory_t> factories;
+    if (options.mode == "tcp") {
+        factories.push_back(startTcpTarget(options));
+    } else if (options.mode == "cluster") {
+        factories = startClusterTarget(options);
+    } else {
+        factories = startLoopbackTarget(options);
+    }
+
+    // Drive every stream from its own worker.
+    LoadRun run(options);
+    vector<RunResult> results(options.connections);
+    vector<thread> workers;
+    for (int i = 0; i < options.connections; i++) {
+        workers.emplace_back([&, i]() {
+            auto &factory = factories[i % factories.size()];
+            if (options.perRequest) {
+                results[i] = runPerRequest(run, factory, i);
+                return;
+            }
+            auto [status, stream] = factory();
+            if (!status.ok()) {
+                cerr << "Failed to open stream " << i << ": " << status.message() << endl;
+                results[i].errors++;
+                return;
+            }
+            results[i] = runPipelined(run, std::move(stream), i);
+        });
+    }
+
+    RunResult merged;
+    for (int i = 0; i < options.connections; i++) {
+        workers[i].join();
+        merged.merge(results[i]);
+    }
+    report(options, merged);
+    if (options.metrics) {
+        cout << MetricsRegistry::global().exposition();
+    }
+
+    // The targets run on detached threads so skip their destruction after flushing the output.
+    cout.flush();
+    AsyncLogSink::global().flush();
+    Tracer::global().flush();
+    _exit(0);
+}
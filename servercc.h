@@ -1,10 +1,14 @@
 #ifndef SERVERCC_H
 #define SERVERCC_H
 
+#include "servercc/cache/cache.h"
 #include "servercc/clients/clients.h"
 #include "servercc/connectors/connectors.h"
 #include "servercc/distributed/distributed.h"
+#include "servercc/logging/logging.h"
+#include "servercc/metrics/metrics.h"
 #include "servercc/servers/servers.h"
+#include "servercc/tracing/tracing.h"
 #include "servercc/types/types.h"
 
 #endif
@@ -0,0 +1,7 @@
+#ifndef SERVERCC_CACHE_H
+#define SERVERCC_CACHE_H
+
+#include "include/cache_service.h"
+#include "include/cache_store.h"
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef SERVERCC_CACHE_SERVICE_H
+#define SERVERCC_CACHE_SERVICE_H
+
+#include <netinet/in.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "cache_store.h"
+#include "distributed_server.h"
+
+namespace ostp::servercc {
+
+// The result of a cache lookup: the value if the key is cached or loaded, nullopt otherwise.
+typedef std::pair<absl::Status, std::optional<std::string>> cache_lookup_t;
+
+// Loads the value of a key missing from the cache, for example from a database. Returns nullopt
+// if the key does not exist.
+typedef std::function<cache_lookup_t(absl::string_view key)> cache_loader_t;
+
+// The configuration of a cache service.
+struct CacheServiceOptions {
+    // The options of the store holding the keys owned by this server.
+    CacheStoreOptions store;
+
+    // Whether values read from peers are kept in a near cache.
+    bool nearCache = true;
+
+    // The options of the near cache. The TTL bounds how long a value invalidated by another
+    // server may still be read from the near cache.
+    CacheStoreOptions nearCacheStore = {.capacity = 4 << 20,
+                                        .shards = 4,
+                                        .ttl = std::chrono::milliseconds(1000)};
+
+    // The time to wait for the response of a peer in milliseconds.
+    int timeout = 1000;
+};
+
+// A read-through cache sharded across the servers of a DistributedServer group.
+//
+// Every key is owned by the server chosen by the consistent hash ring of the group. The owner
+// keeps the key in its store and loads it with the loader on a miss, once for concurrent misses
+// of the same key. Other servers forward their lookups to the owner and may keep the values in a
+// near cache for a short time. A multi-get sends a single request per owner and waits for all of
+// them concurrently.
+class CacheService {
+   public:
+    // Creates the cache service registering its handlers on the server. Must be created before
+    // the server runs.
+    //
+    // Arguments:
+    //     server: The server of the group.
+    //     loader: The loader called on a miss of an owned key. Misses are not loaded if null.
+    //     options: The service options.
+    CacheService(DistributedServer &server, cache_loader_t loader = nullptr,
+                 CacheServiceOptions options = CacheServiceOptions());
+
+    // Returns the value of the specified key.
+    //
+    // Arguments:
+    //     key: The key to look up.
+    // Returns:
+    //     The status of the operation and the value if it exists.
+    cache_lookup_t get(absl::string_view key);
+
+    // Returns the values of the specified keys in the same order.
+    //
+    // Arguments:
+    //     keys: The keys to look up.
+    // Returns:
+    //     The status of the operation and the values if they exist.
+    std::pair<absl::Status, std::vector<std::optional<std::string>>> multiGet(
+        const std::vector<std::string> &keys);
+
+    // Stores the value of the specified key on its owner.
+    //
+    // Arguments:
+    //     key: The key to store.
+    //     value: The value to store.
+    // Returns:
+    //     The status of the operation.
+    absl::Status put(absl::string_view key, absl::string_view value);
+
+    // Removes the specified key from its owner so that the next lookup loads it again.
+    //
+    // Arguments:
+    //     key: The key to remove.
+    // Returns:
+    //     The status of the operation.
+    absl::Status invalidate(absl::string_view key);
+
+   private:
+    // The server of the group.
+    DistributedServer &server;
+
+    // The loader called on a miss.
+    const cache_loader_t loader;
+
+    // The service options.
+    const CacheServiceOptions options;
+
+    // The keys owned by this server.
+    CacheStore store;
+
+    // The values recently read from peers.
+    CacheStore nearCache;
+
+    // A load in progress.
+    struct Load {
+        // The result of the load.
+        std::shared_future<cache_lookup_t> result;
+
+        // The version of the key, bumped when the key is stored or invalidated during the load so
+        // that the loaded value, which may be stale by then, is not stored.
+        uint64_t version = 0;
+    };
+
+    // Mutex protecting the loads in progress.
+    std::mutex loadsMutex;
+
+    // The loads in progress by key so that concurrent misses wait for the same load.
+    absl::flat_hash_map<std::string, std::shared_ptr<Load>> loads;
+
+    // Looks up a key owned by this server loading it on a miss.
+    //
+    // Arguments:
+    //     key: The key to look up.
+    cache_lookup_t lookup(absl::string_view key);
+
+    // Bumps the version of the load of a key in progress, if there is one, and removes it from
+    // the loads so that its value is not stored and later misses load the key again. Called
+    // before a key owned by this server is stored or invalidated.
+    //
+    // Arguments:
+    //     key: The key stored or invalidated.
+    void supersedeLoad(absl::string_view key);
+
+    // Sends a request to a peer as a single-shot request as every cache request is answered by a
+    // single response.
+    //
+    // Arguments:
+    //     peer: The address and port of the peer.
+    //     protocol: The protocol of the request.
+    //     body: The body of the request.
+    // Returns:
+    //     The status of the operation and the request to receive the response from.
+    std::pair<absl::Status, std::unique_ptr<Request>> send(PeerAddress peer, protocol_t protocol,
+                                                           std::vector<uint8_t> body);
+
+    // Receives the response of a request.
+    //
+    // Arguments:
+    //     request: The request to receive the response from.
+    // Returns:
+    //     The status of the operation and the body of the response.
+    std::pair<absl::Status, std::vector<uint8_t>> receive(Request &request);
+
+    // Handles a kCacheGetProtocol request.
+    absl::Status handleGet(std::unique_ptr<Request> request);
+
+    // Handles a kCacheMultiGetProtocol request.
+    absl::Status handleMultiGet(std::unique_ptr<Request> request);
+
+    // Handles a kCachePutProtocol request.
+    absl::Status handlePut(std::unique_ptr<Request> request);
+
+    // Handles a kCacheInvalidateProtocol request.
+    absl::Status handleInvalidate(std::unique_ptr<Request> request);
+};
+
+}  // namespace ostp::servercc
+
+#endif
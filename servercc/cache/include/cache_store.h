@@ -0,0 +1,102 @@
+#ifndef SERVERCC_CACHE_STORE_H
+#define SERVERCC_CACHE_STORE_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace ostp::servercc {
+
+// The configuration of a cache store.
+struct CacheStoreOptions {
+    // The maximum number of bytes of keys, values and bookkeeping held by the store.
+    size_t capacity = 64 << 20;
+
+    // The number of independently locked shards. Rounded up to a power of two.
+    size_t shards = 16;
+
+    // The fraction of the capacity of a shard reserved for entries that were hit at least once.
+    double protectedRatio = 0.8;
+
+    // The time after which an entry expires. Entries do not expire if zero.
+    std::chrono::milliseconds ttl = std::chrono::milliseconds(0);
+};
+
+// A bounded in-memory key-value store evicting with a segmented LRU policy.
+//
+// New entries enter a probationary segment and are promoted to a protected segment when they are
+// hit. Eviction takes the least recently used probationary entry first so that a scan of keys read
+// once cannot flush the entries that are read repeatedly.
+//
+// Every shard indexes its entries with an open addressing table of 8-byte slots holding a part of
+// the hash and the index of the entry. The entries live in a contiguous array linked into the LRU
+// lists by 32-bit indices so the store allocates nothing per operation besides the key and value.
+class CacheStore {
+   public:
+    // Creates an empty store.
+    //
+    // Arguments:
+    //     options: The store options.
+    explicit CacheStore(CacheStoreOptions options = CacheStoreOptions());
+
+    // Destroys the store.
+    ~CacheStore();
+
+    // Returns the value of the specified key if it is cached and marks it as recently used.
+    //
+    // Arguments:
+    //     key: The key to look up.
+    std::optional<std::string> get(absl::string_view key);
+
+    // Inserts or replaces the value of the specified key evicting entries to stay within the
+    // capacity. Values larger than the capacity of a shard are not cached.
+    //
+    // Arguments:
+    //     key: The key to store.
+    //     value: The value to store.
+    void put(absl::string_view key, absl::string_view value);
+
+    // Removes the specified key.
+    //
+    // Arguments:
+    //     key: The key to remove.
+    // Returns:
+    //     Whether the key was cached.
+    bool erase(absl::string_view key);
+
+    // Returns the number of cached entries.
+    size_t size();
+
+    // Returns the number of bytes accounted to the cached entries.
+    size_t bytes();
+
+   private:
+    class Shard;
+
+    // The shards of the store.
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    // The mask selecting a shard from the hash of a key.
+    size_t shardMask;
+
+    // Returns the hash of a key.
+    //
+    // Arguments:
+    //     key: The key to hash.
+    static uint64_t hash(absl::string_view key);
+
+    // Returns the shard of a hash.
+    //
+    // Arguments:
+    //     hash: The hash of the key.
+    Shard &shardOf(uint64_t hash) { return *shards[(hash >> 40) & shardMask]; }
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,416 @@
+#include "cache_service.h"
+
+#include <string.h>
+
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The result of a lookup in a response.
+enum CacheResult : uint8_t {
+    kCacheMiss = 0,
+    kCacheHit = 1,
+    kCacheError = 2,
+};
+
+// The metrics recorded by the cache services of the process.
+struct CacheMetrics {
+    Counter &hits;
+    Counter &misses;
+    Counter &nearHits;
+    Counter &loads;
+    Counter &remoteRequests;
+};
+
+// Returns the cache metrics of the process.
+CacheMetrics &cacheMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static CacheMetrics metrics = {
+        registry.counter("servercc_cache_lookups_total", {{"result", "hit"}}),
+        registry.counter("servercc_cache_lookups_total", {{"result", "miss"}}),
+        registry.counter("servercc_cache_near_hits_total"),
+        registry.counter("servercc_cache_loads_total"),
+        registry.counter("servercc_cache_remote_requests_total"),
+    };
+    return metrics;
+}
+
+// Appends a length prefixed string to a body.
+void appendString(std::vector<uint8_t> &body, absl::string_view value) {
+    uint32_t length = value.size();
+    auto offset = body.size();
+    body.resize(offset + sizeof(uint32_t) + length);
+    memcpy(body.data() + offset, &length, sizeof(uint32_t));
+    memcpy(body.data() + offset + sizeof(uint32_t), value.data(), length);
+}
+
+// Reads a length prefixed string from a body advancing the offset. Returns nullopt if the body is
+// too short.
+std::optional<absl::string_view> readString(const std::vector<uint8_t> &body, size_t &offset) {
+    uint32_t length;
+    if (body.size() - offset < sizeof(uint32_t)) {
+        return std::nullopt;
+    }
+    memcpy(&length, body.data() + offset, sizeof(uint32_t));
+    offset += sizeof(uint32_t);
+    if (body.size() - offset < length) {
+        return std::nullopt;
+    }
+    absl::string_view value((const char *)body.data() + offset, length);
+    offset += length;
+    return value;
+}
+
+// Appends the result of a lookup to a body as its result followed by the length prefixed value
+// or status message.
+void appendLookup(std::vector<uint8_t> &body, const cache_lookup_t &lookup) {
+    if (!lookup.first.ok()) {
+        body.push_back(kCacheError);
+        body.push_back((uint8_t)lookup.first.code());
+        appendString(body, lookup.first.message());
+    } else if (lookup.second.has_value()) {
+        body.push_back(kCacheHit);
+        appendString(body, *lookup.second);
+    } else {
+        body.push_back(kCacheMiss);
+    }
+}
+
+// Reads the result of a lookup from a body advancing the offset.
+cache_lookup_t readLookup(const std::vector<uint8_t> &body, size_t &offset) {
+    auto invalid = cache_lookup_t{absl::InternalError("Invalid cache response"), std::nullopt};
+    if (offset >= body.size()) {
+        return invalid;
+    }
+    auto result = body[offset++];
+    if (result == kCacheMiss) {
+        return {absl::OkStatus(), std::nullopt};
+    }
+    if (result == kCacheHit) {
+        auto value = readString(body, offset);
+        if (!value.has_value()) {
+            return invalid;
+        }
+        return {absl::OkStatus(), std::string(*value)};
+    }
+    if (result == kCacheError && offset < body.size()) {
+        auto code = (absl::StatusCode)body[offset++];
+        auto message = readString(body, offset);
+        if (message.has_value()) {
+            return {absl::Status(code, *message), std::nullopt};
+        }
+    }
+    return invalid;
+}
+
+// Returns a message with the specified protocol and body.
+std::unique_ptr<Message> makeMessage(protocol_t protocol, std::vector<uint8_t> body) {
+    auto message = std::make_unique<Message>();
+    message->header.protocol = protocol;
+    message->header.length = body.size();
+    message->body.data = std::move(body);
+    return message;
+}
+
+}  // namespace
+
+// See cache_service.h for documentation.
+CacheService::CacheService(DistributedServer &server, cache_loader_t loader,
+                           CacheServiceOptions options)
+    : server(server),
+      loader(std::move(loader)),
+      options(options),
+      store(options.store),
+      nearCache(options.nearCacheStore) {
+    std::pair<protocol_t, handler_t> handlers[] = {
+        {kCacheGetProtocol,
+         [this](std::unique_ptr<Request> request) { return handleGet(std::move(request)); }},
+        {kCacheMultiGetProtocol,
+         [this](std::unique_ptr<Request> request) { return handleMultiGet(std::move(request)); }},
+        {kCachePutProtocol,
+         [this](std::unique_ptr<Request> request) { return handlePut(std::move(request)); }},
+        {kCacheInvalidateProtocol,
+         [this](std::unique_ptr<Request> request) { return handleInvalidate(std::move(request)); }},
+    };
+    for (auto &[protocol, handler] : handlers) {
+        auto status = server.addHandler(protocol, handler);
+        if (!status.ok()) {
+            LOG(FATAL) << "Failed to add cache handler for protocol " << protocol << ": "
+                       << status.message();
+        }
+    }
+}
+
+// See cache_service.h for documentation.
+cache_lookup_t CacheService::get(absl::string_view key) {
+    auto owner = server.ownerOf(key);
+    if (owner == server.getLocalPeer()) {
+        return lookup(key);
+    }
+    if (options.nearCache) {
+        if (auto value = nearCache.get(key)) {
+            cacheMetrics().nearHits.add();
+            return {absl::OkStatus(), std::move(value)};
+        }
+    }
+
+    // Ask the owner.
+    auto [sendStatus, request] =
+        send(owner, kCacheGetProtocol, std::vector<uint8_t>(key.begin(), key.end()));
+    if (!sendStatus.ok()) {
+        return {sendStatus, std::nullopt};
+    }
+    auto [receiveStatus, body] = receive(*request);
+    if (!receiveStatus.ok()) {
+        return {receiveStatus, std::nullopt};
+    }
+    size_t offset = 0;
+    auto result = readLookup(body, offset);
+    if (options.nearCache && result.second.has_value()) {
+        nearCache.put(key, *result.second);
+    }
+    return result;
+}
+
+// See cache_service.h for documentation.
+std::pair<absl::Status, std::vector<std::optional<std::string>>> CacheService::multiGet(
+    const std::vector<std::string> &keys) {
+    std::vector<std::optional<std::string>> values(keys.size());
+
+    // Group the keys missing from the near cache by owner.
+    absl::flat_hash_map<PeerAddress, std::vector<size_t>> keysByOwner;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (options.nearCache && (values[i] = nearCache.get(keys[i])).has_value()) {
+            cacheMetrics().nearHits.add();
+            continue;
+        }
+        keysByOwner[server.ownerOf(keys[i])].push_back(i);
+    }
+
+    // Send a single request per peer before serving the local keys so that the peers work
+    // concurrently.
+    std::vector<std::pair<std::unique_ptr<Request>, const std::vector<size_t> *>> requests;
+    for (const auto &[owner, indices] : keysByOwner) {
+        if (owner == server.getLocalPeer()) {
+            continue;
+        }
+        std::vector<uint8_t> body;
+        for (auto i : indices) {
+            appendString(body, keys[i]);
+        }
+        auto [status, request] = send(owner, kCacheMultiGetProtocol, std::move(body));
+        if (!status.ok()) {
+            return {status, {}};
+        }
+        requests.emplace_back(std::move(request), &indices);
+    }
+    auto local = keysByOwner.find(server.getLocalPeer());
+    if (local != keysByOwner.end()) {
+        for (auto i : local->second) {
+            auto [status, value] = lookup(keys[i]);
+            if (!status.ok()) {
+                return {status, {}};
+            }
+            values[i] = std::move(value);
+        }
+    }
+
+    // Collect the responses.
+    for (auto &[request, indices] : requests) {
+        auto [status, body] = receive(*request);
+        if (!status.ok()) {
+            return {status, {}};
+        }
+        size_t offset = 0;
+        for (auto i : *indices) {
+            auto [lookupStatus, value] = readLookup(body, offset);
+            if (!lookupStatus.ok()) {
+                return {lookupStatus, {}};
+            }
+            if (options.nearCache && value.has_value()) {
+                nearCache.put(keys[i], *value);
+            }
+            values[i] = std::move(value);
+        }
+    }
+    return {absl::OkStatus(), std::move(values)};
+}
+
+// See cache_service.h for documentation.
+absl::Status CacheService::put(absl::string_view key, absl::string_view value) {
+    nearCache.erase(key);
+    auto owner = server.ownerOf(key);
+    if (owner == server.getLocalPeer()) {
+        supersedeLoad(key);
+        store.put(key, value);
+        return absl::OkStatus();
+    }
+    std::vector<uint8_t> body;
+    appendString(body, key);
+    body.insert(body.end(), value.begin(), value.end());
+    auto [sendStatus, request] = send(owner, kCachePutProtocol, std::move(body));
+    if (!sendStatus.ok()) {
+        return sendStatus;
+    }
+    return receive(*request).first;
+}
+
+// See cache_service.h for documentation.
+absl::Status CacheService::invalidate(absl::string_view key) {
+    nearCache.erase(key);
+    auto owner = server.ownerOf(key);
+    if (owner == server.getLocalPeer()) {
+        supersedeLoad(key);
+        store.erase(key);
+        return absl::OkStatus();
+    }
+    auto [sendStatus, request] =
+        send(owner, kCacheInvalidateProtocol, std::vector<uint8_t>(key.begin(), key.end()));
+    if (!sendStatus.ok()) {
+        return sendStatus;
+    }
+    return receive(*request).first;
+}
+
+// Private methods.
+
+// See cache_service.h for documentation.
+cache_lookup_t CacheService::lookup(absl::string_view key) {
+    auto &metrics = cacheMetrics();
+    if (auto value = store.get(key)) {
+        metrics.hits.add();
+        return {absl::OkStatus(), std::move(value)};
+    }
+    metrics.misses.add();
+    if (loader == nullptr) {
+        return {absl::OkStatus(), std::nullopt};
+    }
+
+    // Wait for the load in progress if there is one.
+    std::string ownedKey(key);
+    std::promise<cache_lookup_t> promise;
+    loadsMutex.lock();
+    auto loadIt = loads.find(ownedKey);
+    if (loadIt != loads.end()) {
+        auto result = loadIt->second->result;
+        loadsMutex.unlock();
+        return result.get();
+    }
+    auto load = std::make_shared<Load>();
+    load->result = promise.get_future().share();
+    loads.emplace(ownedKey, load);
+    auto version = load->version;
+    loadsMutex.unlock();
+
+    // Load the value and publish it to the store before releasing the waiters unless the key was
+    // stored or invalidated in the meantime.
+    metrics.loads.add();
+    auto result = loader(key);
+    loadsMutex.lock();
+    if (load->version == version) {
+        if (result.first.ok() && result.second.has_value()) {
+            store.put(key, *result.second);
+        }
+        loads.erase(ownedKey);
+    }
+    loadsMutex.unlock();
+    promise.set_value(result);
+    return result;
+}
+
+// See cache_service.h for documentation.
+void CacheService::supersedeLoad(absl::string_view key) {
+    std::lock_guard lock(loadsMutex);
+    auto loadIt = loads.find(key);
+    if (loadIt == loads.end()) {
+        return;
+    }
+    loadIt->second->version++;
+    loads.erase(loadIt);
+}
+
+// See cache_service.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Request>> CacheService::send(PeerAddress peer,
+                                                                     protocol_t protocol,
+                                                                     std::vector<uint8_t> body) {
+    cacheMetrics().remoteRequests.add();
+    auto [status, request] = server.sendInternalRequest(peer, true);
+    if (!status.ok()) {
+        return {status, nullptr};
+    }
+    auto sendStatus = request->sendMessage(makeMessage(protocol, std::move(body)));
+    if (!sendStatus.ok()) {
+        return {sendStatus, nullptr};
+    }
+    return {absl::OkStatus(), std::move(request)};
+}
+
+// See cache_service.h for documentation.
+std::pair<absl::Status, std::vector<uint8_t>> CacheService::receive(Request &request) {
+    auto [status, message] = request.receiveMessage(options.timeout);
+    if (!status.ok()) {
+        return {status, {}};
+    }
+    if (message->header.protocol != kCacheResponseProtocol) {
+        return {absl::InternalError("Unexpected cache response protocol"), {}};
+    }
+    return {absl::OkStatus(), std::move(message->body.data)};
+}
+
+// See cache_service.h for documentation.
+absl::Status CacheService::handleGet(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive cache get");
+    auto &data = message->body.data;
+    std::vector<uint8_t> body;
+    appendLookup(body, lookup(absl::string_view((const char *)data.data(), data.size())));
+    return request->sendMessage(makeMessage(kCacheResponseProtocol, std::move(body)));
+}
+
+// See cache_service.h for documentation.
+absl::Status CacheService::handleMultiGet(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive cache multi-get");
+    auto cancellation = request->cancellationToken();
+    std::vector<uint8_t> body;
+    for (size_t offset = 0; offset < message->body.data.size();) {
+        // A missing key may be loaded so stop once the requester no longer waits for the answer.
+        if (cancellation->cancelled()) {
+            return absl::CancelledError("Cache multi-get was cancelled");
+        }
+        auto key = readString(message->body.data, offset);
+        if (!key.has_value()) {
+            return absl::InvalidArgumentError("Invalid cache multi-get request");
+        }
+        appendLookup(body, lookup(*key));
+    }
+    return request->sendMessage(makeMessage(kCacheResponseProtocol, std::move(body)));
+}
+
+// See cache_service.h for documentation.
+absl::Status CacheService::handlePut(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive cache put");
+    auto &data = message->body.data;
+    size_t offset = 0;
+    auto key = readString(data, offset);
+    if (!key.has_value()) {
+        return absl::InvalidArgumentError("Invalid cache put request");
+    }
+    supersedeLoad(*key);
+    store.put(*key, absl::string_view((const char *)data.data() + offset, data.size() - offset));
+    return request->sendMessage(makeMessage(kCacheResponseProtocol, {}));
+}
+
+// See cache_service.h for documentation.
+absl::Status CacheService::handleInvalidate(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive cache invalidate");
+    auto &data = message->body.data;
+    absl::string_view key((const char *)data.data(), data.size());
+    supersedeLoad(key);
+    store.erase(key);
+    return request->sendMessage(makeMessage(kCacheResponseProtocol, {}));
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,346 @@
+#include "cache_store.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "absl/hash/hash.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// Marks an empty slot and the end of a list.
+constexpr uint32_t kNone = UINT32_MAX;
+
+// The segments of the LRU.
+enum Segment : uint8_t {
+    kProbation = 0,
+    kProtected = 1,
+};
+
+// Returns the current time in steady clock ticks.
+int64_t now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+}  // namespace
+
+// A shard of the store with its own table, entries and lock.
+class CacheStore::Shard {
+   public:
+    // Creates an empty shard.
+    //
+    // Arguments:
+    //     capacity: The maximum number of bytes of the shard.
+    //     protectedCapacity: The maximum number of bytes of the protected segment.
+    //     ttl: The time after which an entry expires in steady clock ticks or zero.
+    Shard(size_t capacity, size_t protectedCapacity, int64_t ttl)
+        : capacity(capacity), protectedCapacity(protectedCapacity), ttl(ttl), table(16) {}
+
+    // See cache_store.h for documentation.
+    std::optional<std::string> get(absl::string_view key, uint32_t hash) {
+        std::lock_guard lock(mutex);
+        auto slot = find(key, hash);
+        if (slot == kNone) {
+            return std::nullopt;
+        }
+        auto index = table[slot].entry;
+        auto &entry = entries[index];
+        if (ttl != 0 && entry.expiresAt <= now()) {
+            remove(slot);
+            return std::nullopt;
+        }
+        touch(index);
+        return entry.data.substr(entry.keyLength);
+    }
+
+    // See cache_store.h for documentation.
+    void put(absl::string_view key, absl::string_view value, uint32_t hash) {
+        auto cost = costOf(key, value);
+        std::lock_guard lock(mutex);
+        auto slot = find(key, hash);
+        if (slot != kNone) {
+            remove(slot);
+        }
+        if (cost > capacity) {
+            return;
+        }
+
+        // Take a free entry or append one and link it at the head of the probationary segment.
+        uint32_t index;
+        if (!freeEntries.empty()) {
+            index = freeEntries.back();
+            freeEntries.pop_back();
+        } else {
+            index = entries.size();
+            entries.emplace_back();
+        }
+        auto &entry = entries[index];
+        entry.data.reserve(key.size() + value.size());
+        entry.data.assign(key.data(), key.size());
+        entry.data.append(value.data(), value.size());
+        entry.keyLength = key.size();
+        entry.hash = hash;
+        entry.cost = cost;
+        entry.expiresAt = ttl != 0 ? now() + ttl : 0;
+        link(index, kProbation);
+        insert(index);
+
+        // Evict from the probationary segment first sparing the new entry.
+        while (segmentBytes[kProbation] + segmentBytes[kProtected] > capacity) {
+            auto victim = tails[kProbation] != index ? tails[kProbation] : tails[kProtected];
+            remove(find(entries[victim].key(), entries[victim].hash));
+        }
+    }
+
+    // See cache_store.h for documentation.
+    bool erase(absl::string_view key, uint32_t hash) {
+        std::lock_guard lock(mutex);
+        auto slot = find(key, hash);
+        if (slot == kNone) {
+            return false;
+        }
+        remove(slot);
+        return true;
+    }
+
+    // Returns the number of entries of the shard.
+    size_t size() {
+        std::lock_guard lock(mutex);
+        return count;
+    }
+
+    // Returns the number of bytes of the shard.
+    size_t bytes() {
+        std::lock_guard lock(mutex);
+        return segmentBytes[kProbation] + segmentBytes[kProtected];
+    }
+
+   private:
+    // A cached entry.
+    struct Entry {
+        // The key followed by the value.
+        std::string data;
+
+        // The length of the key.
+        uint32_t keyLength = 0;
+
+        // The part of the hash stored in the slots.
+        uint32_t hash = 0;
+
+        // The previous and next entries of the segment.
+        uint32_t prev = kNone;
+        uint32_t next = kNone;
+
+        // The segment of the entry.
+        Segment segment = kProbation;
+
+        // The number of bytes accounted to the entry.
+        size_t cost = 0;
+
+        // The time at which the entry expires in steady clock ticks.
+        int64_t expiresAt = 0;
+
+        // Returns the key of the entry.
+        absl::string_view key() const { return absl::string_view(data.data(), keyLength); }
+    };
+
+    // A slot of the table.
+    struct Slot {
+        // The part of the hash of the key.
+        uint32_t hash = 0;
+
+        // The index of the entry or kNone if the slot is empty.
+        uint32_t entry = kNone;
+    };
+
+    // The maximum number of bytes of the shard and of its protected segment.
+    const size_t capacity;
+    const size_t protectedCapacity;
+
+    // The time after which an entry expires in steady clock ticks or zero.
+    const int64_t ttl;
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // The open addressing table with linear probing. Its size is a power of two at least twice the
+    // number of entries.
+    std::vector<Slot> table;
+
+    // The entries and the indices of the unused ones.
+    std::vector<Entry> entries;
+    std::vector<uint32_t> freeEntries;
+
+    // The number of entries in the table.
+    size_t count = 0;
+
+    // The most and least recently used entries and the bytes of every segment.
+    uint32_t heads[2] = {kNone, kNone};
+    uint32_t tails[2] = {kNone, kNone};
+    size_t segmentBytes[2] = {0, 0};
+
+    // Returns the number of bytes accounted to an entry.
+    static size_t costOf(absl::string_view key, absl::string_view value) {
+        return key.size() + value.size() + sizeof(Entry) + 2 * sizeof(Slot);
+    }
+
+    // Returns the slot of the specified key or kNone.
+    uint32_t find(absl::string_view key, uint32_t hash) {
+        auto mask = table.size() - 1;
+        for (auto slot = hash & mask;; slot = (slot + 1) & mask) {
+            if (table[slot].entry == kNone) {
+                return kNone;
+            }
+            if (table[slot].hash == hash && entries[table[slot].entry].key() == key) {
+                return slot;
+            }
+        }
+    }
+
+    // Inserts an entry that is not in the table growing the table if needed.
+    void insert(uint32_t index) {
+        if (2 * (count + 1) > table.size()) {
+            std::vector<Slot> old(table.size() * 2);
+            std::swap(old, table);
+            for (const auto &slot : old) {
+                if (slot.entry != kNone) {
+                    place(slot);
+                }
+            }
+        }
+        place({entries[index].hash, index});
+        count++;
+    }
+
+    // Places a slot in the first empty slot of its probe sequence.
+    void place(Slot slot) {
+        auto mask = table.size() - 1;
+        auto position = slot.hash & mask;
+        while (table[position].entry != kNone) {
+            position = (position + 1) & mask;
+        }
+        table[position] = slot;
+    }
+
+    // Removes the entry of a slot from the table and its segment and frees it. The following
+    // slots of the probe sequence are shifted back so that no tombstone is left.
+    void remove(uint32_t slot) {
+        auto index = table[slot].entry;
+        unlink(index);
+        auto &entry = entries[index];
+        std::string().swap(entry.data);
+        freeEntries.push_back(index);
+        count--;
+
+        auto mask = table.size() - 1;
+        auto hole = slot;
+        for (auto next = (hole + 1) & mask; table[next].entry != kNone; next = (next + 1) & mask) {
+            // Move the slot to the hole unless its home lies cyclically in (hole, next].
+            auto home = table[next].hash & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                table[hole] = table[next];
+                hole = next;
+            }
+        }
+        table[hole] = Slot();
+    }
+
+    // Links an entry at the head of a segment.
+    void link(uint32_t index, Segment segment) {
+        auto &entry = entries[index];
+        entry.segment = segment;
+        entry.prev = kNone;
+        entry.next = heads[segment];
+        if (heads[segment] != kNone) {
+            entries[heads[segment]].prev = index;
+        } else {
+            tails[segment] = index;
+        }
+        heads[segment] = index;
+        segmentBytes[segment] += entry.cost;
+    }
+
+    // Unlinks an entry from its segment.
+    void unlink(uint32_t index) {
+        auto &entry = entries[index];
+        if (entry.prev != kNone) {
+            entries[entry.prev].next = entry.next;
+        } else {
+            heads[entry.segment] = entry.next;
+        }
+        if (entry.next != kNone) {
+            entries[entry.next].prev = entry.prev;
+        } else {
+            tails[entry.segment] = entry.prev;
+        }
+        segmentBytes[entry.segment] -= entry.cost;
+    }
+
+    // Moves a hit entry to the head of the protected segment demoting the least recently used
+    // protected entries to the probationary segment when it is full.
+    void touch(uint32_t index) {
+        unlink(index);
+        link(index, kProtected);
+        while (segmentBytes[kProtected] > protectedCapacity && tails[kProtected] != index) {
+            auto demoted = tails[kProtected];
+            unlink(demoted);
+            link(demoted, kProbation);
+        }
+    }
+};
+
+// See cache_store.h for documentation.
+CacheStore::CacheStore(CacheStoreOptions options) {
+    auto count = std::bit_ceil(std::max<size_t>(options.shards, 1));
+    auto capacity = options.capacity / count;
+    auto protectedRatio = std::clamp(options.protectedRatio, 0.0, 1.0);
+    auto ttl = std::chrono::duration_cast<std::chrono::steady_clock::duration>(options.ttl).count();
+    for (size_t i = 0; i < count; i++) {
+        shards.push_back(
+            std::make_unique<Shard>(capacity, (size_t)(capacity * protectedRatio), ttl));
+    }
+    shardMask = count - 1;
+}
+
+// See cache_store.h for documentation.
+CacheStore::~CacheStore() = default;
+
+// See cache_store.h for documentation.
+std::optional<std::string> CacheStore::get(absl::string_view key) {
+    auto keyHash = hash(key);
+    return shardOf(keyHash).get(key, keyHash);
+}
+
+// See cache_store.h for documentation.
+void CacheStore::put(absl::string_view key, absl::string_view value) {
+    auto keyHash = hash(key);
+    shardOf(keyHash).put(key, value, keyHash);
+}
+
+// See cache_store.h for documentation.
+bool CacheStore::erase(absl::string_view key) {
+    auto keyHash = hash(key);
+    return shardOf(keyHash).erase(key, keyHash);
+}
+
+// See cache_store.h for documentation.
+size_t CacheStore::size() {
+    size_t total = 0;
+    for (auto &shard : shards) {
+        total += shard->size();
+    }
+    return total;
+}
+
+// See cache_store.h for documentation.
+size_t CacheStore::bytes() {
+    size_t total = 0;
+    for (auto &shard : shards) {
+        total += shard->bytes();
+    }
+    return total;
+}
+
+// See cache_store.h for documentation.
+uint64_t CacheStore::hash(absl::string_view key) { return absl::Hash<absl::string_view>()(key); }
+
+}  // namespace ostp::servercc
@@ -4,5 +4,6 @@
 #include "include/client.h"
 #include "include/multicast_client.h"
 #include "include/tcp_client.h"
+#include "include/unix_client.h"
 
 #endif
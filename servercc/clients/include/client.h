@@ -124,6 +124,23 @@ class Client {
     //     number of bytes sent.
     virtual absl::Status sendMessage(std::unique_ptr<Message> message) = 0;
 
+    // Sends a message whose body is a bulk payload without copying it into a message when the
+    // client supports it. The payload can be reused once the call returns.
+    //
+    // Arguments:
+    //     protocol: The protocol of the message.
+    //     payload: The body of the message.
+    //
+    // Returns:
+    //     A status indicating whether the message was sent successfully.
+    virtual absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload &payload) {
+        auto [status, message] = makeBulkMessage(protocol, payload);
+        if (!status.ok()) {
+            return status;
+        }
+        return sendMessage(std::move(message));
+    }
+
     // Blocks until a message is received from the server.
     //
     // Returns:
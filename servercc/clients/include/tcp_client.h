@@ -41,6 +41,9 @@ class TcpClient : virtual public Client {
     // See abstract_client.h
     absl::Status sendMessage(std::unique_ptr<Message> message) final;
 
+    // See abstract_client.h
+    absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload &payload) final;
+
     // See abstract_client.h
     std::pair<absl::Status, std::unique_ptr<Message>> receiveMessage() final;
 };
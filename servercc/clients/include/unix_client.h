@@ -0,0 +1,75 @@
+#ifndef SERVERCC_UNIX_CLIENT_H
+#define SERVERCC_UNIX_CLIENT_H
+
+#include <string>
+#include <vector>
+
+#include "client.h"
+
+namespace ostp::servercc {
+
+// A Unix domain stream socket client for a UnixServer on the same host. File descriptors passed by
+// the server with its messages are kept until they are taken.
+class UnixClient : virtual public Client {
+   public:
+    // Constructors
+
+    // Constructs a Unix domain socket client for the specified path.
+    //
+    // Arguments:
+    //     path: The path of the server. A path starting with '@' is in the abstract namespace.
+    UnixClient(const absl::string_view path);
+
+    // Destructor that closes the socket and the file descriptors that were not taken.
+    ~UnixClient();
+
+    // Client methods.
+
+    // Gets the path of the server.
+    //
+    // Returns:
+    //     The path of the server.
+    absl::string_view getAddress() final { return path; }
+
+    // See client.h
+    absl::Status openSocket() final;
+
+    // See client.h
+    void closeSocket() final;
+
+    // See client.h
+    absl::Status sendMessage(std::unique_ptr<Message> message) final;
+
+    // See client.h
+    absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload &payload) final;
+
+    // See client.h
+    std::pair<absl::Status, std::unique_ptr<Message>> receiveMessage() final;
+
+    // Sends a message to the server passing file descriptors with it.
+    //
+    // Arguments:
+    //     message: The message to send.
+    //     descriptors: The file descriptors to pass. The caller keeps ownership of them.
+    // Returns:
+    //     The status of the operation.
+    absl::Status sendMessage(std::unique_ptr<Message> message,
+                             const std::vector<int> &descriptors);
+
+    // Takes the file descriptors passed by the server with the messages received so far.
+    //
+    // Returns:
+    //     The file descriptors which are owned by the caller.
+    std::vector<int> takeDescriptors();
+
+   private:
+    // The path of the server.
+    const std::string path;
+
+    // The file descriptors passed by the server that were not taken yet.
+    std::vector<int> descriptors;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -1,5 +1,7 @@
 #include "multicast_client.h"
 
+#include <sys/uio.h>
+
 #include "absl/log/log.h"
 
 namespace ostp::servercc {
@@ -76,18 +78,22 @@ absl::Status MulticastClient::sendMessage(std::unique_ptr<Message> message) {
         return absl::FailedPreconditionError("Socket is not open");
     }
 
-    // Send the message.
-    auto sent = sendto(clientFd, &message->header, kMessageHeaderLength, 0, &clientAddr,
-                       sizeof(clientAddr));
-    if (sent < kMessageHeaderLength) {
-        perror("sendto header");
-        return absl::InternalError("Failed to send message header");
+    // Send the header and body in a single datagram so that messages from different senders
+    // cannot interleave.
+    if (message->header.length > kMaxDatagramBodyLength) {
+        return absl::InvalidArgumentError("Message too long for a datagram");
     }
-    sent = sendto(clientFd, message->body.data.data(), message->header.length, 0, &clientAddr,
-                  sizeof(clientAddr));
-    if (sent < message->header.length) {
-        perror("sendto body");
-        return absl::InternalError("Failed to send message body");
+    iovec iov[2] = {{&message->header, kMessageHeaderLength},
+                    {message->body.data.data(), message->header.length}};
+    msghdr msg = {};
+    msg.msg_name = &clientAddr;
+    msg.msg_namelen = sizeof(clientAddr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    auto sent = sendmsg(clientFd, &msg, MSG_NOSIGNAL);
+    if (sent < (ssize_t)(kMessageHeaderLength + message->header.length)) {
+        perror("sendmsg");
+        return absl::InternalError("Failed to send message");
     }
     return absl::OkStatus();
 }
@@ -1,6 +1,6 @@
 #include "tcp_client.h"
 
-#include "absl/log/log.h"
+#include "async_log.h"
 
 namespace ostp::servercc {
 
@@ -64,8 +64,8 @@ absl::Status TcpClient::openSocket() {
     // Mark the socket as open, set the client address.
     isSocketOpen = true;
     memcpy(&clientAddr, serverInfo->ai_addr, serverInfo->ai_addrlen);
-    LOG(INFO) << "Opened socket: " << clientFd << " for client: " << getAddress() << ":"
-              << getPort();
+    SCC_VLOG(1) << "Opened socket: " << clientFd << " for client: " << getAddress() << ":"
+                << getPort();
     return absl::OkStatus();
 }
 
@@ -75,7 +75,7 @@ void TcpClient::closeSocket() {
         return;
     }
     close(clientFd);
-    LOG(INFO) << "Closed socket: " << clientFd;
+    SCC_VLOG(1) << "Closed socket: " << clientFd;
     clientFd = -1;
     isSocketOpen = false;
     return;
@@ -87,19 +87,15 @@ absl::Status TcpClient::sendMessage(std::unique_ptr<Message> message) {
     if (clientFd == -1) {
         return absl::FailedPreconditionError("Socket is not open");
     }
-    // Send the message.
-    auto sent = send(clientFd, &message->header, kMessageHeaderLength, 0);
-    if (sent < kMessageHeaderLength) {
-        perror("send header");
-        return absl::InternalError("Failed to send message header");
-    }
-    sent = send(clientFd, message->body.data.data(), message->header.length, 0);
-    if (sent < message->header.length) {
-        perror("send body");
-        return absl::InternalError("Failed to send message body");
+    return writeMessage(clientFd, std::move(message));
+}
+
+// See tcp_client.h for documentation.
+absl::Status TcpClient::sendBulkMessage(protocol_t protocol, const BulkPayload &payload) {
+    if (clientFd == -1) {
+        return absl::FailedPreconditionError("Socket is not open");
     }
-    fsync(clientFd);
-    return absl::OkStatus();
+    return writeBulkMessage(clientFd, protocol, payload);
 }
 
 // See tcp_client.h for documentation.
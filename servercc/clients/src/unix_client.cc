@@ -0,0 +1,103 @@
+#include "unix_client.h"
+
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "async_log.h"
+
+namespace ostp::servercc {
+
+// See unix_client.h for documentation.
+UnixClient::UnixClient(const absl::string_view path) : Client(path, 0), path(path) {
+    clientAddr.sa_family = AF_UNIX;
+}
+
+// See unix_client.h for documentation.
+UnixClient::~UnixClient() {
+    closeSocket();
+    for (auto descriptor : descriptors) {
+        close(descriptor);
+    }
+}
+
+// See unix_client.h for documentation.
+absl::Status UnixClient::openSocket() {
+    // If the socket is already open, return.
+    if (isSocketOpen) {
+        return absl::OkStatus();
+    }
+
+    sockaddr_un address;
+    socklen_t addressLength;
+    auto addressStatus = makeUnixAddress(path, address, addressLength);
+    if (!addressStatus.ok()) {
+        return addressStatus;
+    }
+
+    // Create a socket and try to connect to the server.
+    if ((clientFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        return absl::ErrnoToStatus(errno, "Could not create socket");
+    }
+    if (connect(clientFd, (sockaddr *)&address, addressLength) == -1) {
+        auto status = absl::ErrnoToStatus(errno, "Could not connect to server");
+        close(clientFd);
+        clientFd = -1;
+        return status;
+    }
+
+    // Mark the socket as open.
+    isSocketOpen = true;
+    SCC_VLOG(1) << "Opened socket: " << clientFd << " for client: " << path;
+    return absl::OkStatus();
+}
+
+// See unix_client.h for documentation.
+void UnixClient::closeSocket() {
+    if (clientFd == -1) {
+        return;
+    }
+    close(clientFd);
+    SCC_VLOG(1) << "Closed socket: " << clientFd;
+    clientFd = -1;
+    isSocketOpen = false;
+}
+
+// See unix_client.h for documentation.
+absl::Status UnixClient::sendMessage(std::unique_ptr<Message> message) {
+    if (clientFd == -1) {
+        return absl::FailedPreconditionError("Socket is not open");
+    }
+    return writeMessage(clientFd, std::move(message));
+}
+
+// See unix_client.h for documentation.
+absl::Status UnixClient::sendBulkMessage(protocol_t protocol, const BulkPayload &payload) {
+    if (clientFd == -1) {
+        return absl::FailedPreconditionError("Socket is not open");
+    }
+    return writeBulkMessage(clientFd, protocol, payload);
+}
+
+// See unix_client.h for documentation.
+absl::Status UnixClient::sendMessage(std::unique_ptr<Message> message,
+                                     const std::vector<int> &descriptors) {
+    if (clientFd == -1) {
+        return absl::FailedPreconditionError("Socket is not open");
+    }
+    return writeMessage(clientFd, std::move(message), descriptors);
+}
+
+// See unix_client.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> UnixClient::receiveMessage() {
+    if (clientFd == -1) {
+        return {absl::FailedPreconditionError("Socket is not open"), nullptr};
+    }
+    return readMessage(clientFd, descriptors);
+}
+
+// See unix_client.h for documentation.
+std::vector<int> UnixClient::takeDescriptors() { return std::exchange(descriptors, {}); }
+
+}  // namespace ostp::servercc
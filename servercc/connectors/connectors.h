@@ -1,8 +1,16 @@
 #ifndef SERVERCC_CONNECTORS_H
 #define SERVERCC_CONNECTORS_H
 
+#include "include/batched_request.h"
+#include "include/compression.h"
 #include "include/connector.h"
+#include "include/frame_scheduler.h"
 #include "include/internal_channel.h"
 #include "include/internal_channel_manager.h"
+#include "include/message_link.h"
+#include "include/phi_accrual_failure_detector.h"
+#include "include/request_batcher.h"
+#include "include/shm_link.h"
+#include "include/wire_format.h"
 
 #endif
\ No newline at end of file
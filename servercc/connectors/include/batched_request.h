@@ -0,0 +1,123 @@
+#ifndef SERVERCC_BATCHED_REQUEST_H
+#define SERVERCC_BATCHED_REQUEST_H
+
+#include <netinet/in.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// Appends a message to the body of a batch as an entry.
+//
+// Arguments:
+//     body: The body of the batch.
+//     message: The message to append.
+void appendBatchEntry(std::vector<uint8_t> &body, const Message &message);
+
+// Appends an entry for a request of a batch that failed to the body of the batch response.
+//
+// Arguments:
+//     body: The body of the batch response.
+//     status: The status the request failed with.
+void appendBatchError(std::vector<uint8_t> &body, const absl::Status &status);
+
+// Reads the next entry of a batch advancing the offset.
+//
+// Arguments:
+//     body: The body of the batch.
+//     offset: The offset of the entry.
+// Returns:
+//     The status of the operation and the message of the entry. Returns the status of a failed
+//     request of a batch response as an error.
+std::pair<absl::Status, std::unique_ptr<Message>> readBatchEntry(const std::vector<uint8_t> &body,
+                                                                 size_t &offset);
+
+// The responses of the requests of a batch.
+struct BatchResponses;
+
+// A request of a batch handled by the handler of its protocol like any other request. The request
+// holds the single message sent for it and keeps the first message the handler sends as its
+// response, so only handlers exchanging one message each way can be batched. The response is
+// final once the handler destroys the request.
+class BatchedRequest : public virtual Request {
+   public:
+    // Creates a request of a batch.
+    //
+    // Arguments:
+    //     addr: The address of the peer that sent the batch.
+    //     cancellation: The cancellation token of the batch.
+    //     message: The message of the request.
+    //     responses: The responses of the batch.
+    //     index: The index of the request in the batch.
+    BatchedRequest(const sockaddr &addr, std::shared_ptr<CancellationToken> cancellation,
+                   std::unique_ptr<Message> message, std::shared_ptr<BatchResponses> responses,
+                   size_t index);
+
+    // Hands the response to the batch.
+    ~BatchedRequest() final;
+
+    // See request.h for documentation.
+    sockaddr getAddr() final;
+
+    // See request.h for documentation.
+    protocol_t getProtocol() final;
+
+    // See request.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> receiveMessage() final;
+
+    // See request.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> receiveMessage(int timeout) final;
+
+    // See request.h for documentation.
+    absl::Status sendMessage(std::unique_ptr<Message> message) final;
+
+    // See request.h for documentation.
+    std::chrono::steady_clock::time_point deadline() final;
+
+    // See request.h for documentation.
+    std::shared_ptr<CancellationToken> cancellationToken() final;
+
+    // See request.h for documentation.
+    void terminate() final {}
+
+   private:
+    // The address of the peer that sent the batch.
+    const sockaddr addr;
+
+    // The protocol of the request.
+    const protocol_t protocol;
+
+    // The cancellation token of the batch.
+    const std::shared_ptr<CancellationToken> cancellation;
+
+    // The message of the request until it is received.
+    std::unique_ptr<Message> message;
+
+    // The response sent by the handler.
+    std::unique_ptr<Message> response;
+
+    // The responses of the batch and the index of the request in it.
+    const std::shared_ptr<BatchResponses> responses;
+    const size_t index;
+};
+
+// Handles a batch of requests by running the handler of each request of the batch in order and
+// answering with one response holding the response of every request in the same order once every
+// handler destroyed its request.
+//
+// Arguments:
+//     request: The request carrying the batch.
+//     handlerOf: Returns the handler of a protocol.
+// Returns:
+//     The status of the operation.
+absl::Status handleBatch(std::unique_ptr<Request> request,
+                         const std::function<handler_t(protocol_t)> &handlerOf);
+
+}  // namespace ostp::servercc
+
+#endif
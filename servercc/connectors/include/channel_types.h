@@ -8,6 +8,26 @@ namespace ostp::servercc {
 // The type of the channel ID.
 typedef uint32_t channel_id_t;
 
+// The number of internal channels a connector link multiplexes. Messages of a channel with a
+// higher ID are rejected when read.
+constexpr channel_id_t kMaxChannels = 1024;
+
+// The value appended to the first message of a sampled channel in place of the channel ID.
+struct __attribute__((packed)) traced_channel_id_t {
+    // The trace ID of the span of the channel on the sending peer.
+    uint64_t traceId;
+
+    // The ID of the span of the channel on the sending peer.
+    uint64_t spanId;
+
+    // The ID of the channel.
+    channel_id_t id;
+};
+
+// The time left until the deadline of a request in microseconds appended to the first message of
+// its channel.
+typedef uint64_t deadline_budget_t;
+
 }  // namespace ostp::servercc
 
 #endif
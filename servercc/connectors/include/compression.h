@@ -0,0 +1,149 @@
+#ifndef SERVERCC_COMPRESSION_H
+#define SERVERCC_COMPRESSION_H
+
+#include <inttypes.h>
+
+#include <memory>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "types.h"
+
+struct z_stream_s;
+
+namespace ostp::servercc {
+
+// The codecs the bodies of messages in the compact wire format are compressed with. Peers agree on
+// one when they connect.
+enum class Compression : uint8_t {
+    kNone = 0,
+
+    // Raw deflate at its fastest level, primed with the dictionary both peers share if any.
+    kDeflate = 1,
+};
+
+// Returns the bit of a codec in the set of codecs a peer offers.
+constexpr uint8_t compressionBit(Compression codec) { return 1 << ((uint8_t)codec - 1); }
+
+// The options of the compression of the messages of a link.
+struct CompressionOptions {
+    // The codec both peers agreed on.
+    Compression codec = Compression::kNone;
+
+    // The length of body from which messages are compressed. Smaller bodies do not save enough to
+    // pay for their compression.
+    size_t threshold = 512;
+
+    // The byte sequences common to the messages of the application both peers prime their codec
+    // with so that small messages compress well. Must be the same on both ends.
+    std::shared_ptr<const std::vector<uint8_t>> dictionary;
+
+    // The bandwidth of the path to the peer in bytes per second, against which the time spent
+    // compressing a message is weighed.
+    double bandwidth = 125e6;
+};
+
+// Returns the ID peers compare to check that they share a dictionary. Never zero.
+//
+// Arguments:
+//     dictionary: The dictionary.
+uint32_t dictionaryId(const std::vector<uint8_t> &dictionary);
+
+// Compresses the bodies of the messages written to a link when it pays off. Keeps the cost of the
+// compression per byte and the share of the bytes it saves on recent messages and stops
+// compressing while the time the bytes it saves take on the wire is less than the time spent
+// compressing them, trying again every kProbeInterval messages in case the messages changed.
+//
+// Must be used by a single writer at a time.
+class FrameCompressor {
+   public:
+    // Creates a compressor.
+    //
+    // Arguments:
+    //     options: The options of the compression whose codec is not kNone.
+    explicit FrameCompressor(CompressionOptions options);
+
+    ~FrameCompressor();
+
+    // Compresses a body made of a payload followed by a trailer if it is long enough and
+    // compression pays off on the link.
+    //
+    // Arguments:
+    //     data: The payload.
+    //     length: The length of the payload.
+    //     trailer: The bytes that follow the payload in the body.
+    // Returns:
+    //     Whether the body was compressed into output() and is shorter than it was.
+    bool compress(const uint8_t *data, size_t length, const std::vector<uint8_t> &trailer);
+
+    // Returns the last compressed body. Reused by the next call to compress.
+    BulkPayload output() const { return BulkPayload::fromBuffer(buffer.data(), bufferLength); }
+
+   private:
+    // The number of messages above the threshold after which one is compressed to measure whether
+    // compression pays off again.
+    static constexpr uint32_t kProbeInterval = 64;
+
+    // The options of the compression.
+    const CompressionOptions options;
+
+    // The state of deflate, kept across messages so that it is only allocated once.
+    std::unique_ptr<z_stream_s> stream;
+
+    // The buffer the bodies are compressed into and the length of the last compressed body.
+    std::vector<uint8_t> buffer;
+    size_t bufferLength = 0;
+
+    // The moving averages of the CPU time spent compressing a byte in nanoseconds and of the share
+    // of the bytes saved.
+    double costPerByte = 0;
+    double savedPerByte = 0;
+
+    // Whether compression paid off on the recent messages.
+    bool worthwhile = true;
+
+    // The number of messages above the threshold sent uncompressed since the last probe.
+    uint32_t skipped = 0;
+};
+
+// Decompresses the bodies of the messages read from a link. Must be used by a single reader.
+class FrameDecompressor {
+   public:
+    // Creates a decompressor.
+    //
+    // Arguments:
+    //     options: The options of the compression whose codec is not kNone.
+    explicit FrameDecompressor(CompressionOptions options);
+
+    ~FrameDecompressor();
+
+    // Decompresses a body.
+    //
+    // Arguments:
+    //     data: The compressed body.
+    //     length: The length of the compressed body.
+    //     out: The buffer of the decompressed body.
+    //     outLength: The length of the decompressed body.
+    // Returns:
+    //     The status of the operation. Returns an InvalidArgument error if the body is corrupt or
+    //     its length is not outLength.
+    absl::Status decompress(const uint8_t *data, size_t length, uint8_t *out, size_t outLength);
+
+    // Returns the length of the longest body a compressed body of the specified length
+    // decompresses to, beyond which the original length it claims is corrupt.
+    //
+    // Arguments:
+    //     length: The length of the compressed body.
+    static size_t maxDecompressedLength(size_t length);
+
+   private:
+    // The options of the compression.
+    const CompressionOptions options;
+
+    // The state of inflate, kept across messages so that it is only allocated once.
+    std::unique_ptr<z_stream_s> stream;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -1,16 +1,23 @@
 #ifndef SERVERCC_CONNECTOR_H
 #define SERVERCC_CONNECTOR_H
 
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
+#include "admission_controller.h"
+#include "batched_request.h"
 #include "clients.h"
 #include "connector_types.h"
 #include "internal_channel_manager.h"
 #include "internal_request.h"
+#include "message_link.h"
+#include "phi_accrual_failure_detector.h"
 #include "types.h"
 
 namespace ostp::servercc {
@@ -22,10 +29,22 @@ class Connector {
 
     // Constructs a new connector with the specified default processor and disconnect handler.
     //
+    // Every link exchanges heartbeats watched by a phi accrual failure detector. A suspected peer
+    // is disconnected through the same path as a peer closing its connection: its channels are
+    // failed and the disconnect handler is called.
+    //
+    // A peer may be reached through several connections. New request channels are striped across
+    // them by load so that a slow or congested connection does not stall every request to the
+    // peer. The disconnect handler is only called once the last connection of a peer is lost.
+    //
     // Arguments:
     //     default_processor: The default processor to use.
-    //     disconnect_handler: The handler to use when a client disconnects.
-    Connector(handler_t defaultHandler, std::function<void(in_addr_t)> disconnectCallback);
+    //     disconnect_handler: The handler to use when the last connection of a peer is lost.
+    //     heartbeatOptions: The heartbeat and failure detection options.
+    //     connectionsPerPeer: The maximum number of connections to a peer.
+    Connector(handler_t defaultHandler, std::function<void(PeerAddress)> disconnectCallback,
+              HeartbeatOptions heartbeatOptions = HeartbeatOptions(),
+              size_t connectionsPerPeer = 1);
 
     // Destructor
     ~Connector();
@@ -39,36 +58,100 @@ class Connector {
     //     processor: The processor to add.
     absl::Status addHandler(protocol_t protocol, handler_t handler);
 
-    // Adds a TCP client to the connector.
+    // Enables admission control of the requests received from peers. A request above the
+    // adaptive concurrency limit is answered with an overloaded message on its channel and closed
+    // without spawning its handler. Must be called before any client is added.
+    //
+    // Arguments:
+    //     options: The options of the concurrency limit.
+    void setAdmissionControl(AdmissionOptions options);
+
+    // Adds a TCP client to the connector as a connection to the peer at its address and port.
     //
     // Arguments:
     //     client: The client to add.
+    //     link: The link carrying the messages of the client such as a shared memory link to a
+    //         peer on the same host. The messages are carried by the socket of the client if null
+    //         while the socket is only watched for hang ups otherwise.
     // Returns:
-    //     The address of the client if successful, otherwise an error.
-    absl::Status addClient(std::unique_ptr<TcpClient> client);
+    //     The status of the operation. Returns an AlreadyExists error if the peer has as many
+    //     connections as allowed.
+    absl::Status addClient(std::unique_ptr<TcpClient> client,
+                           std::shared_ptr<MessageLink> link = nullptr);
 
-    // Send a message through the specified client.
+    // Adds a peer reached through a link that is not backed by a socket such as an in-process
+    // link.
     //
     // Arguments:
-    //     address: The address of the client to send the message to.
+    //     address: The address of the peer.
+    //     link: The link carrying the messages of the peer.
+    // Returns:
+    //     The status of the operation. Returns an AlreadyExists error if the peer has as many
+    //     connections as allowed.
+    absl::Status addClient(const sockaddr &address, std::shared_ptr<MessageLink> link);
+
+    // Removes a peer from the connector. Its connections are shut down and removed by their
+    // readers which fail their channels and call the disconnect callback.
+    //
+    // Arguments:
+    //     peer: The peer to remove.
+    // Returns:
+    //     The status of the operation.
+    absl::Status removeClient(PeerAddress peer);
+
+    // Send a message to the specified peer through its least loaded connection. The request
+    // inherits the deadline of the calling thread, which the handler of the peer sees as the
+    // deadline of its request.
+    //
+    // A single-shot request sends a single message answered by a single message which end the
+    // request on both ends, so it takes two frames instead of four. Further messages fail to send
+    // and the request is only ended separately if it is closed before it is answered.
+    //
+    // Arguments:
+    //     peer: The peer to send the message to.
+    //     singleShot: Whether the request is a single message answered by a single message.
     //
     // Returns:
     //     The status ofr the operation and a request if successful.
     std::pair<absl::Status, std::unique_ptr<Request>>
-    sendRequest(in_addr_t address);
+    sendRequest(PeerAddress peer, bool singleShot = false);
+
+    // Returns the load of the specified peer as seen by the requests sent to it over all of its
+    // connections. Returns an empty load if the peer is not connected.
+    //
+    // Arguments:
+    //     peer: The peer.
+    PeerLoad peerLoad(PeerAddress peer);
+
+    // Returns the number of connections to the specified peer.
+    //
+    // Arguments:
+    //     peer: The peer.
+    size_t connectionCount(PeerAddress peer);
 
    private:
-    // Represents an internal client with a channel manager and write mutex.
+    // Represents an internal client with a channel manager and frame scheduler.
     class InternalClient {
        public:
-        InternalClient(const std::shared_ptr<TcpClient> client,
-                       const std::shared_ptr<std::mutex> writeMutex,
-                       const std::shared_ptr<connector_channel_manager_t> channelManager)
-            : client(client), writeMutex(writeMutex), channelManager(channelManager) {}
-
+        InternalClient(const std::shared_ptr<TcpClient> client, const sockaddr &address,
+                       const std::shared_ptr<MessageLink> link,
+                       const std::shared_ptr<FrameScheduler> scheduler,
+                       const std::shared_ptr<connector_channel_manager_t> channelManager,
+                       const std::shared_ptr<PhiAccrualFailureDetector> failureDetector)
+            : client(client),
+              address(address),
+              link(link),
+              scheduler(scheduler),
+              channelManager(channelManager),
+              failureDetector(failureDetector) {}
+
+        // The socket of the peer if the link is backed by one, kept open as long as the peer.
         const std::shared_ptr<TcpClient> client;
-        const std::shared_ptr<std::mutex> writeMutex;
+        const sockaddr address;
+        const std::shared_ptr<MessageLink> link;
+        const std::shared_ptr<FrameScheduler> scheduler;
         const std::shared_ptr<connector_channel_manager_t> channelManager;
+        const std::shared_ptr<PhiAccrualFailureDetector> failureDetector;
     };
 
     // The map of protocol handlers.
@@ -77,23 +160,88 @@ class Connector {
     // The default handler to use when no handler is found for a protocol.
     handler_t defaultHandler;
 
-    // The handler to use when a client disconnects.
-    std::function<void(in_addr_t)> disconnectCallback;
+    // Limits the requests handled at the same time if admission control is enabled.
+    std::shared_ptr<AdmissionController> admissionController;
 
-    // A map of the current TCP clients identified by their address.
-    absl::flat_hash_map<in_addr_t, InternalClient> clients;
+    // The handler to use when the last connection of a peer is lost.
+    std::function<void(PeerAddress)> disconnectCallback;
 
-    // Runs the specified client in a thread.
+    // The maximum number of connections to a peer.
+    const size_t connectionsPerPeer;
+
+    // A map of the connections of the current peers identified by their address and port.
+    absl::flat_hash_map<PeerAddress, std::vector<std::shared_ptr<InternalClient>>> clients;
+
+    // Runs the reader of the specified connection in a thread.
+    //
+    // Arguments:
+    //     peer: The peer of the connection.
+    //     internalClient: The connection to run.
+    void runClient(PeerAddress peer, std::shared_ptr<InternalClient> internalClient);
+
+    // Adds a peer and runs its reader.
     //
     // Arguments:
-    //     client: The client to run.
-    absl::Status runClient(in_addr_t address);
+    //     client: The socket of the peer if the link is backed by one.
+    //     address: The address of the peer.
+    //     link: The link carrying the messages of the peer.
+    absl::Status addClient(std::unique_ptr<TcpClient> client, const sockaddr &address,
+                           std::shared_ptr<MessageLink> link);
+
+    // Returns the handler of the specified protocol or the default handler if it has none.
+    //
+    // Arguments:
+    //     protocol: The protocol of the request.
+    handler_t handlerOf(protocol_t protocol);
 
     // The mutex protecting the clients map.
     std::mutex clientsMutex;
 
     // The mutex protecting the handlers map.
     std::mutex handlersMutex;
+
+    // The heartbeat and failure detection options.
+    const HeartbeatOptions heartbeatOptions;
+
+    // The thread sending heartbeats and evicting suspected peers.
+    std::thread heartbeatThread;
+
+    // Mutex and condition used to stop the heartbeat thread.
+    std::mutex heartbeatMutex;
+    std::condition_variable heartbeatCondition;
+
+    // Whether the heartbeat thread should stop.
+    bool stopHeartbeats = false;
+
+    // Sends heartbeats to every client and evicts the clients whose failure detector suspects
+    // them until the connector is destroyed.
+    void runHeartbeats();
+
+    // The thread answering the requests shed by the readers and destroying the ones they drop.
+    // Doing either from a reader could block it behind a peer that stopped reading, as destroying
+    // a request ends its channel, so the readers queue them instead.
+    std::thread reaperThread;
+
+    // Mutex and condition protecting the queue of the reaper thread.
+    std::mutex reaperMutex;
+    std::condition_variable reaperCondition;
+
+    // The requests queued for the reaper thread and whether to shed them. Bounded by the channels
+    // of the links as every request holds a channel.
+    std::deque<std::pair<std::unique_ptr<Request>, bool>> reaperQueue;
+
+    // Whether the reaper thread should stop.
+    bool stopReaper = false;
+
+    // Queues a request dropped by a reader for the reaper thread.
+    //
+    // Arguments:
+    //     request: The request to drop.
+    //     shed: Whether to answer the request with an overloaded message before destroying it.
+    void reap(std::unique_ptr<Request> request, bool shed);
+
+    // Sheds and destroys the queued requests until the connector is destroyed.
+    void runReaper();
 };
 
 }  // namespace ostp::servercc
@@ -1,7 +1,12 @@
 #ifndef SERVERCC_CONNECTOR_TYPES_H
 #define SERVERCC_CONNECTOR_TYPES_H
 
+#include <arpa/inet.h>
 #include <inttypes.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <utility>
 
 #include "channel_types.h"
 #include "internal_channel_manager.h"
@@ -13,7 +18,7 @@ namespace ostp::servercc {
 // The type of the connector channel manager.
 typedef InternalChannelManager<kInternalRequestProtocol, kInternalRequestEndProtocol,
                                kInternalResponseProtocol, kInternalResponseEndProtocol,
-                               kInternalResponseEndProtocol, 1024>
+                               kInternalResponseEndProtocol, kMaxChannels>
     connector_channel_manager_t;
 
 // The type of the connector request.
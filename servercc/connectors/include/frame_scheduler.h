@@ -0,0 +1,135 @@
+#ifndef SERVERCC_FRAME_SCHEDULER_H
+#define SERVERCC_FRAME_SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+
+namespace ostp::servercc {
+
+// The priority classes of the frames written to a link. A class is only served when every class
+// before it has no frame waiting.
+enum class FramePriority {
+    // Frames keeping the connection and its channels healthy such as channel close messages.
+    kControl = 0,
+
+    // Small frames of requests and responses.
+    kInteractive = 1,
+
+    // Large frames such as the chunks of a stream which use the bandwidth left by the others.
+    kBulk = 2,
+};
+
+// The number of priority classes.
+constexpr size_t kFramePriorityCount = 3;
+
+// The length from which a data frame is bulk.
+constexpr size_t kBulkFrameLength = 64 * 1024;
+
+// The number of bytes a flow may write per round of the deficit round robin.
+constexpr size_t kFrameQuantum = 64 * 1024;
+
+// Returns the priority class of a data frame of the specified length.
+inline FramePriority dataFramePriority(size_t length) {
+    return length >= kBulkFrameLength ? FramePriority::kBulk : FramePriority::kInteractive;
+}
+
+// Orders the frames written by the channels sharing a link. Every writer waits for its turn and
+// then writes its frame from its own thread so that payloads are written without being queued.
+//
+// Waiting frames are served by strict priority across classes and by deficit round robin across
+// the flows of a class: every round a flow earns a quantum of bytes and writes its frames as long
+// as they fit in what it earned. A bulk transfer thus takes its share of the bandwidth between the
+// frames of interactive channels instead of whoever locks the link first winning.
+//
+// See Shreedhar and Varghese, "Efficient fair queuing using deficit round robin".
+class FrameScheduler {
+   public:
+    // Creates a scheduler.
+    //
+    // Arguments:
+    //     quantum: The number of bytes a flow may write per round.
+    explicit FrameScheduler(size_t quantum = kFrameQuantum) : quantum(quantum) {}
+
+    // Writes a frame once it is scheduled. Blocks until every frame scheduled before it was
+    // written. Frames of the same flow are written in order whatever their priority: a frame
+    // waits behind the frames of its flow in a lower class, such as the end of a channel behind
+    // its bulk data.
+    //
+    // Arguments:
+    //     flow: The flow of the frame, such as a channel.
+    //     priority: The priority class of the frame.
+    //     length: The length of the frame in bytes.
+    //     write: Writes the frame to the link.
+    // Returns:
+    //     The status returned by write.
+    absl::Status write(uint64_t flow, FramePriority priority, size_t length,
+                       const std::function<absl::Status()> &write);
+
+    // Writes a frame right away if the link is idle.
+    //
+    // Arguments:
+    //     write: Writes the frame to the link.
+    // Returns:
+    //     The status returned by write or nullopt if the link was busy.
+    std::optional<absl::Status> tryWrite(const std::function<absl::Status()> &write);
+
+   private:
+    // A writer waiting for its turn.
+    struct Waiter {
+        // Creates the waiter of a frame of the specified length.
+        explicit Waiter(size_t length) : length(length) {}
+
+        // The length of the frame.
+        const size_t length;
+
+        // Whether the writer may write.
+        bool granted = false;
+
+        // Signaled when the writer is granted.
+        std::condition_variable condition;
+    };
+
+    // The waiting frames of a flow.
+    struct Flow {
+        // The waiting writers in order.
+        std::deque<Waiter *> waiters;
+
+        // The number of bytes the flow may still write in this round.
+        size_t deficit = 0;
+    };
+
+    // The waiting frames of a priority class.
+    struct PriorityClass {
+        // The flows with waiting frames in round robin order.
+        std::deque<uint64_t> active;
+
+        // The flows with waiting frames.
+        absl::flat_hash_map<uint64_t, Flow> flows;
+    };
+
+    // The number of bytes a flow may write per round.
+    const size_t quantum;
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // Whether a frame is being written.
+    bool busy = false;
+
+    // The waiting frames of every priority class.
+    PriorityClass classes[kFramePriorityCount];
+
+    // Grants the next waiting frame or marks the link idle. Must be called with the mutex held by
+    // the writer that finished.
+    void grantNext();
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -1,14 +1,22 @@
 #ifndef SERVERCC_INTERNAL_CHANNEL_H
 #define SERVERCC_INTERNAL_CHANNEL_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <memory>
 #include <mutex>
 
-#include "absl/log/log.h"
+#include "async_log.h"
 #include "channel_types.h"
+#include "frame_scheduler.h"
 #include "inttypes.h"
 #include "message_buffer.h"
+#include "message_link.h"
+#include "tracer.h"
 #include "types.h"
+#include "wire_format.h"
 
 namespace ostp::servercc {
 
@@ -25,37 +33,67 @@ class InternalChannel {
     //
     // Arguments:
     //     id: The ID of the channel.
-    //     writeFd: The write file descriptor of the channel.
-    //     writeMutex: The mutex protecting the write operations.
+    //     link: The link to the other end.
+    //     scheduler: The scheduler of the frames written to the link.
     //     closeCallback: The callback to call when the channel is closed.
-    InternalChannel(const channel_id_t id, const int writeFd,
-                    const std::shared_ptr<std::mutex> writeMutex,
-                    const std::function<void(channel_id_t)> closeCallback)
-        : id(id), writeFd(writeFd), writeMutex(writeMutex), closeCallback(closeCallback) {
-        LOG(INFO) << "Constructed channel " << id;
+    //     span: The span of the channel ended when the channel is closed.
+    //     sendTraceContext: Whether to send the context of the span with the first message.
+    //     deadline: The deadline of the request of the channel.
+    //     sendDeadline: Whether to send the deadline with the first message.
+    //     singleShot: Whether the channel carries a single message each way so that the message
+    //                 written ends the channel.
+    InternalChannel(const channel_id_t id, const std::shared_ptr<MessageLink> link,
+                    const std::shared_ptr<FrameScheduler> scheduler,
+                    const std::function<void(channel_id_t)> closeCallback, Span span = Span(),
+                    bool sendTraceContext = false,
+                    std::chrono::steady_clock::time_point deadline = kNoDeadline,
+                    bool sendDeadline = false, bool singleShot = false)
+        : id(id),
+          link(link),
+          scheduler(scheduler),
+          closeCallback(closeCallback),
+          span(std::move(span)),
+          traceContextPending(sendTraceContext && this->span.sampled()),
+          sendDeadline(sendDeadline),
+          deadlinePending(sendDeadline),
+          singleShot(singleShot),
+          cancellation(std::make_shared<CancellationToken>(deadline)) {
+        SCC_VLOG(2) << "Constructed channel " << id;
     }
 
     // Destructor for the channel. Closes the channel by calling close().
     ~InternalChannel() {
         close();
-        LOG(INFO) << "Destructed channel " << id;
+        SCC_VLOG(2) << "Destructed channel " << id;
     }
 
-    // Reads a message from the channel. Blocks until a message is available.
+    // Reads a message from the channel. Blocks until a message is available or the deadline of
+    // the channel is reached.
     //
     // Returns:
     //     A pair containing the status of the operation and the message.
-    std::pair<absl::Status, std::unique_ptr<Message>> read() { return messageBuffer.pop(); }
+    std::pair<absl::Status, std::unique_ptr<Message>> read() {
+        if (getDeadline() == kNoDeadline) {
+            return checkEnd(messageBuffer.pop());
+        }
+        return read(std::numeric_limits<int>::max());
+    }
 
-    // Reads a message from the channel. Blocks until a message is available or the timeout is
-    // reached.
+    // Reads a message from the channel. Blocks until a message is available or the timeout or
+    // the deadline of the channel is reached.
     //
     // Arguments:
     //     timeout: The timeout in milliseconds.
     // Returns:
     //     A pair containing the status of the operation and the message.
     std::pair<absl::Status, std::unique_ptr<Message>> read(int timeout) {
-        return messageBuffer.pop(timeout);
+        auto deadline = getDeadline();
+        if (deadline != kNoDeadline) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            timeout = std::clamp<int64_t>(left.count(), 0, timeout);
+        }
+        return checkEnd(messageBuffer.pop(timeout));
     }
 
     // Writes a message to the channel delivering it to the other end.
@@ -65,14 +103,52 @@ class InternalChannel {
     // Returns:
     //     A status indicating whether the operation was successful.
     absl::Status write(std::unique_ptr<Message> message) {
-        if (isClosed) {
+        if (!claimWrite()) {
+            return absl::FailedPreconditionError("Channel is closed");
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= getDeadline()) {
+            return finishWrite(absl::DeadlineExceededError("Deadline of the request exceeded"));
+        }
+        if (firstWriteTime.load(std::memory_order_relaxed) == 0) {
+            firstWriteTime.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        auto length = message->body.data.size();
+        auto frame = takeFrame(now, length);
+        return finishWrite(scheduler->write(flow(), frame.priority, length, [&]() {
+            return link->writeFrame(frame, std::move(message));
+        }));
+    }
+
+    // Writes a message whose body is a bulk payload to the channel without copying the payload
+    // into a message when the link supports it. The other end reads it like any other message.
+    //
+    // Arguments:
+    //     protocol: The protocol of the message.
+    //     payload: The body of the message which can be reused once the call returns.
+    // Returns:
+    //     A status indicating whether the operation was successful.
+    absl::Status writeBulk(protocol_t protocol, const BulkPayload &payload) {
+        if (payload.length > std::numeric_limits<uint32_t>::max()) {
+            return absl::InvalidArgumentError("Bulk payload does not fit in a message");
+        }
+        if (!claimWrite()) {
             return absl::FailedPreconditionError("Channel is closed");
         }
-        writeMutex->lock();
-        auto status =
-            writeMessage(writeFd, wrapMessage<channel_id_t, WriteProtocol>(id, std::move(message)));
-        writeMutex->unlock();
-        return std::move(status);
+        auto now = std::chrono::steady_clock::now();
+        if (now >= getDeadline()) {
+            return finishWrite(absl::DeadlineExceededError("Deadline of the request exceeded"));
+        }
+        if (firstWriteTime.load(std::memory_order_relaxed) == 0) {
+            firstWriteTime.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        // The message is framed exactly like write() frames a message.
+        auto frame = takeFrame(now, payload.length);
+        return finishWrite(scheduler->write(flow(), frame.priority, payload.length, [&]() {
+            return link->writeBulkFrame(frame, protocol, payload);
+        }));
     }
 
     // Pushes a message to the channel's message buffer to be read by this end.
@@ -82,56 +158,353 @@ class InternalChannel {
     // Returns:
     //     A status indicating whether the operation was successful.
     absl::Status push(std::unique_ptr<Message> message) {
-        if (isClosed) {
+        if (closed() || endPushed) {
             return absl::FailedPreconditionError("Channel is closed");
         }
+        if (!receivedMessage) {
+            receivedMessage = true;
+            span.mark("first_byte");
+        }
         return messageBuffer.push(std::move(message));
     }
 
-    // Closes the channel.
+    // Marks the end of the messages the other end writes to the channel once its last message was
+    // pushed. Reads fail once the messages pushed before are read.
+    //
+    // Returns:
+    //     A status indicating whether the operation was successful.
+    absl::Status pushEnd() {
+        if (endPushed) {
+            return absl::FailedPreconditionError("Channel end was already pushed");
+        }
+        endPushed = true;
+        return messageBuffer.push(nullptr);
+    }
+
+    // Releases the channel once the other end ended it, with its last message or an end message,
+    // so that its ID can be reused. A released channel is neither ended again nor removed from
+    // its manager when closed as its ID may belong to another channel by then.
+    //
+    // Arguments:
+    //     abandoned: Whether the other end ended the channel without its last message, which
+    //                cancels the channel.
+    // Returns:
+    //     Whether the channel was released. Returns false if this end already closed the channel
+    //     which then removes itself from its manager.
+    bool release(bool abandoned) {
+        {
+            std::lock_guard lock(stateMutex);
+            if (isClosed) {
+                return false;
+            }
+            released = true;
+        }
+        if (!endPushed) {
+            pushEnd().IgnoreError();
+        }
+        if (abandoned) {
+            cancellation->cancel();
+        }
+        return true;
+    }
+
+    // Returns whether this end ended the channel, by closing it or writing its last message, so
+    // that the other end may reuse its ID.
+    bool ended() {
+        std::lock_guard lock(stateMutex);
+        return isClosed || endSent;
+    }
+
+    // Returns whether a message was pushed to the channel.
+    bool hasReceivedMessage() const { return receivedMessage; }
+
+    // Returns whether a message was written to the channel.
+    bool hasWritten() const { return firstWriteTime.load(std::memory_order_relaxed) != 0; }
+
+    // Returns the time elapsed since the first message was written to the channel or zero if no
+    // message was written.
+    std::chrono::nanoseconds sinceFirstWrite() const {
+        auto first = firstWriteTime.load(std::memory_order_relaxed);
+        if (first == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        return std::chrono::steady_clock::now() -
+               std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(first));
+    }
+
+    // Returns the deadline of the request of the channel or kNoDeadline if it has none.
+    std::chrono::steady_clock::time_point getDeadline() const { return cancellation->deadline(); }
+
+    // Sets the deadline of the request of the channel. The deadline is sent with the first message
+    // of a channel that sends its deadline.
+    //
+    // Arguments:
+    //     deadline: The deadline of the request.
+    // Returns:
+    //     The status of the operation. Returns a FailedPrecondition error if the deadline was
+    //     already sent.
+    absl::Status setDeadline(std::chrono::steady_clock::time_point deadline) {
+        if (sendDeadline && firstWriteTime.load(std::memory_order_relaxed) != 0) {
+            return absl::FailedPreconditionError("Deadline was already sent");
+        }
+        cancellation->setDeadline(deadline);
+        return absl::OkStatus();
+    }
+
+    // Returns the token cancelled when the channel is closed or aborted or its deadline passes.
+    std::shared_ptr<CancellationToken> getCancellationToken() const { return cancellation; }
+
+    // Returns the trace context of the channel which is not sampled if the channel is not traced.
+    TraceContext traceContext() const { return span.context(); }
+
+    // Records an instant event on the span of the channel if it is traced.
+    //
+    // Arguments:
+    //     event: The name of the event. Must be a string literal.
+    void markTrace(const char *event) { span.mark(event); }
+
+    // Closes the channel ending it unless the other end has nothing left to hear from it.
     void close() {
+        std::unique_lock lock(stateMutex);
         if (isClosed) {
             return;
         }
-        messageBuffer.close();
-        LOG(INFO) << "Closed channel " << id;
+        isClosed = true;
 
-        // Close the channel by sending a close message.
-        auto closeMessage = std::make_unique<Message>();
-        closeMessage->header.protocol = WriteEndProtocol;
-        closeMessage->header.length = sizeof(channel_id_t);
-        closeMessage->body.data.resize(sizeof(channel_id_t));
-        memcpy(closeMessage->body.data.data(), &id, sizeof(channel_id_t));
+        // An end answered with the last message of the other end, or answering with its own last
+        // message, has nothing left to end, and neither has an end that never exchanged a message.
+        // A single-shot request that was not answered yet is still ended to abandon it, by its
+        // writer if its last message is still being written so that the end follows it.
+        bool sendEnd;
+        if (!endSent) {
+            endSent = true;
+            sendEnd = !released && (hasWritten() || receivedMessage);
+        } else {
+            sendEnd = !released && !receivedMessage && !endWriting && hasWritten();
+        }
+        bool notifyManager = !released;
+        lock.unlock();
+        messageBuffer.close();
+        cancellation->cancel();
+        SCC_VLOG(2) << "Closed channel " << id;
 
-        writeMutex->lock();
-        auto status = writeMessage(writeFd, std::move(closeMessage));
-        if (!status.ok()) {
-            LOG(ERROR) << "Failed to send close message to channel " << id << ": "
-                       << status.message();
+        if (sendEnd) {
+            writeEnd();
         }
-        writeMutex->unlock();
+        span.end();
 
         // Call the close callback to remove the channel from the channel manager.
-        isClosed = true;
-        closeCallback(id);
+        if (notifyManager) {
+            closeCallback(id);
+        }
+    }
+
+    // Fails the channel without notifying the other end, waking up any reader. Used when the
+    // connection to the other end is lost.
+    void abort() {
+        {
+            std::lock_guard lock(stateMutex);
+            if (isClosed) {
+                return;
+            }
+            isClosed = true;
+        }
+        messageBuffer.close();
+        cancellation->cancel();
+        span.end();
+        SCC_VLOG(2) << "Aborted channel " << id;
     }
 
    private:
+    // Claims the writing of a message, which ends a single-shot channel, so that this end decides
+    // to end the channel once even when a message is written while the channel is closed.
+    //
+    // Returns:
+    //     Whether the message may be written. Returns false if this end already ended the channel.
+    bool claimWrite() {
+        std::lock_guard lock(stateMutex);
+        if (isClosed || endSent) {
+            return false;
+        }
+        endSent = singleShot;
+        endWriting = singleShot;
+        return true;
+    }
+
+    // Completes a write claimed by claimWrite(). Abandons a single-shot channel closed while its
+    // last message was being written as close() left it to the writer.
+    //
+    // Arguments:
+    //     status: The status of the write.
+    // Returns:
+    //     The status of the write.
+    absl::Status finishWrite(absl::Status status) {
+        if (!singleShot) {
+            return status;
+        }
+        std::unique_lock lock(stateMutex);
+        endWriting = false;
+        bool sendEnd = isClosed && !released && !receivedMessage && hasWritten();
+        lock.unlock();
+        if (sendEnd) {
+            writeEnd();
+        }
+        return status;
+    }
+
+    // Sends the end message of the channel which releases the channel on the other end so it
+    // skips the data frames.
+    void writeEnd() {
+        ChannelFrame frame;
+        frame.protocol = WriteEndProtocol;
+        frame.id = id;
+        frame.priority = FramePriority::kControl;
+        auto status = scheduler->write(flow(), frame.priority, sizeof(channel_id_t),
+                                       [&]() { return link->writeFrame(frame, nullptr); });
+        if (!status.ok()) {
+            SCC_LOG_EVERY_N(ERROR, 100)
+                << "Failed to send close message to channel " << id << ": " << status.message();
+        }
+    }
+
+    // Returns whether the channel is closed.
+    bool closed() {
+        std::lock_guard lock(stateMutex);
+        return isClosed;
+    }
+
+    // Turns the mark pushed after the last message of the other end into an error.
+    //
+    // Arguments:
+    //     result: The result of reading the message buffer.
+    // Returns:
+    //     The result of the read.
+    std::pair<absl::Status, std::unique_ptr<Message>> checkEnd(
+        std::pair<absl::Status, std::unique_ptr<Message>> result) {
+        if (result.first.ok() && result.second == nullptr) {
+            messageBuffer.close();
+            return {absl::FailedPreconditionError("Channel was ended by the other end"), nullptr};
+        }
+        return result;
+    }
+
+    // Returns the fields of the channel to frame the message being written with. The first message
+    // of a sampled channel carries the trace context to the other end.
+    //
+    // Arguments:
+    //     now: The time at which the message is written.
+    //     length: The length of the body of the message.
+    ChannelFrame takeFrame(std::chrono::steady_clock::time_point now, size_t length) {
+        ChannelFrame frame;
+        frame.protocol = WriteProtocol;
+        frame.id = id;
+        frame.priority = dataFramePriority(length);
+        if (traceContextPending) {
+            traceContextPending = false;
+            auto context = span.context();
+            frame.protocol |= kTracedProtocolFlag;
+            frame.traceId = context.traceId;
+            frame.spanId = context.spanId;
+        }
+        if (takeDeadlinePending()) {
+            frame.protocol |= kDeadlineProtocolFlag;
+            frame.budget =
+                std::chrono::duration_cast<std::chrono::microseconds>(getDeadline() - now).count();
+        }
+        frame.protocol |= takeChannelFlags();
+        return frame;
+    }
+
+    // Returns the flags of the channel to set on the protocol of the message being written. The
+    // last message of a single-shot channel, which claimWrite() ended before it is written so that
+    // the other end never reuses the ID of the channel while this end still holds it, carries the
+    // end.
+    protocol_t takeChannelFlags() {
+        protocol_t flags = 0;
+        if (openPending) {
+            openPending = false;
+            flags |= kChannelOpenFlag;
+        }
+        if (singleShot) {
+            flags |= kChannelEndFlag;
+        }
+        return flags;
+    }
+
+    // Returns whether the deadline has to be sent with the message being written. Only the first
+    // message carries it.
+    bool takeDeadlinePending() {
+        if (!deadlinePending) {
+            return false;
+        }
+        deadlinePending = false;
+        return getDeadline() != kNoDeadline;
+    }
+
+    // Returns the flow of the frames of the channel. The request and response channels of a link
+    // have separate IDs so the flow includes the direction.
+    uint64_t flow() const { return (uint64_t)WriteProtocol << 32 | id; }
+
     // The ID of the channel.
     const channel_id_t id;
 
-    // The write file descriptor of the channel.
-    const int writeFd;
+    // The link to the other end.
+    const std::shared_ptr<MessageLink> link;
 
-    // Mutex protecting the write operations.
-    const std::shared_ptr<std::mutex> writeMutex;
+    // The scheduler of the frames written to the link.
+    const std::shared_ptr<FrameScheduler> scheduler;
 
     // The callback to call when the channel is closed.
     const std::function<void(channel_id_t)> closeCallback;
 
+    // Mutex protecting the state of the channel below, which the thread forwarding the messages
+    // of the link changes as well.
+    std::mutex stateMutex;
+
     // Whether the channel is closed.
     bool isClosed = false;
 
+    // Whether this end ended the channel, with its last message or an end message.
+    bool endSent = false;
+
+    // Whether the last message of a single-shot channel is being written.
+    bool endWriting = false;
+
+    // Whether the channel was released as the other end ended it.
+    bool released = false;
+
+    // Whether the next message written is the first one of the channel.
+    bool openPending = true;
+
+    // Whether the end of the messages of the other end was pushed. Only used by the thread
+    // forwarding the messages of the link.
+    bool endPushed = false;
+
+    // The span of the channel.
+    Span span;
+
+    // Whether the trace context still has to be sent with the first message.
+    bool traceContextPending;
+
+    // Whether the deadline is sent with the first message.
+    const bool sendDeadline;
+
+    // Whether the first message still has to be written with the deadline.
+    bool deadlinePending;
+
+    // Whether the channel carries a single message each way.
+    const bool singleShot;
+
+    // The token of the channel which also holds the deadline of its request.
+    const std::shared_ptr<CancellationToken> cancellation;
+
+    // Whether a message was received by the channel.
+    std::atomic<bool> receivedMessage = false;
+
+    // The time of the first write in steady clock ticks or zero if nothing was written. Written by
+    // the writer and read by the thread pushing the responses.
+    std::atomic<std::chrono::steady_clock::rep> firstWriteTime = 0;
+
     // The message buffer used to read messages to the channel.
     ostp::libcc::data_structures::MessageBuffer<std::unique_ptr<Message>> messageBuffer;
 };
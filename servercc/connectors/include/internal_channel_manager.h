@@ -1,9 +1,12 @@
 #ifndef SERVERCC_INTERNAL_CHANNEL_MANAGER_H
 #define SERVERCC_INTERNAL_CHANNEL_MANAGER_H
 
+#include <assert.h>
 #include <inttypes.h>
 
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -11,12 +14,29 @@
 #include <stack>
 
 #include "absl/status/status.h"
+#include "async_log.h"
 #include "channel_types.h"
 #include "internal_channel.h"
+#include "metrics_registry.h"
+#include "tracer.h"
 #include "types.h"
+#include "wire_format.h"
 
 namespace ostp::servercc {
 
+// The load of a peer as seen by the requests sent to it.
+struct PeerLoad {
+    // The number of open request channels.
+    uint32_t openRequests = 0;
+
+    // The number of requests waiting for a free channel.
+    uint32_t waitingRequests = 0;
+
+    // The moving average of the time between the first request message and the first response
+    // message in nanoseconds or zero if no response was received yet.
+    uint64_t latency = 0;
+};
+
 // Allows internal communication between servercc processes with multiplexing. The protocol is
 // used to identify the type of message sent through the channel.
 //
@@ -40,13 +60,15 @@ class InternalChannelManager {
     // Creates a new InternalChannelManager.
     //
     // Arguments:
-    //     writeFd: The write file descriptor of the channel (write-only).
-    //     writeMutex: The mutex protecting the write operations.
-    InternalChannelManager(const int writeFd, std::shared_ptr<std::mutex> writeMutex)
-        : writeFd(writeFd),
-          writeMutex(writeMutex),
+    //     link: The link to the peer.
+    //     scheduler: The scheduler of the frames written to the link.
+    InternalChannelManager(const std::shared_ptr<MessageLink> link,
+                           std::shared_ptr<FrameScheduler> scheduler)
+        : link(link),
+          scheduler(scheduler),
           freeListMutex(),
-          freeListSemaphore(MaxChannels) {
+          freeListSemaphore(MaxChannels),
+          metrics(Metrics::global()) {
         // Initialize the free list.
         for (channel_id_t i = 0; i < MaxChannels; i++) {
             freeList.push(i);
@@ -57,100 +79,222 @@ class InternalChannelManager {
 
     // Destructor for the channel manager. Closes all channels by calling close().
     ~InternalChannelManager() {
-        LOG(INFO) << "Closing all channels for channel manager on write fd " << writeFd;
+        SCC_VLOG(1) << "Closing all channels for channel manager";
         for (channel_id_t i = 0; i < MaxChannels; i++) {
             removeResponseChannel(i);
-            removeRequestChannel(i);
+            if (auto channel = takeRequestChannel(i)) {
+                channel->close();
+            }
         }
     }
 
     // Tries to forward a ResponseProtocol message to the appropiate requestChannel channel.
     //
     // Arguments:
-    //     message: The message to forward.
+    //     frame: The fields of the channel of the message.
+    //     message: The message to forward or null for a frame without a message.
     // Returns:
     //    The status of the operation the protocol of the message and the response channel if
     //    one was created.
     std::tuple<absl::Status, protocol_t, std::shared_ptr<response_channel_t>> forwardMessage(
-        std::unique_ptr<Message> message) {
+        const ChannelFrame &frame, std::unique_ptr<Message> message) {
         // If the message is a response end or request end message remove the channel.
-        auto protocol = message->header.protocol;
+        auto protocol = frame.protocol;
+        auto id = frame.id;
+        assert(id < MaxChannels);
         if (protocol == ResponseEndProtocol) {
-            channel_id_t id;
-            memcpy(&id, message->body.data.data(), sizeof(channel_id_t));
-            if (requestChannel[id]) {
-                removeRequestChannel(id);
-            }
+            endRequestChannel(id, true);
             return {absl::OkStatus(), protocol, nullptr};
 
         } else if (protocol == RequestEndProtocol) {
-            channel_id_t id;
-            memcpy(&id, message->body.data.data(), sizeof(channel_id_t));
-            if (responseChannel[id]) {
-                removeResponseChannel(id);
-            }
+            removeResponseChannel(id);
             return {absl::OkStatus(), protocol, nullptr};
         }
 
-        // Otherwise try to unwrap the message and forward it to the appropriate channel.
-        auto [status, channelId, unwrapped] = unwrapMessage<channel_id_t>(std::move(message));
-        if (!status.ok()) {
-            return {status, -1, nullptr};
+        // The first and the last message an end writes to a channel are marked so that the
+        // channel is opened and ended without messages of their own.
+        bool open = protocol & kChannelOpenFlag;
+        bool last = protocol & kChannelEndFlag;
+        protocol &= ~(kChannelOpenFlag | kChannelEndFlag);
+
+        // The first message of a request with a deadline carries the time left until it. The
+        // budget is read from the wire so a budget beyond the end of the clock means no deadline.
+        auto deadline = kNoDeadline;
+        if (protocol & kDeadlineProtocolFlag) {
+            protocol &= ~kDeadlineProtocolFlag;
+            auto now = std::chrono::steady_clock::now();
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(kNoDeadline - now);
+            if (frame.budget < (deadline_budget_t)left.count()) {
+                deadline = now + std::chrono::microseconds(frame.budget);
+            }
+        }
+
+        // The first message of a sampled channel also carries the trace context of the sender.
+        TraceContext traceContext;
+        if (protocol & kTracedProtocolFlag) {
+            protocol &= ~kTracedProtocolFlag;
+            traceContext = {frame.traceId, frame.spanId};
+        }
+        if (protocol != RequestProtocol && protocol != ResponseProtocol) {
+            return {absl::InvalidArgumentError("Invalid protocol"), -1, nullptr};
         }
-        auto unwrappedHeaderProtocol = unwrapped->header.protocol;
-        auto id = *channelId;
+        if (message == nullptr) {
+            return {absl::InvalidArgumentError("Channel message is missing"), -1, nullptr};
+        }
+        // A request starting with a stream is dispatched on the protocol of the stream.
+        auto headerProtocol = streamProtocol(message->header.protocol);
 
-        // If the protocol is a response push the message to the requesting channel. Otherwise if
-        // the protocol is a request push the message to the responding channel.
+        // If the protocol is a response push the message to the requesting channel. Otherwise the
+        // protocol is a request so push the message to the responding channel.
         if (protocol == ResponseProtocol) {
-            if (requestChannel[id] == nullptr) {
-                return {absl::NotFoundError("Channel does not exist"), unwrappedHeaderProtocol,
-                        nullptr};
+            // The last message of the response ends the request channel even if this end closed
+            // it already as the ID is only reused once the peer ended the channel.
+            auto channel = getRequestChannel(id);
+            absl::Status status = absl::NotFoundError("Channel does not exist");
+            if (channel != nullptr) {
+                if (!channel->hasReceivedMessage()) {
+                    recordLatency(channel->sinceFirstWrite());
+                }
+                status = channel->push(std::move(message));
             }
-            return {requestChannel[id]->push(std::move(unwrapped)), unwrappedHeaderProtocol,
-                    nullptr};
-
-        } else if (protocol == RequestProtocol) {
-            // Check if the channel exists otherwise try to create it.
-            absl::Status status;
-            if (responseChannel[id] == nullptr && !(status = createResponseChannel(id)).ok()) {
-                return {status, unwrappedHeaderProtocol, nullptr};
+            if (last) {
+                endRequestChannel(id, false);
             }
-            return {responseChannel[id]->push(std::move(unwrapped)), unwrappedHeaderProtocol,
-                    responseChannel[id]};
+            return {status, headerProtocol, nullptr};
+        }
 
+        // Create the channel with the first message of the request. Only a newly created channel
+        // is returned so that a single request is dispatched per channel.
+        std::shared_ptr<response_channel_t> channel;
+        if (open) {
+            auto [status, created] = createResponseChannel(id, traceContext, deadline, last);
+            if (!status.ok()) {
+                return {status, headerProtocol, nullptr};
+            }
+            channel = created;
         } else {
-            return {absl::InvalidArgumentError("Invalid protocol"), unwrappedHeaderProtocol,
-                    nullptr};
+            channel = getResponseChannel(id);
+            if (channel == nullptr || channel->ended()) {
+                return {absl::NotFoundError("Channel does not exist"), headerProtocol, nullptr};
+            }
+        }
+        auto status = channel->push(std::move(message));
+        if (status.ok() && last) {
+            status = channel->pushEnd();
         }
+        return {status, headerProtocol, open ? channel : nullptr};
     }
 
-    // Tries to create a new requestChannel channel and returns the ID of the channel.
+    // Tries to create a new requestChannel channel and returns the ID of the channel. The channel
+    // inherits the deadline of the calling thread and sends it to the peer.
     //
+    // Arguments:
+    //     singleShot: Whether the request is a single message answered by a single message so
+    //                 that both end the channel without end messages.
     // Returns:
-    //     The status of the operation and a pointer to the channel if successful.
-    std::pair<absl::Status, std::shared_ptr<request_channel_t>> createRequestChannel() {
-        // Wait on the free list.
-        freeListSemaphore.acquire();
+    //     The status of the operation and a pointer to the channel if successful. Returns a
+    //     DeadlineExceeded error if the deadline passes before a channel is free.
+    std::pair<absl::Status, std::shared_ptr<request_channel_t>> createRequestChannel(
+        bool singleShot = false) {
+        // The work of a caller past its deadline is wasted so it is not sent at all.
+        auto deadline = currentDeadline();
+        if (deadline <= std::chrono::steady_clock::now()) {
+            return {absl::DeadlineExceededError("Deadline of the request exceeded"), nullptr};
+        }
+
+        // Wait on the free list recording the wait if every channel is in use.
+        if (!freeListSemaphore.try_acquire()) {
+            auto start = std::chrono::steady_clock::now();
+            waitingRequests.fetch_add(1, std::memory_order_relaxed);
+            bool acquired = true;
+            if (deadline == kNoDeadline) {
+                freeListSemaphore.acquire();
+            } else {
+                acquired = freeListSemaphore.try_acquire_until(deadline);
+            }
+            waitingRequests.fetch_sub(1, std::memory_order_relaxed);
+            if (!acquired) {
+                return {absl::DeadlineExceededError("Deadline exceeded waiting for a channel"),
+                        nullptr};
+            }
+            metrics.semaphoreWaits.add();
+            metrics.semaphoreWaitTime.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                 std::chrono::steady_clock::now() - start)
+                                                 .count());
+        }
         freeListMutex.lock();
         auto id = freeList.top();
         freeList.pop();
+        requestEnds[id] = kOpen;
         freeListMutex.unlock();
 
-        // Create the channel.
-        requestChannel[id] = std::make_shared<InternalChannel<RequestProtocol, RequestEndProtocol>>(
-            id, writeFd, writeMutex, [this](channel_id_t id) { this->removeRequestChannel(id); });
-        LOG(INFO) << "Opened request channel " << id << " for channel manager on write fd "
-                  << writeFd;
-        return {absl::OkStatus(), requestChannel[id]};
+        // Create the channel continuing the trace of the calling thread if there is one.
+        auto span = Tracer::global().startSpan("internal_request");
+        span.setArgument("channel", id);
+        auto channel = std::make_shared<request_channel_t>(
+            id, link, scheduler, [this](channel_id_t id) { this->removeRequestChannel(id); },
+            std::move(span), true, deadline, true, singleShot);
+        channelsMutex.lock();
+        requestChannel[id] = channel;
+        channelsMutex.unlock();
+        openRequests.fetch_add(1, std::memory_order_relaxed);
+        metrics.openRequestChannels.add();
+        metrics.requestChannelOpens.add();
+        SCC_VLOG(2) << "Opened request channel " << id;
+        return {absl::OkStatus(), channel};
+    }
+
+    // Fails every open channel without notifying the peer so that requests waiting on the peer
+    // return immediately. Used when the connection to the peer is lost.
+    void abort() {
+        SCC_VLOG(1) << "Aborting all channels for channel manager";
+        for (channel_id_t i = 0; i < MaxChannels; i++) {
+            if (auto channel = takeResponseChannel(i)) {
+                channel->abort();
+                metrics.openResponseChannels.sub();
+                metrics.responseChannelCloses.add();
+            }
+
+            // The IDs waiting for the peer to end their channels are free as the peer is gone.
+            if (auto channel = takeRequestChannel(i)) {
+                channel->abort();
+                openRequests.fetch_sub(1, std::memory_order_relaxed);
+                metrics.openRequestChannels.sub();
+                metrics.requestChannelCloses.add();
+                endRequestId(i, kLocalEnd | kPeerEnd);
+            } else {
+                freeListMutex.lock();
+                bool pending = (requestEnds[i] & (kLocalEnd | kPeerEnd)) != 0;
+                freeListMutex.unlock();
+                if (pending) {
+                    endRequestId(i, kLocalEnd | kPeerEnd);
+                }
+            }
+        }
+    }
+
+    // Returns the load of the peer as seen by the requests sent to it.
+    PeerLoad load() const {
+        return {openRequests.load(std::memory_order_relaxed),
+                waitingRequests.load(std::memory_order_relaxed),
+                latency.load(std::memory_order_relaxed)};
     }
 
    private:
-    // The write file descriptor of the channel (write-only).
-    const int writeFd;
+    // This end ended a request channel.
+    static constexpr uint8_t kLocalEnd = 1;
+
+    // The peer ended a request channel.
+    static constexpr uint8_t kPeerEnd = 2;
+
+    // A request channel was opened with the ID.
+    static constexpr uint8_t kOpen = 4;
 
-    // Mutex protecting the write operations.
-    const std::shared_ptr<std::mutex> writeMutex;
+    // The link to the peer.
+    const std::shared_ptr<MessageLink> link;
+
+    // The scheduler of the frames written to the link.
+    const std::shared_ptr<FrameScheduler> scheduler;
 
     // The free list of channel IDs.
     std::stack<channel_id_t> freeList;
@@ -159,7 +303,15 @@ class InternalChannelManager {
     std::mutex freeListMutex;
 
     // Semaphore used to block on the free list.
-    std::binary_semaphore freeListSemaphore;
+    std::counting_semaphore<MaxChannels> freeListSemaphore;
+
+    // Whether a request channel was opened with every ID that is not free yet and the ends that
+    // ended it. Protected by the free list mutex.
+    std::array<uint8_t, MaxChannels> requestEnds = {};
+
+    // Mutex protecting the arrays of channels below which the thread forwarding the messages of
+    // the link and the threads closing channels change.
+    std::mutex channelsMutex;
 
     // The array of request channels used to send requests to another peer.
     std::array<std::shared_ptr<request_channel_t>, MaxChannels> requestChannel;
@@ -167,57 +319,241 @@ class InternalChannelManager {
     // The array of response channels used to send responses to another peer.
     std::array<std::shared_ptr<response_channel_t>, MaxChannels> responseChannel;
 
-    // Tries to create a new responseChannel channel with the specified ID.
+    // The number of open request channels.
+    std::atomic<uint32_t> openRequests = 0;
+
+    // The number of requests waiting for a free channel.
+    std::atomic<uint32_t> waitingRequests = 0;
+
+    // The moving average of the time to the first response in nanoseconds. Only written by the
+    // thread forwarding the messages.
+    std::atomic<uint64_t> latency = 0;
+
+    // The metrics shared by every channel manager of the process.
+    struct Metrics {
+        Gauge &openRequestChannels;
+        Gauge &openResponseChannels;
+        Counter &requestChannelOpens;
+        Counter &responseChannelOpens;
+        Counter &requestChannelCloses;
+        Counter &responseChannelCloses;
+        Counter &semaphoreWaits;
+        Histogram &semaphoreWaitTime;
+
+        // Returns the channel manager metrics of the process.
+        static Metrics &global() {
+            static auto &registry = MetricsRegistry::global();
+            static metric_labels_t request = {{"direction", "request"}};
+            static metric_labels_t response = {{"direction", "response"}};
+            static Metrics metrics = {
+                registry.gauge("servercc_channels_open", request),
+                registry.gauge("servercc_channels_open", response),
+                registry.counter("servercc_channel_opens_total", request),
+                registry.counter("servercc_channel_opens_total", response),
+                registry.counter("servercc_channel_closes_total", request),
+                registry.counter("servercc_channel_closes_total", response),
+                registry.counter("servercc_channel_semaphore_waits_total"),
+                registry.histogram("servercc_channel_semaphore_wait_ns"),
+            };
+            return metrics;
+        }
+    };
+
+    // The metrics of the channel manager.
+    Metrics &metrics;
+
+    // Tries to create a new responseChannel channel with the specified ID. A channel this end
+    // ended stays in place until its handler closes it while the peer may already reuse its ID,
+    // so it is replaced.
     //
     // Arguments:
     //     id: The ID of the channel to create.
+    //     traceContext: The trace context sent by the requesting peer.
+    //     deadline: The deadline of the request sent by the requesting peer.
+    //     singleShot: Whether the request is a single message answered by a single message.
     // Returns:
-    //     The status of the operation.
-    absl::Status createResponseChannel(channel_id_t id) {
-        // Check if the channel exists.
+    //     The status of the operation and the channel if successful.
+    std::pair<absl::Status, std::shared_ptr<response_channel_t>> createResponseChannel(
+        channel_id_t id, const TraceContext &traceContext,
+        std::chrono::steady_clock::time_point deadline, bool singleShot) {
+        std::lock_guard lock(channelsMutex);
         if (responseChannel[id] != nullptr) {
-            return absl::AlreadyExistsError("Channel already exists");
+            if (!responseChannel[id]->ended()) {
+                return {absl::AlreadyExistsError("Channel already exists"), nullptr};
+            }
+            responseChannel[id] = nullptr;
+            metrics.openResponseChannels.sub();
+            metrics.responseChannelCloses.add();
         }
-        responseChannel[id] =
-            std::make_shared<InternalChannel<ResponseProtocol, ResponseEndProtocol>>(
-                id, writeFd, writeMutex,
-                [this](channel_id_t id) { this->removeResponseChannel(id); });
-        LOG(INFO) << "Opened response channel " << id << " for channel manager on write fd "
-                  << writeFd;
-        return absl::OkStatus();
+        Span span("internal_response", traceContext);
+        span.setArgument("channel", id);
+        responseChannel[id] = std::make_shared<response_channel_t>(
+            id, link, scheduler, [this](channel_id_t id) { this->releaseResponseChannel(id); },
+            std::move(span), false, deadline, false, singleShot);
+        metrics.openResponseChannels.add();
+        metrics.responseChannelOpens.add();
+        SCC_VLOG(2) << "Opened response channel " << id;
+        return {absl::OkStatus(), responseChannel[id]};
     }
 
-    // Removes the response channel with the specified ID from the channel manager.
+    // Adds the time to the first response of a request to the moving average with a weight of
+    // 1/8 so that the average follows a change of load within a few requests.
+    //
+    // Arguments:
+    //     sample: The time to the first response.
+    void recordLatency(std::chrono::nanoseconds sample) {
+        if (sample.count() <= 0) {
+            return;
+        }
+        auto current = latency.load(std::memory_order_relaxed);
+        if (current == 0) {
+            latency.store(sample.count(), std::memory_order_relaxed);
+        } else {
+            latency.store(current + ((int64_t)sample.count() - (int64_t)current) / 8,
+                          std::memory_order_relaxed);
+        }
+    }
+
+    // Returns the request channel with the specified ID or nullptr if there is none.
+    //
+    // Arguments:
+    //     id: The ID of the channel.
+    std::shared_ptr<request_channel_t> getRequestChannel(channel_id_t id) {
+        std::lock_guard lock(channelsMutex);
+        return requestChannel[id];
+    }
+
+    // Returns the response channel with the specified ID or nullptr if there is none.
+    //
+    // Arguments:
+    //     id: The ID of the channel.
+    std::shared_ptr<response_channel_t> getResponseChannel(channel_id_t id) {
+        std::lock_guard lock(channelsMutex);
+        return responseChannel[id];
+    }
+
+    // Takes the request channel with the specified ID out of the channel manager.
+    //
+    // Arguments:
+    //     id: The ID of the channel.
+    // Returns:
+    //     The channel or nullptr if there is none.
+    std::shared_ptr<request_channel_t> takeRequestChannel(channel_id_t id) {
+        std::lock_guard lock(channelsMutex);
+        return std::move(requestChannel[id]);
+    }
+
+    // Takes the response channel with the specified ID out of the channel manager.
+    //
+    // Arguments:
+    //     id: The ID of the channel.
+    // Returns:
+    //     The channel or nullptr if there is none.
+    std::shared_ptr<response_channel_t> takeResponseChannel(channel_id_t id) {
+        std::lock_guard lock(channelsMutex);
+        return std::move(responseChannel[id]);
+    }
+
+    // Removes the response channel with the specified ID from the channel manager closing it.
     //
     // Arguments:
     //     id: The ID of the channel to remove.
     void removeResponseChannel(channel_id_t id) {
-        if (responseChannel[id] == nullptr) {
+        auto channel = takeResponseChannel(id);
+        if (channel == nullptr) {
             return;
         }
-        auto channel = std::move(responseChannel[id]);
         channel->close();
-        LOG(INFO) << "Removed response channel " << id << " from manager";
+        metrics.openResponseChannels.sub();
+        metrics.responseChannelCloses.add();
+        SCC_VLOG(2) << "Removed response channel " << id << " from manager";
+    }
+
+    // Removes the response channel with the specified ID from the channel manager once it is
+    // closed. Called by a closing channel which may already have been replaced by the channel of
+    // the next request with the same ID.
+    //
+    // Arguments:
+    //     id: The ID of the channel to remove.
+    void releaseResponseChannel(channel_id_t id) {
+        {
+            std::lock_guard lock(channelsMutex);
+            if (responseChannel[id] == nullptr || !responseChannel[id]->ended()) {
+                return;
+            }
+            responseChannel[id] = nullptr;
+        }
+        metrics.openResponseChannels.sub();
+        metrics.responseChannelCloses.add();
+        SCC_VLOG(2) << "Removed response channel " << id << " from manager";
     }
 
-    // Removes the request channel with the specified ID from the channel manager and returns the
-    // channel to the free list.
+    // Removes the request channel with the specified ID from the channel manager once this end
+    // closed it. The ID returns to the free list once the peer ended the channel as well, unless
+    // the peer never heard of the channel.
     //
     // Arguments:
     //     id: The ID of the channel to remove.
     void removeRequestChannel(channel_id_t id) {
-        if (requestChannel[id] == nullptr) {
+        // The channel is gone already if the connection was lost.
+        auto channel = takeRequestChannel(id);
+        if (channel == nullptr) {
             return;
         }
-        auto channel = std::move(requestChannel[id]);
-        channel->close();
-        LOG(INFO) << "Removed request channel " << id << " from manager";
+        openRequests.fetch_sub(1, std::memory_order_relaxed);
+        metrics.openRequestChannels.sub();
+        metrics.requestChannelCloses.add();
+        SCC_VLOG(2) << "Removed request channel " << id << " from manager";
+        endRequestId(id, channel->hasWritten() ? kLocalEnd : kLocalEnd | kPeerEnd);
+    }
 
-        // Add the channel ID to the free list.
+    // Ends the request channel with the specified ID as the peer ended it. A channel still open
+    // on this end is released so that its reader sees the end after the messages of the peer. An
+    // end for a free ID, such as a late end of a channel the peer already ended, is ignored.
+    //
+    // Arguments:
+    //     id: The ID of the channel.
+    //     abandoned: Whether the peer ended the channel without its last message.
+    void endRequestChannel(channel_id_t id, bool abandoned) {
+        // A channel closed on this end removes itself from the manager.
+        auto channel = getRequestChannel(id);
+        if (channel == nullptr || !channel->release(abandoned)) {
+            endRequestId(id, kPeerEnd);
+            return;
+        }
+        takeRequestChannel(id);
+        openRequests.fetch_sub(1, std::memory_order_relaxed);
+        metrics.openRequestChannels.sub();
+        metrics.requestChannelCloses.add();
+        SCC_VLOG(2) << "Released request channel " << id;
+        endRequestId(id, kLocalEnd | kPeerEnd);
+    }
+
+    // Records the ends that ended the request channel with the specified ID and returns the ID
+    // to the free list once both did so that a late end message of the peer never ends the next
+    // channel with the same ID. Ends of an ID that is free are ignored.
+    //
+    // Arguments:
+    //     id: The ID of the channel.
+    //     ends: The ends that ended the channel.
+    void endRequestId(channel_id_t id, uint8_t ends) {
+        assert(id < MaxChannels);
         freeListMutex.lock();
-        freeList.push(id);
+        if (requestEnds[id] == 0) {
+            freeListMutex.unlock();
+            SCC_VLOG(2) << "Ignored end of free request channel " << id;
+            return;
+        }
+        requestEnds[id] |= ends;
+        bool free = (requestEnds[id] & (kLocalEnd | kPeerEnd)) == (kLocalEnd | kPeerEnd);
+        if (free) {
+            requestEnds[id] = 0;
+            freeList.push(id);
+        }
         freeListMutex.unlock();
-        freeListSemaphore.release();
+        if (free) {
+            freeListSemaphore.release();
+        }
     }
 };
 
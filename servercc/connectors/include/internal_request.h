@@ -55,9 +55,36 @@ class InternalRequest : public virtual Request {
         return channel->write(std::move(message));
     }
 
+    // See request.h for documentation.
+    absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload& payload) final {
+        return channel->writeBulk(protocol, payload);
+    }
+
+    // See request.h for documentation.
+    std::chrono::steady_clock::time_point deadline() final { return channel->getDeadline(); }
+
+    // See request.h for documentation.
+    absl::Status setDeadline(std::chrono::steady_clock::time_point deadline) final {
+        return channel->setDeadline(deadline);
+    }
+
+    // See request.h for documentation.
+    std::shared_ptr<CancellationToken> cancellationToken() final {
+        return channel->getCancellationToken();
+    }
+
     // See request.h for documentation.
     void terminate() final { channel->close(); }
 
+    // Returns the trace context of the request which is not sampled if the request is not traced.
+    TraceContext traceContext() const { return channel->traceContext(); }
+
+    // Records an instant event on the span of the request if it is traced.
+    //
+    // Arguments:
+    //     event: The name of the event. Must be a string literal.
+    void markTrace(const char *event) { channel->markTrace(event); }
+
    private:
     // The protocol of the first message.
     const protocol_t protocol;
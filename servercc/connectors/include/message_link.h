@@ -0,0 +1,207 @@
+#ifndef SERVERCC_MESSAGE_LINK_H
+#define SERVERCC_MESSAGE_LINK_H
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "compression.h"
+#include "types.h"
+#include "wire_format.h"
+
+namespace ostp::servercc {
+
+// A bidirectional link carrying the framed messages of a connector to a peer.
+class MessageLink {
+   public:
+    virtual ~MessageLink() = default;
+
+    // Writes a message to the peer. Writes must be serialized by the caller.
+    //
+    // Arguments:
+    //     message: The message to write.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status write(std::unique_ptr<Message> message) = 0;
+
+    // Writes a message whose body is a bulk payload followed by a trailer to the peer. Links that
+    // cannot send the payload directly copy it into a message. Writes must be serialized by the
+    // caller.
+    //
+    // Arguments:
+    //     protocol: The protocol of the message.
+    //     payload: The start of the body.
+    //     trailer: The rest of the body.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status writeBulk(protocol_t protocol, const BulkPayload &payload,
+                                   const std::vector<uint8_t> &trailer);
+
+    // Writes a message of an internal channel framed with the fields of the channel to the peer.
+    // Links in the legacy wire format wrap the fields after the body of the message. Writes must be
+    // serialized by the caller.
+    //
+    // Arguments:
+    //     frame: The fields of the channel.
+    //     message: The message to write or null for a frame without a message such as an end
+    //              frame.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status writeFrame(const ChannelFrame &frame, std::unique_ptr<Message> message);
+
+    // Writes a message of an internal channel whose body is a bulk payload framed with the fields
+    // of the channel to the peer. Writes must be serialized by the caller.
+    //
+    // Arguments:
+    //     frame: The fields of the channel.
+    //     protocol: The protocol of the message.
+    //     payload: The body of the message.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status writeBulkFrame(const ChannelFrame &frame, protocol_t protocol,
+                                        const BulkPayload &payload);
+
+    // Returns whether a small message can be written without blocking.
+    virtual bool writable() = 0;
+
+    // Reads the next message from the peer. Blocks until a message is available or the link
+    // fails. Must be called by a single thread.
+    //
+    // Returns:
+    //     The status of the operation and the message if successful.
+    virtual std::pair<absl::Status, std::unique_ptr<Message>> read() = 0;
+
+    // Reads the next message from the peer along with the fields of its channel. A message that
+    // does not belong to a channel is returned with a frame holding only its protocol. Blocks until
+    // a message is available or the link fails. Must be called by a single thread.
+    //
+    // Returns:
+    //     The status of the operation, the fields of the channel and the message which is null for
+    //     a frame without a message.
+    virtual std::tuple<absl::Status, ChannelFrame, std::unique_ptr<Message>> readFrame();
+
+    // Fails the pending and future reads and writes of both ends so that their readers run the
+    // disconnect path.
+    virtual void shutdown() = 0;
+};
+
+// A link over a connected stream socket. The socket is owned by the caller.
+//
+// In the compact wire format the link reads the socket through a buffer so that the header of a
+// message is parsed without a system call of its own and several small messages are read at once.
+// The bodies of the messages are compressed with the codec both ends agreed on, if any, when they
+// are long enough and compressing them pays off. Links that agreed on checksums follow every
+// header, and every body if they agreed on FrameChecksums::kFull, with its CRC32C and fail on a
+// message that does not match rather than misparse the stream. A message longer than the maximum
+// frame length is neither written nor read.
+// Compression and checksums need the compact wire format.
+class SocketLink final : public MessageLink {
+   public:
+    // Creates a link over the specified socket.
+    //
+    // Arguments:
+    //     fd: The file descriptor of the socket.
+    //     format: The wire format both ends agreed on.
+    //     compression: The compression both ends agreed on.
+    //     checksums: The checksums both ends agreed on.
+    //     maxFrameLength: The length of the longest message after its length prefix in the
+    //         compact wire format.
+    explicit SocketLink(int fd, WireFormat format = WireFormat::kLegacy,
+                        CompressionOptions compression = CompressionOptions(),
+                        FrameChecksums checksums = FrameChecksums::kNone,
+                        size_t maxFrameLength = kDefaultMaxFrameLength);
+
+    // See message_link.h for documentation.
+    absl::Status write(std::unique_ptr<Message> message) final;
+
+    // See message_link.h for documentation.
+    absl::Status writeBulk(protocol_t protocol, const BulkPayload &payload,
+                           const std::vector<uint8_t> &trailer) final;
+
+    // See message_link.h for documentation.
+    absl::Status writeFrame(const ChannelFrame &frame, std::unique_ptr<Message> message) final;
+
+    // See message_link.h for documentation.
+    absl::Status writeBulkFrame(const ChannelFrame &frame, protocol_t protocol,
+                                const BulkPayload &payload) final;
+
+    // See message_link.h for documentation.
+    bool writable() final;
+
+    // See message_link.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> read() final;
+
+    // See message_link.h for documentation.
+    std::tuple<absl::Status, ChannelFrame, std::unique_ptr<Message>> readFrame() final;
+
+    // See message_link.h for documentation.
+    void shutdown() final;
+
+   private:
+    // The file descriptor of the socket.
+    const int fd;
+
+    // The wire format of the messages.
+    const WireFormat format;
+
+    // The checksums of the messages.
+    const FrameChecksums checksums;
+
+    // The length of the longest message after its length prefix.
+    const size_t maxFrameLength;
+
+    // The bytes read from the socket in the compact wire format and the range of them not parsed
+    // yet. Only used by the reader.
+    std::vector<uint8_t> readBuffer;
+    size_t readStart = 0;
+    size_t readEnd = 0;
+
+    // The compressor of the written bodies and the decompressor of the read ones if the link
+    // compresses messages.
+    std::unique_ptr<FrameCompressor> compressor;
+    std::unique_ptr<FrameDecompressor> decompressor;
+
+    // The buffer a compressed body that did not fit in the read buffer is read into, reused across
+    // messages. Only used by the reader.
+    std::vector<uint8_t> compressedBuffer;
+
+    // The trailer of a written body followed by the checksum of the body, reused across messages.
+    // Only used by the writer.
+    std::vector<uint8_t> checkedTrailer;
+
+    // Writes a frame in the compact wire format.
+    //
+    // Arguments:
+    //     frame: The fields of the channel or the protocol of a message without a channel.
+    //     protocol: The original protocol of the message of a channel frame.
+    //     hasMessage: Whether the frame carries a message.
+    //     payload: The body of the message.
+    //     trailer: The bytes sent after the payload in the body.
+    // Returns:
+    //     The status of the operation.
+    absl::Status writeCompact(const ChannelFrame &frame, protocol_t protocol, bool hasMessage,
+                              const BulkPayload &payload, const std::vector<uint8_t> &trailer = {});
+
+    // Waits until the buffer holds at least the specified number of unparsed bytes.
+    //
+    // Arguments:
+    //     length: The number of bytes to wait for which must fit in the buffer.
+    // Returns:
+    //     Whether the bytes arrived before the stream ended or failed.
+    bool fill(size_t length);
+
+    // Reads the rest of a body that did not fit in the buffer directly into place, refilling the
+    // buffer with the bytes available after it. The buffer must have been parsed.
+    //
+    // Arguments:
+    //     data: Where the rest of the body goes.
+    //     length: The length of the rest of the body.
+    // Returns:
+    //     Whether the bytes arrived before the stream ended or failed.
+    bool readPast(uint8_t *data, size_t length);
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef SERVERCC_PHI_ACCRUAL_FAILURE_DETECTOR_H
+#define SERVERCC_PHI_ACCRUAL_FAILURE_DETECTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+namespace ostp::servercc {
+
+// The configuration of the heartbeats exchanged on a connector link and of the failure detector
+// watching them.
+struct HeartbeatOptions {
+    // The interval between heartbeats. Heartbeats and failure detection are disabled if zero.
+    std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+
+    // The suspicion level above which a peer is considered failed. A threshold of 8 means the
+    // detector is wrong about once in 10^8 decisions if the intervals are normally distributed.
+    double phiThreshold = 8.0;
+
+    // The pause beyond the mean interval tolerated before the suspicion level rises, for example
+    // for garbage collection or scheduling hiccups on the peer.
+    std::chrono::milliseconds acceptablePause = std::chrono::milliseconds(3000);
+
+    // The lower bound of the standard deviation of the intervals so that a very regular peer is
+    // not suspected after a small delay.
+    std::chrono::milliseconds minStdDeviation = std::chrono::milliseconds(100);
+
+    // The number of intervals kept to estimate their distribution.
+    size_t maxSampleSize = 1000;
+};
+
+// An accrual failure detector outputting the suspicion level phi that a peer has failed instead of
+// a binary verdict. Phi is derived from the time since the last heartbeat and the distribution of
+// the previous heartbeat intervals so that the detector adapts to the network and the load of the
+// peer.
+//
+// See Hayashibara et al., "The phi accrual failure detector".
+class PhiAccrualFailureDetector {
+   public:
+    // Creates a detector with the first heartbeat at the current time.
+    //
+    // Arguments:
+    //     options: The heartbeat options.
+    explicit PhiAccrualFailureDetector(const HeartbeatOptions &options);
+
+    // Records the arrival of a heartbeat adding the interval since the previous heartbeat to the
+    // history.
+    //
+    // Arguments:
+    //     now: The time of the arrival.
+    void heartbeat(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // Records the arrival of any other message from the peer. The message proves the peer alive
+    // but is not added to the history as messages do not arrive at a regular interval.
+    //
+    // Arguments:
+    //     now: The time of the arrival.
+    void recordActivity(
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        lastActivity.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    // Returns the suspicion level that the peer has failed.
+    //
+    // Arguments:
+    //     now: The time at which to evaluate the suspicion level.
+    double phi(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // Returns whether the suspicion level is below the threshold.
+    //
+    // Arguments:
+    //     now: The time at which to evaluate the suspicion level.
+    bool isAvailable(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        return phi(now) < threshold;
+    }
+
+   private:
+    // The suspicion level above which the peer is considered failed.
+    const double threshold;
+
+    // The pause tolerated beyond the mean interval in milliseconds.
+    const double acceptablePause;
+
+    // The lower bound of the standard deviation in milliseconds.
+    const double minStdDeviation;
+
+    // The number of intervals kept.
+    const size_t maxSampleSize;
+
+    // The time of the last message from the peer in steady clock ticks.
+    std::atomic<std::chrono::steady_clock::rep> lastActivity;
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // The time of the last heartbeat.
+    std::chrono::steady_clock::time_point lastHeartbeat;
+
+    // The last intervals in milliseconds.
+    std::deque<double> intervals;
+
+    // The sum of the intervals.
+    double intervalSum = 0;
+
+    // The sum of the squares of the intervals.
+    double squaredIntervalSum = 0;
+
+    // Adds an interval to the history evicting the oldest if the history is full.
+    //
+    // Arguments:
+    //     interval: The interval in milliseconds.
+    void addInterval(double interval);
+};
+
+}  // namespace ostp::servercc
+
+#endif
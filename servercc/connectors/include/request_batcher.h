@@ -0,0 +1,119 @@
+#ifndef SERVERCC_REQUEST_BATCHER_H
+#define SERVERCC_REQUEST_BATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "connector.h"
+#include "connector_types.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// The options of a request batcher.
+struct BatchOptions {
+    // How long the first request of a batch waits for more requests to the same peer.
+    std::chrono::microseconds window = std::chrono::microseconds(100);
+
+    // The number of requests after which a batch is sent without waiting for the window.
+    size_t maxBatchSize = 64;
+};
+
+// Sends small requests to the peers of a connector in batches. Requests to the same peer made
+// within a window share a single single-shot internal request: one frame carrying every request
+// and one frame carrying every response, instead of a channel and its frames each.
+// The peer handles every request of a batch with the handler of its protocol and the responses
+// are handed back to their callers.
+//
+// Only requests made of one message answered by one message can be batched. Batching trades the
+// window of latency for fewer frames and system calls so it pays off for requests much smaller
+// than their framing, such as key lookups.
+class RequestBatcher {
+   public:
+    // Creates a batcher.
+    //
+    // Arguments:
+    //     connector: The connector of the peers which must outlive the batcher.
+    //     options: The options of the batches.
+    RequestBatcher(Connector &connector, BatchOptions options = BatchOptions());
+
+    // Sends a request as part of the next batch to the peer and waits for its response. The
+    // request expires with the deadline of the calling thread and the batch is sent with the
+    // latest deadline of its requests.
+    //
+    // Arguments:
+    //     peer: The peer to send the request to.
+    //     message: The message of the request.
+    // Returns:
+    //     The status of the request and its response.
+    std::pair<absl::Status, std::unique_ptr<Message>> call(PeerAddress peer,
+                                                           std::unique_ptr<Message> message);
+
+   private:
+    // A request waiting for its response.
+    struct Call {
+        // Creates the call of a request with the specified message and deadline.
+        Call(std::unique_ptr<Message> message, std::chrono::steady_clock::time_point deadline)
+            : message(std::move(message)), deadline(deadline) {}
+
+        // The message of the request.
+        std::unique_ptr<Message> message;
+
+        // The deadline of the request.
+        const std::chrono::steady_clock::time_point deadline;
+
+        // Whether the response arrived or the request failed.
+        bool done = false;
+
+        // The status and response of the request.
+        absl::Status status;
+        std::unique_ptr<Message> response;
+
+        // Signaled when the request is done.
+        std::condition_variable condition;
+    };
+
+    // The requests to a peer collected for the next batch.
+    struct Batch {
+        std::vector<Call *> calls;
+
+        // Signaled when the batch is full.
+        std::condition_variable full;
+    };
+
+    // The connector of the peers.
+    Connector &connector;
+
+    // The options of the batches.
+    const BatchOptions options;
+
+    // Mutex protecting the fields below and the calls of the batches.
+    std::mutex mutex;
+
+    // The batch being collected for every peer. The first caller of a batch sends it.
+    absl::flat_hash_map<PeerAddress, std::shared_ptr<Batch>> batches;
+
+    // Sends a batch and hands every response to its caller.
+    //
+    // Arguments:
+    //     peer: The peer to send the batch to.
+    //     calls: The requests of the batch.
+    void send(PeerAddress peer, const std::vector<Call *> &calls);
+
+    // Completes a request waking up its caller.
+    //
+    // Arguments:
+    //     call: The request to complete.
+    //     status: The status of the request.
+    //     response: The response of the request.
+    void complete(Call &call, absl::Status status, std::unique_ptr<Message> response);
+};
+
+}  // namespace ostp::servercc
+
+#endif
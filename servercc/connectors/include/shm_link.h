@@ -0,0 +1,160 @@
+#ifndef SERVERCC_SHM_LINK_H
+#define SERVERCC_SHM_LINK_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "message_link.h"
+
+namespace ostp::servercc {
+
+// A link to a peer on the same host over a pair of single-producer single-consumer byte rings in
+// a shared memory segment, one per direction.
+//
+// Messages are copied once into the ring by the writer and once out of it by the reader without
+// any system call while both ends are busy. A reader that finds its ring empty sleeps on a futex
+// in the segment that the writer only wakes when the reader announced that it sleeps, and likewise
+// for a writer that finds the ring full. The link is established over the TCP connection to the
+// peer which is kept open to detect that the peer process died.
+class ShmLink final : public MessageLink {
+   public:
+    // The default capacity of each ring in bytes.
+    static constexpr size_t kDefaultCapacity = 1 << 20;
+
+    // Creates a new shared memory segment and a link writing to its first ring. The name of the
+    // segment is sent to the peer which opens it with open().
+    //
+    // Arguments:
+    //     watchFd: The file descriptor of the connection to the peer watched for hang ups.
+    //     capacity: The capacity of each ring in bytes. Rounded up to a power of two.
+    // Returns:
+    //     The status of the operation and the link if successful.
+    static std::pair<absl::Status, std::shared_ptr<ShmLink>> create(
+        int watchFd, size_t capacity = kDefaultCapacity);
+
+    // Opens a segment created by a peer and returns a link writing to its second ring.
+    //
+    // Arguments:
+    //     name: The name of the segment.
+    //     watchFd: The file descriptor of the connection to the peer watched for hang ups.
+    // Returns:
+    //     The status of the operation and the link if successful.
+    static std::pair<absl::Status, std::shared_ptr<ShmLink>> open(absl::string_view name,
+                                                                  int watchFd);
+
+    // Unmaps the segment and removes its name if it was not removed yet.
+    ~ShmLink();
+
+    // Returns the name of the segment.
+    const std::string &getName() const { return name; }
+
+    // Removes the name of the segment once the peer opened it or failed to so that the segment is
+    // freed when both ends unmap it.
+    void unlink();
+
+    // See message_link.h for documentation.
+    absl::Status write(std::unique_ptr<Message> message) final;
+
+    // See message_link.h for documentation.
+    bool writable() final;
+
+    // See message_link.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> read() final;
+
+    // See message_link.h for documentation.
+    void shutdown() final;
+
+   private:
+    struct Ring;
+
+    // Returns the size of a segment with rings of the specified capacity.
+    //
+    // Arguments:
+    //     capacity: The capacity of each ring.
+    static size_t segmentSize(size_t capacity);
+
+    // Maps a link over the segment.
+    //
+    // Arguments:
+    //     name: The name of the segment.
+    //     segment: The mapped segment.
+    //     size: The size of the mapping.
+    //     capacity: The capacity of each ring.
+    //     creator: Whether this end created the segment.
+    //     watchFd: The file descriptor of the connection to the peer.
+    ShmLink(std::string name, void *segment, size_t size, size_t capacity, bool creator,
+            int watchFd);
+
+    // The name of the segment.
+    const std::string name;
+
+    // The mapped segment and its size.
+    void *const segment;
+    const size_t size;
+
+    // The capacity of each ring and the mask of a position in a ring.
+    const size_t capacity;
+    const size_t mask;
+
+    // The file descriptor of the connection to the peer.
+    const int watchFd;
+
+    // The ring written by this end and the ring read by this end.
+    Ring *const tx;
+    Ring *const rx;
+
+    // The data of the rings.
+    uint8_t *const txData;
+    uint8_t *const rxData;
+
+    // Whether the name of the segment still has to be removed.
+    bool linked;
+
+    // The position of the reader in the receiving ring not yet published to the writer.
+    uint64_t readPosition;
+
+    // Copies bytes into the sending ring waiting for space.
+    //
+    // Arguments:
+    //     data: The bytes to copy.
+    //     length: The number of bytes.
+    //     position: The position of the writer advanced by the copy.
+    // Returns:
+    //     The status of the operation.
+    absl::Status writeBytes(const void *data, size_t length, uint64_t &position);
+
+    // Copies bytes out of the receiving ring waiting for data.
+    //
+    // Arguments:
+    //     data: The buffer to copy into.
+    //     length: The number of bytes.
+    // Returns:
+    //     The status of the operation.
+    absl::Status readBytes(void *data, size_t length);
+
+    // Publishes a position of the writer or the reader waking the other end if it sleeps.
+    //
+    // Arguments:
+    //     ring: The ring of the position.
+    //     writer: Whether the position is the writer's.
+    //     position: The position to publish.
+    void publish(Ring &ring, bool writer, uint64_t position);
+
+    // Sleeps until the other end of a ring publishes a position different from the expected one
+    // or a timeout elapses.
+    //
+    // Arguments:
+    //     ring: The ring to wait on.
+    //     writer: Whether this end is the writer of the ring.
+    //     expected: The position of the other end observed last.
+    // Returns:
+    //     An error if the link was shut down or the peer hung up.
+    absl::Status wait(Ring &ring, bool writer, uint64_t expected);
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef SERVERCC_WIRE_FORMAT_H
+#define SERVERCC_WIRE_FORMAT_H
+
+#include <inttypes.h>
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "channel_types.h"
+#include "frame_scheduler.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// The versions of the framing of the messages of a connector link. Peers agree on the version
+// when they connect and links that did not agree on one use kLegacy.
+enum class WireFormat : uint8_t {
+    // Every message has the fixed 8-byte header and the fields of an internal channel are wrapped
+    // after its body together with its original header.
+    //
+    // | header | original body | original header | channel ID | time left (8B) |
+    kLegacy = 1,
+
+    // Every message has a variable-length header leading with the fields of its channel so that it
+    // is parsed in a single forward pass and its body is written and read without copying. The
+    // length counts the bytes after it. The channel ID and original protocol are only present with
+    // kCompactChannelFlag and the original protocol is omitted by a frame without a message such
+    // as an end frame. The trace context and the time left until the deadline are only present
+    // with their flags. A body compressed with the codec the peers agreed on has
+    // kCompactCompressedFlag and is preceded by its original length. Peers that agreed on
+    // checksums follow the header with the CRC32C of the length and the fields and, if they agreed
+    // on FrameChecksums::kFull, the body with its own CRC32C, which is zero without a body. The
+    // length counts neither.
+    //
+    // | length | protocol | flags (1B) | channel ID | trace context (16B) | time left |
+    // | original protocol | original length | optional header CRC32C (4B) | original body |
+    // | optional body CRC32C (4B) |
+    //
+    // Every field but the flags and the trace context is a varint of 7 bits per byte, lowest
+    // first.
+    kCompact = 2,
+};
+
+// The newest wire format this build reads and writes.
+constexpr WireFormat kLatestWireFormat = WireFormat::kCompact;
+
+// The checksums of the messages of a link in the compact wire format. Peers agree on the fewer of
+// the ones they offer when they connect.
+enum class FrameChecksums : uint8_t {
+    kNone = 0,
+
+    // Every header is checked before any length in it is trusted so that a corrupt header fails
+    // the link rather than desynchronize the stream. Costs four bytes and a few nanoseconds a
+    // message.
+    kHeaders = 1,
+
+    // The bodies are checked too, at the cost of a pass over every body on both ends.
+    kFull = 2,
+};
+
+// The longest message after its length prefix a link in the compact wire format writes or reads
+// unless it is configured otherwise. A longer length fails the link before anything is allocated
+// for the message.
+constexpr size_t kDefaultMaxFrameLength = 64 * 1024 * 1024;
+
+// The flags of a message in the compact wire format.
+constexpr uint8_t kCompactChannelFlag = 0x01;
+constexpr uint8_t kCompactOpenFlag = 0x02;
+constexpr uint8_t kCompactEndFlag = 0x04;
+constexpr uint8_t kCompactTracedFlag = 0x08;
+constexpr uint8_t kCompactDeadlineFlag = 0x10;
+constexpr uint8_t kCompactCompressedFlag = 0x20;
+
+// The priority of the frame takes the two highest bits of the flags.
+constexpr uint8_t kCompactPriorityShift = 6;
+
+// The longest header of a message in the compact wire format.
+constexpr size_t kMaxCompactHeaderLength = 5 + 5 + 1 + 5 + sizeof(uint64_t) * 2 + 10 + 5 + 5;
+
+// The flags an internal channel sets on the protocol of its messages.
+constexpr protocol_t kChannelFrameFlags =
+    kTracedProtocolFlag | kDeadlineProtocolFlag | kChannelOpenFlag | kChannelEndFlag;
+
+// The fields an internal channel frames its messages with.
+struct ChannelFrame {
+    // The protocol of the frame along with the flags of the channel, such as
+    // kInternalRequestProtocol | kChannelOpenFlag, or the protocol of a message that does not
+    // belong to a channel such as a heartbeat.
+    protocol_t protocol = 0;
+
+    // The ID of the channel.
+    channel_id_t id = 0;
+
+    // The trace context of the channel if the protocol has kTracedProtocolFlag.
+    uint64_t traceId = 0;
+    uint64_t spanId = 0;
+
+    // The time left until the deadline if the protocol has kDeadlineProtocolFlag.
+    deadline_budget_t budget = 0;
+
+    // The priority the frame was scheduled with. Not carried by the legacy wire format.
+    FramePriority priority = FramePriority::kInteractive;
+};
+
+// Returns whether messages with the specified protocol belong to an internal channel.
+//
+// Arguments:
+//     protocol: The protocol of the message without the flags of the channel.
+bool isChannelProtocol(protocol_t protocol);
+
+// Wraps a message of an internal channel in the legacy wire format.
+//
+// Arguments:
+//     frame: The fields of the channel.
+//     message: The message to wrap or null for a frame without a message.
+// Returns:
+//     The wrapped message.
+std::unique_ptr<Message> wrapFrame(const ChannelFrame &frame, std::unique_ptr<Message> message);
+
+// Returns the bytes wrapFrame appends to a message with the specified header. Used to wrap a bulk
+// payload which is not copied into a message.
+//
+// Arguments:
+//     frame: The fields of the channel.
+//     header: The header of the message.
+std::vector<uint8_t> frameTrailer(const ChannelFrame &frame, const MessageHeader &header);
+
+// Unwraps a message in the legacy wire format. A message that does not belong to a channel is
+// returned as is with a frame holding its protocol.
+//
+// Arguments:
+//     message: The message to unwrap.
+// Returns:
+//     The status of the operation, the fields of the channel and the original message which is
+//     null for a frame without a message. Returns an InvalidArgument error if the channel ID is
+//     not below kMaxChannels.
+std::tuple<absl::Status, ChannelFrame, std::unique_ptr<Message>> unwrapFrame(
+    std::unique_ptr<Message> message);
+
+// Encodes the header of a message in the compact wire format.
+//
+// Arguments:
+//     frame: The fields of the channel or the protocol of a message without a channel.
+//     protocol: The original protocol of the message of a channel frame.
+//     length: The length of the body that follows the header.
+//     hasMessage: Whether the frame carries a message.
+//     out: The buffer of at least kMaxCompactHeaderLength bytes to encode into.
+//     originalLength: The length of the body before compression if it is compressed or zero.
+// Returns:
+//     The length of the header.
+size_t encodeCompactHeader(const ChannelFrame &frame, protocol_t protocol, size_t length,
+                           bool hasMessage, uint8_t *out, size_t originalLength = 0);
+
+// Decodes the length prefix of a message in the compact wire format.
+//
+// Arguments:
+//     data: The bytes of the message read so far.
+//     available: The number of bytes read so far.
+//     length: Receives the number of bytes of the message after the prefix.
+// Returns:
+//     The length of the prefix or zero if more bytes are needed. Returns an InvalidArgument error
+//     if the prefix is malformed.
+std::pair<absl::Status, size_t> decodeCompactLength(const uint8_t *data, size_t available,
+                                                    uint32_t &length);
+
+// Decodes the header of a message in the compact wire format that follows its length prefix.
+//
+// Arguments:
+//     data: The bytes following the length prefix, at least the first kMaxCompactHeaderLength of
+//           them or all of them if there are fewer.
+//     length: The number of bytes of the message after the prefix.
+//     frame: Receives the fields of the channel.
+//     header: Receives the original header of the message whose length is that of the body before
+//             compression.
+//     hasMessage: Receives whether the frame carries a message.
+//     compressed: Receives whether the body is compressed, in which case it takes the rest of the
+//                 message rather than header.length bytes.
+// Returns:
+//     The status of the operation and the length of the header. Returns an InvalidArgument error
+//     if the header is malformed or the channel ID is not below kMaxChannels.
+std::pair<absl::Status, size_t> decodeCompactHeader(const uint8_t *data, size_t length,
+                                                    ChannelFrame &frame, MessageHeader &header,
+                                                    bool &hasMessage, bool &compressed);
+
+}  // namespace ostp::servercc
+
+#endif
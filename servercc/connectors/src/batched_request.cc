@@ -0,0 +1,199 @@
+#include "batched_request.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+namespace ostp::servercc {
+
+// See batched_request.h for documentation.
+void appendBatchEntry(std::vector<uint8_t> &body, const Message &message) {
+    uint32_t length = message.body.data.size();
+    auto offset = body.size();
+    body.resize(offset + sizeof(protocol_t) + sizeof(uint32_t) + length);
+    memcpy(body.data() + offset, &message.header.protocol, sizeof(protocol_t));
+    memcpy(body.data() + offset + sizeof(protocol_t), &length, sizeof(uint32_t));
+    if (length > 0) {
+        memcpy(body.data() + offset + sizeof(protocol_t) + sizeof(uint32_t),
+               message.body.data.data(), length);
+    }
+}
+
+// See batched_request.h for documentation.
+void appendBatchError(std::vector<uint8_t> &body, const absl::Status &status) {
+    Message error;
+    error.header.protocol = kInternalErrorProtocol;
+    auto code = (uint32_t)status.code();
+    error.body.data.resize(sizeof(uint32_t) + status.message().size());
+    memcpy(error.body.data.data(), &code, sizeof(uint32_t));
+    memcpy(error.body.data.data() + sizeof(uint32_t), status.message().data(),
+           status.message().size());
+    appendBatchEntry(body, error);
+}
+
+// See batched_request.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> readBatchEntry(const std::vector<uint8_t> &body,
+                                                                 size_t &offset) {
+    protocol_t protocol;
+    uint32_t length;
+    if (body.size() - offset < sizeof(protocol_t) + sizeof(uint32_t)) {
+        return {absl::InvalidArgumentError("Batch entry is truncated"), nullptr};
+    }
+    memcpy(&protocol, body.data() + offset, sizeof(protocol_t));
+    memcpy(&length, body.data() + offset + sizeof(protocol_t), sizeof(uint32_t));
+    offset += sizeof(protocol_t) + sizeof(uint32_t);
+    if (body.size() - offset < length) {
+        return {absl::InvalidArgumentError("Batch entry is truncated"), nullptr};
+    }
+    auto *data = body.data() + offset;
+    offset += length;
+
+    // A failed request carries its status instead of a response.
+    if (protocol == kInternalErrorProtocol) {
+        uint32_t code = (uint32_t)absl::StatusCode::kUnknown;
+        if (length >= sizeof(uint32_t)) {
+            memcpy(&code, data, sizeof(uint32_t));
+            data += sizeof(uint32_t);
+            length -= sizeof(uint32_t);
+        }
+        return {absl::Status((absl::StatusCode)code, absl::string_view((const char *)data, length)),
+                nullptr};
+    }
+    auto message = std::make_unique<Message>();
+    message->header.protocol = protocol;
+    message->header.length = length;
+    message->body.data.assign(data, data + length);
+    return {absl::OkStatus(), std::move(message)};
+}
+
+// See batched_request.h for documentation.
+struct BatchResponses {
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // Signaled when a request of the batch is destroyed.
+    std::condition_variable condition;
+
+    // The response of every request or nullptr if it sent none.
+    std::vector<std::unique_ptr<Message>> messages;
+
+    // The number of requests not destroyed yet.
+    size_t pending;
+};
+
+// BatchedRequest.
+
+// See batched_request.h for documentation.
+BatchedRequest::BatchedRequest(const sockaddr &addr,
+                               std::shared_ptr<CancellationToken> cancellation,
+                               std::unique_ptr<Message> message,
+                               std::shared_ptr<BatchResponses> responses, size_t index)
+    : addr(addr),
+      protocol(message->header.protocol),
+      cancellation(std::move(cancellation)),
+      message(std::move(message)),
+      responses(std::move(responses)),
+      index(index) {}
+
+// See batched_request.h for documentation.
+BatchedRequest::~BatchedRequest() {
+    std::lock_guard lock(responses->mutex);
+    responses->messages[index] = std::move(response);
+    responses->pending--;
+    responses->condition.notify_all();
+}
+
+// See request.h for documentation.
+sockaddr BatchedRequest::getAddr() { return addr; }
+
+// See request.h for documentation.
+protocol_t BatchedRequest::getProtocol() { return protocol; }
+
+// See request.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> BatchedRequest::receiveMessage() {
+    if (message == nullptr) {
+        return {absl::OutOfRangeError("A batched request has a single message"), nullptr};
+    }
+    return {absl::OkStatus(), std::move(message)};
+}
+
+// See request.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> BatchedRequest::receiveMessage(int) {
+    return receiveMessage();
+}
+
+// See request.h for documentation.
+absl::Status BatchedRequest::sendMessage(std::unique_ptr<Message> message) {
+    if (response != nullptr) {
+        return absl::FailedPreconditionError("A batched request has a single response");
+    }
+    response = std::move(message);
+    return absl::OkStatus();
+}
+
+// See request.h for documentation.
+std::chrono::steady_clock::time_point BatchedRequest::deadline() {
+    return cancellation->deadline();
+}
+
+// See request.h for documentation.
+std::shared_ptr<CancellationToken> BatchedRequest::cancellationToken() { return cancellation; }
+
+// See batched_request.h for documentation.
+absl::Status handleBatch(std::unique_ptr<Request> request,
+                         const std::function<handler_t(protocol_t)> &handlerOf) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive batch");
+    std::vector<std::unique_ptr<Message>> entries;
+    for (size_t offset = 0; offset < message->body.data.size();) {
+        auto [status, entry] = readBatchEntry(message->body.data, offset);
+        if (!status.ok()) {
+            return status;
+        }
+        entries.push_back(std::move(entry));
+    }
+
+    // The handlers run one after the other on this thread as batched requests are small enough
+    // that a thread each would cost more than the requests themselves. Handlers that answer from
+    // threads of their own still run side by side.
+    auto responses = std::make_shared<BatchResponses>();
+    responses->messages.resize(entries.size());
+    responses->pending = entries.size();
+    std::vector<absl::Status> statuses(entries.size());
+    auto cancellation = request->cancellationToken();
+    auto addr = request->getAddr();
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (cancellation->cancelled()) {
+            statuses[i] = absl::CancelledError("Batch was cancelled");
+            std::lock_guard lock(responses->mutex);
+            responses->pending--;
+            continue;
+        }
+        auto handler = handlerOf(entries[i]->header.protocol);
+        auto batched = std::make_unique<BatchedRequest>(addr, cancellation, std::move(entries[i]),
+                                                        responses, i);
+        statuses[i] = handler(std::move(batched));
+    }
+
+    // Wait for every handler to finish with its request.
+    std::unique_lock lock(responses->mutex);
+    responses->condition.wait(lock, [&]() { return responses->pending == 0; });
+    std::vector<uint8_t> body;
+    for (size_t i = 0; i < statuses.size(); i++) {
+        if (responses->messages[i] != nullptr) {
+            appendBatchEntry(body, *responses->messages[i]);
+        } else if (!statuses[i].ok()) {
+            appendBatchError(body, statuses[i]);
+        } else {
+            appendBatchError(body, absl::InternalError("Batched request was not answered"));
+        }
+    }
+    lock.unlock();
+
+    auto response = std::make_unique<Message>();
+    response->header.protocol = kInternalBatchResponseProtocol;
+    response->header.length = body.size();
+    response->body.data = std::move(body);
+    return request->sendMessage(std::move(response));
+}
+
+}  // namespace ostp::servercc
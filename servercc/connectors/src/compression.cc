@@ -0,0 +1,180 @@
+#include "compression.h"
+
+#include <time.h>
+#include <zlib.h>
+
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The base two logarithm of the window of deflate. Negative for a raw stream without the zlib
+// header and checksum which the framing of the message makes redundant.
+constexpr int kWindowBits = -15;
+
+// The memory level of deflate. Its hash table is cleared for every message so it is sized for
+// messages of a few kilobytes, which halves the cost of a small message and barely changes the
+// ratio of large ones.
+constexpr int kMemoryLevel = 5;
+
+// The most deflate expands a body: a match of 258 bytes takes at least two bits.
+constexpr size_t kMaxDeflateRatio = 1032;
+
+// The weight of the latest message in the moving averages of a compressor.
+constexpr double kSmoothing = 0.125;
+
+// The metrics recorded by the compressors of the process.
+struct CompressionMetrics {
+    Counter &bytesIn;
+    Counter &bytesOut;
+    Counter &skipped;
+};
+
+// Returns the compression metrics of the process.
+CompressionMetrics &compressionMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static CompressionMetrics metrics = {
+        registry.counter("servercc_compression_bytes_in_total"),
+        registry.counter("servercc_compression_bytes_out_total"),
+        registry.counter("servercc_compression_skipped_total"),
+    };
+    return metrics;
+}
+
+// Returns the CPU time of the calling thread in nanoseconds.
+uint64_t threadCpuTime() {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+}  // namespace
+
+// See compression.h for documentation.
+uint32_t dictionaryId(const std::vector<uint8_t> &dictionary) {
+    auto id = adler32(adler32(0, nullptr, 0), dictionary.data(), dictionary.size());
+    return id != 0 ? id : 1;
+}
+
+// FrameCompressor.
+
+// See compression.h for documentation.
+FrameCompressor::FrameCompressor(CompressionOptions options)
+    : options(std::move(options)), stream(std::make_unique<z_stream_s>()) {
+    if (deflateInit2(stream.get(), Z_BEST_SPEED, Z_DEFLATED, kWindowBits, kMemoryLevel,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        stream = nullptr;
+    }
+}
+
+// See compression.h for documentation.
+FrameCompressor::~FrameCompressor() {
+    if (stream != nullptr) {
+        deflateEnd(stream.get());
+    }
+}
+
+// See compression.h for documentation.
+bool FrameCompressor::compress(const uint8_t *data, size_t length,
+                               const std::vector<uint8_t> &trailer) {
+    auto total = length + trailer.size();
+    if (stream == nullptr || total < options.threshold) {
+        return false;
+    }
+    if (!worthwhile && ++skipped < kProbeInterval) {
+        compressionMetrics().skipped.add();
+        return false;
+    }
+    skipped = 0;
+
+    // The output is only useful if it is shorter than the body so deflate stops there. The buffer
+    // only grows so that it is not cleared again for every message.
+    auto start = threadCpuTime();
+    if (buffer.size() < total - 1) {
+        buffer.resize(total - 1);
+    }
+    deflateReset(stream.get());
+    if (options.dictionary != nullptr) {
+        deflateSetDictionary(stream.get(), options.dictionary->data(),
+                             options.dictionary->size());
+    }
+    stream->next_out = buffer.data();
+    stream->avail_out = total - 1;
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = length;
+    auto result = deflate(stream.get(), trailer.empty() ? Z_FINISH : Z_NO_FLUSH);
+    if (!trailer.empty() && result == Z_OK) {
+        stream->next_in = (Bytef *)trailer.data();
+        stream->avail_in = trailer.size();
+        result = deflate(stream.get(), Z_FINISH);
+    }
+    bool compressed = result == Z_STREAM_END;
+    auto outLength = compressed ? stream->total_out : total;
+    auto cost = threadCpuTime() - start;
+
+    // Weigh the time spent on a byte against the time the bytes it saved take on the wire.
+    double costSample = (double)cost / total;
+    double savedSample = (double)(total - outLength) / total;
+    if (costPerByte == 0) {
+        costPerByte = costSample;
+        savedPerByte = savedSample;
+    } else {
+        costPerByte += kSmoothing * (costSample - costPerByte);
+        savedPerByte += kSmoothing * (savedSample - savedPerByte);
+    }
+    worthwhile = costPerByte < savedPerByte * 1e9 / options.bandwidth;
+
+    if (!compressed) {
+        compressionMetrics().skipped.add();
+        return false;
+    }
+    bufferLength = outLength;
+    compressionMetrics().bytesIn.add(total);
+    compressionMetrics().bytesOut.add(outLength);
+    return true;
+}
+
+// FrameDecompressor.
+
+// See compression.h for documentation.
+FrameDecompressor::FrameDecompressor(CompressionOptions options)
+    : options(std::move(options)), stream(std::make_unique<z_stream_s>()) {
+    if (inflateInit2(stream.get(), kWindowBits) != Z_OK) {
+        stream = nullptr;
+    }
+}
+
+// See compression.h for documentation.
+FrameDecompressor::~FrameDecompressor() {
+    if (stream != nullptr) {
+        inflateEnd(stream.get());
+    }
+}
+
+// See compression.h for documentation.
+absl::Status FrameDecompressor::decompress(const uint8_t *data, size_t length, uint8_t *out,
+                                           size_t outLength) {
+    if (stream == nullptr) {
+        return absl::InternalError("Failed to initialize inflate");
+    }
+    inflateReset(stream.get());
+    if (options.dictionary != nullptr) {
+        inflateSetDictionary(stream.get(), options.dictionary->data(),
+                             options.dictionary->size());
+    }
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = length;
+    stream->next_out = out;
+    stream->avail_out = outLength;
+    if (inflate(stream.get(), Z_FINISH) != Z_STREAM_END || stream->avail_in != 0 ||
+        stream->avail_out != 0) {
+        return absl::InvalidArgumentError("Corrupt compressed message");
+    }
+    return absl::OkStatus();
+}
+
+// See compression.h for documentation.
+size_t FrameDecompressor::maxDecompressedLength(size_t length) { return length * kMaxDeflateRatio; }
+
+}  // namespace ostp::servercc
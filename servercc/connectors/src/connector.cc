@@ -1,19 +1,114 @@
 #include "connector.h"
 
+#include <algorithm>
+#include <chrono>
+
 #include "absl/log/log.h"
 #include "absl/strings/str_cat.h"
+#include "async_log.h"
 #include "internal_request.h"
+#include "metrics_registry.h"
+#include "trace_context.h"
 
 namespace ostp::servercc {
 
+namespace {
+
+// The metrics recorded by the connectors of the process.
+struct ConnectorMetrics {
+    Gauge &peers;
+    Gauge &connections;
+    Counter &disconnects;
+    Counter &messages;
+    Counter &forwardErrors;
+    Counter &heartbeats;
+    Counter &evictions;
+    Counter &expiredRequests;
+    Counter &cancelledRequests;
+};
+
+// Returns the connector metrics of the process.
+ConnectorMetrics &connectorMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static ConnectorMetrics metrics = {
+        registry.gauge("servercc_connector_peers"),
+        registry.gauge("servercc_connector_connections"),
+        registry.counter("servercc_connector_disconnects_total"),
+        registry.counter("servercc_connector_messages_total"),
+        registry.counter("servercc_connector_forward_errors_total"),
+        registry.counter("servercc_connector_heartbeats_total"),
+        registry.counter("servercc_connector_evictions_total"),
+        registry.counter("servercc_connector_expired_requests_total"),
+        registry.counter("servercc_connector_cancelled_requests_total"),
+    };
+    return metrics;
+}
+
+// Sends a heartbeat through the specified link unless the link is busy. A busy link either has a
+// frame being written, which proves this end alive to the peer, or a full send buffer in which case
+// blocking would stall the heartbeats of every other peer.
+//
+// Arguments:
+//     link: The link to the peer.
+//     scheduler: The scheduler of the frames written to the link.
+// Returns:
+//     Whether the heartbeat was sent.
+bool sendHeartbeat(MessageLink &link, FrameScheduler &scheduler) {
+    auto status = scheduler.tryWrite([&link]() -> absl::Status {
+        if (!link.writable()) {
+            return absl::UnavailableError("Link is not writable");
+        }
+        auto heartbeat = std::make_unique<Message>();
+        heartbeat->header.protocol = kInternalHeartbeatProtocol;
+        heartbeat->header.length = 0;
+        return link.write(std::move(heartbeat));
+    });
+    return status.has_value() && status->ok();
+}
+
+// Returns the expected wait of a new request on a connection with the specified load.
+//
+// Arguments:
+//     load: The load of the connection.
+uint64_t queueLength(const PeerLoad &load) { return load.openRequests + load.waitingRequests; }
+
+}  // namespace
+
 // Constructors.
 
 // See connector.h for documentation.
-Connector::Connector(handler_t defaultHandler, std::function<void(in_addr_t)> disconnectCallback)
-    : defaultHandler(defaultHandler), disconnectCallback(disconnectCallback) {}
+Connector::Connector(handler_t defaultHandler, std::function<void(PeerAddress)> disconnectCallback,
+                     HeartbeatOptions heartbeatOptions, size_t connectionsPerPeer)
+    : defaultHandler(defaultHandler),
+      disconnectCallback(disconnectCallback),
+      connectionsPerPeer(std::max<size_t>(connectionsPerPeer, 1)),
+      heartbeatOptions(heartbeatOptions) {
+    // Batches sent by request batchers are split into requests for the other handlers.
+    handlers.emplace(kInternalBatchProtocol, [this](std::unique_ptr<Request> request) {
+        return handleBatch(std::move(request),
+                           [this](protocol_t protocol) { return this->handlerOf(protocol); });
+    });
+    if (heartbeatOptions.interval.count() > 0) {
+        heartbeatThread = std::thread([this]() { this->runHeartbeats(); });
+    }
+    reaperThread = std::thread([this]() { this->runReaper(); });
+}
 
 // See connector.h for documentation.
-Connector::~Connector() {}
+Connector::~Connector() {
+    if (heartbeatThread.joinable()) {
+        heartbeatMutex.lock();
+        stopHeartbeats = true;
+        heartbeatMutex.unlock();
+        heartbeatCondition.notify_all();
+        heartbeatThread.join();
+    }
+    reaperMutex.lock();
+    stopReaper = true;
+    reaperMutex.unlock();
+    reaperCondition.notify_all();
+    reaperThread.join();
+}
 
 // Public methods.
 
@@ -30,110 +125,349 @@ absl::Status Connector::addHandler(protocol_t protocol, handler_t handler) {
 }
 
 // See connector.h for documentation.
-absl::Status Connector::addClient(std::unique_ptr<TcpClient> client) {
+handler_t Connector::handlerOf(protocol_t protocol) {
+    std::lock_guard lock(handlersMutex);
+    auto it = handlers.find(protocol);
+    return it != handlers.end() ? it->second : defaultHandler;
+}
+
+// See connector.h for documentation.
+void Connector::setAdmissionControl(AdmissionOptions options) {
+    admissionController = std::make_shared<AdmissionController>("connector", std::move(options));
+}
+
+// See connector.h for documentation.
+absl::Status Connector::addClient(std::unique_ptr<TcpClient> client,
+                                  std::shared_ptr<MessageLink> link) {
     ASSERT_OK(client->openSocket(), "Failed to open socket for client");
-    auto address = client->getClientInAddr();
-    auto writeMutex = std::make_shared<std::mutex>();
-    auto channelManager =
-        std::make_shared<connector_channel_manager_t>(client->getClientFd(), writeMutex);
+    if (link == nullptr) {
+        link = std::make_shared<SocketLink>(client->getClientFd());
+    }
+    auto address = client->getClientAddr();
+    return addClient(std::move(client), address, std::move(link));
+}
 
+// See connector.h for documentation.
+absl::Status Connector::addClient(const sockaddr &address, std::shared_ptr<MessageLink> link) {
+    return addClient(nullptr, address, std::move(link));
+}
+
+// See connector.h for documentation.
+absl::Status Connector::removeClient(PeerAddress peer) {
     clientsMutex.lock();
-    if (clients.contains(address)) {
+    auto clientIt = clients.find(peer);
+    if (clientIt == clients.end()) {
         clientsMutex.unlock();
-        return absl::AlreadyExistsError("Client already exists");
+        return absl::NotFoundError("Client does not exist");
+    }
+    for (auto &internalClient : clientIt->second) {
+        internalClient->link->shutdown();
     }
-    clients.emplace(address, InternalClient(std::move(client), writeMutex, channelManager));
     clientsMutex.unlock();
-
-    // Run the client.
-    return runClient(address);
+    return absl::OkStatus();
 }
 
 // See connector.h for documentation.
 std::pair<absl::Status, std::unique_ptr<Request>>
-Connector::sendRequest(in_addr_t address) {
-    // Check if the client exists.
+Connector::sendRequest(PeerAddress peer, bool singleShot) {
+    // Pick the connection with the fewest open and waiting requests. Ties go to the first
+    // connection so that a single idle peer keeps using the same connection.
     clientsMutex.lock();
-    auto clientIt = clients.find(address);
+    auto clientIt = clients.find(peer);
     if (clientIt == clients.end()) {
         clientsMutex.unlock();
         return {absl::NotFoundError("Client does not exist"), nullptr};
     }
+    std::shared_ptr<connector_channel_manager_t> channelManager;
+    uint64_t leastQueue = 0;
+    for (auto &internalClient : clientIt->second) {
+        auto queue = queueLength(internalClient->channelManager->load());
+        if (channelManager == nullptr || queue < leastQueue) {
+            channelManager = internalClient->channelManager;
+            leastQueue = queue;
+        }
+    }
     clientsMutex.unlock();
 
     // Open the channel and send the message.
-    auto [status, channel] = clientIt->second.channelManager->createRequestChannel();
+    auto [status, channel] = channelManager->createRequestChannel(singleShot);
     if (!status.ok()) {
         return {status, nullptr};
     }
     return {absl::OkStatus(), std::make_unique<connector_internal_request_t>(channel)};
 }
 
+// See connector.h for documentation.
+PeerLoad Connector::peerLoad(PeerAddress peer) {
+    clientsMutex.lock();
+    auto clientIt = clients.find(peer);
+    if (clientIt == clients.end()) {
+        clientsMutex.unlock();
+        return PeerLoad();
+    }
+
+    // The queues of the connections add up while the latency is averaged over the connections
+    // that received a response.
+    PeerLoad load;
+    uint64_t latencySum = 0;
+    uint64_t latencyCount = 0;
+    for (auto &internalClient : clientIt->second) {
+        auto connectionLoad = internalClient->channelManager->load();
+        load.openRequests += connectionLoad.openRequests;
+        load.waitingRequests += connectionLoad.waitingRequests;
+        if (connectionLoad.latency != 0) {
+            latencySum += connectionLoad.latency;
+            latencyCount++;
+        }
+    }
+    clientsMutex.unlock();
+    load.latency = latencyCount == 0 ? 0 : latencySum / latencyCount;
+    return load;
+}
+
+// See connector.h for documentation.
+size_t Connector::connectionCount(PeerAddress peer) {
+    std::lock_guard lock(clientsMutex);
+    auto clientIt = clients.find(peer);
+    return clientIt == clients.end() ? 0 : clientIt->second.size();
+}
+
 // Private methods.
 
 // See connector.h for documentation.
-absl::Status Connector::runClient(in_addr_t address) {
-    // Check if the client exists.
+absl::Status Connector::addClient(std::unique_ptr<TcpClient> client, const sockaddr &addr,
+                                  std::shared_ptr<MessageLink> link) {
+    auto peer = PeerAddress::of(addr);
+    auto scheduler = std::make_shared<FrameScheduler>();
+    auto channelManager = std::make_shared<connector_channel_manager_t>(link, scheduler);
+    auto failureDetector = std::make_shared<PhiAccrualFailureDetector>(heartbeatOptions);
+    auto internalClient = std::make_shared<InternalClient>(std::move(client), addr, link, scheduler,
+                                                           channelManager, failureDetector);
+
     clientsMutex.lock();
-    auto clientIt = clients.find(address);
-    if (clientIt == clients.end()) {
+    auto &connections = clients[peer];
+    if (connections.size() >= connectionsPerPeer) {
         clientsMutex.unlock();
-        return absl::NotFoundError("Client does not exist");
+        return absl::AlreadyExistsError("Client already exists");
     }
+    connections.push_back(internalClient);
+    bool newPeer = connections.size() == 1;
     clientsMutex.unlock();
-    auto client = clientIt->second.client;
-    auto channelManager = clientIt->second.channelManager;
+    if (newPeer) {
+        connectorMetrics().peers.add();
+    }
+    connectorMetrics().connections.add();
+
+    // Run the client.
+    runClient(peer, std::move(internalClient));
+    return absl::OkStatus();
+}
 
+// See connector.h for documentation.
+void Connector::runClient(PeerAddress peer, std::shared_ptr<InternalClient> internalClient) {
     // Run the client.
-    std::thread clientThread([address, client, channelManager, this]() {
+    std::thread clientThread([peer, internalClient, this]() {
+        auto address = peer.address;
+        auto &client = internalClient->client;
+        auto &clientAddr = internalClient->address;
+        auto &link = internalClient->link;
+        auto &channelManager = internalClient->channelManager;
+        auto &failureDetector = internalClient->failureDetector;
         char ipStr[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &address, ipStr, INET_ADDRSTRLEN);
-        LOG(INFO) << "Running client '" << ipStr << "'";
+        SCC_VLOG(1) << "Running client '" << ipStr << "'";
+        auto &metrics = connectorMetrics();
+
+        // The request metrics of every protocol handled by this client.
+        absl::flat_hash_map<protocol_t, RequestMetrics> requestMetrics;
 
         // Enter a read loop.
         while (true) {
             // Read the request.
-            auto [rcvStatus, message] = client->receiveMessage();
+            auto [rcvStatus, frame, message] = link->readFrame();
             if (!rcvStatus.ok()) {
                 LOG(ERROR) << "Failed to receive message from client '" << ipStr << "': "
                            << rcvStatus.message();
-                client->closeSocket();
+
+                // Remove the connection before closing its socket so that the heartbeat thread
+                // never shuts down a reused descriptor. Fail the channels first so that waiting
+                // requests return immediately and no end message is written to a closed
+                // descriptor.
                 clientsMutex.lock();
-                clients.erase(address);
+                auto clientIt = clients.find(peer);
+                bool lastConnection = false;
+                if (clientIt != clients.end()) {
+                    std::erase(clientIt->second, internalClient);
+                    if (clientIt->second.empty()) {
+                        clients.erase(clientIt);
+                        lastConnection = true;
+                    }
+                }
                 clientsMutex.unlock();
-                disconnectCallback(address);
+                channelManager->abort();
+                if (client != nullptr) {
+                    client->closeSocket();
+                }
+                metrics.connections.sub();
+                metrics.disconnects.add();
+
+                // The peer is only lost with its last connection.
+                if (lastConnection) {
+                    metrics.peers.sub();
+                    disconnectCallback(peer);
+                }
                 break;
             }
+            metrics.messages.add();
+
+            // Heartbeats only feed the failure detector while any other message proves the peer
+            // alive.
+            if (frame.protocol == kInternalHeartbeatProtocol) {
+                failureDetector->heartbeat();
+                continue;
+            }
+            failureDetector->recordActivity();
 
             // If the request is internal, forward it to the appropriate channel.
             auto [fwdStatus, fwdProtocol, fwdChannel] =
-                channelManager->forwardMessage(std::move(message));
+                channelManager->forwardMessage(frame, std::move(message));
             if (!fwdStatus.ok()) {
-                LOG(ERROR) << "Failed to forward message from client '" << ipStr << "': "
-                           << fwdStatus.message();
+                metrics.forwardErrors.add();
+                SCC_LOG_EVERY_N(ERROR, 100) << "Failed to forward message from client '" << ipStr
+                                            << "': " << fwdStatus.message();
             }
 
             // If a new channel was created, create a new request with the channel ID and
             // start a new thread to process it.
             if (fwdChannel != nullptr) {
                 auto request = std::make_unique<connector_internal_response_t>(
-                    fwdProtocol, client->getClientAddr(), fwdChannel);
+                    fwdProtocol, clientAddr, fwdChannel);
 
-                // Process the request.
-                auto handlerIt = handlers.find(fwdProtocol);
-                if (handlerIt != handlers.end()) {
-                    std::thread(handlerIt->second, std::move(request)).detach();
-                } else {
-                    std::thread(defaultHandler, std::move(request)).detach();
+                // Drop a request whose deadline passed on the way as its client no longer waits for
+                // the answer. It is destroyed by the reaper thread for the same reason a shed
+                // request is.
+                if (request->deadline() <= std::chrono::steady_clock::now()) {
+                    metrics.expiredRequests.add();
+                    reap(std::move(request), false);
+                    continue;
+                }
+
+                // Shed the request from the reaper thread as writing the answer from the reader
+                // could block it behind a peer that stopped reading as well.
+                if (admissionController != nullptr && !admissionController->admit(*request)) {
+                    reap(std::move(request), true);
+                    continue;
+                }
+
+                // Find the metrics of the protocol.
+                auto metricsIt = requestMetrics.find(fwdProtocol);
+                if (metricsIt == requestMetrics.end()) {
+                    auto protocolMetrics = RequestMetrics::of("connector", fwdProtocol);
+                    metricsIt = requestMetrics.emplace(fwdProtocol, protocolMetrics).first;
                 }
+
+                // Process the request.
+                auto handler = handlerOf(fwdProtocol);
+                std::thread(
+                    [handler, requestMetrics = metricsIt->second](
+                        std::unique_ptr<connector_internal_response_t> request) {
+                        // The request may have expired or been closed by the peer while waiting
+                        // for its thread.
+                        if (request->deadline() <= std::chrono::steady_clock::now()) {
+                            connectorMetrics().expiredRequests.add();
+                            return;
+                        }
+                        if (request->cancellationToken()->cancelled()) {
+                            connectorMetrics().cancelledRequests.add();
+                            return;
+                        }
+
+                        // Requests sent by the handler join the trace of the request and inherit
+                        // its deadline.
+                        ScopedTraceContext traceScope(request->traceContext());
+                        ScopedDeadline deadlineScope(request->deadline());
+                        request->markTrace("handler_start");
+                        auto start = std::chrono::steady_clock::now();
+                        auto status = handler(std::move(request));
+                        requestMetrics.latency->record(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start)
+                                .count());
+                        requestMetrics.requests->add();
+                        if (!status.ok()) {
+                            requestMetrics.errors->add();
+                        }
+                    },
+                    std::move(request))
+                    .detach();
             }
         }
-        LOG(INFO) << "Client '" << ipStr << "' terminated";
+        SCC_VLOG(1) << "Client '" << ipStr << "' terminated";
     });
 
     // Detach the thread.
     clientThread.detach();
-    return absl::OkStatus();
+}
+
+// See connector.h for documentation.
+void Connector::runHeartbeats() {
+    auto &metrics = connectorMetrics();
+    std::unique_lock lock(heartbeatMutex);
+    while (!heartbeatCondition.wait_for(lock, heartbeatOptions.interval,
+                                        [this]() { return stopHeartbeats; })) {
+        // Send a heartbeat to every client and evict the suspected ones by shutting down their
+        // link. The read loop of the client then fails and runs the disconnect path.
+        auto now = std::chrono::steady_clock::now();
+        clientsMutex.lock();
+        for (auto &[peer, connections] : clients) {
+            for (auto &internalClient : connections) {
+                if (sendHeartbeat(*internalClient->link, *internalClient->scheduler)) {
+                    metrics.heartbeats.add();
+                }
+                auto phi = internalClient->failureDetector->phi(now);
+                if (phi >= heartbeatOptions.phiThreshold) {
+                    char ipStr[INET_ADDRSTRLEN];
+                    inet_ntop(AF_INET, &peer.address, ipStr, INET_ADDRSTRLEN);
+                    LOG(WARNING) << "Evicting connection to client '" << ipStr << ":" << peer.port
+                                 << "' suspected with phi " << phi;
+                    metrics.evictions.add();
+                    internalClient->link->shutdown();
+                }
+            }
+        }
+        clientsMutex.unlock();
+    }
+}
+
+// See connector.h for documentation.
+void Connector::reap(std::unique_ptr<Request> request, bool shed) {
+    reaperMutex.lock();
+    reaperQueue.emplace_back(std::move(request), shed);
+    reaperMutex.unlock();
+    reaperCondition.notify_one();
+}
+
+// See connector.h for documentation.
+void Connector::runReaper() {
+    std::unique_lock lock(reaperMutex);
+    while (true) {
+        reaperCondition.wait(lock, [this]() { return stopReaper || !reaperQueue.empty(); });
+        if (reaperQueue.empty()) {
+            return;
+        }
+        auto [request, shed] = std::move(reaperQueue.front());
+        reaperQueue.pop_front();
+        lock.unlock();
+
+        // The answer is written through the scheduler of the link of the request like any other
+        // frame and the request is destroyed, ending its channel, before the next one.
+        if (shed) {
+            AdmissionController::shed(std::move(request));
+        } else {
+            request.reset();
+        }
+        lock.lock();
+    }
 }
 
 }  // namespace ostp::servercc
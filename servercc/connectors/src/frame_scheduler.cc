@@ -0,0 +1,90 @@
+#include "frame_scheduler.h"
+
+namespace ostp::servercc {
+
+// See frame_scheduler.h for documentation.
+absl::Status FrameScheduler::write(uint64_t flow, FramePriority priority, size_t length,
+                                   const std::function<absl::Status()> &write) {
+    std::unique_lock lock(mutex);
+
+    // The link is only idle when no frame is waiting so an idle link is written right away.
+    if (busy) {
+        // A frame never overtakes the waiting frames of its flow, so it waits in the lowest class
+        // one of them waits in. Classes are served in order and flows in order within a class.
+        auto index = (size_t)priority;
+        for (auto lower = kFramePriorityCount - 1; lower > index; lower--) {
+            if (classes[lower].flows.contains(flow)) {
+                index = lower;
+                break;
+            }
+        }
+
+        Waiter waiter(length);
+        auto &priorityClass = classes[index];
+        auto [it, inserted] = priorityClass.flows.try_emplace(flow);
+        it->second.waiters.push_back(&waiter);
+        if (inserted) {
+            priorityClass.active.push_back(flow);
+        }
+        waiter.condition.wait(lock, [&waiter]() { return waiter.granted; });
+    }
+    busy = true;
+    lock.unlock();
+
+    auto status = write();
+
+    lock.lock();
+    grantNext();
+    return status;
+}
+
+// See frame_scheduler.h for documentation.
+std::optional<absl::Status> FrameScheduler::tryWrite(const std::function<absl::Status()> &write) {
+    std::unique_lock lock(mutex);
+    if (busy) {
+        return std::nullopt;
+    }
+    busy = true;
+    lock.unlock();
+
+    auto status = write();
+
+    lock.lock();
+    grantNext();
+    return status;
+}
+
+// See frame_scheduler.h for documentation.
+void FrameScheduler::grantNext() {
+    for (auto &priorityClass : classes) {
+        while (!priorityClass.active.empty()) {
+            auto id = priorityClass.active.front();
+            auto &flow = priorityClass.flows.find(id)->second;
+            auto *waiter = flow.waiters.front();
+
+            // A flow whose next frame does not fit in its deficit earns a quantum and waits for
+            // the next round. The earned bytes add up so that frames larger than the quantum are
+            // eventually written.
+            if (flow.deficit < waiter->length) {
+                flow.deficit += quantum;
+                priorityClass.active.pop_front();
+                priorityClass.active.push_back(id);
+                continue;
+            }
+            flow.deficit -= waiter->length;
+            flow.waiters.pop_front();
+
+            // A flow that has no frame left loses its deficit as in deficit round robin.
+            if (flow.waiters.empty()) {
+                priorityClass.flows.erase(id);
+                priorityClass.active.pop_front();
+            }
+            waiter->granted = true;
+            waiter->condition.notify_one();
+            return;
+        }
+    }
+    busy = false;
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,416 @@
+#include "message_link.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "crc32c.h"
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The length of the buffer a link in the compact wire format reads the socket through.
+constexpr size_t kReadBufferLength = 64 * 1024;
+
+// The metrics recorded by the links in the compact wire format.
+struct CompactMetrics {
+    Counter &messagesWritten;
+    Counter &messagesRead;
+    Counter &checksumFailures;
+};
+
+// Returns the compact link metrics of the process.
+CompactMetrics &compactMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static CompactMetrics metrics = {
+        registry.counter("servercc_compact_messages_written_total"),
+        registry.counter("servercc_compact_messages_read_total"),
+        registry.counter("servercc_compact_checksum_failures_total"),
+    };
+    return metrics;
+}
+
+// Returns the checksum of a body made of a payload and a trailer. A payload in a file is mapped to
+// be read.
+//
+// Arguments:
+//     payload: The start of the body.
+//     trailer: The rest of the body.
+// Returns:
+//     The status of the operation and the checksum.
+std::pair<absl::Status, uint32_t> bodyChecksum(const BulkPayload &payload,
+                                               const std::vector<uint8_t> &trailer) {
+    uint32_t crc = 0;
+    if (payload.data != nullptr || payload.length == 0) {
+        crc = extendCrc32c(crc, payload.data, payload.length);
+    } else {
+        // The mapping starts at the page holding the offset.
+        auto pageOffset = payload.offset % sysconf(_SC_PAGESIZE);
+        auto mappedLength = payload.length + pageOffset;
+        auto mapped = mmap(nullptr, mappedLength, PROT_READ, MAP_SHARED, payload.fd,
+                           payload.offset - pageOffset);
+        if (mapped == MAP_FAILED) {
+            return {absl::InternalError("Failed to map bulk payload"), 0};
+        }
+        crc = extendCrc32c(crc, (const uint8_t *)mapped + pageOffset, payload.length);
+        munmap(mapped, mappedLength);
+    }
+    return {absl::OkStatus(), extendCrc32c(crc, trailer.data(), trailer.size())};
+}
+
+}  // namespace
+
+// MessageLink.
+
+// See message_link.h for documentation.
+absl::Status MessageLink::writeBulk(protocol_t protocol, const BulkPayload &payload,
+                                    const std::vector<uint8_t> &trailer) {
+    auto [status, message] = makeBulkMessage(protocol, payload, trailer);
+    if (!status.ok()) {
+        return status;
+    }
+    return write(std::move(message));
+}
+
+// See message_link.h for documentation.
+absl::Status MessageLink::writeFrame(const ChannelFrame &frame, std::unique_ptr<Message> message) {
+    return write(wrapFrame(frame, std::move(message)));
+}
+
+// See message_link.h for documentation.
+absl::Status MessageLink::writeBulkFrame(const ChannelFrame &frame, protocol_t protocol,
+                                         const BulkPayload &payload) {
+    MessageHeader header = {(uint32_t)payload.length, protocol};
+    return writeBulk(frame.protocol, payload, frameTrailer(frame, header));
+}
+
+// See message_link.h for documentation.
+std::tuple<absl::Status, ChannelFrame, std::unique_ptr<Message>> MessageLink::readFrame() {
+    auto [status, message] = read();
+    if (!status.ok()) {
+        return {status, ChannelFrame(), nullptr};
+    }
+    return unwrapFrame(std::move(message));
+}
+
+// SocketLink.
+
+// See message_link.h for documentation.
+SocketLink::SocketLink(int fd, WireFormat format, CompressionOptions compression,
+                       FrameChecksums checksums, size_t maxFrameLength)
+    : fd(fd),
+      format(format),
+      checksums(format == WireFormat::kCompact ? checksums : FrameChecksums::kNone),
+      maxFrameLength(std::min<size_t>(maxFrameLength, std::numeric_limits<uint32_t>::max())) {
+    if (format != WireFormat::kCompact) {
+        return;
+    }
+    readBuffer.resize(kReadBufferLength);
+    if (compression.codec != Compression::kNone) {
+        compressor = std::make_unique<FrameCompressor>(compression);
+        decompressor = std::make_unique<FrameDecompressor>(std::move(compression));
+    }
+}
+
+// See message_link.h for documentation.
+absl::Status SocketLink::write(std::unique_ptr<Message> message) {
+    if (format == WireFormat::kLegacy) {
+        return writeMessage(fd, std::move(message));
+    }
+
+    // A message wrapped in the legacy wire format is framed with the fields of its channel.
+    if (isChannelProtocol(message->header.protocol & ~kChannelFrameFlags)) {
+        auto [status, frame, unwrapped] = unwrapFrame(std::move(message));
+        if (!status.ok()) {
+            return status;
+        }
+        return writeFrame(frame, std::move(unwrapped));
+    }
+    ChannelFrame frame;
+    frame.protocol = message->header.protocol;
+    auto &data = message->body.data;
+    return writeCompact(frame, 0, true, BulkPayload::fromBuffer(data.data(), data.size()));
+}
+
+// See message_link.h for documentation.
+absl::Status SocketLink::writeBulk(protocol_t protocol, const BulkPayload &payload,
+                                   const std::vector<uint8_t> &trailer) {
+    if (format == WireFormat::kLegacy) {
+        return writeBulkMessage(fd, protocol, payload, trailer);
+    }
+    if (isChannelProtocol(protocol & ~kChannelFrameFlags)) {
+        return MessageLink::writeBulk(protocol, payload, trailer);
+    }
+    ChannelFrame frame;
+    frame.protocol = protocol;
+    return writeCompact(frame, 0, true, payload, trailer);
+}
+
+// See message_link.h for documentation.
+absl::Status SocketLink::writeFrame(const ChannelFrame &frame, std::unique_ptr<Message> message) {
+    if (format == WireFormat::kLegacy) {
+        return MessageLink::writeFrame(frame, std::move(message));
+    }
+    if (message == nullptr) {
+        return writeCompact(frame, 0, false, BulkPayload());
+    }
+    auto &data = message->body.data;
+    return writeCompact(frame, message->header.protocol, true,
+                        BulkPayload::fromBuffer(data.data(), data.size()));
+}
+
+// See message_link.h for documentation.
+absl::Status SocketLink::writeBulkFrame(const ChannelFrame &frame, protocol_t protocol,
+                                        const BulkPayload &payload) {
+    if (format == WireFormat::kLegacy) {
+        return MessageLink::writeBulkFrame(frame, protocol, payload);
+    }
+    return writeCompact(frame, protocol, true, payload);
+}
+
+// See message_link.h for documentation.
+bool SocketLink::writable() {
+    pollfd pollFd = {fd, POLLOUT, 0};
+    return poll(&pollFd, 1, 0) == 1 && (pollFd.revents & POLLOUT);
+}
+
+// See message_link.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> SocketLink::read() {
+    if (format == WireFormat::kLegacy) {
+        return readMessage(fd);
+    }
+    auto [status, frame, message] = readFrame();
+    if (!status.ok()) {
+        return {status, nullptr};
+    }
+    if (isChannelProtocol(frame.protocol & ~kChannelFrameFlags)) {
+        message = wrapFrame(frame, std::move(message));
+    }
+    return {absl::OkStatus(), std::move(message)};
+}
+
+// See message_link.h for documentation.
+std::tuple<absl::Status, ChannelFrame, std::unique_ptr<Message>> SocketLink::readFrame() {
+    if (format == WireFormat::kLegacy) {
+        return MessageLink::readFrame();
+    }
+    auto fail = [](absl::Status status) -> std::tuple<absl::Status, ChannelFrame,
+                                                       std::unique_ptr<Message>> {
+        return {std::move(status), ChannelFrame(), nullptr};
+    };
+
+    // Read until the length prefix is complete.
+    uint32_t length;
+    size_t prefixLength;
+    while (true) {
+        auto [status, decoded] =
+            decodeCompactLength(readBuffer.data() + readStart, readEnd - readStart, length);
+        if (!status.ok()) {
+            return fail(status);
+        }
+        if (decoded > 0) {
+            prefixLength = decoded;
+            break;
+        }
+        if (!fill(readEnd - readStart + 1)) {
+            return fail(absl::InvalidArgumentError("Error reading message header"));
+        }
+    }
+
+    // The header is parsed in place once it is buffered along with its checksum, which is checked
+    // before any length in the header is trusted.
+    auto checksumLength = checksums != FrameChecksums::kNone ? sizeof(uint32_t) : 0;
+    if (!fill(prefixLength + std::min<size_t>(length, kMaxCompactHeaderLength) + checksumLength)) {
+        return fail(absl::InvalidArgumentError("Error reading message header"));
+    }
+    ChannelFrame frame;
+    MessageHeader header;
+    bool hasMessage;
+    bool compressed;
+    auto *prefix = readBuffer.data() + readStart;
+    auto [status, headerLength] = decodeCompactHeader(prefix + prefixLength, length, frame,
+                                                      header, hasMessage, compressed);
+    if (!status.ok()) {
+        return fail(status);
+    }
+    if (checksumLength > 0) {
+        uint32_t expected;
+        memcpy(&expected, prefix + prefixLength + headerLength, sizeof(uint32_t));
+        if (crc32c(prefix, prefixLength + headerLength) != expected) {
+            compactMetrics().checksumFailures.add();
+            return fail(absl::DataLossError("Message header checksum mismatch"));
+        }
+    }
+    if (length > maxFrameLength) {
+        return fail(absl::InvalidArgumentError("Message exceeds the maximum frame length"));
+    }
+    readStart += prefixLength + headerLength + checksumLength;
+
+    // The body is copied out of the buffer and the rest of a body that did not fit is read
+    // directly into the message.
+    bool checkBody = checksums == FrameChecksums::kFull;
+    uint32_t crc = 0;
+    std::unique_ptr<Message> message;
+    if (hasMessage && !compressed) {
+        message = std::make_unique<Message>();
+        message->header = header;
+        message->body.data.resize(header.length);
+        auto buffered = std::min<size_t>(header.length, readEnd - readStart);
+        memcpy(message->body.data.data(), readBuffer.data() + readStart, buffered);
+        readStart += buffered;
+        auto left = header.length - buffered;
+        if (left > 0 && !readPast(message->body.data.data() + buffered, left)) {
+            return fail(absl::InvalidArgumentError("Error reading message body"));
+        }
+        if (checkBody) {
+            crc = crc32c(message->body.data.data(), header.length);
+        }
+    }
+
+    // A compressed body is decompressed into the message straight out of the read buffer if it is
+    // all there and out of the reused compressed buffer otherwise. Its original length is bounded
+    // by the maximum frame length and by the most the codec expands a body before anything is
+    // allocated for it. A failure to decompress is only reported once the checksum ruled out a
+    // corrupt message.
+    absl::Status decompressStatus;
+    if (hasMessage && compressed) {
+        if (decompressor == nullptr) {
+            return fail(absl::InvalidArgumentError("Compressed message on a link without a codec"));
+        }
+        auto bodyLength = length - headerLength;
+        if (header.length > maxFrameLength ||
+            header.length > FrameDecompressor::maxDecompressedLength(bodyLength)) {
+            return fail(absl::InvalidArgumentError("Invalid original message length"));
+        }
+        const uint8_t *body = readBuffer.data() + readStart;
+        auto buffered = std::min<size_t>(bodyLength, readEnd - readStart);
+        readStart += buffered;
+        if (buffered < bodyLength) {
+            compressedBuffer.resize(bodyLength);
+            memcpy(compressedBuffer.data(), body, buffered);
+            if (!readPast(compressedBuffer.data() + buffered, bodyLength - buffered)) {
+                return fail(absl::InvalidArgumentError("Error reading message body"));
+            }
+            body = compressedBuffer.data();
+        }
+        if (checkBody) {
+            crc = crc32c(body, bodyLength);
+        }
+        message = std::make_unique<Message>();
+        message->header = header;
+        message->body.data.resize(header.length);
+        decompressStatus = decompressor->decompress(body, bodyLength, message->body.data.data(),
+                                                    header.length);
+    }
+
+    // The checksum of the body follows it, even if it is empty.
+    if (checkBody) {
+        if (!fill(sizeof(uint32_t))) {
+            return fail(absl::InvalidArgumentError("Error reading message checksum"));
+        }
+        uint32_t expected;
+        memcpy(&expected, readBuffer.data() + readStart, sizeof(uint32_t));
+        readStart += sizeof(uint32_t);
+        if (crc != expected) {
+            compactMetrics().checksumFailures.add();
+            return fail(absl::DataLossError("Message checksum mismatch"));
+        }
+    }
+    if (!decompressStatus.ok()) {
+        return fail(decompressStatus);
+    }
+    compactMetrics().messagesRead.add();
+    return {absl::OkStatus(), frame, std::move(message)};
+}
+
+// See message_link.h for documentation.
+void SocketLink::shutdown() { ::shutdown(fd, SHUT_RDWR); }
+
+// Private methods.
+
+// See message_link.h for documentation.
+absl::Status SocketLink::writeCompact(const ChannelFrame &frame, protocol_t protocol,
+                                      bool hasMessage, const BulkPayload &payload,
+                                      const std::vector<uint8_t> &trailer) {
+    auto length = payload.length + trailer.size();
+    if (length + kMaxCompactHeaderLength > maxFrameLength) {
+        return absl::InvalidArgumentError("Body does not fit in a message");
+    }
+
+    // A compressed body replaces both the payload and the trailer.
+    static const std::vector<uint8_t> kNoTrailer;
+    uint8_t header[kMaxCompactHeaderLength + sizeof(uint32_t)];
+    size_t headerLength;
+    auto body = payload;
+    auto *bodyTrailer = &trailer;
+    if (compressor != nullptr && hasMessage && payload.data != nullptr &&
+        compressor->compress(payload.data, payload.length, trailer)) {
+        body = compressor->output();
+        bodyTrailer = &kNoTrailer;
+        headerLength =
+            encodeCompactHeader(frame, protocol, body.length, hasMessage, header, length);
+    } else {
+        headerLength = encodeCompactHeader(frame, protocol, length, hasMessage, header);
+    }
+
+    // The checksum of the header is sent after it and the one of the body after the body.
+    if (checksums != FrameChecksums::kNone) {
+        auto crc = crc32c(header, headerLength);
+        memcpy(header + headerLength, &crc, sizeof(uint32_t));
+        headerLength += sizeof(uint32_t);
+    }
+    if (checksums == FrameChecksums::kFull) {
+        auto [checksumStatus, crc] = bodyChecksum(body, *bodyTrailer);
+        if (!checksumStatus.ok()) {
+            return checksumStatus;
+        }
+        checkedTrailer.assign(bodyTrailer->begin(), bodyTrailer->end());
+        checkedTrailer.insert(checkedTrailer.end(), (const uint8_t *)&crc,
+                              (const uint8_t *)&crc + sizeof(uint32_t));
+        bodyTrailer = &checkedTrailer;
+    }
+    auto status = sendFrame(fd, header, headerLength, body, *bodyTrailer);
+    if (status.ok()) {
+        compactMetrics().messagesWritten.add();
+    }
+    return status;
+}
+
+// See message_link.h for documentation.
+bool SocketLink::fill(size_t length) {
+    if (readEnd - readStart >= length) {
+        return true;
+    }
+
+    // Move the bytes not parsed yet to the front to make room.
+    memmove(readBuffer.data(), readBuffer.data() + readStart, readEnd - readStart);
+    readEnd -= readStart;
+    readStart = 0;
+    auto bytesRead = readAtLeast(fd, readBuffer.data() + readEnd, length - readEnd,
+                                 readBuffer.size() - readEnd);
+    if (bytesRead < 0) {
+        return false;
+    }
+    readEnd += bytesRead;
+    return true;
+}
+
+// See message_link.h for documentation.
+bool SocketLink::readPast(uint8_t *data, size_t length) {
+    auto bytesRead = readAtLeast(fd, data, length, readBuffer.data(), readBuffer.size());
+    if (bytesRead < 0) {
+        return false;
+    }
+    readStart = 0;
+    readEnd = bytesRead;
+    return true;
+}
+
+}  // namespace ostp::servercc
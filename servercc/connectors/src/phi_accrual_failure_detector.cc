@@ -0,0 +1,71 @@
+#include "phi_accrual_failure_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ostp::servercc {
+
+// See phi_accrual_failure_detector.h for documentation.
+PhiAccrualFailureDetector::PhiAccrualFailureDetector(const HeartbeatOptions &options)
+    : threshold(options.phiThreshold),
+      acceptablePause(options.acceptablePause.count()),
+      minStdDeviation(options.minStdDeviation.count()),
+      maxSampleSize(std::max<size_t>(options.maxSampleSize, 2)),
+      lastActivity(std::chrono::steady_clock::now().time_since_epoch().count()),
+      lastHeartbeat(std::chrono::steady_clock::now()) {
+    // Seed the history with the expected interval and a wide deviation until real heartbeats
+    // arrive.
+    double interval = options.interval.count();
+    addInterval(interval - interval / 4);
+    addInterval(interval + interval / 4);
+}
+
+// See phi_accrual_failure_detector.h for documentation.
+void PhiAccrualFailureDetector::heartbeat(std::chrono::steady_clock::time_point now) {
+    {
+        std::lock_guard lock(mutex);
+        addInterval(std::chrono::duration<double, std::milli>(now - lastHeartbeat).count());
+        lastHeartbeat = now;
+    }
+    recordActivity(now);
+}
+
+// See phi_accrual_failure_detector.h for documentation.
+double PhiAccrualFailureDetector::phi(std::chrono::steady_clock::time_point now) {
+    std::chrono::steady_clock::time_point last(
+        std::chrono::steady_clock::duration(lastActivity.load(std::memory_order_relaxed)));
+    double elapsed = std::chrono::duration<double, std::milli>(now - last).count();
+    double mean, stdDeviation;
+    {
+        std::lock_guard lock(mutex);
+        mean = intervalSum / intervals.size();
+        auto variance = squaredIntervalSum / intervals.size() - mean * mean;
+        stdDeviation = std::sqrt(std::max(variance, 0.0));
+    }
+    mean += acceptablePause;
+    stdDeviation = std::max(stdDeviation, minStdDeviation);
+
+    // Logistic approximation of the cumulative normal distribution which stays accurate in the
+    // tail and avoids evaluating erfc.
+    auto y = (elapsed - mean) / stdDeviation;
+    auto e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+    if (elapsed > mean) {
+        return -std::log10(e / (1.0 + e));
+    }
+    return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
+
+// See phi_accrual_failure_detector.h for documentation.
+void PhiAccrualFailureDetector::addInterval(double interval) {
+    if (intervals.size() >= maxSampleSize) {
+        auto oldest = intervals.front();
+        intervals.pop_front();
+        intervalSum -= oldest;
+        squaredIntervalSum -= oldest * oldest;
+    }
+    intervals.push_back(interval);
+    intervalSum += interval;
+    squaredIntervalSum += interval * interval;
+}
+
+}  // namespace ostp::servercc
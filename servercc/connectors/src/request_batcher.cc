@@ -0,0 +1,158 @@
+#include "request_batcher.h"
+
+#include <algorithm>
+
+#include "batched_request.h"
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The metrics recorded by the request batchers of the process.
+struct BatcherMetrics {
+    Counter &batches;
+    Counter &requests;
+    Histogram &batchSize;
+};
+
+// Returns the request batcher metrics of the process.
+BatcherMetrics &batcherMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static BatcherMetrics metrics = {
+        registry.counter("servercc_batcher_batches_total"),
+        registry.counter("servercc_batcher_requests_total"),
+        registry.histogram("servercc_batcher_batch_size"),
+    };
+    return metrics;
+}
+
+}  // namespace
+
+// See request_batcher.h for documentation.
+RequestBatcher::RequestBatcher(Connector &connector, BatchOptions options)
+    : connector(connector), options(options) {}
+
+// See request_batcher.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> RequestBatcher::call(
+    PeerAddress peer, std::unique_ptr<Message> message) {
+    Call call(std::move(message), currentDeadline());
+    std::unique_lock lock(mutex);
+
+    // A full batch may still wait for its first caller to wake up and take it.
+    auto &batch = batches[peer];
+    bool leader = batch == nullptr || batch->calls.size() >= options.maxBatchSize;
+    if (leader) {
+        batch = std::make_shared<Batch>();
+    }
+    batch->calls.push_back(&call);
+
+    // The other callers wait for the first caller to send the batch.
+    if (!leader) {
+        if (batch->calls.size() >= options.maxBatchSize) {
+            batch->full.notify_one();
+        }
+        call.condition.wait(lock, [&call]() { return call.done; });
+        return {call.status, std::move(call.response)};
+    }
+
+    // Collect requests until the window closes or the batch is full. A new batch is started for
+    // the requests made while this one is sent.
+    auto own = batch;
+    own->full.wait_until(lock, std::chrono::steady_clock::now() + options.window,
+                         [&]() { return own->calls.size() >= options.maxBatchSize; });
+    if (auto it = batches.find(peer); it != batches.end() && it->second == own) {
+        batches.erase(it);
+    }
+    lock.unlock();
+
+    send(peer, own->calls);
+
+    lock.lock();
+    return {call.status, std::move(call.response)};
+}
+
+// See request_batcher.h for documentation.
+void RequestBatcher::send(PeerAddress peer, const std::vector<Call *> &calls) {
+    auto &metrics = batcherMetrics();
+    metrics.batches.add();
+    metrics.requests.add(calls.size());
+    metrics.batchSize.record(calls.size());
+
+    // Requests that expired while the batch was collected are not sent. The batch lives as long
+    // as its latest request.
+    std::vector<Call *> live;
+    auto deadline = std::chrono::steady_clock::time_point::min();
+    auto now = std::chrono::steady_clock::now();
+    std::vector<uint8_t> body;
+    for (auto *call : calls) {
+        if (call->deadline <= now) {
+            complete(*call, absl::DeadlineExceededError("Deadline of the request exceeded"),
+                     nullptr);
+            continue;
+        }
+        appendBatchEntry(body, *call->message);
+        deadline = std::max(deadline, call->deadline);
+        live.push_back(call);
+    }
+    if (live.empty()) {
+        return;
+    }
+    auto fail = [&](const absl::Status &status) {
+        for (auto *call : live) {
+            complete(*call, status, nullptr);
+        }
+    };
+
+    auto [status, request] = connector.sendRequest(peer, true);
+    if (!status.ok()) {
+        return fail(status);
+    }
+    if (auto deadlineStatus = request->setDeadline(deadline); !deadlineStatus.ok()) {
+        return fail(deadlineStatus);
+    }
+    auto message = std::make_unique<Message>();
+    message->header.protocol = kInternalBatchProtocol;
+    message->header.length = body.size();
+    message->body.data = std::move(body);
+    if (auto sendStatus = request->sendMessage(std::move(message)); !sendStatus.ok()) {
+        return fail(sendStatus);
+    }
+    auto [receiveStatus, response] = request->receiveMessage();
+    if (!receiveStatus.ok()) {
+        return fail(receiveStatus);
+    }
+
+    // A batch shed by the peer is answered like every request of it would have been.
+    if (response->header.protocol == kOverloadedProtocol) {
+        for (auto *call : live) {
+            complete(*call, absl::OkStatus(), std::make_unique<Message>(*response));
+        }
+        return;
+    }
+    if (response->header.protocol != kInternalBatchResponseProtocol) {
+        return fail(absl::InternalError("Unexpected batch response protocol"));
+    }
+
+    // Hand every response to its caller in the order of the batch.
+    size_t offset = 0;
+    for (auto *call : live) {
+        if (offset >= response->body.data.size()) {
+            complete(*call, absl::InternalError("Batch response is missing a request"), nullptr);
+            continue;
+        }
+        auto [entryStatus, entry] = readBatchEntry(response->body.data, offset);
+        complete(*call, entryStatus, std::move(entry));
+    }
+}
+
+// See request_batcher.h for documentation.
+void RequestBatcher::complete(Call &call, absl::Status status, std::unique_ptr<Message> response) {
+    std::lock_guard lock(mutex);
+    call.status = std::move(status);
+    call.response = std::move(response);
+    call.done = true;
+    call.condition.notify_one();
+}
+
+}  // namespace ostp::servercc
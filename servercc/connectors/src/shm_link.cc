@@ -0,0 +1,352 @@
+#include "shm_link.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <random>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// Identifies a segment laid out by this version of the link.
+constexpr uint64_t kSegmentMagic = 0x53434353484d0001;
+
+// The number of times an end polls the ring before sleeping. Covers the turnaround of a busy peer
+// which is far shorter than a futex wake up. Spinning only delays the peer on a single processor.
+const int kSpinIterations = std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+
+// The time a sleeping end waits before checking whether the peer hung up.
+constexpr timespec kSleepTimeout = {0, 50 * 1000 * 1000};
+
+// The header at the start of a segment.
+struct alignas(64) SegmentHeader {
+    uint64_t magic;
+    uint64_t capacity;
+};
+
+// The metrics recorded by the shared memory links of the process.
+struct ShmMetrics {
+    Counter &messagesWritten;
+    Counter &messagesRead;
+    Counter &sleeps;
+    Counter &wakeups;
+};
+
+// Returns the shared memory link metrics of the process.
+ShmMetrics &shmMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static ShmMetrics metrics = {
+        registry.counter("servercc_shm_messages_written_total"),
+        registry.counter("servercc_shm_messages_read_total"),
+        registry.counter("servercc_shm_sleeps_total"),
+        registry.counter("servercc_shm_wakeups_total"),
+    };
+    return metrics;
+}
+
+// Hints the processor that the thread is spinning.
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Wakes the waiters of a futex shared between processes.
+void futexWake(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+// Sleeps on a futex shared between processes while it holds the expected value.
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, expected, &kSleepTimeout, nullptr, 0);
+}
+
+}  // namespace
+
+// The control block of a ring. The fields of each end are on their own cache line.
+struct ShmLink::Ring {
+    // The number of bytes written, the futex bumped when the reader sleeps and whether the writer
+    // sleeps waiting for space.
+    alignas(64) std::atomic<uint64_t> writePosition;
+    std::atomic<uint32_t> writeSignal;
+    std::atomic<uint32_t> writerSleeping;
+
+    // The number of bytes read, the futex bumped when the writer sleeps and whether the reader
+    // sleeps waiting for data.
+    alignas(64) std::atomic<uint64_t> readPosition;
+    std::atomic<uint32_t> readSignal;
+    std::atomic<uint32_t> readerSleeping;
+
+    // Whether either end shut the link down.
+    alignas(64) std::atomic<uint32_t> closed;
+};
+
+// See shm_link.h for documentation.
+size_t ShmLink::segmentSize(size_t capacity) {
+    return sizeof(SegmentHeader) + 2 * sizeof(ShmLink::Ring) + 2 * capacity;
+}
+
+// See shm_link.h for documentation.
+std::pair<absl::Status, std::shared_ptr<ShmLink>> ShmLink::create(int watchFd, size_t capacity) {
+    capacity = std::bit_ceil(std::max<size_t>(capacity, 4096));
+    auto name = absl::StrCat("/servercc.", getpid(), ".",
+                             absl::Hex(std::random_device()() | (uint64_t)std::random_device()()
+                                                                    << 32));
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return {absl::ErrnoToStatus(errno, "Failed to create shared memory segment"), nullptr};
+    }
+    auto size = segmentSize(capacity);
+    if (ftruncate(fd, size) < 0) {
+        auto status = absl::ErrnoToStatus(errno, "Failed to size shared memory segment");
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return {status, nullptr};
+    }
+    auto segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (segment == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return {absl::ErrnoToStatus(errno, "Failed to map shared memory segment"), nullptr};
+    }
+
+    // Lay out the segment. The rings must be constructed before the header is visible to the peer
+    // which only happens once the name is sent.
+    auto *header = new (segment) SegmentHeader{kSegmentMagic, capacity};
+    new (header + 1) Ring[2]();
+    return {absl::OkStatus(), std::shared_ptr<ShmLink>(
+                                  new ShmLink(name, segment, size, capacity, true, watchFd))};
+}
+
+// See shm_link.h for documentation.
+std::pair<absl::Status, std::shared_ptr<ShmLink>> ShmLink::open(absl::string_view name,
+                                                                int watchFd) {
+    std::string segmentName(name);
+    int fd = shm_open(segmentName.c_str(), O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return {absl::ErrnoToStatus(errno, "Failed to open shared memory segment"), nullptr};
+    }
+    struct stat stats;
+    if (fstat(fd, &stats) < 0 || (size_t)stats.st_size < sizeof(SegmentHeader)) {
+        ::close(fd);
+        return {absl::InvalidArgumentError("Invalid shared memory segment"), nullptr};
+    }
+    size_t size = stats.st_size;
+    auto segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (segment == MAP_FAILED) {
+        return {absl::ErrnoToStatus(errno, "Failed to map shared memory segment"), nullptr};
+    }
+    auto *header = (SegmentHeader *)segment;
+    auto capacity = header->capacity;
+    if (header->magic != kSegmentMagic || !std::has_single_bit(capacity) ||
+        segmentSize(capacity) != size) {
+        munmap(segment, size);
+        return {absl::InvalidArgumentError("Invalid shared memory segment"), nullptr};
+    }
+    auto link = std::shared_ptr<ShmLink>(
+        new ShmLink(std::move(segmentName), segment, size, capacity, false, watchFd));
+    return {absl::OkStatus(), std::move(link)};
+}
+
+// See shm_link.h for documentation.
+ShmLink::ShmLink(std::string name, void *segment, size_t size, size_t capacity, bool creator,
+                 int watchFd)
+    : name(std::move(name)),
+      segment(segment),
+      size(size),
+      capacity(capacity),
+      mask(capacity - 1),
+      watchFd(watchFd),
+      tx((Ring *)((SegmentHeader *)segment + 1) + (creator ? 0 : 1)),
+      rx((Ring *)((SegmentHeader *)segment + 1) + (creator ? 1 : 0)),
+      txData((uint8_t *)((Ring *)((SegmentHeader *)segment + 1) + 2) + (creator ? 0 : capacity)),
+      rxData((uint8_t *)((Ring *)((SegmentHeader *)segment + 1) + 2) + (creator ? capacity : 0)),
+      linked(creator),
+      readPosition(rx->readPosition.load(std::memory_order_relaxed)) {}
+
+// See shm_link.h for documentation.
+ShmLink::~ShmLink() {
+    unlink();
+    munmap(segment, size);
+}
+
+// See shm_link.h for documentation.
+void ShmLink::unlink() {
+    if (linked) {
+        linked = false;
+        shm_unlink(name.c_str());
+    }
+}
+
+// See message_link.h for documentation.
+absl::Status ShmLink::write(std::unique_ptr<Message> message) {
+    message->header.length = message->body.data.size();
+    auto position = tx->writePosition.load(std::memory_order_relaxed);
+    auto status = writeBytes(&message->header, kMessageHeaderLength, position);
+    if (status.ok()) {
+        status = writeBytes(message->body.data.data(), message->header.length, position);
+    }
+    if (!status.ok()) {
+        return status;
+    }
+    publish(*tx, true, position);
+    shmMetrics().messagesWritten.add();
+    return absl::OkStatus();
+}
+
+// See message_link.h for documentation.
+bool ShmLink::writable() {
+    auto used = tx->writePosition.load(std::memory_order_relaxed) -
+                tx->readPosition.load(std::memory_order_acquire);
+    return capacity - used >= kMessageHeaderLength &&
+           tx->closed.load(std::memory_order_relaxed) == 0;
+}
+
+// See message_link.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> ShmLink::read() {
+    auto message = std::make_unique<Message>();
+    auto status = readBytes(&message->header, kMessageHeaderLength);
+    if (status.ok() && message->header.length > 0) {
+        message->body.data.resize(message->header.length);
+        status = readBytes(message->body.data.data(), message->header.length);
+    }
+    if (!status.ok()) {
+        return {status, nullptr};
+    }
+    publish(*rx, false, readPosition);
+    shmMetrics().messagesRead.add();
+    return {absl::OkStatus(), std::move(message)};
+}
+
+// See message_link.h for documentation.
+void ShmLink::shutdown() {
+    for (auto *ring : {tx, rx}) {
+        ring->closed.store(1);
+        ring->writeSignal.fetch_add(1);
+        ring->readSignal.fetch_add(1);
+        futexWake(&ring->writeSignal);
+        futexWake(&ring->readSignal);
+    }
+}
+
+// Private methods.
+
+// See shm_link.h for documentation.
+absl::Status ShmLink::writeBytes(const void *data, size_t length, uint64_t &position) {
+    auto *bytes = (const uint8_t *)data;
+    while (length > 0) {
+        auto read = tx->readPosition.load(std::memory_order_acquire);
+        auto free = capacity - (position - read);
+        if (free == 0) {
+            // Let the reader drain the ring before sleeping.
+            publish(*tx, true, position);
+            auto status = wait(*tx, true, read);
+            if (!status.ok()) {
+                return status;
+            }
+            continue;
+        }
+        auto chunk = std::min({length, free, capacity - (position & mask)});
+        memcpy(txData + (position & mask), bytes, chunk);
+        position += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+    return absl::OkStatus();
+}
+
+// See shm_link.h for documentation.
+absl::Status ShmLink::readBytes(void *data, size_t length) {
+    auto *bytes = (uint8_t *)data;
+    while (length > 0) {
+        auto available = rx->writePosition.load(std::memory_order_acquire) - readPosition;
+        if (available == 0) {
+            // Free the space read so far before sleeping in case the writer waits for it.
+            publish(*rx, false, readPosition);
+            auto status = wait(*rx, false, readPosition);
+            if (!status.ok()) {
+                return status;
+            }
+            continue;
+        }
+        auto chunk = std::min({length, available, capacity - (readPosition & mask)});
+        memcpy(bytes, rxData + (readPosition & mask), chunk);
+        readPosition += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+    return absl::OkStatus();
+}
+
+// See shm_link.h for documentation.
+void ShmLink::publish(Ring &ring, bool writer, uint64_t position) {
+    // The position is published before checking whether the other end sleeps while the other end
+    // announces that it sleeps before checking the position so that one of them sees the other.
+    if (writer) {
+        ring.writePosition.store(position);
+        if (ring.readerSleeping.load()) {
+            ring.writeSignal.fetch_add(1);
+            futexWake(&ring.writeSignal);
+            shmMetrics().wakeups.add();
+        }
+    } else {
+        ring.readPosition.store(position);
+        if (ring.writerSleeping.load()) {
+            ring.readSignal.fetch_add(1);
+            futexWake(&ring.readSignal);
+            shmMetrics().wakeups.add();
+        }
+    }
+}
+
+// See shm_link.h for documentation.
+absl::Status ShmLink::wait(Ring &ring, bool writer, uint64_t expected) {
+    auto &signal = writer ? ring.readSignal : ring.writeSignal;
+    auto &sleeping = writer ? ring.writerSleeping : ring.readerSleeping;
+    auto &other = writer ? ring.readPosition : ring.writePosition;
+    for (int i = 0; i < kSpinIterations; i++) {
+        if (other.load(std::memory_order_relaxed) != expected ||
+            ring.closed.load(std::memory_order_relaxed) != 0) {
+            break;
+        }
+        cpuRelax();
+    }
+    auto value = signal.load();
+    sleeping.store(1);
+    bool slept = false;
+    if (other.load() == expected && ring.closed.load() == 0) {
+        shmMetrics().sleeps.add();
+        futexWait(&signal, value);
+        slept = true;
+    }
+    sleeping.store(0);
+    if (tx->closed.load() != 0 || rx->closed.load() != 0) {
+        return absl::UnavailableError("Shared memory link was shut down");
+    }
+
+    // Without news from the peer make sure that it did not die.
+    if (slept && other.load() == expected) {
+        pollfd pollFd = {watchFd, POLLRDHUP, 0};
+        if (poll(&pollFd, 1, 0) == 1 && (pollFd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+            return absl::UnavailableError("Peer hung up");
+        }
+    }
+    return absl::OkStatus();
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,295 @@
+#include "wire_format.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ostp::servercc {
+
+namespace {
+
+// Appends a varint to the buffer.
+//
+// Arguments:
+//     value: The value to append.
+//     out: The buffer to append to, advanced past the varint.
+void putVarint(uint64_t value, uint8_t *&out) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+}
+
+// Reads a varint of at most the specified number of bytes.
+//
+// Arguments:
+//     data: The bytes to read from, advanced past the varint.
+//     end: The end of the bytes.
+//     maxBytes: The maximum length of the varint.
+//     value: Receives the value.
+// Returns:
+//     Whether a complete varint was read.
+bool getVarint(const uint8_t *&data, const uint8_t *end, size_t maxBytes, uint64_t &value) {
+    value = 0;
+    for (size_t i = 0; i < maxBytes && data < end; i++) {
+        auto byte = *data++;
+        value |= (uint64_t)(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads a varint holding a 32-bit value.
+bool getVarint32(const uint8_t *&data, const uint8_t *end, uint32_t &value) {
+    uint64_t wide;
+    if (!getVarint(data, end, 5, wide) || wide > UINT32_MAX) {
+        return false;
+    }
+    value = wide;
+    return true;
+}
+
+}  // namespace
+
+// See wire_format.h for documentation.
+bool isChannelProtocol(protocol_t protocol) {
+    return protocol == kInternalRequestProtocol || protocol == kInternalResponseProtocol ||
+           protocol == kInternalRequestEndProtocol || protocol == kInternalResponseEndProtocol;
+}
+
+// Legacy wire format.
+
+// See wire_format.h for documentation.
+std::unique_ptr<Message> wrapFrame(const ChannelFrame &frame, std::unique_ptr<Message> message) {
+    // An end frame only carries the channel ID.
+    if (message == nullptr) {
+        message = std::make_unique<Message>();
+        message->body.data.resize(sizeof(channel_id_t));
+        memcpy(message->body.data.data(), &frame.id, sizeof(channel_id_t));
+        message->header = {sizeof(channel_id_t), frame.protocol};
+        return message;
+    }
+    message->header.length = message->body.data.size();
+    auto trailer = frameTrailer(frame, message->header);
+    message->body.data.insert(message->body.data.end(), trailer.begin(), trailer.end());
+    message->header = {(uint32_t)message->body.data.size(), frame.protocol};
+    return message;
+}
+
+// See wire_format.h for documentation.
+std::vector<uint8_t> frameTrailer(const ChannelFrame &frame, const MessageHeader &header) {
+    std::vector<uint8_t> trailer;
+    if (frame.protocol & kTracedProtocolFlag) {
+        trailer = wrapTrailer(traced_channel_id_t{frame.traceId, frame.spanId, frame.id}, header);
+    } else {
+        trailer = wrapTrailer(frame.id, header);
+    }
+
+    // The time left until the deadline follows the channel ID.
+    if (frame.protocol & kDeadlineProtocolFlag) {
+        trailer.resize(trailer.size() + sizeof(deadline_budget_t));
+        memcpy(trailer.data() + trailer.size() - sizeof(deadline_budget_t), &frame.budget,
+               sizeof(deadline_budget_t));
+    }
+    return trailer;
+}
+
+// See wire_format.h for documentation.
+std::tuple<absl::Status, ChannelFrame, std::unique_ptr<Message>> unwrapFrame(
+    std::unique_ptr<Message> message) {
+    ChannelFrame frame;
+    frame.protocol = message->header.protocol;
+    auto protocol = frame.protocol & ~kChannelFrameFlags;
+    if (!isChannelProtocol(protocol)) {
+        return {absl::OkStatus(), frame, std::move(message)};
+    }
+
+    // An end frame only carries the channel ID.
+    auto &data = message->body.data;
+    if (protocol == kInternalRequestEndProtocol || protocol == kInternalResponseEndProtocol) {
+        if (data.size() < sizeof(channel_id_t)) {
+            return {absl::InvalidArgumentError("Message is too short for a channel ID"), frame,
+                    nullptr};
+        }
+        memcpy(&frame.id, data.data(), sizeof(channel_id_t));
+        if (frame.id >= kMaxChannels) {
+            return {absl::InvalidArgumentError("Channel ID out of range"), frame, nullptr};
+        }
+        return {absl::OkStatus(), frame, nullptr};
+    }
+
+    // The time left until the deadline is the last field.
+    if (frame.protocol & kDeadlineProtocolFlag) {
+        if (data.size() < sizeof(deadline_budget_t)) {
+            return {absl::InvalidArgumentError("Message is too short for a deadline"), frame,
+                    nullptr};
+        }
+        memcpy(&frame.budget, data.data() + data.size() - sizeof(deadline_budget_t),
+               sizeof(deadline_budget_t));
+        data.resize(data.size() - sizeof(deadline_budget_t));
+        message->header.length = data.size();
+    }
+
+    // The first message of a sampled channel carries the trace context with the channel ID.
+    if (frame.protocol & kTracedProtocolFlag) {
+        auto [status, tracedId, unwrapped] = unwrapMessage<traced_channel_id_t>(std::move(message));
+        if (!status.ok()) {
+            return {status, frame, nullptr};
+        }
+        frame.id = tracedId->id;
+        frame.traceId = tracedId->traceId;
+        frame.spanId = tracedId->spanId;
+        if (frame.id >= kMaxChannels) {
+            return {absl::InvalidArgumentError("Channel ID out of range"), frame, nullptr};
+        }
+        return {absl::OkStatus(), frame, std::move(unwrapped)};
+    }
+    auto [status, id, unwrapped] = unwrapMessage<channel_id_t>(std::move(message));
+    if (!status.ok()) {
+        return {status, frame, nullptr};
+    }
+    frame.id = *id;
+    if (frame.id >= kMaxChannels) {
+        return {absl::InvalidArgumentError("Channel ID out of range"), frame, nullptr};
+    }
+    return {absl::OkStatus(), frame, std::move(unwrapped)};
+}
+
+// Compact wire format.
+
+// See wire_format.h for documentation.
+size_t encodeCompactHeader(const ChannelFrame &frame, protocol_t protocol, size_t length,
+                           bool hasMessage, uint8_t *out, size_t originalLength) {
+    // The fields are encoded first as the length prefix counts them.
+    uint8_t fields[kMaxCompactHeaderLength];
+    auto *end = fields;
+    putVarint(frame.protocol & ~kChannelFrameFlags, end);
+    uint8_t flags = (uint8_t)frame.priority << kCompactPriorityShift;
+    flags |= originalLength > 0 ? kCompactCompressedFlag : 0;
+    bool channel = isChannelProtocol(frame.protocol & ~kChannelFrameFlags);
+    if (channel) {
+        flags |= kCompactChannelFlag;
+        flags |= frame.protocol & kChannelOpenFlag ? kCompactOpenFlag : 0;
+        flags |= frame.protocol & kChannelEndFlag ? kCompactEndFlag : 0;
+        flags |= frame.protocol & kTracedProtocolFlag ? kCompactTracedFlag : 0;
+        flags |= frame.protocol & kDeadlineProtocolFlag ? kCompactDeadlineFlag : 0;
+    }
+    *end++ = flags;
+    if (channel) {
+        putVarint(frame.id, end);
+        if (flags & kCompactTracedFlag) {
+            memcpy(end, &frame.traceId, sizeof(uint64_t));
+            memcpy(end + sizeof(uint64_t), &frame.spanId, sizeof(uint64_t));
+            end += sizeof(uint64_t) * 2;
+        }
+        if (flags & kCompactDeadlineFlag) {
+            putVarint(frame.budget, end);
+        }
+        if (hasMessage) {
+            putVarint(protocol, end);
+        }
+    }
+    if (originalLength > 0) {
+        putVarint(originalLength, end);
+    }
+
+    auto fieldsLength = end - fields;
+    auto *start = out;
+    putVarint(fieldsLength + length, out);
+    memcpy(out, fields, fieldsLength);
+    return out + fieldsLength - start;
+}
+
+// See wire_format.h for documentation.
+std::pair<absl::Status, size_t> decodeCompactLength(const uint8_t *data, size_t available,
+                                                    uint32_t &length) {
+    auto *position = data;
+    if (getVarint32(position, data + available, length)) {
+        return {absl::OkStatus(), position - data};
+    }
+    if (available >= 5) {
+        return {absl::InvalidArgumentError("Malformed message length"), 0};
+    }
+    return {absl::OkStatus(), 0};
+}
+
+// See wire_format.h for documentation.
+std::pair<absl::Status, size_t> decodeCompactHeader(const uint8_t *data, size_t length,
+                                                    ChannelFrame &frame, MessageHeader &header,
+                                                    bool &hasMessage, bool &compressed) {
+    auto malformed = []() -> std::pair<absl::Status, size_t> {
+        return {absl::InvalidArgumentError("Malformed message header"), 0};
+    };
+    auto *position = data;
+    auto *end = data + std::min(length, kMaxCompactHeaderLength);
+    frame = ChannelFrame();
+    if (!getVarint32(position, end, frame.protocol) || position == end) {
+        return malformed();
+    }
+    auto flags = *position++;
+    frame.priority = (FramePriority)std::min<int>(flags >> kCompactPriorityShift,
+                                                  (int)FramePriority::kBulk);
+    header.protocol = frame.protocol;
+
+    // The body of a compressed message is preceded by its original length.
+    compressed = flags & kCompactCompressedFlag;
+    auto readBodyLength = [&]() {
+        uint32_t bodyLength = length - (position - data);
+        if (compressed && !getVarint32(position, end, bodyLength)) {
+            return false;
+        }
+        header.length = bodyLength;
+        return true;
+    };
+
+    // A message that does not belong to a channel is followed by its body.
+    hasMessage = true;
+    if ((flags & kCompactChannelFlag) == 0) {
+        if (!readBodyLength()) {
+            return malformed();
+        }
+        return {absl::OkStatus(), position - data};
+    }
+    frame.protocol |= flags & kCompactOpenFlag ? kChannelOpenFlag : 0;
+    frame.protocol |= flags & kCompactEndFlag ? kChannelEndFlag : 0;
+    frame.protocol |= flags & kCompactTracedFlag ? kTracedProtocolFlag : 0;
+    frame.protocol |= flags & kCompactDeadlineFlag ? kDeadlineProtocolFlag : 0;
+    if (!getVarint32(position, end, frame.id)) {
+        return malformed();
+    }
+    if (frame.id >= kMaxChannels) {
+        return {absl::InvalidArgumentError("Channel ID out of range"), 0};
+    }
+    if (flags & kCompactTracedFlag) {
+        if (end - position < (ptrdiff_t)sizeof(uint64_t) * 2) {
+            return malformed();
+        }
+        memcpy(&frame.traceId, position, sizeof(uint64_t));
+        memcpy(&frame.spanId, position + sizeof(uint64_t), sizeof(uint64_t));
+        position += sizeof(uint64_t) * 2;
+    }
+    if ((flags & kCompactDeadlineFlag) && !getVarint(position, end, 10, frame.budget)) {
+        return malformed();
+    }
+
+    // A frame without a message such as an end frame ends with the fields of the channel.
+    hasMessage = position < data + length;
+    header = {0, 0};
+    if (hasMessage) {
+        protocol_t protocol;
+        if (!getVarint32(position, end, protocol)) {
+            return malformed();
+        }
+        header.protocol = protocol;
+        if (!readBodyLength()) {
+            return malformed();
+        }
+    } else if (compressed) {
+        return malformed();
+    }
+    return {absl::OkStatus(), position - data};
+}
+
+}  // namespace ostp::servercc
@@ -2,5 +2,11 @@
 #define SERVERCC_DISTRIBUTED_H_
 
 #include "include/distributed_server.h"
+#include "include/hash_ring.h"
+#include "include/loopback_transport.h"
+#include "include/network_transport.h"
+#include "include/reliable_multicast.h"
+#include "include/swim_membership.h"
+#include "include/transport.h"
 
 #endif
\ No newline at end of file
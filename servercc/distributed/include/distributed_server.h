@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 
+#include <atomic>
 #include <optional>
 #include <queue>
 #include <semaphore>
@@ -18,6 +19,10 @@
 #include "connectors.h"
 #include "message_buffer.h"
 #include "servers.h"
+#include "hash_ring.h"
+#include "reliable_multicast.h"
+#include "swim_membership.h"
+#include "transport.h"
 #include "types.h"
 
 namespace ostp::servercc {
@@ -43,8 +48,17 @@ class DistributedServer {
 
     // Creates a new DistributedServer on the specified interface, group and port.
     //
+    // Peers are discovered with a SWIM membership protocol. A server announces itself with a
+    // multicast connect request until it knows another member and then learns about the rest of
+    // the group through the gossip piggybacked on the membership probes. TCP connections to peers
+    // are opened lazily by the first internal request sent to them, up to connectionsPerPeer
+    // connections per peer across which the requests are striped.
+    //
     // A connect request has the following format:
-    //     connect <port>
+    //     connect <port> <address>
+    //
+    // where the address, announced by servers that know it, identifies the peer together with its
+    // port so that several servers may share a host.
     //
     // Arguments:
     //     interfaceName: The name of the interface to use for the distributed server.
@@ -52,13 +66,36 @@ class DistributedServer {
     //     interfaces: The interface ip address.
     //     port: The port to use for the distributed server.
     //     default_handler: The default handler to use for the distributed server.
-    //     peer_connect_callback: The callback to call when a peer connects.
-    //     peer_disconnect_callback: The callback to call when a peer disconnects.
+    //     viewChangeCallback: The callback to call when a peer joins, is suspected, recovers or
+    //         is declared dead, including when its connection is evicted by the failure detector.
+    //     heartbeatOptions: The heartbeat and failure detection options of the peer links.
+    //     membershipOptions: The options of the membership protocol.
+    //     connectionsPerPeer: The number of connections opened to a peer.
     DistributedServer(
         absl::string_view interfaceName, absl::string_view group,
         std::vector<absl::string_view> interfaces, const uint16_t port, handler_t default_handler,
-        const std::function<void(in_addr_t, DistributedServer &server)> peerConnectCallback,
-        const std::function<void(in_addr_t, DistributedServer &server)> peerDisconnectCallback);
+        const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback,
+        HeartbeatOptions heartbeatOptions = HeartbeatOptions(),
+        MembershipOptions membershipOptions = MembershipOptions(), size_t connectionsPerPeer = 1);
+
+    // Creates a new DistributedServer reaching its peers through the specified transport, such as
+    // a LoopbackTransport running a whole cluster in a single process.
+    //
+    // Arguments:
+    //     transport: The transport of the server.
+    //     default_handler: The default handler to use for the distributed server.
+    //     viewChangeCallback: The callback to call when the state of a peer changes.
+    //     heartbeatOptions: The heartbeat and failure detection options of the peer links.
+    //     membershipOptions: The options of the membership protocol.
+    //     connectionsPerPeer: The number of connections opened to a peer.
+    DistributedServer(
+        std::unique_ptr<Transport> transport, handler_t default_handler,
+        const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback,
+        HeartbeatOptions heartbeatOptions = HeartbeatOptions(),
+        MembershipOptions membershipOptions = MembershipOptions(), size_t connectionsPerPeer = 1);
+
+    // Stops multicasting reliably before the transport stops.
+    ~DistributedServer();
 
     // Methods
 
@@ -75,16 +112,41 @@ class DistributedServer {
     //     A StatusOr<void> with the status of the operation.
     absl::Status addHandler(protocol_t protocol, handler_t handler);
 
+    // Method to enable admission control of the internal requests received from peers. Requests
+    // above the adaptive concurrency limit are answered with an overloaded message. Must be called
+    // before the server runs.
+    //
+    // Arguments:
+    //     options: The options of the concurrency limit.
+    void setAdmissionControl(AdmissionOptions options) {
+        connector.setAdmissionControl(std::move(options));
+    }
+
+    // Method to set the options of the reliable multicast of the server. Must be called before the
+    // server runs.
+    //
+    // Arguments:
+    //     options: The options of the reliable multicast.
+    void setReliableMulticast(ReliableMulticastOptions options) {
+        reliableMulticast.setOptions(std::move(options));
+    }
+
     // Server utilities.
 
     // Method to send a multicast message to all the servers.
     //
+    // A reliable message is delivered to the handler of its protocol on every server that hears
+    // from this server, in the order this server sent its reliable messages. Lost datagrams are
+    // retransmitted when the servers missing them ask for them, so a message still takes a single
+    // datagram instead of one per server. Other messages may be lost or reordered.
+    //
     // Arguments:
     //     message: The message to send.
+    //     reliable: Whether the message is multicast reliably.
     //
     // Returns:
     //     The number of bytes sent or an error.
-    absl::Status multicastMessage(std::unique_ptr<Message> message);
+    absl::Status multicastMessage(std::unique_ptr<Message> message, bool reliable = false);
 
     // Method to send a multicast a connect request to all the servers.
     //
@@ -92,44 +154,101 @@ class DistributedServer {
     //    The number of bytes sent or an error.
     absl::Status sendConnectMessage();
 
-    // Method to send a message to a specific server.
+    // Method to send a message to a specific server. Connects to the server if it is a member
+    // that is not connected yet.
     //
     // Arguments:
-    //     ip: The ip address of the server to send the message to.
-    //     message: The message to send.
+    //     peer: The ip address and port of the server to send the message to, which tell apart
+    //           the servers sharing a host.
+    //     singleShot: Whether the request is a single message answered by a single message. See
+    //                 Connector::sendRequest.
     //
     // Returns:
     //     The ID of the message or an error.
     std::pair<absl::Status, std::unique_ptr<Request>>
-    sendInternalRequest(in_addr_t address);
+    sendInternalRequest(PeerAddress peer, bool singleShot = false);
 
-   private:
-    // Server components.
+    // Method to send a message to a peer chosen by load. Two alive peers are drawn at random and
+    // the less loaded one is used, comparing the expected wait of a new request from the open and
+    // waiting requests and the average response latency of each. Suits stateless protocols that
+    // any peer serves.
+    //
+    // Returns:
+    //     The request or an error. Returns a NotFound error if there is no alive peer.
+    std::pair<absl::Status, std::unique_ptr<Request>> sendInternalRequest();
+
+    // Method to send a message to the server owning the specified key on the consistent hash
+    // ring of the members.
+    //
+    // Arguments:
+    //     key: The key to route the request by.
+    //
+    // Returns:
+    //     The request or an error. Returns a FailedPrecondition error if this server owns the key
+    //     so that the caller serves it locally.
+    std::pair<absl::Status, std::unique_ptr<Request>>
+    sendInternalRequest(absl::string_view key);
+
+    // Method to get the server owning the specified key on the consistent hash ring of the
+    // members that are alive or suspected, including this server.
+    //
+    // Arguments:
+    //     key: The key to look up.
+    //
+    // Returns:
+    //     The ip address and port of the owner.
+    PeerAddress ownerOf(absl::string_view key);
+
+    // Method to get the ip address of this server.
+    //
+    // Returns:
+    //     The ip address of the first interface of this server.
+    in_addr_t getLocalAddress() const { return localAddress; }
 
-    // The TCP server to handle TCP requests.
-    TcpServer tcpServer;
+    // Method to get the ip address and port identifying this server among its peers.
+    //
+    // Returns:
+    //     The ip address of the first interface and the port of this server.
+    PeerAddress getLocalPeer() const { return {localAddress, port}; }
 
-    // The UDP server to handle multicast requests.
-    UdpServer udpServer;
+    // Method to get the peers that are alive or suspected.
+    //
+    // Returns:
+    //     The peers in the current view of the membership.
+    std::vector<Member> members();
+
+   private:
+    // Server components.
 
     // The connector to handle inter-server requests.
     Connector connector;
 
-    // The multicast client to send multicast requests.
-    MulticastClient multicastClient;
+    // Peer server datastructures.
 
-    // Service threads.
+    // The ip address of this server.
+    const in_addr_t localAddress;
 
-    // The thread to run the TCP server.
-    std::thread tcpServerThread;
+    // The membership of the group of servers.
+    SwimMembership membership;
 
-    // The thread to run the UDP server.
-    std::thread udpServerThread;
+    // The consistent hash ring of the members that are not dead including this server.
+    HashRing ring;
 
-    // Peer server datastructures.
+    // The reliable multicast of the messages to the group.
+    ReliableMulticast reliableMulticast;
+
+    // The addresses of the alive peers replaced on every view change so that peers are chosen
+    // without locking.
+    std::atomic<std::shared_ptr<const std::vector<PeerAddress>>> alivePeers;
+
+    // Mutex serializing the updates of the alive peers.
+    std::mutex alivePeersMutex;
 
-    // The list of peers connected to the distributed server.
-    absl::flat_hash_set<in_addr_t> peers;
+    // Mutex serializing the connections opened to peers.
+    std::mutex connectMutex;
+
+    // The number of connections opened to a peer.
+    const size_t connectionsPerPeer;
 
     // Handling datastructures.
 
@@ -142,27 +261,28 @@ class DistributedServer {
 
     // Callbacks.
 
-    // The callback to call when a peer connects.
-    const std::function<void(in_addr_t, DistributedServer &server)> peerConnectCallback;
-
-    // The callback to call when a peer disconnects.
-    const std::function<void(in_addr_t, DistributedServer &server)> peerDisconnectCallback;
-
-    // Server service methods.
-
-    // Method to run the TCP server.
-    absl::Status runTcpServer();
-
-    // Method to run the UDP server.
-    absl::Status runUdpServer();
+    // The callback to call when the state of a peer changes.
+    const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback;
 
     // Internal callback methods.
 
     // Method to handle a Connector disconnect.
     //
     // Arguments:
-    //     ip: The ip address of the peer that disconnected.
-    void onConnectorDisconnect(in_addr_t ip);
+    //     peer: The peer whose last connection was lost.
+    void onConnectorDisconnect(PeerAddress peer);
+
+    // Method to handle a change of the state of a member.
+    //
+    // Arguments:
+    //     member: The member whose state changed.
+    void onViewChange(const Member &member);
+
+    // Method to add a connection to a peer to the connector.
+    //
+    // Arguments:
+    //     connection: The connection opened by the transport.
+    absl::Status addPeer(PeerConnection connection);
 
     // Method to forward the specified request to the protocol processors.
     //
@@ -172,17 +292,30 @@ class DistributedServer {
 
     // Handler methods.
 
-    // Method to handle a connect request.
+    // Method to handle a datagram of the membership protocol or of the handlers.
     //
     // Arguments:
     //     request: The request to handle.
-    absl::Status handleConnect(std::unique_ptr<Request> request);
+    absl::Status handleDatagram(std::unique_ptr<Request> request);
 
-    // Method to handle a connect_ack request.
+    // Method to handle a connect request announcing a new member.
     //
     // Arguments:
     //     request: The request to handle.
-    absl::Status handleConnectAck(std::unique_ptr<Request> request);
+    absl::Status handleConnect(std::unique_ptr<Request> request);
+
+    // Creates a new DistributedServer. See the public constructors for documentation.
+    DistributedServer(
+        std::unique_ptr<Transport> transport, absl::string_view interfaceName,
+        absl::string_view group, std::vector<absl::string_view> interfaces,
+        handler_t default_handler,
+        const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback,
+        HeartbeatOptions heartbeatOptions, MembershipOptions membershipOptions,
+        size_t connectionsPerPeer);
+
+    // The transport of the server. Declared last so that it is destroyed first and stops calling
+    // into the server.
+    std::unique_ptr<Transport> transport;
 };
 
 }  // namespace ostp::servercc
@@ -0,0 +1,83 @@
+#ifndef SERVERCC_HASH_RING_H_
+#define SERVERCC_HASH_RING_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// A consistent hash ring mapping keys to the members that own them.
+//
+// Every member is placed on the ring at a number of pseudo-random points, its virtual nodes, and a
+// key is owned by the member of the first point at or after the hash of the key. Adding or removing
+// a member only moves the keys of the arcs that precede its points, about 1/N of the keys, and the
+// virtual nodes keep the arcs of every member close to the same length.
+//
+// The ring is immutable once published. Updates copy it under a mutex and atomically swap it so
+// that lookups never wait for an update. The hashes do not depend on the process so that every
+// server computes the same owner for a key.
+class HashRing {
+   public:
+    // Creates an empty ring.
+    //
+    // Arguments:
+    //     virtualNodes: The number of points of every member on the ring.
+    explicit HashRing(size_t virtualNodes = 128);
+
+    // Adds a member to the ring. Does nothing if the member is already on the ring.
+    //
+    // Arguments:
+    //     peer: The address and port of the member.
+    void add(PeerAddress peer);
+
+    // Removes a member from the ring. Does nothing if the member is not on the ring.
+    //
+    // Arguments:
+    //     peer: The address and port of the member.
+    void remove(PeerAddress peer);
+
+    // Returns the member owning the specified key or nullopt if the ring is empty.
+    //
+    // Arguments:
+    //     key: The key to look up.
+    std::optional<PeerAddress> owner(absl::string_view key) const;
+
+    // Returns the members on the ring.
+    std::vector<PeerAddress> members() const;
+
+    // Returns the hash of a key on the ring.
+    //
+    // Arguments:
+    //     key: The key to hash.
+    static uint64_t hash(absl::string_view key);
+
+   private:
+    // A published version of the ring.
+    struct Ring {
+        // The points of the ring sorted by hash.
+        std::vector<std::pair<uint64_t, PeerAddress>> points;
+
+        // The members on the ring sorted by address and port.
+        std::vector<PeerAddress> members;
+    };
+
+    // The number of points of every member.
+    const size_t virtualNodes;
+
+    // The current ring.
+    std::atomic<std::shared_ptr<const Ring>> ring;
+
+    // Mutex serializing the updates of the ring.
+    std::mutex updateMutex;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef SERVERCC_LOOPBACK_TRANSPORT_H_
+#define SERVERCC_LOOPBACK_TRANSPORT_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "transport.h"
+
+namespace ostp::servercc {
+
+// The conditions of the links of a loopback network.
+struct LoopbackOptions {
+    // The one way delay of every datagram and message.
+    std::chrono::microseconds latency = std::chrono::microseconds(0);
+
+    // The bandwidth in bytes per second of each direction of a connection and of the datagrams
+    // sent by a server. Unlimited if zero.
+    uint64_t bandwidth = 0;
+
+    // The probability that a datagram is dropped. Messages on connections are never dropped as a
+    // connection is reliable.
+    double lossRate = 0;
+};
+
+class LoopbackTransport;
+
+// An in-process network connecting the loopback transports created on it. Datagrams and the
+// messages of connections are moved through in-memory queues without touching a socket so that a
+// cluster of servers runs in a single process without interfaces, multicast or ports.
+//
+// The network must outlive its transports.
+class LoopbackNetwork {
+   public:
+    // Creates a network.
+    //
+    // Arguments:
+    //     options: The conditions of the links of the network.
+    explicit LoopbackNetwork(LoopbackOptions options = LoopbackOptions()) : options(options) {}
+
+    // Returns the conditions of the links of the network.
+    const LoopbackOptions &getOptions() const { return options; }
+
+   private:
+    friend class LoopbackTransport;
+
+    // The conditions of the links of the network.
+    const LoopbackOptions options;
+
+    // Mutex protecting the transports. Held while a datagram or a connection is handed to a
+    // transport so that the transport is not destroyed in the meantime.
+    std::mutex mutex;
+
+    // The started transports by their address and port.
+    absl::flat_hash_map<uint64_t, LoopbackTransport *> transports;
+};
+
+// A transport over a loopback network. Every transport delivers its datagrams from a thread of its
+// own in the order of their arrival time like a UDP server does. Connections are pairs of in-memory
+// queues whose messages become readable once the latency and the transmission time of the
+// bandwidth elapsed.
+//
+// There are no clients outside of the network so the request handler is never called.
+class LoopbackTransport : public Transport {
+   public:
+    // Creates a transport.
+    //
+    // Arguments:
+    //     network: The network of the transport.
+    //     address: The address of the server on the network.
+    //     port: The port of the server on the network in host byte order.
+    LoopbackTransport(LoopbackNetwork &network, in_addr_t address, uint16_t port);
+
+    // Leaves the network and stops delivering datagrams.
+    ~LoopbackTransport();
+
+    // See transport.h for documentation.
+    in_addr_t getLocalAddress() override { return address; }
+
+    // See transport.h for documentation.
+    uint16_t getPort() override { return port; }
+
+    // See transport.h for documentation.
+    absl::Status start(handler_t datagramHandler, handler_t requestHandler,
+                       accept_handler_t acceptHandler) override;
+
+    // See transport.h for documentation.
+    absl::Status sendDatagram(in_addr_t address, uint16_t port,
+                              std::unique_ptr<Message> message) override;
+
+    // See transport.h for documentation.
+    absl::Status multicastDatagram(std::unique_ptr<Message> message) override;
+
+    // See transport.h for documentation.
+    std::pair<absl::Status, PeerConnection> connect(in_addr_t address, uint16_t port) override;
+
+   private:
+    // A datagram waiting to be delivered.
+    struct Datagram {
+        std::chrono::steady_clock::time_point arrival;
+        uint64_t sequence;
+        sockaddr from;
+        std::unique_ptr<Message> message;
+
+        bool operator>(const Datagram &other) const {
+            return arrival != other.arrival ? arrival > other.arrival : sequence > other.sequence;
+        }
+    };
+
+    // The network of the transport.
+    LoopbackNetwork &network;
+
+    // The address of the server on the network.
+    const in_addr_t address;
+
+    // The port of the server on the network.
+    const uint16_t port;
+
+    // The handlers passed to start().
+    handler_t datagramHandler;
+    accept_handler_t acceptHandler;
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // Signaled when a datagram is queued or the transport stops.
+    std::condition_variable condition;
+
+    // The datagrams waiting to be delivered ordered by arrival.
+    std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram>> datagrams;
+
+    // The sequence of the next queued datagram keeping datagrams of the same arrival in order.
+    uint64_t nextSequence = 0;
+
+    // The time at which the datagrams sent by this transport finish transmitting.
+    std::chrono::steady_clock::time_point transmitEnd;
+
+    // Whether the transport stops.
+    bool stopped = false;
+
+    // The thread delivering the datagrams.
+    std::thread deliveryThread;
+
+    // Returns the key of a transport in the network.
+    static uint64_t key(in_addr_t address, uint16_t port) {
+        return (uint64_t)address << 16 | port;
+    }
+
+    // Returns the time at which a datagram sent now arrives.
+    //
+    // Arguments:
+    //     length: The length of the datagram in bytes.
+    std::chrono::steady_clock::time_point scheduleDatagram(size_t length);
+
+    // Queues a datagram for delivery.
+    //
+    // Arguments:
+    //     arrival: The time at which the datagram arrives.
+    //     from: The address of the sender.
+    //     message: The datagram.
+    void queueDatagram(std::chrono::steady_clock::time_point arrival, const sockaddr &from,
+                       std::unique_ptr<Message> message);
+
+    // Delivers the datagrams until the transport stops.
+    void deliverDatagrams();
+
+    // Returns the address of this transport as seen by its peers.
+    sockaddr socketAddress() const;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef SERVERCC_NETWORK_TRANSPORT_H_
+#define SERVERCC_NETWORK_TRANSPORT_H_
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "clients.h"
+#include "servers.h"
+#include "transport.h"
+
+namespace ostp::servercc {
+
+// A transport over the network of the host. Datagrams are sent over UDP and announcements to a
+// multicast group while peers connect over TCP. A peer on the same host is offered a shared memory
+// link carrying its messages instead of the TCP connection which is then only watched for hang
+// ups. Shared memory links are disabled by setting SERVERCC_SHARED_MEMORY to 0. Messages carried
+// over TCP are compressed with deflate between peers that both set SERVERCC_COMPRESSION to deflate,
+// primed with the dictionary at SERVERCC_COMPRESSION_DICTIONARY if both peers have the same one,
+// and their headers, or their bodies too, are checksummed between peers that both set
+// SERVERCC_FRAME_CHECKSUMS to headers or full. Messages longer than SERVERCC_MAX_FRAME_LENGTH
+// bytes, 64 MiB by default, are refused.
+//
+// Datagrams are multicast to the group on the port of the server unless a group port is set.
+// Servers sharing a host listen on distinct ports, so they only hear each other's announcements
+// and multicasts if they share a group port.
+class NetworkTransport : public Transport {
+   public:
+    // Creates the transport.
+    //
+    // Arguments:
+    //     interfaceName: The name of the interface sending the multicast announcements.
+    //     group: The multicast group address.
+    //     interfaces: The addresses of the interfaces joining the group. The first one is the
+    //         address of this server.
+    //     port: The port of the TCP and UDP servers.
+    //     groupPort: The port the datagrams to the group are multicast to, shared by every server
+    //         of the group. The port of the server if zero.
+    NetworkTransport(absl::string_view interfaceName, absl::string_view group,
+                     std::vector<absl::string_view> interfaces, uint16_t port,
+                     uint16_t groupPort = 0);
+
+    // See transport.h for documentation.
+    in_addr_t getLocalAddress() override { return localAddress; }
+
+    // See transport.h for documentation.
+    uint16_t getPort() override { return port; }
+
+    // See transport.h for documentation.
+    absl::Status start(handler_t datagramHandler, handler_t requestHandler,
+                       accept_handler_t acceptHandler) override;
+
+    // See transport.h for documentation.
+    absl::Status sendDatagram(in_addr_t address, uint16_t port,
+                              std::unique_ptr<Message> message) override;
+
+    // See transport.h for documentation.
+    absl::Status multicastDatagram(std::unique_ptr<Message> message) override;
+
+    // See transport.h for documentation.
+    std::pair<absl::Status, PeerConnection> connect(in_addr_t address, uint16_t port) override;
+
+   private:
+    // The addresses of the interfaces joining the group.
+    const std::vector<absl::string_view> interfaces;
+
+    // The port of the TCP and UDP servers.
+    const uint16_t port;
+
+    // The port the datagrams to the group are multicast to.
+    const uint16_t groupPort;
+
+    // The address of this server.
+    const in_addr_t localAddress;
+
+    // The handlers passed to start().
+    handler_t datagramHandler;
+    handler_t requestHandler;
+    accept_handler_t acceptHandler;
+
+    // The TCP server accepting peers and clients.
+    TcpServer tcpServer;
+
+    // The UDP server receiving datagrams.
+    UdpServer udpServer;
+
+    // The UDP server receiving the datagrams multicast to the group port if it differs from the
+    // port of the server.
+    std::unique_ptr<UdpServer> groupServer;
+
+    // The multicast client sending announcements.
+    MulticastClient multicastClient;
+
+    // The threads running the servers.
+    std::thread tcpServerThread;
+    std::thread udpServerThread;
+    std::thread groupServerThread;
+
+    // Handles a connectAck request opening a connection from a peer.
+    //
+    // Arguments:
+    //     request: The request to handle.
+    absl::Status handleConnectAck(std::unique_ptr<Request> request);
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef SERVERCC_RELIABLE_MULTICAST_H_
+#define SERVERCC_RELIABLE_MULTICAST_H_
+
+#include <netinet/in.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// The configuration of reliable multicast.
+struct ReliableMulticastOptions {
+    // The number of the last messages a sender keeps to retransmit. A receiver that falls further
+    // behind skips the messages it can no longer recover.
+    size_t windowSize = 8192;
+
+    // The minimum time a sender keeps a message to retransmit it. A sender whose window is full of
+    // messages younger than this waits for the oldest one to age, which bounds its rate to
+    // windowSize messages per retention.
+    std::chrono::milliseconds retention = std::chrono::milliseconds(500);
+
+    // The rate in bytes per second at which a sender sends messages and retransmissions, so that
+    // it does not overrun the receivers and the retransmissions it causes. Unlimited if zero.
+    double rate = 125e6;
+
+    // The number of bytes a sender sends at once before its rate applies.
+    size_t burst = 64 * 1024;
+
+    // The longest random delay after which a receiver reports a missing message. A retransmission
+    // asked for by another receiver in the meantime repairs it without a report of its own.
+    std::chrono::milliseconds nackDelay = std::chrono::milliseconds(10);
+
+    // The time after which a receiver reports a message still missing again.
+    std::chrono::milliseconds nackInterval = std::chrono::milliseconds(50);
+
+    // The number of reports after which a receiver gives up on a missing message, about as many as
+    // are sent within the retention.
+    int maxNacks = 10;
+
+    // The time after the last message after which a sender first advertises its last sequence, so
+    // that the receivers detect the loss of the last messages. The advertisements back off to
+    // maxHeartbeatInterval while the sender is idle. A sender also advertises its session from the
+    // start so that the receivers know it before its first message.
+    std::chrono::milliseconds heartbeatInterval = std::chrono::milliseconds(20);
+    std::chrono::milliseconds maxHeartbeatInterval = std::chrono::milliseconds(1000);
+};
+
+// A reliable multicast over unreliable datagrams so that a message reaches every member of the
+// group with a single datagram instead of one per member.
+//
+// Every sender numbers its messages in a session of its own and keeps the last windowSize of them
+// for at least the retention. Receivers deliver the messages of a sender in order, starting after
+// the last one it advertised or from the first one they hear, and report the gaps in the sequence
+// to the sender with negative acknowledgements (NACKs) after a random delay. The sender multicasts
+// the missing messages again so that a single retransmission repairs every receiver missing a
+// message, and ignores the NACKs that arrive for a message it just retransmitted. A sender
+// advertises its session and last sequence, often after its last message and less often while it
+// is idle, so that the loss of its last messages is detected too. Messages and retransmissions are
+// paced to the configured rate.
+//
+// See Floyd et al., "A Reliable Multicast Framework for Light-weight Sessions and Application
+// Level Framing" and RFC 5740, "NACK-Oriented Reliable Multicast (NORM) Transport Protocol".
+class ReliableMulticast {
+   public:
+    // Sends a datagram to a member.
+    typedef std::function<absl::Status(in_addr_t address, uint16_t port,
+                                       std::unique_ptr<Message> message)>
+        send_function_t;
+
+    // Sends a datagram to every member of the group.
+    typedef std::function<absl::Status(std::unique_ptr<Message> message)> multicast_function_t;
+
+    // Creates the reliable multicast of the local member.
+    //
+    // Arguments:
+    //     address: The address of the local member.
+    //     port: The port of the local member in host byte order.
+    //     send: The function used to send NACKs and advertisements to a member.
+    //     multicast: The function used to multicast messages, retransmissions and advertisements.
+    //     deliver: The handler the messages are delivered to in the order of their sender, with
+    //         their original protocol and body. Called by a single thread at a time.
+    //     options: The options of the protocol.
+    ReliableMulticast(in_addr_t address, uint16_t port, send_function_t send,
+                      multicast_function_t multicast, handler_t deliver,
+                      ReliableMulticastOptions options = ReliableMulticastOptions());
+
+    // Stops the protocol.
+    ~ReliableMulticast();
+
+    // Replaces the options of the protocol. Must be called before the protocol starts.
+    //
+    // Arguments:
+    //     options: The options of the protocol.
+    void setOptions(ReliableMulticastOptions options) { this->options = std::move(options); }
+
+    // Starts retransmitting, reporting gaps and advertising on a background thread.
+    void start();
+
+    // Stops the background thread. Messages are still received and sent afterwards, but lost ones
+    // are neither reported nor retransmitted.
+    void stop();
+
+    // Multicasts a message to every member of the group, waiting for the window and the rate to
+    // allow it.
+    //
+    // Arguments:
+    //     message: The message to send.
+    // Returns:
+    //     The status of the operation. Returns an InvalidArgument error if the message does not fit
+    //     in a datagram.
+    absl::Status multicast(std::unique_ptr<Message> message);
+
+    // Handles a message, advertisement or NACK of the protocol.
+    //
+    // Arguments:
+    //     request: The request carrying the datagram.
+    // Returns:
+    //     The status of the operation.
+    absl::Status handleMessage(std::unique_ptr<Request> request);
+
+   private:
+    // A message kept to be retransmitted.
+    struct Sent {
+        // The datagram of the message.
+        std::unique_ptr<Message> datagram;
+
+        // The time it was sent.
+        std::chrono::steady_clock::time_point sentAt;
+
+        // The time it was last retransmitted.
+        std::chrono::steady_clock::time_point repairedAt;
+    };
+
+    // A message missing from a sender.
+    struct Gap {
+        // The time at which it is reported next.
+        std::chrono::steady_clock::time_point deadline;
+
+        // The number of times it was reported.
+        int nacks;
+    };
+
+    // The state of a sender heard by the local member.
+    struct Source {
+        // The address and port of the sender.
+        in_addr_t address;
+        uint16_t port;
+
+        // The session of the sender. A new session starts the sequence again.
+        uint32_t session;
+
+        // The sequence of the next message to deliver and the highest sequence heard.
+        uint64_t expected;
+        uint64_t highest;
+
+        // The messages received ahead of a missing one.
+        std::map<uint64_t, std::unique_ptr<Request>> pending;
+
+        // The missing messages.
+        std::map<uint64_t, Gap> missing;
+    };
+
+    // The local member.
+    const in_addr_t address;
+    const uint16_t port;
+
+    // The session of the local member.
+    const uint32_t session;
+
+    // The functions used to send datagrams.
+    const send_function_t send;
+    const multicast_function_t sendToGroup;
+
+    // The handler of the delivered messages.
+    const handler_t deliver;
+
+    // The options of the protocol.
+    ReliableMulticastOptions options;
+
+    // Sender state.
+
+    // Mutex protecting the sender state.
+    std::mutex senderMutex;
+
+    // The sequence of the next message.
+    uint64_t nextSequence = 1;
+
+    // The last messages sent and the sequence of the first one.
+    std::deque<Sent> window;
+    uint64_t windowStart = 1;
+
+    // The sequences to retransmit.
+    std::vector<uint64_t> repairs;
+
+    // The time at which the bytes sent so far are paced out.
+    std::chrono::steady_clock::time_point paceTime;
+
+    // The time of the next advertisement and the interval after it.
+    std::chrono::steady_clock::time_point heartbeatTime;
+    std::chrono::milliseconds heartbeatDelay{0};
+
+    // Receiver state.
+
+    // Mutex protecting the receiver state.
+    std::mutex receiverMutex;
+
+    // The senders heard by the local member by address and port.
+    absl::flat_hash_map<uint64_t, Source> sources;
+
+    // Mutex held while delivering messages so that the messages of a sender are delivered in
+    // order. Acquired while holding the receiver mutex.
+    std::mutex deliveryMutex;
+
+    // Background thread.
+
+    // Mutex protecting the fields below.
+    std::mutex threadMutex;
+
+    // Signaled when retransmissions are queued or the protocol stops.
+    std::condition_variable condition;
+
+    // Whether retransmissions were queued since the background work last ran.
+    bool repairsQueued = false;
+
+    // Whether the protocol should stop.
+    bool stopped = false;
+
+    // The thread retransmitting, reporting gaps and advertising.
+    std::thread protocolThread;
+
+    // Runs the background work until stopped.
+    void run();
+
+    // Retransmits the queued messages.
+    void sendRepairs();
+
+    // Reports the missing messages whose delay expired and gives up on the ones reported too often.
+    void sendNacks();
+
+    // Advertises the last sequence if the local member was idle for long enough.
+    void sendHeartbeat();
+
+    // Handles a message of a sender.
+    //
+    // Arguments:
+    //     request: The request carrying the message.
+    //     message: The datagram of the message.
+    absl::Status handleData(std::unique_ptr<Request> request, std::unique_ptr<Message> message);
+
+    // Handles the advertisement of a sender.
+    //
+    // Arguments:
+    //     request: The request carrying the advertisement.
+    //     message: The datagram of the advertisement.
+    absl::Status handleHeartbeat(std::unique_ptr<Request> request,
+                                 std::unique_ptr<Message> message);
+
+    // Handles a NACK of a receiver.
+    //
+    // Arguments:
+    //     request: The request carrying the NACK.
+    //     message: The datagram of the NACK.
+    absl::Status handleNack(std::unique_ptr<Request> request, std::unique_ptr<Message> message);
+
+    // Returns the state of a sender, starting it over for a new session. Must hold the receiver
+    // mutex.
+    //
+    // Arguments:
+    //     address: The address of the sender.
+    //     port: The port of the sender.
+    //     session: The session of the sender.
+    //     first: The sequence to start from if the sender is new or its session changed.
+    Source &source(in_addr_t address, uint16_t port, uint32_t session, uint64_t first);
+
+    // Marks the sequences after the highest heard up to the specified one as missing. Must hold
+    // the receiver mutex.
+    //
+    // Arguments:
+    //     source: The sender.
+    //     last: The last missing sequence.
+    void markMissing(Source &source, uint64_t last);
+
+    // Collects the messages of a sender that can be delivered in order, skipping the missing ones
+    // that were given up on or are before the specified sequence. Must hold the receiver mutex.
+    //
+    // Arguments:
+    //     source: The sender.
+    //     floor: The first sequence that can still be recovered.
+    //     deliveries: The messages to deliver.
+    void advance(Source &source, uint64_t floor,
+                 std::vector<std::unique_ptr<Request>> &deliveries);
+
+    // Delivers messages in order and releases the receiver mutex.
+    //
+    // Arguments:
+    //     lock: The lock of the receiver mutex.
+    //     deliveries: The messages to deliver.
+    void deliverAll(std::unique_lock<std::mutex> &lock,
+                    std::vector<std::unique_ptr<Request>> &deliveries);
+
+    // Returns the time to wait before sending the specified number of bytes at the rate. Must
+    // hold the sender mutex.
+    //
+    // Arguments:
+    //     length: The length of the datagram.
+    std::chrono::nanoseconds pace(size_t length);
+
+    // Builds the advertisement of the last sequence. Must hold the sender mutex.
+    std::unique_ptr<Message> buildHeartbeat();
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef SERVERCC_SWIM_MEMBERSHIP_H_
+#define SERVERCC_SWIM_MEMBERSHIP_H_
+
+#include <netinet/in.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// The state of a member as seen by the local member.
+enum class MemberState : uint8_t {
+    kAlive = 0,
+    kSuspect = 1,
+    kDead = 2,
+};
+
+// A member of the group.
+struct Member {
+    // The address of the member.
+    in_addr_t address;
+
+    // The port of the member in host byte order.
+    uint16_t port;
+
+    // The state of the member.
+    MemberState state;
+
+    // The incarnation of the member. Only the member itself increments it to refute a suspicion.
+    uint32_t incarnation;
+
+    // Returns the address and port identifying the member, as several members may share a host.
+    PeerAddress peer() const { return {address, port}; }
+};
+
+// The configuration of the membership protocol.
+struct MembershipOptions {
+    // The interval at which a member is probed.
+    std::chrono::milliseconds protocolPeriod = std::chrono::milliseconds(1000);
+
+    // The time to wait for the ack of a direct probe before probing indirectly.
+    std::chrono::milliseconds probeTimeout = std::chrono::milliseconds(300);
+
+    // The number of members asked to probe a member that did not answer a direct probe.
+    size_t indirectProbes = 3;
+
+    // Scales the time a member stays suspected before being declared dead. The timeout is this
+    // multiplier times the protocol period times log10 of the group size.
+    int suspicionMultiplier = 4;
+
+    // Scales the number of messages an update is piggybacked on. The count is this multiplier
+    // times log10 of the group size.
+    int retransmitMultiplier = 4;
+
+    // The maximum number of updates piggybacked on a single message.
+    size_t maxPiggybackedUpdates = 32;
+};
+
+// A SWIM membership protocol keeping a weakly consistent view of the group over datagrams.
+//
+// Every protocol period the local member probes one member in round-robin order. A member that
+// does not ack is probed indirectly through other members and then suspected. A suspected member
+// that does not refute the suspicion by incrementing its incarnation within the suspicion timeout
+// is declared dead. Membership updates are disseminated by piggybacking them on probes and acks,
+// so each member sends a constant number of messages per period regardless of the group size.
+//
+// See Das et al., "SWIM: Scalable Weakly-consistent Infection-style Process Group Membership
+// Protocol".
+class SwimMembership {
+   public:
+    // Sends a membership message to a member.
+    typedef std::function<absl::Status(in_addr_t address, uint16_t port,
+                                       std::unique_ptr<Message> message)>
+        send_function_t;
+
+    // Creates the membership of the local member.
+    //
+    // Arguments:
+    //     address: The address of the local member.
+    //     port: The port of the local member in host byte order.
+    //     send: The function used to send membership messages.
+    //     announce: The function used to announce the local member while it knows no other member
+    //         such as a multicast connect request.
+    //     viewChangeCallback: The callback called when the state of a member changes. Called
+    //         without holding any lock of the membership.
+    //     options: The protocol options.
+    SwimMembership(in_addr_t address, uint16_t port, send_function_t send,
+                   std::function<absl::Status()> announce,
+                   std::function<void(const Member &)> viewChangeCallback,
+                   MembershipOptions options = MembershipOptions());
+
+    // Stops the protocol.
+    ~SwimMembership();
+
+    // Starts probing the members on a background thread.
+    void start();
+
+    // Adds a member that announced itself and sends it the view of the local member. The
+    // announcements of the local member itself are ignored.
+    //
+    // Arguments:
+    //     address: The address of the member.
+    //     port: The port of the member in host byte order.
+    // Returns:
+    //     The status of the operation.
+    absl::Status handleJoin(in_addr_t address, uint16_t port);
+
+    // Handles a ping, ping request, ack or sync message.
+    //
+    // Arguments:
+    //     request: The request carrying the message.
+    // Returns:
+    //     The status of the operation.
+    absl::Status handleMessage(std::unique_ptr<Request> request);
+
+    // Suspects a member on evidence from outside the protocol such as a failed connection. The
+    // member refutes the suspicion if it is alive.
+    //
+    // Arguments:
+    //     peer: The address and port of the member.
+    void suspect(PeerAddress peer);
+
+    // Returns the member with the specified address and port if it is known.
+    //
+    // Arguments:
+    //     peer: The address and port of the member.
+    std::optional<Member> member(PeerAddress peer);
+
+    // Returns the members that are alive or suspected excluding the local member.
+    std::vector<Member> members();
+
+   private:
+    // An update waiting to be piggybacked.
+    struct Update {
+        Member member;
+        int transmissions;
+    };
+
+    // An indirect probe relayed for another member.
+    struct Relay {
+        in_addr_t origin;
+        uint16_t originPort;
+        uint32_t originSequence;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    // The local member.
+    Member self;
+
+    // The function used to send membership messages.
+    const send_function_t send;
+
+    // The function used to announce the local member.
+    const std::function<absl::Status()> announce;
+
+    // The callback called when the state of a member changes.
+    const std::function<void(const Member &)> viewChangeCallback;
+
+    // The protocol options.
+    const MembershipOptions options;
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // The members known to the local member by address and port including dead ones so that
+    // stale updates about them are rejected.
+    absl::flat_hash_map<PeerAddress, Member> membersByPeer;
+
+    // The time at which each suspected member was suspected.
+    absl::flat_hash_map<PeerAddress, std::chrono::steady_clock::time_point> suspectedAt;
+
+    // The updates waiting to be piggybacked.
+    std::vector<Update> updates;
+
+    // The indirect probes relayed for other members by their relay sequence.
+    absl::flat_hash_map<uint32_t, Relay> relays;
+
+    // The order in which members are probed in the current round and the next position.
+    std::vector<PeerAddress> probeOrder;
+    size_t probePosition = 0;
+
+    // The next sequence number.
+    uint32_t nextSequence = 1;
+
+    // The sequence of the probe waiting for an ack and whether it was acked.
+    uint32_t awaitedSequence = 0;
+    bool awaitedAcked = false;
+
+    // Signaled when the awaited probe is acked or the protocol stops.
+    std::condition_variable condition;
+
+    // Whether the protocol should stop.
+    bool stopped = false;
+
+    // The thread running the protocol periods.
+    std::thread protocolThread;
+
+    // Runs protocol periods until stopped.
+    void run();
+
+    // Runs a single protocol period probing the next member.
+    void probeNext();
+
+    // Declares dead the members suspected for longer than the suspicion timeout and forgets
+    // expired relays.
+    void expireSuspicions();
+
+    // Applies an update to the view following the SWIM precedence rules. Must hold the mutex.
+    //
+    // Arguments:
+    //     update: The update to apply.
+    //     changes: The members whose state changed, to report once the mutex is released.
+    void applyUpdate(const Member &update, std::vector<Member> &changes);
+
+    // Queues an update to be piggybacked. Must hold the mutex.
+    //
+    // Arguments:
+    //     member: The member to disseminate.
+    void queueUpdate(const Member &member);
+
+    // Builds a message piggybacking the updates that were sent the fewest times. Must hold the
+    // mutex.
+    //
+    // Arguments:
+    //     protocol: The protocol of the message.
+    //     sequence: The sequence of the probe.
+    //     target: The member the message is about.
+    //     everyMember: Whether to include the whole view instead of the pending updates.
+    std::unique_ptr<Message> buildMessage(protocol_t protocol, uint32_t sequence,
+                                          const Member &target, bool everyMember);
+
+    // Reports the changes of the view to the callback. Must not hold the mutex.
+    //
+    // Arguments:
+    //     changes: The members whose state changed.
+    void reportChanges(const std::vector<Member> &changes);
+
+    // Returns the number of members that are not dead including the local member. Must hold the
+    // mutex.
+    size_t groupSize();
+};
+
+}  // namespace ostp::servercc
+
+#endif
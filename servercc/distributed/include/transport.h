@@ -0,0 +1,86 @@
+#ifndef SERVERCC_TRANSPORT_H_
+#define SERVERCC_TRANSPORT_H_
+
+#include <netinet/in.h>
+
+#include <functional>
+#include <memory>
+
+#include "absl/status/status.h"
+#include "clients.h"
+#include "connectors.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// A connection to a peer established by a transport.
+struct PeerConnection {
+    // The address of the peer with the port it listens on, which identifies the peer.
+    sockaddr address = {};
+
+    // The socket of the connection if the transport uses one. Kept open as long as the peer.
+    std::unique_ptr<TcpClient> client;
+
+    // The link carrying the messages of the peer. The messages are carried by the socket of the
+    // client if null.
+    std::shared_ptr<MessageLink> link;
+};
+
+// The network a DistributedServer reaches its peers through. A transport carries the datagrams of
+// the membership protocol, the announcements to the group and the connections of the connector.
+class Transport {
+   public:
+    // Called with a connection opened by a peer.
+    typedef std::function<absl::Status(PeerConnection connection)> accept_handler_t;
+
+    virtual ~Transport() = default;
+
+    // Returns the address of this server on the transport.
+    virtual in_addr_t getLocalAddress() = 0;
+
+    // Returns the port of this server on the transport in host byte order.
+    virtual uint16_t getPort() = 0;
+
+    // Starts receiving datagrams, requests and connections.
+    //
+    // Arguments:
+    //     datagramHandler: The handler of the datagrams sent to this server or its group.
+    //     requestHandler: The handler of the requests of clients that are not peers.
+    //     acceptHandler: The handler of the connections opened by peers.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status start(handler_t datagramHandler, handler_t requestHandler,
+                               accept_handler_t acceptHandler) = 0;
+
+    // Sends a message in a single datagram to a server.
+    //
+    // Arguments:
+    //     address: The address of the server.
+    //     port: The port of the server in host byte order.
+    //     message: The message to send.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status sendDatagram(in_addr_t address, uint16_t port,
+                                      std::unique_ptr<Message> message) = 0;
+
+    // Sends a message in a single datagram to every server of the group.
+    //
+    // Arguments:
+    //     message: The message to send.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status multicastDatagram(std::unique_ptr<Message> message) = 0;
+
+    // Opens a connection to a peer. The peer receives the other end through its accept handler.
+    //
+    // Arguments:
+    //     address: The address of the peer.
+    //     port: The port of the peer in host byte order.
+    // Returns:
+    //     The status of the operation and the connection if successful.
+    virtual std::pair<absl::Status, PeerConnection> connect(in_addr_t address, uint16_t port) = 0;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -3,6 +3,7 @@
 #include <arpa/inet.h>
 
 #include <iostream>
+#include <algorithm>
 #include <memory>
 #include <random>
 #include <thread>
@@ -10,90 +11,134 @@
 #include "absl/log/log.h"
 #include "absl/strings/str_cat.h"
 #include "internal_channel_manager.h"
+#include "metrics_handler.h"
+#include "network_transport.h"
 
 namespace ostp::servercc {
 
 using ostp::libcc::data_structures::MessageBuffer;
 using ostp::servercc::kMessageHeaderLength;
 
-namespace {}  // namespace
+namespace {
+
+// Returns a random number from a generator local to the calling thread.
+uint32_t randomNumber() {
+    static thread_local std::minstd_rand generator(std::random_device{}());
+    return generator();
+}
+
+// Returns whether a request to a peer with the first load is expected to complete sooner than to
+// a peer with the second load. The latencies are only compared once both are known so that a
+// new peer is not flooded before its first response.
+bool lessLoaded(const PeerLoad &first, const PeerLoad &second) {
+    uint64_t firstQueue = first.openRequests + first.waitingRequests + 1;
+    uint64_t secondQueue = second.openRequests + second.waitingRequests + 1;
+    if (first.latency == 0 || second.latency == 0) {
+        return firstQueue <= secondQueue;
+    }
+    return firstQueue * first.latency <= secondQueue * second.latency;
+}
+
+}  // namespace
 
 // See distributed.h for documentation.
 DistributedServer::DistributedServer(
     absl::string_view interfaceName, absl::string_view group,
     std::vector<absl::string_view> interfaces, const uint16_t port, handler_t default_handler,
-    const std::function<void(in_addr_t, DistributedServer &server)> peerConnectCallback,
-    const std::function<void(in_addr_t, DistributedServer &server)> peerDisconnectCallback)
+    const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback,
+    HeartbeatOptions heartbeatOptions, MembershipOptions membershipOptions,
+    size_t connectionsPerPeer)
+    : DistributedServer(std::make_unique<NetworkTransport>(interfaceName, group, interfaces, port),
+                        interfaceName, group, interfaces, default_handler, viewChangeCallback,
+                        heartbeatOptions, membershipOptions, connectionsPerPeer) {}
+
+// See distributed.h for documentation.
+DistributedServer::DistributedServer(
+    std::unique_ptr<Transport> transport, handler_t default_handler,
+    const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback,
+    HeartbeatOptions heartbeatOptions, MembershipOptions membershipOptions,
+    size_t connectionsPerPeer)
+    : DistributedServer(std::move(transport), "", "", {}, default_handler, viewChangeCallback,
+                        heartbeatOptions, membershipOptions, connectionsPerPeer) {}
+
+// See distributed.h for documentation.
+DistributedServer::DistributedServer(
+    std::unique_ptr<Transport> transport, absl::string_view interfaceName,
+    absl::string_view group, std::vector<absl::string_view> interfaces,
+    handler_t default_handler,
+    const std::function<void(const Member &, DistributedServer &server)> viewChangeCallback,
+    HeartbeatOptions heartbeatOptions, MembershipOptions membershipOptions,
+    size_t connectionsPerPeer)
     : interfaceName(interfaceName),  // TODO: allow multiple interfaces.
       interfaces(std::move(interfaces)),
       group(group),
-      port(port),
-      udpServer(port, group, this->interfaces,
-                [this](std::unique_ptr<Request> request) -> absl::Status {
-                    return this->forwardRequestToHandler(std::move(request));
-                }),
-      tcpServer(port,
-                [this](std::unique_ptr<Request> request) -> absl::Status {
-                    return this->forwardRequestToHandler(std::move(request));
-                }),
+      port(transport->getPort()),
       connector(
           [this](std::unique_ptr<Request> request) -> absl::Status {
               return this->forwardRequestToHandler(std::move(request));
           },
-          [this](in_addr_t peerIp) { this->onConnectorDisconnect(peerIp); }),
-      multicastClient(interfaceName, group, port, 1),  // TODO: Make TTL configurable.
-      defaultHandler(defaultHandler),
-      peerConnectCallback(peerConnectCallback),
-      peerDisconnectCallback(peerDisconnectCallback) {
-    // TODO define types and return stats from setting handlers.
-    // Add the connect request handler to the UDP server.
-    absl::Status status;
-    if (!(status = udpServer.addHandler(kConnectRequestProtocol,
-                                        [this](std::unique_ptr<Request> request) -> absl::Status {
-                                            return this->handleConnect(std::move(request));
-                                        }))
-             .ok()) {
-        LOG(FATAL) << "Failed to add connect request handler to UDP server: " << status.message();
-    }
-
-    // Add the connectAck request handler to the TCP server.
-    if (!(status = tcpServer.addHandler(kConnectAckRequestProtocol,
-                                        [this](std::unique_ptr<Request> request) -> absl::Status {
-                                            return this->handleConnectAck(std::move(request));
-                                        }))
-             .ok()) {
-        LOG(FATAL) << "Failed to add connectAck request handler to TCP server: "
-                   << status.message();
-    }
+          [this](PeerAddress peer) { this->onConnectorDisconnect(peer); }, heartbeatOptions,
+          connectionsPerPeer),
+      localAddress(transport->getLocalAddress()),
+      membership(
+          localAddress, port,
+          [this](in_addr_t address, uint16_t port, std::unique_ptr<Message> message) {
+              return this->transport->sendDatagram(address, port, std::move(message));
+          },
+          [this]() { return this->sendConnectMessage(); },
+          [this](const Member &member) { this->onViewChange(member); }, membershipOptions),
+      reliableMulticast(
+          localAddress, port,
+          [this](in_addr_t address, uint16_t port, std::unique_ptr<Message> message) {
+              return this->transport->sendDatagram(address, port, std::move(message));
+          },
+          [this](std::unique_ptr<Message> message) {
+              return this->transport->multicastDatagram(std::move(message));
+          },
+          [this](std::unique_ptr<Request> request) -> absl::Status {
+              return this->forwardRequestToHandler(std::move(request));
+          }),
+      alivePeers(std::make_shared<const std::vector<PeerAddress>>()),
+      connectionsPerPeer(std::max<size_t>(connectionsPerPeer, 1)),
+      defaultHandler(default_handler),
+      viewChangeCallback(viewChangeCallback),
+      transport(std::move(transport)) {
+    // Own a share of the keys from the start.
+    ring.add(getLocalPeer());
+
+    // Serve the metrics of the process to peers and TCP clients.
+    handlers.insert({kMetricsRequestProtocol, metricsHandler});
 }
 
+// See distributed.h for documentation.
+DistributedServer::~DistributedServer() { reliableMulticast.stop(); }
+
 // See distributed.h for documentation.
 absl::Status DistributedServer::run() {
-    // Run the services.
-    absl::Status status;
-    if (!(status = runTcpServer()).ok()) {
-        LOG(ERROR) << "Failed to run TCP server: " << status.message();
-        return status;
-    }
-    if (!(status = runUdpServer()).ok()) {
-        LOG(ERROR) << "Failed to run UDP server: " << status.message();
+    // Run the transport.
+    auto status = transport->start(
+        [this](std::unique_ptr<Request> request) -> absl::Status {
+            return this->handleDatagram(std::move(request));
+        },
+        [this](std::unique_ptr<Request> request) -> absl::Status {
+            return this->forwardRequestToHandler(std::move(request));
+        },
+        [this](PeerConnection connection) -> absl::Status {
+            return this->addPeer(std::move(connection));
+        });
+    if (!status.ok()) {
+        LOG(ERROR) << "Failed to run transport: " << status.message();
         return status;
     }
 
-    // TODO make this configurable.
-    // Try to connect to the multicast group.
-    int retries = 5;
-    while (true) {
-        // Send the connect message.
-        const auto result = sendConnectMessage();
-        if (!result.ok()) {
-            // TODO log
-
-        } else {
-            return absl::OkStatus();
-        }
+    // Announce this server to the multicast group and join the members that answer. The
+    // membership keeps announcing while it knows no other member.
+    if (!(status = sendConnectMessage()).ok()) {
+        LOG(WARNING) << "Failed to announce to multicast group: " << status.message();
     }
-    return absl::InternalError("Failed to connect to multicast group");
+    membership.start();
+    reliableMulticast.start();
+    return absl::OkStatus();
 }
 
 // See distributed.h for documentation.
@@ -107,60 +152,146 @@ absl::Status DistributedServer::addHandler(protocol_t protocol, handler_t handle
 }
 
 // See distributed.h for documentation.
-absl::Status DistributedServer::multicastMessage(std::unique_ptr<Message> message) {
-    if (!multicastClient.isOpen() && !multicastClient.openSocket().ok()) {
-        return absl::InternalError("Failed to open socket");
+absl::Status DistributedServer::multicastMessage(std::unique_ptr<Message> message,
+                                                bool reliable) {
+    if (reliable) {
+        return reliableMulticast.multicast(std::move(message));
     }
-    return std::move(multicastClient.sendMessage(std::move(message)));
+    return transport->multicastDatagram(std::move(message));
 }
 
 // See distributed.h for documentation.
 absl::Status DistributedServer::sendConnectMessage() {
     auto message = std::make_unique<Message>();
     message->header.protocol = kConnectRequestProtocol;
-    message->header.length = sizeof(uint16_t);
+    message->header.length = sizeof(uint16_t) + sizeof(in_addr_t);
     message->body.data.resize(message->header.length);
-    memcpy(message->body.data.data(), &port, message->header.length);
+    memcpy(message->body.data.data(), &port, sizeof(uint16_t));
+    memcpy(message->body.data.data() + sizeof(uint16_t), &localAddress, sizeof(in_addr_t));
     return multicastMessage(std::move(message));
 }
 
 // See distributed.h for documentation.
 std::pair<absl::Status, std::unique_ptr<Request>>
-DistributedServer::sendInternalRequest(in_addr_t address) {
-    return connector.sendRequest(address);
+DistributedServer::sendInternalRequest(PeerAddress peer, bool singleShot) {
+    // The connections of a peer are identified by the port it listens on as several servers may
+    // share a host.
+    auto member = membership.member(peer);
+    if (!member.has_value() || member->state == MemberState::kDead) {
+        return {absl::NotFoundError("Peer is not a member"), nullptr};
+    }
+    auto [status, request] = connector.sendRequest(peer, singleShot);
+    if (!absl::IsNotFound(status)) {
+        return {status, std::move(request)};
+    }
+
+    // Connect to the peer as it is a member that is not connected yet.
+    connectMutex.lock();
+    auto connectStatus = connector.sendRequest(peer, singleShot);
+    if (absl::IsNotFound(connectStatus.first)) {
+        // Every connection after the first is only an optimization so that the peer is used as
+        // soon as one connection is open.
+        for (auto count = connector.connectionCount(peer); count < connectionsPerPeer; count++) {
+            auto [openStatus, connection] = transport->connect(peer.address, peer.port);
+            if (openStatus.ok()) {
+                // The peer may have connected to this server in the meantime in which case its
+                // connections are used.
+                openStatus = addPeer(std::move(connection));
+                if (absl::IsAlreadyExists(openStatus)) {
+                    break;
+                }
+            }
+            if (!openStatus.ok()) {
+                if (connector.connectionCount(peer) == 0) {
+                    connectMutex.unlock();
+                    return {openStatus, nullptr};
+                }
+                LOG(WARNING) << "Failed to open an additional connection to peer: "
+                             << openStatus.message();
+                break;
+            }
+        }
+        connectStatus = connector.sendRequest(peer, singleShot);
+    }
+    connectMutex.unlock();
+    return connectStatus;
 }
 
 // See distributed.h for documentation.
-absl::Status DistributedServer::runTcpServer() {
-    // TODO Create setup phase to catch errors early
-    tcpServerThread = std::thread([this]() {
-        LOG(INFO) << "Running TCP server";
-        this->tcpServer.run();
-    });
-    return absl::OkStatus();
+std::pair<absl::Status, std::unique_ptr<Request>> DistributedServer::sendInternalRequest() {
+    // Power of two choices: comparing two random peers avoids herding on the single least loaded
+    // peer whose load every server reads at the same time.
+    auto peers = alivePeers.load();
+    if (peers->empty()) {
+        return {absl::NotFoundError("No alive peer"), nullptr};
+    }
+    auto chosen = (*peers)[randomNumber() % peers->size()];
+    if (peers->size() > 1) {
+        auto other = (*peers)[randomNumber() % (peers->size() - 1)];
+        if (other == chosen) {
+            other = peers->back();
+        }
+        if (lessLoaded(connector.peerLoad(other), connector.peerLoad(chosen))) {
+            chosen = other;
+        }
+    }
+    return sendInternalRequest(chosen);
 }
 
 // See distributed.h for documentation.
-absl::Status DistributedServer::runUdpServer() {
-    // TODO create setup phase to catch errors early
-    udpServerThread = std::thread([this]() {
-        LOG(INFO) << "Running UDP server";
-        this->udpServer.run();
-    });
-    return absl::OkStatus();
+std::pair<absl::Status, std::unique_ptr<Request>>
+DistributedServer::sendInternalRequest(absl::string_view key) {
+    auto owner = ownerOf(key);
+    if (owner == getLocalPeer()) {
+        return {absl::FailedPreconditionError("Key is owned by this server"), nullptr};
+    }
+    return sendInternalRequest(owner);
 }
 
 // See distributed.h for documentation.
-void DistributedServer::onConnectorDisconnect(in_addr_t ip) {
-    char ipStr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &ip, ipStr, INET_ADDRSTRLEN);
+PeerAddress DistributedServer::ownerOf(absl::string_view key) {
+    // The ring always holds this server.
+    return ring.owner(key).value_or(getLocalPeer());
+}
+
+// See distributed.h for documentation.
+std::vector<Member> DistributedServer::members() { return membership.members(); }
+
+// See distributed.h for documentation.
+void DistributedServer::onConnectorDisconnect(PeerAddress peer) {
+    // A lost connection is evidence that the peer failed. The membership protocol confirms it or
+    // the peer refutes the suspicion, and the connections are opened again by the next request.
+    membership.suspect(peer);
+}
+
+// See distributed.h for documentation.
+void DistributedServer::onViewChange(const Member &member) {
+    // Move the keys of a dead peer to the next members on the ring and drop its connection
+    // failing its channels. A suspected peer keeps its keys until it is declared dead.
+    if (member.state == MemberState::kDead) {
+        ring.remove(member.peer());
+        auto status = connector.removeClient(member.peer());
+        if (!status.ok() && !absl::IsNotFound(status)) {
+            LOG(WARNING) << "Failed to remove connections to dead peer: " << status.message();
+        }
+    } else {
+        ring.add(member.peer());
+    }
 
-    // Remove from the peers list.
-    peers.erase(ip);
+    // Publish the alive peers. Suspected peers are avoided as they are likely to fail.
+    alivePeersMutex.lock();
+    auto peers = std::make_shared<std::vector<PeerAddress>>();
+    for (const auto &peer : membership.members()) {
+        if (peer.state == MemberState::kAlive) {
+            peers->push_back({peer.address, peer.port});
+        }
+    }
+    alivePeers.store(std::move(peers));
+    alivePeersMutex.unlock();
 
-    // Call the user-specified disconnect callback.
-    if (peerDisconnectCallback != nullptr) {
-        peerDisconnectCallback(ip, *this);
+    // Call the user-specified view change callback.
+    if (viewChangeCallback != nullptr) {
+        viewChangeCallback(member, *this);
     }
 }
 
@@ -175,114 +306,63 @@ absl::Status DistributedServer::forwardRequestToHandler(std::unique_ptr<Request>
     }
 }
 
+// See distributed.h for documentation.
+absl::Status DistributedServer::handleDatagram(std::unique_ptr<Request> request) {
+    switch (request->getProtocol()) {
+        case kConnectRequestProtocol:
+            return handleConnect(std::move(request));
+        case kMembershipPingProtocol:
+        case kMembershipPingRequestProtocol:
+        case kMembershipAckProtocol:
+        case kMembershipSyncProtocol:
+            return membership.handleMessage(std::move(request));
+        case kReliableMulticastDataProtocol:
+        case kReliableMulticastHeartbeatProtocol:
+        case kReliableMulticastNackProtocol:
+            return reliableMulticast.handleMessage(std::move(request));
+        default:
+            return forwardRequestToHandler(std::move(request));
+    }
+}
+
 // See distributed.h for documentation.
 absl::Status DistributedServer::handleConnect(std::unique_ptr<Request> request) {
     ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive connect request");
-    if (message->header.length != sizeof(uint16_t)) {
+    if (message->header.length != sizeof(uint16_t) &&
+        message->header.length != sizeof(uint16_t) + sizeof(in_addr_t)) {
         return absl::InternalError("Invalid connect request length");
     }
 
-    // Get the port and ip from the connect request.
+    // Get the port and ip from the connect request. The address announced by the peer is preferred
+    // over the source of the datagram which is the address of the interface it was multicast on.
     uint16_t peerPort;
     memcpy(&peerPort, message->body.data.data(), sizeof(uint16_t));
-
-    // Get the IP address from the connect request address.
     auto addr = request->getAddr();
     in_addr_t peerIp = ((sockaddr_in *)&addr)->sin_addr.s_addr;
-    char ipStr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &peerIp, ipStr, INET_ADDRSTRLEN);
-
-    // If the ip address is the same as the interface ip then ignore the
-    // request or if the peer server is already connected.
-    if (interfaces[0] == ipStr || peers.contains(peerIp)) {
-        return absl::OkStatus();
-    }
-
-    // Create a TCP client for the peer server and try to connect to it.
-    auto peerServer = std::make_unique<TcpClient>(ipStr, peerPort);
-    auto openStatus = peerServer->openSocket();
-    if (!openStatus.ok()) {
-        close(peerServer->getClientFd());
-        return absl::InternalError(absl::StrCat("Failed to open socket to peer server '", ipStr,
-                                                "': ", openStatus.message()));
+    if (message->header.length > sizeof(uint16_t)) {
+        memcpy(&peerIp, message->body.data.data() + sizeof(uint16_t), sizeof(in_addr_t));
     }
 
-    // Send a connectAck message to the peer server and wait for a connectAck.
-    auto connectAckMessage = std::make_unique<Message>();
-    connectAckMessage->header.protocol = kConnectAckRequestProtocol;
-    connectAckMessage->header.length = 0;
-    auto sendStatus = peerServer->sendMessage(std::move(connectAckMessage));
-    if (!sendStatus.ok()) {
-        close(peerServer->getClientFd());
-        return absl::InternalError(absl::StrCat("Failed to send connectAck to peer server '", ipStr,
-                                                "': ", sendStatus.message()));
-    }
-
-    // If the peer server did not send a connectAck then close the socket and return.
-    auto [receiveStatus, ackResponse] = peerServer->receiveMessage();
-    if (!receiveStatus.ok() || ackResponse->header.protocol != kConnectAckResponseProtocol) {
-        close(peerServer->getClientFd());
-        return absl::InternalError(absl::StrCat("Failed to receive connect end from peer server '",
-                                                ipStr, "': ", receiveStatus.message()));
-    }
-
-    // Add the peer server to the connector and mappings.
-    auto connectorStatus = connector.addClient(std::move(peerServer));
-    if (!connectorStatus.ok()) {
-        close(peerServer->getClientFd());
-        return absl::InternalError(absl::StrCat("Failed to add peer server '", ipStr,
-                                                "' to connector: ", connectorStatus.message()));
-    }
-
-    // Call the peer connect callback.
-    if (peerConnectCallback != nullptr) {
-        peerConnectCallback(peerIp, *this);
-    }
-    return absl::OkStatus();
+    // Add the peer to the membership which answers with its view. The announcements of this server
+    // are ignored while the other servers on the same host are told apart by their port.
+    return membership.handleJoin(peerIp, peerPort);
 }
 
 // See distributed.h for documentation.
-absl::Status DistributedServer::handleConnectAck(std::unique_ptr<Request> request) {
-    // Get the port and ip from the connect request.
-    sockaddr addr = request->getAddr();
-    auto *addr_in = (sockaddr_in *)&addr;
-    uint16_t peerPort = ntohs(addr_in->sin_port);
-    in_addr_t peerIp = addr_in->sin_addr.s_addr;
+absl::Status DistributedServer::addPeer(PeerConnection connection) {
     char ipStr[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &peerIp, ipStr, INET_ADDRSTRLEN);
-
-    // Add the peer server to the connector and mappings.
-    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(),
-                         "Failed to receive connectAck request");
-
-    // Send connectAck to the peer server.
-    auto connectAckMessage = std::make_unique<Message>();
-    connectAckMessage->header.protocol = kConnectAckResponseProtocol;
-    connectAckMessage->header.length = 0;
-    ASSERT_OK(request->sendMessage(std::move(connectAckMessage)),
-              "Failed to send connectAck to peer server");
-
-    // Try to cast request to TcpRequest.
-    auto tcpRequest = std::unique_ptr<TcpRequest>(dynamic_cast<TcpRequest *>(request.release()));
-    if (tcpRequest == nullptr) {
-        return absl::InternalError("Failed to cast request to TcpRequest");
+    inet_ntop(AF_INET, &((sockaddr_in *)&connection.address)->sin_addr, ipStr, INET_ADDRSTRLEN);
+    absl::Status status;
+    if (connection.client != nullptr) {
+        status = connector.addClient(std::move(connection.client), std::move(connection.link));
+    } else {
+        status = connector.addClient(connection.address, std::move(connection.link));
     }
-
-    // Add the peer server to the connector and mappings.
-    auto connectorStatus = connector.addClient(
-        std::make_unique<TcpClient>(tcpRequest->setKeepAlive(), ipStr, peerPort, addr));
-    if (!connectorStatus.ok()) {
+    if (!status.ok() && !absl::IsAlreadyExists(status)) {
         LOG(ERROR) << "Failed to add peer server '" << ipStr
-                   << "' to connector: " << connectorStatus.message();
-        close(tcpRequest->setKeepAlive());
-        return std::move(connectorStatus);
-    }
-
-    // Call the peer connect callback.
-    if (peerConnectCallback != nullptr) {
-        peerConnectCallback(peerIp, *this);
+                   << "' to connector: " << status.message();
     }
-    return absl::OkStatus();
+    return status;
 }
 
 }  // namespace ostp::servercc
@@ -0,0 +1,97 @@
+#include "hash_ring.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace ostp::servercc {
+
+namespace {
+
+// The splitmix64 finalizer spreading the bits of a 64-bit value.
+uint64_t mix(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+}  // namespace
+
+// See hash_ring.h for documentation.
+HashRing::HashRing(size_t virtualNodes)
+    : virtualNodes(std::max<size_t>(virtualNodes, 1)), ring(std::make_shared<const Ring>()) {}
+
+// See hash_ring.h for documentation.
+void HashRing::add(PeerAddress peer) {
+    std::lock_guard lock(updateMutex);
+    auto current = ring.load();
+    auto member = std::lower_bound(current->members.begin(), current->members.end(), peer);
+    if (member != current->members.end() && *member == peer) {
+        return;
+    }
+
+    // Merge the sorted points of the member into a copy of the ring. The points of the members on
+    // the same host differ by their port.
+    std::vector<std::pair<uint64_t, PeerAddress>> added;
+    added.reserve(virtualNodes);
+    auto seed = mix((uint64_t)peer.address << 16 | peer.port);
+    for (uint64_t i = 0; i < virtualNodes; i++) {
+        added.emplace_back(mix((seed ^ i) + 0x9e3779b97f4a7c15), peer);
+    }
+    std::sort(added.begin(), added.end());
+    auto next = std::make_shared<Ring>();
+    next->points.reserve(current->points.size() + added.size());
+    std::merge(current->points.begin(), current->points.end(), added.begin(), added.end(),
+               std::back_inserter(next->points));
+    next->members = current->members;
+    next->members.insert(next->members.begin() + (member - current->members.begin()), peer);
+    ring.store(std::move(next));
+}
+
+// See hash_ring.h for documentation.
+void HashRing::remove(PeerAddress peer) {
+    std::lock_guard lock(updateMutex);
+    auto current = ring.load();
+    auto member = std::lower_bound(current->members.begin(), current->members.end(), peer);
+    if (member == current->members.end() || *member != peer) {
+        return;
+    }
+
+    // Copy the ring without the points of the member.
+    auto next = std::make_shared<Ring>();
+    next->points.reserve(current->points.size() - virtualNodes);
+    std::copy_if(current->points.begin(), current->points.end(), std::back_inserter(next->points),
+                 [peer](const auto &point) { return point.second != peer; });
+    next->members = current->members;
+    next->members.erase(next->members.begin() + (member - current->members.begin()));
+    ring.store(std::move(next));
+}
+
+// See hash_ring.h for documentation.
+std::optional<PeerAddress> HashRing::owner(absl::string_view key) const {
+    auto current = ring.load();
+    if (current->points.empty()) {
+        return std::nullopt;
+    }
+    auto point =
+        std::lower_bound(current->points.begin(), current->points.end(),
+                         std::make_pair(hash(key), PeerAddress()));
+    if (point == current->points.end()) {
+        point = current->points.begin();
+    }
+    return point->second;
+}
+
+// See hash_ring.h for documentation.
+std::vector<PeerAddress> HashRing::members() const { return ring.load()->members; }
+
+// See hash_ring.h for documentation.
+uint64_t HashRing::hash(absl::string_view key) {
+    // FNV-1a followed by a finalizer as FNV-1a alone spreads short keys poorly.
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    return mix(hash);
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,293 @@
+#include "loopback_transport.h"
+
+#include <arpa/inet.h>
+
+#include <deque>
+#include <random>
+
+#include "absl/log/log.h"
+#include "udp_request.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// Returns a number in [0, 1) from a generator local to the calling thread.
+double randomFraction() {
+    static thread_local std::minstd_rand generator(std::random_device{}());
+    return std::uniform_real_distribution<double>(0, 1)(generator);
+}
+
+// Returns whether a datagram is lost.
+//
+// Arguments:
+//     lossRate: The probability that a datagram is lost.
+bool isLost(double lossRate) { return lossRate > 0 && randomFraction() < lossRate; }
+
+// Returns the time needed to transmit the specified number of bytes.
+//
+// Arguments:
+//     length: The number of bytes.
+//     bandwidth: The bandwidth in bytes per second. Unlimited if zero.
+std::chrono::nanoseconds transmissionTime(size_t length, uint64_t bandwidth) {
+    if (bandwidth == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::nanoseconds((uint64_t)length * 1000000000 / bandwidth);
+}
+
+// One direction of a loopback connection.
+struct Pipe {
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // Signaled when a message is written or the pipe is closed.
+    std::condition_variable condition;
+
+    // The messages in flight with their arrival time.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::unique_ptr<Message>>>
+        messages;
+
+    // The time at which the messages written so far finish transmitting.
+    std::chrono::steady_clock::time_point transmitEnd;
+
+    // Whether the connection was shut down.
+    bool closed = false;
+};
+
+// An end of a loopback connection.
+class LoopbackLink final : public MessageLink {
+   public:
+    LoopbackLink(std::shared_ptr<Pipe> in, std::shared_ptr<Pipe> out,
+                 const LoopbackOptions &options)
+        : in(std::move(in)), out(std::move(out)), options(options) {}
+
+    ~LoopbackLink() { shutdown(); }
+
+    // See message_link.h for documentation.
+    absl::Status write(std::unique_ptr<Message> message) final {
+        message->header.length = message->body.data.size();
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard lock(out->mutex);
+        if (out->closed) {
+            return absl::UnavailableError("Loopback link was shut down");
+        }
+
+        // Messages are transmitted one after the other at the bandwidth of the link and arrive
+        // after the latency, so they keep their order.
+        out->transmitEnd = std::max(out->transmitEnd, now) +
+                           transmissionTime(kMessageHeaderLength + message->header.length,
+                                            options.bandwidth);
+        out->messages.emplace_back(out->transmitEnd + options.latency, std::move(message));
+        out->condition.notify_one();
+        return absl::OkStatus();
+    }
+
+    // See message_link.h for documentation.
+    bool writable() final {
+        std::lock_guard lock(out->mutex);
+        return !out->closed;
+    }
+
+    // See message_link.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> read() final {
+        std::unique_lock lock(in->mutex);
+        while (true) {
+            if (in->closed) {
+                return {absl::UnavailableError("Loopback link was shut down"), nullptr};
+            }
+            if (in->messages.empty()) {
+                in->condition.wait(lock);
+                continue;
+            }
+            auto arrival = in->messages.front().first;
+            if (arrival > std::chrono::steady_clock::now()) {
+                in->condition.wait_until(lock, arrival);
+                continue;
+            }
+            auto message = std::move(in->messages.front().second);
+            in->messages.pop_front();
+            return {absl::OkStatus(), std::move(message)};
+        }
+    }
+
+    // See message_link.h for documentation.
+    void shutdown() final {
+        for (auto *pipe : {in.get(), out.get()}) {
+            std::lock_guard lock(pipe->mutex);
+            pipe->closed = true;
+            pipe->condition.notify_all();
+        }
+    }
+
+   private:
+    // The pipe read by this end.
+    const std::shared_ptr<Pipe> in;
+
+    // The pipe written by this end.
+    const std::shared_ptr<Pipe> out;
+
+    // The conditions of the link.
+    const LoopbackOptions options;
+};
+
+}  // namespace
+
+// See loopback_transport.h for documentation.
+LoopbackTransport::LoopbackTransport(LoopbackNetwork &network, in_addr_t address, uint16_t port)
+    : network(network), address(address), port(port) {}
+
+// See loopback_transport.h for documentation.
+LoopbackTransport::~LoopbackTransport() {
+    network.mutex.lock();
+    auto it = network.transports.find(key(address, port));
+    if (it != network.transports.end() && it->second == this) {
+        network.transports.erase(it);
+    }
+    network.mutex.unlock();
+
+    mutex.lock();
+    stopped = true;
+    condition.notify_all();
+    mutex.unlock();
+    if (deliveryThread.joinable()) {
+        deliveryThread.join();
+    }
+}
+
+// See transport.h for documentation.
+// Only peers connect on the loopback network so there are no requests of clients to handle.
+absl::Status LoopbackTransport::start(handler_t datagramHandler, handler_t,
+                                      accept_handler_t acceptHandler) {
+    this->datagramHandler = std::move(datagramHandler);
+    this->acceptHandler = std::move(acceptHandler);
+    deliveryThread = std::thread([this]() { this->deliverDatagrams(); });
+
+    // Join the network once datagrams and connections can be handled.
+    network.mutex.lock();
+    if (!network.transports.emplace(key(address, port), this).second) {
+        network.mutex.unlock();
+        return absl::AlreadyExistsError("Address is already in use on the loopback network");
+    }
+    network.mutex.unlock();
+    return absl::OkStatus();
+}
+
+// See transport.h for documentation.
+absl::Status LoopbackTransport::sendDatagram(in_addr_t address, uint16_t port,
+                                             std::unique_ptr<Message> message) {
+    message->header.length = message->body.data.size();
+    auto arrival = scheduleDatagram(message->header.length);
+    if (isLost(network.options.lossRate)) {
+        return absl::OkStatus();
+    }
+
+    // A datagram to a server that is not on the network is silently dropped.
+    std::lock_guard lock(network.mutex);
+    auto it = network.transports.find(key(address, port));
+    if (it != network.transports.end()) {
+        it->second->queueDatagram(arrival, socketAddress(), std::move(message));
+    }
+    return absl::OkStatus();
+}
+
+// See transport.h for documentation.
+absl::Status LoopbackTransport::multicastDatagram(std::unique_ptr<Message> message) {
+    message->header.length = message->body.data.size();
+    auto arrival = scheduleDatagram(message->header.length);
+
+    // Every other server on the network receives a copy which is lost independently.
+    std::lock_guard lock(network.mutex);
+    for (auto &[transportKey, transport] : network.transports) {
+        if (transport != this && !isLost(network.options.lossRate)) {
+            transport->queueDatagram(arrival, socketAddress(), std::make_unique<Message>(*message));
+        }
+    }
+    return absl::OkStatus();
+}
+
+// See transport.h for documentation.
+std::pair<absl::Status, PeerConnection> LoopbackTransport::connect(in_addr_t address,
+                                                                   uint16_t port) {
+    auto requestPipe = std::make_shared<Pipe>();
+    auto responsePipe = std::make_shared<Pipe>();
+
+    // Hand the other end to the peer while holding the network so that it stays alive.
+    std::lock_guard lock(network.mutex);
+    auto it = network.transports.find(key(address, port));
+    if (it == network.transports.end()) {
+        return {absl::UnavailableError("No server at the address on the loopback network"),
+                PeerConnection()};
+    }
+    PeerConnection accepted;
+    accepted.address = socketAddress();
+    accepted.link = std::make_shared<LoopbackLink>(requestPipe, responsePipe, network.options);
+    auto status = it->second->acceptHandler(std::move(accepted));
+    if (!status.ok()) {
+        return {status, PeerConnection()};
+    }
+
+    PeerConnection connection;
+    connection.address = it->second->socketAddress();
+    connection.link = std::make_shared<LoopbackLink>(responsePipe, requestPipe, network.options);
+    return {absl::OkStatus(), std::move(connection)};
+}
+
+// See loopback_transport.h for documentation.
+std::chrono::steady_clock::time_point LoopbackTransport::scheduleDatagram(size_t length) {
+    // Datagrams are transmitted one after the other at the bandwidth of the network, including
+    // the ones that are lost on the way.
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(mutex);
+    transmitEnd = std::max(transmitEnd, now) +
+                  transmissionTime(kMessageHeaderLength + length, network.options.bandwidth);
+    return transmitEnd + network.options.latency;
+}
+
+// See loopback_transport.h for documentation.
+void LoopbackTransport::queueDatagram(std::chrono::steady_clock::time_point arrival,
+                                      const sockaddr &from, std::unique_ptr<Message> message) {
+    std::lock_guard lock(mutex);
+    datagrams.push(Datagram{arrival, nextSequence++, from, std::move(message)});
+    condition.notify_one();
+}
+
+// See loopback_transport.h for documentation.
+void LoopbackTransport::deliverDatagrams() {
+    std::unique_lock lock(mutex);
+    while (!stopped) {
+        if (datagrams.empty()) {
+            condition.wait(lock);
+            continue;
+        }
+        auto arrival = datagrams.top().arrival;
+        if (arrival > std::chrono::steady_clock::now()) {
+            condition.wait_until(lock, arrival);
+            continue;
+        }
+
+        // The queue only hands out const references to its top.
+        auto &top = const_cast<Datagram &>(datagrams.top());
+        auto from = top.from;
+        auto message = std::move(top.message);
+        datagrams.pop();
+
+        lock.unlock();
+        auto status = datagramHandler(std::make_unique<UdpRequest>(from, std::move(message)));
+        if (!status.ok()) {
+            LOG(ERROR) << "Failed to handle datagram: " << status.message();
+        }
+        lock.lock();
+    }
+}
+
+// See loopback_transport.h for documentation.
+sockaddr LoopbackTransport::socketAddress() const {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = address;
+    addr.sin_port = htons(port);
+    return *(sockaddr *)&addr;
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,471 @@
+#include "network_transport.h"
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "absl/log/log.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "shm_link.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// Returns whether internal requests to peers on the same host are carried over shared memory.
+// Disabled by setting SERVERCC_SHARED_MEMORY to 0.
+bool sharedMemoryEnabled() {
+    static const bool enabled = []() {
+        auto value = getenv("SERVERCC_SHARED_MEMORY");
+        return value == nullptr || absl::string_view(value) != "0";
+    }();
+    return enabled;
+}
+
+// Returns the newest wire format offered to peers. The compact wire format is disabled by setting
+// SERVERCC_COMPACT_WIRE_FORMAT to 0.
+WireFormat offeredWireFormat() {
+    static const WireFormat format = []() {
+        auto value = getenv("SERVERCC_COMPACT_WIRE_FORMAT");
+        return value == nullptr || absl::string_view(value) != "0" ? kLatestWireFormat
+                                                                   : WireFormat::kLegacy;
+    }();
+    return format;
+}
+
+// Returns the checksums of the messages carried over TCP offered to peers. Disabled unless
+// SERVERCC_FRAME_CHECKSUMS is set to headers or to full for the bodies too.
+FrameChecksums offeredChecksums() {
+    static const FrameChecksums checksums = []() {
+        auto value = getenv("SERVERCC_FRAME_CHECKSUMS");
+        if (value == nullptr) {
+            return FrameChecksums::kNone;
+        }
+        absl::string_view level(value);
+        return level == "full"      ? FrameChecksums::kFull
+               : level == "headers" ? FrameChecksums::kHeaders
+                                    : FrameChecksums::kNone;
+    }();
+    return checksums;
+}
+
+// Returns the length of the longest message carried over TCP, kDefaultMaxFrameLength unless
+// SERVERCC_MAX_FRAME_LENGTH is set to a number of bytes.
+size_t maxFrameLength() {
+    static const size_t length = []() {
+        auto value = getenv("SERVERCC_MAX_FRAME_LENGTH");
+        size_t length;
+        if (value == nullptr || !absl::SimpleAtoi(value, &length) ||
+            length <= kMaxCompactHeaderLength) {
+            return kDefaultMaxFrameLength;
+        }
+        return length;
+    }();
+    return length;
+}
+
+// Returns the checksums agreed on with a peer.
+//
+// Arguments:
+//     checksums: The checksums the peer offered.
+FrameChecksums agreedChecksums(uint8_t checksums) {
+    return (FrameChecksums)std::min(checksums, (uint8_t)offeredChecksums());
+}
+
+// Returns the compression offered to peers. Disabled unless SERVERCC_COMPRESSION is set to deflate.
+// The codec is primed with the contents of the file at SERVERCC_COMPRESSION_DICTIONARY if both
+// peers have the same one.
+const CompressionOptions &offeredCompression() {
+    static const CompressionOptions options = []() {
+        CompressionOptions options;
+        auto value = getenv("SERVERCC_COMPRESSION");
+        if (value == nullptr || absl::string_view(value) != "deflate") {
+            return options;
+        }
+        options.codec = Compression::kDeflate;
+        auto path = getenv("SERVERCC_COMPRESSION_DICTIONARY");
+        if (path == nullptr) {
+            return options;
+        }
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> dictionary{std::istreambuf_iterator<char>(file),
+                                        std::istreambuf_iterator<char>()};
+        if (!file || dictionary.empty()) {
+            LOG(WARNING) << "Failed to read compression dictionary '" << path << "'";
+            return options;
+        }
+        options.dictionary = std::make_shared<const std::vector<uint8_t>>(std::move(dictionary));
+        return options;
+    }();
+    return options;
+}
+
+// Returns the ID of the dictionary offered to peers or zero if there is none.
+uint32_t offeredDictionaryId() {
+    static const uint32_t id = offeredCompression().dictionary != nullptr
+                                   ? dictionaryId(*offeredCompression().dictionary)
+                                   : 0;
+    return id;
+}
+
+// Returns the compression of a link to a peer.
+//
+// Arguments:
+//     codec: The codec agreed on with the peer.
+//     dictionary: The ID of the dictionary agreed on with the peer or zero if there is none.
+CompressionOptions agreedCompression(uint8_t codec, uint32_t dictionary) {
+    auto &offered = offeredCompression();
+    if (offered.codec == Compression::kNone || codec != (uint8_t)offered.codec) {
+        return CompressionOptions();
+    }
+    auto options = offered;
+    if (dictionary == 0 || dictionary != offeredDictionaryId()) {
+        options.dictionary = nullptr;
+    }
+    return options;
+}
+
+// Returns whether an address belongs to an interface of this host.
+//
+// Arguments:
+//     address: The address in network byte order.
+bool isLocalAddress(in_addr_t address) {
+    if ((ntohl(address) >> 24) == 127) {
+        return true;
+    }
+    ifaddrs *interfaceAddresses;
+    if (getifaddrs(&interfaceAddresses) != 0) {
+        return false;
+    }
+    bool local = false;
+    for (auto *entry = interfaceAddresses; entry != nullptr && !local; entry = entry->ifa_next) {
+        if (entry->ifa_addr != nullptr && entry->ifa_addr->sa_family == AF_INET) {
+            local = ((sockaddr_in *)entry->ifa_addr)->sin_addr.s_addr == address;
+        }
+    }
+    freeifaddrs(interfaceAddresses);
+    return local;
+}
+
+}  // namespace
+
+// See network_transport.h for documentation.
+NetworkTransport::NetworkTransport(absl::string_view interfaceName, absl::string_view group,
+                                   std::vector<absl::string_view> interfaces, uint16_t port,
+                                   uint16_t groupPort)
+    : interfaces(std::move(interfaces)),
+      port(port),
+      groupPort(groupPort != 0 ? groupPort : port),
+      localAddress(inet_addr(std::string(this->interfaces[0]).c_str())),
+      tcpServer(port,
+                [this](std::unique_ptr<Request> request) -> absl::Status {
+                    return this->requestHandler(std::move(request));
+                }),
+      udpServer(port, group, this->interfaces,
+                [this](std::unique_ptr<Request> request) -> absl::Status {
+                    return this->datagramHandler(std::move(request));
+                }),
+      multicastClient(interfaceName, group, this->groupPort, 1) {  // TODO: Make TTL configurable.
+    // Receive the datagrams multicast to a port shared by the servers of a host on a socket of its
+    // own as the socket of the port of this server is the only one receiving the datagrams sent to
+    // this server.
+    if (this->groupPort != port) {
+        groupServer = std::make_unique<UdpServer>(
+            this->groupPort, group, this->interfaces,
+            [this](std::unique_ptr<Request> request) -> absl::Status {
+                return this->datagramHandler(std::move(request));
+            });
+    }
+
+    // Add the connectAck request handler to the TCP server.
+    absl::Status status;
+    if (!(status = tcpServer.addHandler(kConnectAckRequestProtocol,
+                                        [this](std::unique_ptr<Request> request) -> absl::Status {
+                                            return this->handleConnectAck(std::move(request));
+                                        }))
+             .ok()) {
+        LOG(FATAL) << "Failed to add connectAck request handler to TCP server: "
+                   << status.message();
+    }
+}
+
+// See transport.h for documentation.
+absl::Status NetworkTransport::start(handler_t datagramHandler, handler_t requestHandler,
+                                     accept_handler_t acceptHandler) {
+    this->datagramHandler = std::move(datagramHandler);
+    this->requestHandler = std::move(requestHandler);
+    this->acceptHandler = std::move(acceptHandler);
+
+    // TODO Create setup phase to catch errors early
+    tcpServerThread = std::thread([this]() {
+        LOG(INFO) << "Running TCP server";
+        this->tcpServer.run();
+    });
+    udpServerThread = std::thread([this]() {
+        LOG(INFO) << "Running UDP server";
+        this->udpServer.run();
+    });
+    if (groupServer != nullptr) {
+        groupServerThread = std::thread([this]() {
+            LOG(INFO) << "Running UDP group server";
+            this->groupServer->run();
+        });
+    }
+    return absl::OkStatus();
+}
+
+// See transport.h for documentation.
+absl::Status NetworkTransport::sendDatagram(in_addr_t address, uint16_t port,
+                                            std::unique_ptr<Message> message) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = address;
+    addr.sin_port = htons(port);
+    return udpServer.sendTo(*(sockaddr *)&addr, std::move(message));
+}
+
+// See transport.h for documentation.
+absl::Status NetworkTransport::multicastDatagram(std::unique_ptr<Message> message) {
+    if (!multicastClient.isOpen() && !multicastClient.openSocket().ok()) {
+        return absl::InternalError("Failed to open socket");
+    }
+    return std::move(multicastClient.sendMessage(std::move(message)));
+}
+
+// See transport.h for documentation.
+std::pair<absl::Status, PeerConnection> NetworkTransport::connect(in_addr_t peerIp,
+                                                                  uint16_t peerPort) {
+    char ipStr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &peerIp, ipStr, INET_ADDRSTRLEN);
+
+    // Create a TCP client for the peer server and try to connect to it.
+    auto peerServer = std::make_unique<TcpClient>(ipStr, peerPort);
+    auto openStatus = peerServer->openSocket();
+    if (!openStatus.ok()) {
+        return {absl::InternalError(absl::StrCat("Failed to open socket to peer server '", ipStr,
+                                                 "': ", openStatus.message())),
+                PeerConnection()};
+    }
+
+    // Offer a shared memory link to a peer on the same host. The TCP connection is kept to detect
+    // that the peer died.
+    std::shared_ptr<ShmLink> link;
+    if (sharedMemoryEnabled() && isLocalAddress(peerIp)) {
+        auto [linkStatus, newLink] = ShmLink::create(peerServer->getClientFd());
+        if (linkStatus.ok()) {
+            link = std::move(newLink);
+        } else {
+            LOG(WARNING) << "Failed to create shared memory link to peer server '" << ipStr
+                         << "': " << linkStatus.message();
+        }
+    }
+
+    // Send a connectAck message with the port of this server, the newest wire format it supports,
+    // the codecs it compresses with and the checksums it offers to the peer server and wait for a
+    // connectAck. The codecs are sent even if there are none ahead of the checksums.
+    auto connectAckMessage = std::make_unique<Message>();
+    connectAckMessage->header.protocol = kConnectAckRequestProtocol;
+    connectAckMessage->body.data.resize(sizeof(uint16_t));
+    memcpy(connectAckMessage->body.data.data(), &port, sizeof(uint16_t));
+    if (link != nullptr) {
+        connectAckMessage->body.data.insert(connectAckMessage->body.data.end(),
+                                            link->getName().begin(), link->getName().end());
+    }
+    connectAckMessage->body.data.push_back(0);
+    connectAckMessage->body.data.push_back((uint8_t)offeredWireFormat());
+    if (offeredCompression().codec != Compression::kNone ||
+        offeredChecksums() != FrameChecksums::kNone) {
+        auto codecs = offeredCompression().codec != Compression::kNone
+                          ? compressionBit(offeredCompression().codec)
+                          : 0;
+        auto dictionary = offeredDictionaryId();
+        connectAckMessage->body.data.push_back(codecs);
+        connectAckMessage->body.data.resize(connectAckMessage->body.data.size() +
+                                            sizeof(uint32_t));
+        memcpy(connectAckMessage->body.data.data() + connectAckMessage->body.data.size() -
+                   sizeof(uint32_t),
+               &dictionary, sizeof(uint32_t));
+    }
+    if (offeredChecksums() != FrameChecksums::kNone) {
+        connectAckMessage->body.data.push_back((uint8_t)offeredChecksums());
+    }
+    connectAckMessage->header.length = connectAckMessage->body.data.size();
+    auto sendStatus = peerServer->sendMessage(std::move(connectAckMessage));
+    if (!sendStatus.ok()) {
+        return {absl::InternalError(absl::StrCat("Failed to send connectAck to peer server '",
+                                                 ipStr, "': ", sendStatus.message())),
+                PeerConnection()};
+    }
+
+    // If the peer server did not send a connectAck then close the socket and return.
+    auto [receiveStatus, ackResponse] = peerServer->receiveMessage();
+    if (!receiveStatus.ok() || ackResponse->header.protocol != kConnectAckResponseProtocol) {
+        return {absl::InternalError(absl::StrCat("Failed to receive connect end from peer server '",
+                                                 ipStr, "': ", receiveStatus.message())),
+                PeerConnection()};
+    }
+
+    // The peer opened the segment or refused it so its name is no longer needed.
+    auto &body = ackResponse->body.data;
+    if (link != nullptr) {
+        link->unlink();
+        if (body.empty() || body[0] != 1) {
+            link = nullptr;
+        }
+    }
+
+    // A peer that does not know wire formats answers without one and a peer that does not know
+    // compression or checksums answers without a codec or without agreeing on checksums. The
+    // shared memory link carries the messages in the legacy wire format.
+    PeerConnection connection;
+    connection.link = std::move(link);
+    if (connection.link == nullptr && body.size() >= 2 &&
+        body[1] == (uint8_t)WireFormat::kCompact) {
+        CompressionOptions compression;
+        if (body.size() >= 3 + sizeof(uint32_t)) {
+            uint32_t dictionary;
+            memcpy(&dictionary, body.data() + 3, sizeof(uint32_t));
+            compression = agreedCompression(body[2], dictionary);
+        }
+        auto checksums = body.size() >= 4 + sizeof(uint32_t)
+                             ? agreedChecksums(body[3 + sizeof(uint32_t)])
+                             : FrameChecksums::kNone;
+        connection.link =
+            std::make_shared<SocketLink>(peerServer->getClientFd(), WireFormat::kCompact,
+                                         compression, checksums, maxFrameLength());
+    }
+    connection.address = peerServer->getClientAddr();
+    connection.client = std::move(peerServer);
+    return {absl::OkStatus(), std::move(connection)};
+}
+
+// See network_transport.h for documentation.
+absl::Status NetworkTransport::handleConnectAck(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(),
+                         "Failed to receive connectAck request");
+    if (message->body.data.size() < sizeof(uint16_t)) {
+        return absl::InvalidArgumentError("Invalid connectAck request length");
+    }
+
+    // Identify the peer by its ip and the port it listens on rather than the ephemeral port of
+    // the connection so that several peers on the same host are told apart.
+    sockaddr addr = request->getAddr();
+    auto *addr_in = (sockaddr_in *)&addr;
+    uint16_t peerPort;
+    memcpy(&peerPort, message->body.data.data(), sizeof(uint16_t));
+    addr_in->sin_port = htons(peerPort);
+    in_addr_t peerIp = addr_in->sin_addr.s_addr;
+    char ipStr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &peerIp, ipStr, INET_ADDRSTRLEN);
+
+    // Try to cast request to TcpRequest.
+    auto tcpRequest = std::unique_ptr<TcpRequest>(dynamic_cast<TcpRequest *>(request.release()));
+    if (tcpRequest == nullptr) {
+        return absl::InternalError("Failed to cast request to TcpRequest");
+    }
+
+    // The client owns the socket from now on and closes it if the connection fails.
+    auto peerServer =
+        std::make_unique<TcpClient>(tcpRequest->setKeepAlive(), ipStr, peerPort, addr);
+
+    // The name of the segment is followed by the newest wire format of a peer that knows them, the
+    // codecs and dictionary of a peer that compresses messages and the checksums a peer that
+    // checksums messages offers.
+    absl::string_view name((const char *)message->body.data.data() + sizeof(uint16_t),
+                           message->body.data.size() - sizeof(uint16_t));
+    auto format = WireFormat::kLegacy;
+    bool formatOffered = false;
+    bool compressionOffered = false;
+    bool checksumsAnswered = false;
+    uint8_t checksumsOffered = 0;
+    uint8_t codecs = 0;
+    uint32_t dictionary = 0;
+    if (auto end = name.find('\0'); end != absl::string_view::npos) {
+        formatOffered = true;
+        if (end + 1 < name.size()) {
+            format = std::min(offeredWireFormat(), (WireFormat)(uint8_t)name[end + 1]);
+        }
+        if (end + 2 + sizeof(uint32_t) < name.size()) {
+            compressionOffered = true;
+            codecs = name[end + 2];
+            memcpy(&dictionary, name.data() + end + 3, sizeof(uint32_t));
+        }
+        if (end + 3 + sizeof(uint32_t) < name.size()) {
+            checksumsAnswered = true;
+            checksumsOffered = name[end + 3 + sizeof(uint32_t)];
+        }
+        name = name.substr(0, end);
+    }
+
+    // Open the shared memory link offered by a peer on the same host.
+    bool offered = !name.empty();
+    std::shared_ptr<ShmLink> link;
+    if (offered && sharedMemoryEnabled() && isLocalAddress(peerIp)) {
+        auto [linkStatus, newLink] = ShmLink::open(name, peerServer->getClientFd());
+        if (linkStatus.ok()) {
+            link = std::move(newLink);
+        } else {
+            LOG(WARNING) << "Failed to open shared memory link from peer server '" << ipStr
+                         << "': " << linkStatus.message();
+        }
+    }
+
+    // Send connectAck to the peer server answering the offers if there were any. A wire format
+    // unknown to this server is answered with the legacy one. Messages are only compressed in the
+    // compact wire format with a codec both peers know and a dictionary both peers have, and only
+    // checksummed in the compact wire format as far as both peers want to.
+    if (format != WireFormat::kCompact) {
+        format = WireFormat::kLegacy;
+    }
+    CompressionOptions compression;
+    if (link == nullptr && format == WireFormat::kCompact &&
+        offeredCompression().codec != Compression::kNone &&
+        (codecs & compressionBit(offeredCompression().codec)) != 0) {
+        compression = agreedCompression((uint8_t)offeredCompression().codec, dictionary);
+    }
+    auto checksums = link == nullptr && format == WireFormat::kCompact
+                         ? agreedChecksums(checksumsOffered)
+                         : FrameChecksums::kNone;
+    auto connectAckMessage = std::make_unique<Message>();
+    connectAckMessage->header.protocol = kConnectAckResponseProtocol;
+    if (offered || formatOffered) {
+        connectAckMessage->body.data.push_back(link != nullptr ? 1 : 0);
+    }
+    if (formatOffered) {
+        connectAckMessage->body.data.push_back((uint8_t)format);
+    }
+    if (compressionOffered) {
+        uint32_t agreedDictionary = compression.dictionary != nullptr ? dictionary : 0;
+        connectAckMessage->body.data.push_back((uint8_t)compression.codec);
+        connectAckMessage->body.data.resize(connectAckMessage->body.data.size() +
+                                            sizeof(uint32_t));
+        memcpy(connectAckMessage->body.data.data() + connectAckMessage->body.data.size() -
+                   sizeof(uint32_t),
+               &agreedDictionary, sizeof(uint32_t));
+    }
+    if (checksumsAnswered) {
+        connectAckMessage->body.data.push_back((uint8_t)checksums);
+    }
+    connectAckMessage->header.length = connectAckMessage->body.data.size();
+    ASSERT_OK(tcpRequest->sendMessage(std::move(connectAckMessage)),
+              "Failed to send connectAck to peer server");
+
+    // Hand the connection to the server.
+    PeerConnection connection;
+    connection.address = addr;
+    connection.link = std::move(link);
+    if (connection.link == nullptr && format == WireFormat::kCompact) {
+        connection.link = std::make_shared<SocketLink>(peerServer->getClientFd(), format,
+                                                       compression, checksums, maxFrameLength());
+    }
+    connection.client = std::move(peerServer);
+    return acceptHandler(std::move(connection));
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,561 @@
+#include "reliable_multicast.h"
+
+#include <algorithm>
+#include <random>
+
+#include "absl/strings/str_cat.h"
+#include "async_log.h"
+#include "metrics_registry.h"
+#include "udp_request.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The header of a message and of an advertisement. The message is followed by its original
+// protocol and body and the advertisement by the first sequence the sender still holds.
+struct __attribute__((packed)) multicast_header_t {
+    // The port of the sender.
+    uint16_t port;
+
+    // The session of the sender.
+    uint32_t session;
+
+    // The sequence of the message or the last sequence sent for an advertisement.
+    uint64_t sequence;
+};
+
+// The header of a NACK. It is followed by the ranges of the missing messages.
+struct __attribute__((packed)) nack_header_t {
+    // The session of the sender the NACK is for.
+    uint32_t session;
+
+    // The number of ranges following the header.
+    uint16_t rangeCount;
+};
+
+// A range of missing messages.
+struct __attribute__((packed)) nack_range_t {
+    uint64_t first;
+    uint32_t count;
+};
+
+// The maximum number of ranges that fit in a NACK.
+constexpr size_t kMaxNackRanges =
+    std::min<size_t>((kMaxDatagramBodyLength - sizeof(nack_header_t)) / sizeof(nack_range_t),
+                     UINT16_MAX);
+
+// The metrics recorded by the reliable multicast of the process.
+struct MulticastMetrics {
+    Counter &sent;
+    Counter &retransmitted;
+    Counter &nacks;
+    Counter &duplicates;
+    Counter &lost;
+};
+
+// Returns the reliable multicast metrics of the process.
+MulticastMetrics &multicastMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static MulticastMetrics metrics = {
+        registry.counter("servercc_reliable_multicast_sent_total"),
+        registry.counter("servercc_reliable_multicast_retransmitted_total"),
+        registry.counter("servercc_reliable_multicast_nacks_total"),
+        registry.counter("servercc_reliable_multicast_duplicates_total"),
+        registry.counter("servercc_reliable_multicast_lost_total"),
+    };
+    return metrics;
+}
+
+// Returns the random generator of the calling thread.
+std::mt19937 &randomGenerator() {
+    static thread_local std::mt19937 generator(std::random_device{}());
+    return generator;
+}
+
+// Returns a new random session.
+uint32_t newSession() { return std::uniform_int_distribution<uint32_t>(1)(randomGenerator()); }
+
+// Returns the first sequence a sender holds when it sent the specified one.
+//
+// Arguments:
+//     sequence: The sequence.
+//     windowSize: The number of messages a sender holds.
+uint64_t windowFloor(uint64_t sequence, size_t windowSize) {
+    return sequence >= windowSize ? sequence - windowSize + 1 : 0;
+}
+
+}  // namespace
+
+// See reliable_multicast.h for documentation.
+ReliableMulticast::ReliableMulticast(in_addr_t address, uint16_t port, send_function_t send,
+                                     multicast_function_t multicast, handler_t deliver,
+                                     ReliableMulticastOptions options)
+    : address(address),
+      port(port),
+      session(newSession()),
+      send(send),
+      sendToGroup(multicast),
+      deliver(deliver),
+      options(options) {}
+
+// See reliable_multicast.h for documentation.
+ReliableMulticast::~ReliableMulticast() { stop(); }
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::start() {
+    senderMutex.lock();
+    heartbeatDelay = options.heartbeatInterval;
+    senderMutex.unlock();
+    protocolThread = std::thread([this]() { this->run(); });
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::stop() {
+    threadMutex.lock();
+    stopped = true;
+    threadMutex.unlock();
+    condition.notify_all();
+    if (protocolThread.joinable()) {
+        protocolThread.join();
+    }
+}
+
+// See reliable_multicast.h for documentation.
+absl::Status ReliableMulticast::multicast(std::unique_ptr<Message> message) {
+    auto length = message->body.data.size();
+    if (sizeof(multicast_header_t) + sizeof(protocol_t) + length > kMaxDatagramBodyLength) {
+        return absl::InvalidArgumentError("Message too long for a datagram");
+    }
+
+    // The sender keeps the datagram to retransmit it and sends a copy.
+    auto datagram = std::make_unique<Message>();
+    datagram->header.protocol = kReliableMulticastDataProtocol;
+    datagram->header.length = sizeof(multicast_header_t) + sizeof(protocol_t) + length;
+    datagram->body.data.resize(datagram->header.length);
+    auto offset = sizeof(multicast_header_t);
+    memcpy(datagram->body.data.data() + offset, &message->header.protocol, sizeof(protocol_t));
+    offset += sizeof(protocol_t);
+    memcpy(datagram->body.data.data() + offset, message->body.data.data(), length);
+
+    // Wait for the oldest message to be kept for the retention if the window is full.
+    std::unique_lock lock(senderMutex);
+    while (!window.empty() && window.size() >= options.windowSize) {
+        auto now = std::chrono::steady_clock::now();
+        auto expiry = window.front().sentAt + options.retention;
+        if (expiry <= now) {
+            window.pop_front();
+            windowStart++;
+            continue;
+        }
+        lock.unlock();
+        std::this_thread::sleep_for(expiry - now);
+        lock.lock();
+    }
+
+    multicast_header_t header = {port, session, nextSequence++};
+    memcpy(datagram->body.data.data(), &header, sizeof(multicast_header_t));
+    auto copy = std::make_unique<Message>(*datagram);
+    auto wait = pace(kMessageHeaderLength + copy->header.length);
+    window.push_back({std::move(datagram), std::chrono::steady_clock::now() + wait, {}});
+    heartbeatDelay = options.heartbeatInterval;
+    heartbeatTime = std::chrono::steady_clock::now() + wait + heartbeatDelay;
+    lock.unlock();
+
+    if (wait.count() > 0) {
+        std::this_thread::sleep_for(wait);
+    }
+    multicastMetrics().sent.add();
+    return sendToGroup(std::move(copy));
+}
+
+// See reliable_multicast.h for documentation.
+absl::Status ReliableMulticast::handleMessage(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(),
+                         "Failed to receive reliable multicast message");
+    switch (message->header.protocol) {
+        case kReliableMulticastDataProtocol:
+            return handleData(std::move(request), std::move(message));
+        case kReliableMulticastHeartbeatProtocol:
+            return handleHeartbeat(std::move(request), std::move(message));
+        case kReliableMulticastNackProtocol:
+            return handleNack(std::move(request), std::move(message));
+        default:
+            return absl::InvalidArgumentError("Not a reliable multicast message");
+    }
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::run() {
+    // The background work runs often enough to report gaps and advertise on time.
+    auto tick = std::max(std::chrono::milliseconds(1),
+                         std::min(options.nackDelay, options.heartbeatInterval) / 2);
+    std::unique_lock lock(threadMutex);
+    while (!stopped) {
+        repairsQueued = false;
+        lock.unlock();
+        sendRepairs();
+        sendNacks();
+        sendHeartbeat();
+        lock.lock();
+        condition.wait_for(lock, tick, [this]() { return stopped || repairsQueued; });
+    }
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::sendRepairs() {
+    std::unique_lock lock(senderMutex);
+    auto queued = std::move(repairs);
+    repairs.clear();
+    for (auto sequence : queued) {
+        // The message may have left the window while the lock was released.
+        if (sequence < windowStart) {
+            continue;
+        }
+        auto copy = std::make_unique<Message>(*window[sequence - windowStart].datagram);
+        auto wait = pace(kMessageHeaderLength + copy->header.length);
+        lock.unlock();
+        if (wait.count() > 0) {
+            std::this_thread::sleep_for(wait);
+        }
+        multicastMetrics().retransmitted.add();
+        auto status = sendToGroup(std::move(copy));
+        if (!status.ok()) {
+            SCC_LOG_EVERY_N(ERROR, 100) << "Failed to retransmit multicast message: "
+                                        << status.message();
+        }
+        lock.lock();
+    }
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::sendNacks() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::tuple<in_addr_t, uint16_t, std::unique_ptr<Message>>> nacks;
+    std::vector<std::unique_ptr<Request>> deliveries;
+    std::unique_lock lock(receiverMutex);
+    for (auto &[key, sender] : sources) {
+        // Report the messages whose delay expired in ranges of consecutive sequences. The ones that
+        // do not fit in the NACK are reported next time.
+        std::vector<nack_range_t> ranges;
+        bool gaveUp = false;
+        for (auto it = sender.missing.begin(); it != sender.missing.end();) {
+            auto sequence = it->first;
+            auto &gap = it->second;
+            if (gap.deadline > now) {
+                ++it;
+                continue;
+            }
+            if (gap.nacks >= options.maxNacks) {
+                it = sender.missing.erase(it);
+                gaveUp = true;
+                continue;
+            }
+            bool extends = !ranges.empty() && ranges.back().count < UINT32_MAX &&
+                           ranges.back().first + ranges.back().count == sequence;
+            if (!extends && ranges.size() == kMaxNackRanges) {
+                ++it;
+                continue;
+            }
+            if (extends) {
+                ranges.back().count++;
+            } else {
+                ranges.push_back({sequence, 1});
+            }
+            gap.nacks++;
+            gap.deadline = now + options.nackInterval;
+            ++it;
+        }
+        if (gaveUp) {
+            advance(sender, 0, deliveries);
+        }
+        if (ranges.empty()) {
+            continue;
+        }
+
+        nack_header_t header = {sender.session, (uint16_t)ranges.size()};
+        auto nack = std::make_unique<Message>();
+        nack->header.protocol = kReliableMulticastNackProtocol;
+        nack->header.length = sizeof(nack_header_t) + ranges.size() * sizeof(nack_range_t);
+        nack->body.data.resize(nack->header.length);
+        memcpy(nack->body.data.data(), &header, sizeof(nack_header_t));
+        memcpy(nack->body.data.data() + sizeof(nack_header_t), ranges.data(),
+               ranges.size() * sizeof(nack_range_t));
+        nacks.emplace_back(sender.address, sender.port, std::move(nack));
+    }
+    deliverAll(lock, deliveries);
+
+    for (auto &[address, port, nack] : nacks) {
+        multicastMetrics().nacks.add();
+        auto status = send(address, port, std::move(nack));
+        if (!status.ok()) {
+            SCC_LOG_EVERY_N(ERROR, 100) << "Failed to send multicast NACK: " << status.message();
+        }
+    }
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::sendHeartbeat() {
+    auto now = std::chrono::steady_clock::now();
+    std::unique_lock lock(senderMutex);
+    if (now < heartbeatTime) {
+        return;
+    }
+    auto heartbeat = buildHeartbeat();
+    heartbeatDelay = std::min(heartbeatDelay * 2, options.maxHeartbeatInterval);
+    heartbeatTime = now + heartbeatDelay;
+    lock.unlock();
+    auto status = sendToGroup(std::move(heartbeat));
+    if (!status.ok()) {
+        SCC_LOG_EVERY_N(ERROR, 100) << "Failed to advertise multicast sequence: "
+                                    << status.message();
+    }
+}
+
+// See reliable_multicast.h for documentation.
+absl::Status ReliableMulticast::handleData(std::unique_ptr<Request> request,
+                                           std::unique_ptr<Message> message) {
+    if (message->body.data.size() < sizeof(multicast_header_t) + sizeof(protocol_t)) {
+        return absl::InvalidArgumentError("Reliable multicast message too short");
+    }
+    multicast_header_t header;
+    memcpy(&header, message->body.data.data(), sizeof(multicast_header_t));
+    if (header.sequence == 0) {
+        return absl::InvalidArgumentError("Invalid reliable multicast sequence");
+    }
+    auto addr = request->getAddr();
+    auto from = ((sockaddr_in *)&addr)->sin_addr.s_addr;
+    if (from == address && header.port == port) {
+        return absl::OkStatus();
+    }
+
+    // The message is delivered as a datagram of its sender with its original protocol and body.
+    auto original = std::make_unique<Message>();
+    auto offset = sizeof(multicast_header_t);
+    memcpy(&original->header.protocol, message->body.data.data() + offset, sizeof(protocol_t));
+    offset += sizeof(protocol_t);
+    original->body.data.assign(message->body.data.begin() + offset, message->body.data.end());
+    original->header.length = original->body.data.size();
+
+    uint64_t sequence = header.sequence;
+    std::vector<std::unique_ptr<Request>> deliveries;
+    std::unique_lock lock(receiverMutex);
+    auto &sender = source(from, header.port, header.session, sequence);
+    if (sequence < sender.expected || sender.pending.contains(sequence)) {
+        multicastMetrics().duplicates.add();
+        return absl::OkStatus();
+    }
+    sender.missing.erase(sequence);
+    markMissing(sender, sequence - 1);
+    sender.highest = std::max(sender.highest, sequence);
+    sender.pending.emplace(sequence, std::make_unique<UdpRequest>(addr, std::move(original)));
+
+    // A receiver a whole window behind skips the messages the sender no longer holds.
+    advance(sender, windowFloor(sequence, options.windowSize), deliveries);
+    deliverAll(lock, deliveries);
+    return absl::OkStatus();
+}
+
+// See reliable_multicast.h for documentation.
+absl::Status ReliableMulticast::handleHeartbeat(std::unique_ptr<Request> request,
+                                                std::unique_ptr<Message> message) {
+    if (message->body.data.size() != sizeof(multicast_header_t) + sizeof(uint64_t)) {
+        return absl::InvalidArgumentError("Invalid multicast advertisement length");
+    }
+    multicast_header_t header;
+    uint64_t first;
+    memcpy(&header, message->body.data.data(), sizeof(multicast_header_t));
+    memcpy(&first, message->body.data.data() + sizeof(multicast_header_t), sizeof(uint64_t));
+    if (header.sequence == UINT64_MAX) {
+        return absl::InvalidArgumentError("Invalid reliable multicast sequence");
+    }
+    auto addr = request->getAddr();
+    auto from = ((sockaddr_in *)&addr)->sin_addr.s_addr;
+    if (from == address && header.port == port) {
+        return absl::OkStatus();
+    }
+
+    // A new receiver starts after the last message, which is the first one if the sender advertises
+    // its session before sending. Otherwise the messages after the highest one
+    // heard are missing and the ones the sender no longer holds are skipped.
+    std::vector<std::unique_ptr<Request>> deliveries;
+    std::unique_lock lock(receiverMutex);
+    auto &sender = source(from, header.port, header.session, header.sequence + 1);
+    markMissing(sender, header.sequence);
+    advance(sender, std::max(first, windowFloor(header.sequence, options.windowSize)),
+            deliveries);
+    deliverAll(lock, deliveries);
+    return absl::OkStatus();
+}
+
+// See reliable_multicast.h for documentation.
+absl::Status ReliableMulticast::handleNack(std::unique_ptr<Request> request,
+                                           std::unique_ptr<Message> message) {
+    if (message->body.data.size() < sizeof(nack_header_t)) {
+        return absl::InvalidArgumentError("Multicast NACK too short");
+    }
+    nack_header_t header;
+    memcpy(&header, message->body.data.data(), sizeof(nack_header_t));
+    if (message->body.data.size() !=
+        sizeof(nack_header_t) + header.rangeCount * sizeof(nack_range_t)) {
+        return absl::InvalidArgumentError("Invalid multicast NACK length");
+    }
+    if (header.session != session) {
+        return absl::OkStatus();
+    }
+
+    // Queue the missing messages that were not just retransmitted for another receiver. A receiver
+    // missing messages the sender no longer holds is told where the window starts.
+    auto now = std::chrono::steady_clock::now();
+    bool queued = false;
+    std::unique_ptr<Message> heartbeat;
+    std::unique_lock lock(senderMutex);
+    for (uint16_t i = 0; i < header.rangeCount; i++) {
+        nack_range_t range;
+        memcpy(&range,
+               message->body.data.data() + sizeof(nack_header_t) + i * sizeof(nack_range_t),
+               sizeof(nack_range_t));
+        if (range.first >= nextSequence) {
+            continue;
+        }
+        if (range.first < windowStart && heartbeat == nullptr) {
+            heartbeat = buildHeartbeat();
+        }
+        auto end = range.first + std::min<uint64_t>(range.count, nextSequence - range.first);
+        for (auto sequence = std::max(range.first, windowStart); sequence < end; sequence++) {
+            auto &sent = window[sequence - windowStart];
+            if (now - sent.repairedAt >= options.nackDelay) {
+                sent.repairedAt = now;
+                repairs.push_back(sequence);
+                queued = true;
+            }
+        }
+    }
+    lock.unlock();
+
+    if (queued) {
+        threadMutex.lock();
+        repairsQueued = true;
+        threadMutex.unlock();
+        condition.notify_all();
+    }
+    if (heartbeat != nullptr) {
+        auto addr = request->getAddr();
+        return send(((sockaddr_in *)&addr)->sin_addr.s_addr,
+                    ntohs(((sockaddr_in *)&addr)->sin_port), std::move(heartbeat));
+    }
+    return absl::OkStatus();
+}
+
+// See reliable_multicast.h for documentation.
+ReliableMulticast::Source &ReliableMulticast::source(in_addr_t address, uint16_t port,
+                                                     uint32_t session, uint64_t first) {
+    auto [it, inserted] = sources.try_emplace((uint64_t)address << 16 | port);
+    auto &sender = it->second;
+    if (inserted || sender.session != session) {
+        // A restarted sender starts a new session whose messages are not related to the old ones.
+        sender.address = address;
+        sender.port = port;
+        sender.session = session;
+        sender.expected = first;
+        sender.highest = first - 1;
+        sender.pending.clear();
+        sender.missing.clear();
+    }
+    return sender;
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::markMissing(Source &source, uint64_t last) {
+    // Only the messages the sender still holds are worth reporting.
+    auto now = std::chrono::steady_clock::now();
+    std::uniform_int_distribution<int64_t> delay(0, options.nackDelay.count());
+    auto first = std::max(source.highest + 1, windowFloor(last, options.windowSize));
+    for (auto missing = first; missing <= last; missing++) {
+        source.missing[missing] = {now + std::chrono::milliseconds(delay(randomGenerator())), 0};
+    }
+    source.highest = std::max(source.highest, last);
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::advance(Source &source, uint64_t floor,
+                                std::vector<std::unique_ptr<Request>> &deliveries) {
+    auto &metrics = multicastMetrics();
+    if (floor > source.expected) {
+        auto skipped = floor - source.expected;
+        while (!source.pending.empty() && source.pending.begin()->first < floor) {
+            deliveries.push_back(std::move(source.pending.begin()->second));
+            source.pending.erase(source.pending.begin());
+            skipped--;
+        }
+        source.missing.erase(source.missing.begin(), source.missing.lower_bound(floor));
+        metrics.lost.add(skipped);
+        source.expected = floor;
+        source.highest = std::max(source.highest, floor - 1);
+    }
+
+    // Deliver the messages up to the first missing one. A message that is neither received nor
+    // missing was given up on.
+    while (true) {
+        auto it = source.pending.begin();
+        if (it != source.pending.end() && it->first == source.expected) {
+            deliveries.push_back(std::move(it->second));
+            source.pending.erase(it);
+        } else if (source.expected <= source.highest &&
+                   !source.missing.contains(source.expected)) {
+            metrics.lost.add();
+        } else {
+            break;
+        }
+        source.expected++;
+    }
+}
+
+// See reliable_multicast.h for documentation.
+void ReliableMulticast::deliverAll(std::unique_lock<std::mutex> &lock,
+                                   std::vector<std::unique_ptr<Request>> &deliveries) {
+    if (deliveries.empty()) {
+        lock.unlock();
+        return;
+    }
+
+    // Take the delivery mutex before releasing the receiver mutex so that the messages collected
+    // by another thread afterwards are delivered after these.
+    std::lock_guard delivering(deliveryMutex);
+    lock.unlock();
+    for (auto &request : deliveries) {
+        auto status = deliver(std::move(request));
+        if (!status.ok()) {
+            SCC_LOG_EVERY_N(ERROR, 100) << "Failed to handle multicast message: "
+                                        << status.message();
+        }
+    }
+}
+
+// See reliable_multicast.h for documentation.
+std::chrono::nanoseconds ReliableMulticast::pace(size_t length) {
+    // A token bucket of burst bytes refilled at the rate, kept as the time at which it empties.
+    if (options.rate <= 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto burstTime = std::chrono::nanoseconds((int64_t)(options.burst * 1e9 / options.rate));
+    paceTime = std::max(paceTime, now - burstTime) +
+               std::chrono::nanoseconds((int64_t)(length * 1e9 / options.rate));
+    return std::max(std::chrono::nanoseconds(0), paceTime - now);
+}
+
+// See reliable_multicast.h for documentation.
+std::unique_ptr<Message> ReliableMulticast::buildHeartbeat() {
+    multicast_header_t header = {port, session, nextSequence - 1};
+    auto heartbeat = std::make_unique<Message>();
+    heartbeat->header.protocol = kReliableMulticastHeartbeatProtocol;
+    heartbeat->header.length = sizeof(multicast_header_t) + sizeof(uint64_t);
+    heartbeat->body.data.resize(heartbeat->header.length);
+    memcpy(heartbeat->body.data.data(), &header, sizeof(multicast_header_t));
+    memcpy(heartbeat->body.data.data() + sizeof(multicast_header_t), &windowStart,
+           sizeof(uint64_t));
+    return heartbeat;
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,481 @@
+#include "swim_membership.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "absl/strings/str_cat.h"
+#include "async_log.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The header of every membership message. It is followed by the piggybacked updates.
+struct __attribute__((packed)) swim_header_t {
+    // The sequence of the probe the message belongs to.
+    uint32_t sequence;
+
+    // The member sending the message and its incarnation.
+    in_addr_t source;
+    uint16_t sourcePort;
+    uint32_t sourceIncarnation;
+
+    // The member the message is about such as the member to probe for a ping request.
+    in_addr_t target;
+    uint16_t targetPort;
+
+    // The number of updates following the header.
+    uint16_t updateCount;
+};
+
+// A membership update piggybacked on a message.
+struct __attribute__((packed)) swim_update_t {
+    in_addr_t address;
+    uint16_t port;
+    uint8_t state;
+    uint32_t incarnation;
+};
+
+// The maximum number of updates that fit in a datagram.
+constexpr size_t kMaxUpdatesPerMessage =
+    (kMaxDatagramBodyLength - sizeof(swim_header_t)) / sizeof(swim_update_t);
+
+// Returns the factor by which timeouts and retransmissions grow with the group size.
+//
+// Arguments:
+//     groupSize: The number of members of the group.
+double groupScale(size_t groupSize) { return std::max(1.0, std::ceil(std::log10(groupSize))); }
+
+// Returns the random generator of the calling thread.
+std::mt19937 &randomGenerator() {
+    static thread_local std::mt19937 generator(std::random_device{}());
+    return generator;
+}
+
+}  // namespace
+
+// See swim_membership.h for documentation.
+SwimMembership::SwimMembership(in_addr_t address, uint16_t port, send_function_t send,
+                               std::function<absl::Status()> announce,
+                               std::function<void(const Member &)> viewChangeCallback,
+                               MembershipOptions options)
+    : self({address, port, MemberState::kAlive, 0}),
+      send(send),
+      announce(announce),
+      viewChangeCallback(viewChangeCallback),
+      options(options) {}
+
+// See swim_membership.h for documentation.
+SwimMembership::~SwimMembership() {
+    mutex.lock();
+    stopped = true;
+    mutex.unlock();
+    condition.notify_all();
+    if (protocolThread.joinable()) {
+        protocolThread.join();
+    }
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::start() {
+    protocolThread = std::thread([this]() { this->run(); });
+}
+
+// See swim_membership.h for documentation.
+absl::Status SwimMembership::handleJoin(in_addr_t address, uint16_t port) {
+    if (PeerAddress{address, port} == self.peer()) {
+        return absl::OkStatus();
+    }
+
+    // Add the member and send it the whole view so that it does not have to wait for the updates
+    // to reach it. A restarted member finds its old incarnation in the view and refutes it.
+    std::vector<Member> changes;
+    Member joined = {address, port, MemberState::kAlive, 0};
+    mutex.lock();
+    applyUpdate(joined, changes);
+    auto sync = buildMessage(kMembershipSyncProtocol, 0, joined, true);
+    mutex.unlock();
+    reportChanges(changes);
+    return send(address, port, std::move(sync));
+}
+
+// See swim_membership.h for documentation.
+absl::Status SwimMembership::handleMessage(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(),
+                         "Failed to receive membership message");
+    auto protocol = message->header.protocol;
+    if (message->body.data.size() < sizeof(swim_header_t)) {
+        return absl::InvalidArgumentError("Membership message too short");
+    }
+    swim_header_t header;
+    memcpy(&header, message->body.data.data(), sizeof(swim_header_t));
+    if (message->body.data.size() !=
+        sizeof(swim_header_t) + header.updateCount * sizeof(swim_update_t)) {
+        return absl::InvalidArgumentError("Invalid membership message length");
+    }
+
+    std::vector<Member> changes;
+    std::vector<std::tuple<in_addr_t, uint16_t, std::unique_ptr<Message>>> replies;
+    mutex.lock();
+
+    // A message from a member proves it alive at its incarnation.
+    Member source = {header.source, header.sourcePort, MemberState::kAlive,
+                     header.sourceIncarnation};
+    applyUpdate(source, changes);
+    for (uint16_t i = 0; i < header.updateCount; i++) {
+        swim_update_t update;
+        memcpy(&update,
+               message->body.data.data() + sizeof(swim_header_t) + i * sizeof(swim_update_t),
+               sizeof(swim_update_t));
+        if (update.state > (uint8_t)MemberState::kDead) {
+            continue;
+        }
+        applyUpdate({update.address, update.port, (MemberState)update.state, update.incarnation},
+                    changes);
+    }
+
+    if (protocol == kMembershipPingProtocol) {
+        // Ack the probe.
+        replies.emplace_back(source.address, source.port,
+                             buildMessage(kMembershipAckProtocol, header.sequence, source, false));
+
+    } else if (protocol == kMembershipPingRequestProtocol) {
+        // Probe the target on behalf of the source and relay its ack.
+        auto sequence = nextSequence++;
+        relays[sequence] = {source.address, source.port, header.sequence,
+                            std::chrono::steady_clock::now() + options.protocolPeriod};
+        Member target = {header.target, header.targetPort, MemberState::kAlive, 0};
+        replies.emplace_back(target.address, target.port,
+                             buildMessage(kMembershipPingProtocol, sequence, target, false));
+
+    } else if (protocol == kMembershipAckProtocol) {
+        // Either the ack of the probe of the local member or of a relayed probe.
+        if (header.sequence == awaitedSequence) {
+            awaitedAcked = true;
+            condition.notify_all();
+        } else if (auto relayIt = relays.find(header.sequence); relayIt != relays.end()) {
+            auto relay = relayIt->second;
+            relays.erase(relayIt);
+            Member origin = {relay.origin, relay.originPort, MemberState::kAlive, 0};
+            replies.emplace_back(
+                relay.origin, relay.originPort,
+                buildMessage(kMembershipAckProtocol, relay.originSequence, origin, false));
+        }
+    }
+    mutex.unlock();
+
+    reportChanges(changes);
+    for (auto &[address, port, reply] : replies) {
+        auto status = send(address, port, std::move(reply));
+        if (!status.ok()) {
+            SCC_LOG_EVERY_N(ERROR, 100) << "Failed to send membership message: "
+                                        << status.message();
+        }
+    }
+    return absl::OkStatus();
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::suspect(PeerAddress peer) {
+    std::vector<Member> changes;
+    mutex.lock();
+    auto it = membersByPeer.find(peer);
+    if (it != membersByPeer.end() && it->second.state == MemberState::kAlive) {
+        auto suspected = it->second;
+        suspected.state = MemberState::kSuspect;
+        applyUpdate(suspected, changes);
+    }
+    mutex.unlock();
+    reportChanges(changes);
+}
+
+// See swim_membership.h for documentation.
+std::optional<Member> SwimMembership::member(PeerAddress peer) {
+    std::lock_guard lock(mutex);
+    auto it = membersByPeer.find(peer);
+    if (it == membersByPeer.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+// See swim_membership.h for documentation.
+std::vector<Member> SwimMembership::members() {
+    std::lock_guard lock(mutex);
+    std::vector<Member> result;
+    for (const auto &[peer, member] : membersByPeer) {
+        if (member.state != MemberState::kDead) {
+            result.push_back(member);
+        }
+    }
+    return result;
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::run() {
+    std::unique_lock lock(mutex);
+    while (!stopped) {
+        auto periodStart = std::chrono::steady_clock::now();
+        lock.unlock();
+        probeNext();
+        expireSuspicions();
+        lock.lock();
+        condition.wait_until(lock, periodStart + options.protocolPeriod,
+                             [this]() { return stopped; });
+    }
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::probeNext() {
+    auto periodStart = std::chrono::steady_clock::now();
+    std::unique_lock lock(mutex);
+
+    // Announce the local member until another member is known.
+    if (groupSize() == 1) {
+        lock.unlock();
+        auto status = announce();
+        if (!status.ok()) {
+            SCC_LOG_EVERY_N(ERROR, 10) << "Failed to announce member: " << status.message();
+        }
+        return;
+    }
+
+    // Pick the next member of the round skipping the ones that died since the round started. A new
+    // round probes every member that is not dead in a new random order.
+    Member target;
+    while (true) {
+        if (probePosition >= probeOrder.size()) {
+            probeOrder.clear();
+            for (const auto &[peer, member] : membersByPeer) {
+                if (member.state != MemberState::kDead) {
+                    probeOrder.push_back(peer);
+                }
+            }
+            std::shuffle(probeOrder.begin(), probeOrder.end(), randomGenerator());
+            probePosition = 0;
+        }
+        auto it = membersByPeer.find(probeOrder[probePosition++]);
+        if (it != membersByPeer.end() && it->second.state != MemberState::kDead) {
+            target = it->second;
+            break;
+        }
+    }
+
+    // Probe the member directly.
+    auto sequence = nextSequence++;
+    awaitedSequence = sequence;
+    awaitedAcked = false;
+    auto ping = buildMessage(kMembershipPingProtocol, sequence, target, false);
+    lock.unlock();
+    send(target.address, target.port, std::move(ping)).IgnoreError();
+    lock.lock();
+    if (condition.wait_until(lock, periodStart + options.probeTimeout,
+                             [this]() { return awaitedAcked || stopped; })) {
+        return;
+    }
+
+    // Ask other members to probe the member in case only the path between them is failing.
+    std::vector<Member> helpers;
+    for (const auto &[peer, member] : membersByPeer) {
+        if (member.state != MemberState::kDead && peer != target.peer()) {
+            helpers.push_back(member);
+        }
+    }
+    std::shuffle(helpers.begin(), helpers.end(), randomGenerator());
+    helpers.resize(std::min(helpers.size(), options.indirectProbes));
+    std::vector<std::pair<Member, std::unique_ptr<Message>>> pingRequests;
+    for (const auto &helper : helpers) {
+        pingRequests.emplace_back(
+            helper, buildMessage(kMembershipPingRequestProtocol, sequence, target, false));
+    }
+    lock.unlock();
+    for (auto &[helper, pingRequest] : pingRequests) {
+        send(helper.address, helper.port, std::move(pingRequest)).IgnoreError();
+    }
+    lock.lock();
+    if (condition.wait_until(lock, periodStart + options.protocolPeriod,
+                             [this]() { return awaitedAcked || stopped; })) {
+        return;
+    }
+
+    // Suspect the member unless it refuted in the meantime.
+    std::vector<Member> changes;
+    auto it = membersByPeer.find(target.peer());
+    if (it != membersByPeer.end() && it->second.state == MemberState::kAlive &&
+        it->second.incarnation == target.incarnation) {
+        auto suspected = it->second;
+        suspected.state = MemberState::kSuspect;
+        applyUpdate(suspected, changes);
+    }
+    lock.unlock();
+    reportChanges(changes);
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::expireSuspicions() {
+    std::vector<Member> changes;
+    auto now = std::chrono::steady_clock::now();
+    mutex.lock();
+    auto timeout = options.suspicionMultiplier * groupScale(groupSize()) * options.protocolPeriod;
+    std::vector<PeerAddress> expired;
+    for (const auto &[peer, since] : suspectedAt) {
+        if (now - since >= timeout) {
+            expired.push_back(peer);
+        }
+    }
+    for (auto peer : expired) {
+        auto dead = membersByPeer[peer];
+        dead.state = MemberState::kDead;
+        applyUpdate(dead, changes);
+    }
+    for (auto it = relays.begin(); it != relays.end();) {
+        if (it->second.deadline < now) {
+            relays.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    mutex.unlock();
+    reportChanges(changes);
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::applyUpdate(const Member &update, std::vector<Member> &changes) {
+    // Refute any suspicion of the local member by outliving its incarnation. Other members on the
+    // same host are told apart by their port.
+    if (update.peer() == self.peer()) {
+        if (update.state != MemberState::kAlive && update.incarnation >= self.incarnation) {
+            self.incarnation = update.incarnation + 1;
+            queueUpdate(self);
+        }
+        return;
+    }
+
+    // Learn about new members unless they are already dead.
+    auto it = membersByPeer.find(update.peer());
+    if (it == membersByPeer.end()) {
+        if (update.state == MemberState::kDead) {
+            return;
+        }
+        membersByPeer.emplace(update.peer(), update);
+        if (update.state == MemberState::kSuspect) {
+            suspectedAt[update.peer()] = std::chrono::steady_clock::now();
+        }
+        queueUpdate(update);
+        changes.push_back(update);
+        return;
+    }
+
+    // An alive member is only revived by a newer incarnation, a suspicion overrides an alive
+    // member of the same incarnation and a death overrides any state of the same incarnation.
+    auto &current = it->second;
+    bool overrides;
+    switch (update.state) {
+        case MemberState::kAlive:
+            overrides = update.incarnation > current.incarnation;
+            break;
+        case MemberState::kSuspect:
+            overrides = current.state == MemberState::kAlive
+                            ? update.incarnation >= current.incarnation
+                            : update.incarnation > current.incarnation;
+            break;
+        case MemberState::kDead:
+            overrides = current.state != MemberState::kDead &&
+                        update.incarnation >= current.incarnation;
+            break;
+    }
+    if (!overrides) {
+        return;
+    }
+    auto stateChanged = current.state != update.state;
+    current = update;
+    if (update.state == MemberState::kSuspect) {
+        suspectedAt.try_emplace(update.peer(), std::chrono::steady_clock::now());
+    } else {
+        suspectedAt.erase(update.peer());
+    }
+    queueUpdate(update);
+    if (stateChanged) {
+        changes.push_back(update);
+    }
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::queueUpdate(const Member &member) {
+    for (auto &update : updates) {
+        if (update.member.peer() == member.peer()) {
+            update = {member, 0};
+            return;
+        }
+    }
+    updates.push_back({member, 0});
+}
+
+// See swim_membership.h for documentation.
+std::unique_ptr<Message> SwimMembership::buildMessage(protocol_t protocol, uint32_t sequence,
+                                                      const Member &target, bool everyMember) {
+    std::vector<Member> piggybacked;
+    if (everyMember) {
+        piggybacked.push_back(self);
+        for (const auto &[peer, member] : membersByPeer) {
+            piggybacked.push_back(member);
+        }
+        piggybacked.resize(std::min(piggybacked.size(), kMaxUpdatesPerMessage));
+
+    } else {
+        // Send the updates that were sent the fewest times and forget the ones that were sent
+        // often enough to have reached every member with high probability.
+        std::sort(updates.begin(), updates.end(), [](const Update &a, const Update &b) {
+            return a.transmissions < b.transmissions;
+        });
+        auto count = std::min(updates.size(), options.maxPiggybackedUpdates);
+        for (size_t i = 0; i < count; i++) {
+            piggybacked.push_back(updates[i].member);
+            updates[i].transmissions++;
+        }
+        auto limit = options.retransmitMultiplier * groupScale(groupSize());
+        std::erase_if(updates, [limit](const Update &update) {
+            return update.transmissions >= limit;
+        });
+    }
+
+    swim_header_t header = {sequence,      self.address, self.port, self.incarnation,
+                            target.address, target.port, (uint16_t)piggybacked.size()};
+    auto message = std::make_unique<Message>();
+    message->header.protocol = protocol;
+    message->header.length = sizeof(swim_header_t) + piggybacked.size() * sizeof(swim_update_t);
+    message->body.data.resize(message->header.length);
+    memcpy(message->body.data.data(), &header, sizeof(swim_header_t));
+    auto offset = sizeof(swim_header_t);
+    for (const auto &member : piggybacked) {
+        swim_update_t update = {member.address, member.port, (uint8_t)member.state,
+                                member.incarnation};
+        memcpy(message->body.data.data() + offset, &update, sizeof(swim_update_t));
+        offset += sizeof(swim_update_t);
+    }
+    return message;
+}
+
+// See swim_membership.h for documentation.
+void SwimMembership::reportChanges(const std::vector<Member> &changes) {
+    if (viewChangeCallback == nullptr) {
+        return;
+    }
+    for (const auto &member : changes) {
+        viewChangeCallback(member);
+    }
+}
+
+// See swim_membership.h for documentation.
+size_t SwimMembership::groupSize() {
+    size_t size = 1;
+    for (const auto &[peer, member] : membersByPeer) {
+        if (member.state != MemberState::kDead) {
+            size++;
+        }
+    }
+    return size;
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,135 @@
+#ifndef SERVERCC_ASYNC_LOG_H
+#define SERVERCC_ASYNC_LOG_H
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "async_log_sink.h"
+
+// The highest verbosity level compiled into the binary. SCC_VLOG statements above this level are
+// removed by the compiler together with the evaluation of their arguments. Configured through the
+// SERVERCC_MAX_VLOG_LEVEL CMake cache variable.
+#ifndef SERVERCC_MAX_VLOG_LEVEL
+#define SERVERCC_MAX_VLOG_LEVEL 0
+#endif
+
+namespace ostp::servercc {
+
+namespace logging_internal {
+
+// The runtime verbosity level.
+extern std::atomic<int> verbosity;
+
+}  // namespace logging_internal
+
+// Returns the runtime verbosity level. Initialized from the SERVERCC_VERBOSITY environment
+// variable and 0 by default.
+inline int logVerbosity() { return logging_internal::verbosity.load(std::memory_order_relaxed); }
+
+// Sets the runtime verbosity level. Statements above the compiled in maximum stay disabled.
+//
+// Arguments:
+//     level: The verbosity level.
+void setLogVerbosity(int level);
+
+// A log statement that formats its arguments into a record and hands it to the async sink when it
+// goes out of scope. Arguments are formatted with absl::StrAppend so only types supported by
+// absl::AlphaNum can be logged.
+class LogLine {
+   public:
+    // Starts a log statement.
+    //
+    // Arguments:
+    //     severity: The severity as a single character such as 'I' or 'E'.
+    //     file: The file of the statement.
+    //     line: The line of the statement.
+    LogLine(char severity, const char *file, int line);
+
+    // Queues the record.
+    ~LogLine();
+
+    // Appends a value to the statement.
+    template <typename T>
+    LogLine &operator<<(const T &value) {
+        absl::StrAppend(&text, value);
+        return *this;
+    }
+
+   private:
+    // The record being built.
+    LogRecord record;
+
+    // The text of the statement. Reuses a buffer of the calling thread.
+    std::string &text;
+};
+
+namespace logging_internal {
+
+// Maps severities to the character used in records.
+constexpr char kSeverityINFO = 'I';
+constexpr char kSeverityWARNING = 'W';
+constexpr char kSeverityERROR = 'E';
+
+// Returns whether a statement sampled every `n` times should be logged this time.
+inline bool shouldSample(std::atomic<uint64_t> &counter, uint64_t n) {
+    return counter.fetch_add(1, std::memory_order_relaxed) % n == 0;
+}
+
+}  // namespace logging_internal
+
+}  // namespace ostp::servercc
+
+// Logs only if the condition holds without evaluating the streamed arguments otherwise.
+#ifndef _SCC_LOG_IF_IMPL
+#define _SCC_LOG_IF_IMPL(severity, condition) \
+    switch (0)                                \
+    case 0:                                   \
+    default:                                  \
+        if (!(condition)) {                   \
+        } else                                \
+            ::ostp::servercc::LogLine(severity, __FILE__, __LINE__)
+#endif
+
+// Logs with the specified severity (INFO, WARNING or ERROR) through the async sink.
+#ifndef SCC_LOG
+#define SCC_LOG(severity) \
+    _SCC_LOG_IF_IMPL(::ostp::servercc::logging_internal::kSeverity##severity, true)
+#endif
+
+// Returns a counter unique to the call site used to sample a statement.
+#ifndef _SCC_SITE_COUNTER
+#define _SCC_SITE_COUNTER()                      \
+    ([]() -> std::atomic<uint64_t> & {           \
+        static std::atomic<uint64_t> counter{0}; \
+        return counter;                          \
+    }())
+#endif
+
+// Logs every n-th time the statement is reached with the specified severity.
+#ifndef SCC_LOG_EVERY_N
+#define SCC_LOG_EVERY_N(severity, n)                                          \
+    _SCC_LOG_IF_IMPL(::ostp::servercc::logging_internal::kSeverity##severity, \
+                     ::ostp::servercc::logging_internal::shouldSample(_SCC_SITE_COUNTER(), n))
+#endif
+
+// Logs at INFO if the specified verbosity level is both compiled in and enabled at runtime.
+#ifndef SCC_VLOG
+#define SCC_VLOG(level)                                         \
+    _SCC_LOG_IF_IMPL('I', (level) <= SERVERCC_MAX_VLOG_LEVEL && \
+                              (level) <= ::ostp::servercc::logVerbosity())
+#endif
+
+// Logs at INFO every n-th time the statement is reached if the verbosity level is enabled.
+#ifndef SCC_VLOG_EVERY_N
+#define SCC_VLOG_EVERY_N(level, n)                                                         \
+    _SCC_LOG_IF_IMPL('I', (level) <= SERVERCC_MAX_VLOG_LEVEL &&                            \
+                              (level) <= ::ostp::servercc::logVerbosity() &&               \
+                              ::ostp::servercc::logging_internal::shouldSample(            \
+                                  _SCC_SITE_COUNTER(), n))
+#endif
+
+#endif
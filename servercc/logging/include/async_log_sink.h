@@ -0,0 +1,118 @@
+#ifndef SERVERCC_ASYNC_LOG_SINK_H
+#define SERVERCC_ASYNC_LOG_SINK_H
+
+#include <inttypes.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "absl/strings/string_view.h"
+
+namespace ostp::servercc {
+
+// A formatted log line waiting to be written by the sink.
+struct LogRecord {
+    // The maximum length of the text of a record. Longer lines are truncated.
+    static constexpr size_t kMaxTextLength = 224;
+
+    // The severity of the record as a single character such as 'I' or 'E'.
+    char severity;
+
+    // The length of the text.
+    uint8_t length;
+
+    // The line of the statement that logged the record.
+    uint16_t line;
+
+    // The thread that logged the record.
+    uint32_t threadId;
+
+    // The wall clock time of the record in microseconds since the epoch.
+    uint64_t timestamp;
+
+    // The file of the statement that logged the record. Points to a string literal.
+    const char *file;
+
+    // The text of the record.
+    char text[kMaxTextLength];
+};
+
+// An asynchronous log sink writing records from a bounded lock-free queue on a background thread.
+//
+// Producers claim a slot of the queue with a single compare-and-swap and never block. If the queue
+// is full the record is dropped and counted instead of stalling the hot path. The writer drains the
+// queue in batches and writes every batch with a single system call.
+class AsyncLogSink {
+   public:
+    // The number of records the queue can hold. Must be a power of two.
+    static constexpr size_t kCapacity = 4096;
+
+    // Returns the sink of the process starting its writer on first use. The sink is flushed when
+    // the process exits.
+    static AsyncLogSink &global();
+
+    // Pushes a record to the queue.
+    //
+    // Arguments:
+    //     record: The record to push.
+    // Returns:
+    //     Whether the record was queued or dropped because the queue was full.
+    bool push(const LogRecord &record);
+
+    // Writes every queued record before returning.
+    void flush();
+
+    // Redirects the output of the sink to the specified file descriptor. Defaults to stderr.
+    //
+    // Arguments:
+    //     fd: The file descriptor to write to.
+    void setOutputFd(int fd) { outputFd.store(fd, std::memory_order_relaxed); }
+
+    // Returns the number of records dropped because the queue was full.
+    uint64_t dropped() const { return droppedRecords.load(std::memory_order_relaxed); }
+
+   private:
+    // A slot of the queue. The sequence tells producers and the writer whose turn it is.
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> sequence;
+        LogRecord record;
+    };
+
+    // Creates a sink and starts its writer.
+    AsyncLogSink();
+
+    // The slots of the queue.
+    std::unique_ptr<std::array<Slot, kCapacity>> slots;
+
+    // The position the next producer claims.
+    alignas(64) std::atomic<uint64_t> enqueuePosition{0};
+
+    // The position the writer reads next. Protected by drainMutex.
+    alignas(64) uint64_t dequeuePosition = 0;
+
+    // Mutex making the draining side single consumer.
+    std::mutex drainMutex;
+
+    // The file descriptor the records are written to.
+    std::atomic<int> outputFd;
+
+    // The number of dropped records.
+    std::atomic<uint64_t> droppedRecords{0};
+
+    // The background writer.
+    std::thread writer;
+
+    // Writes every queued record.
+    //
+    // Returns:
+    //     The number of written records.
+    size_t drain();
+};
+
+}  // namespace ostp::servercc
+
+#endif
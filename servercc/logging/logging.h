@@ -0,0 +1,7 @@
+#ifndef SERVERCC_LOGGING_H
+#define SERVERCC_LOGGING_H
+
+#include "include/async_log.h"
+#include "include/async_log_sink.h"
+
+#endif
@@ -0,0 +1,62 @@
+#include "async_log.h"
+
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+
+namespace ostp::servercc {
+
+namespace logging_internal {
+
+// See async_log.h for documentation.
+std::atomic<int> verbosity = []() {
+    auto level = getenv("SERVERCC_VERBOSITY");
+    return level == nullptr ? 0 : atoi(level);
+}();
+
+}  // namespace logging_internal
+
+namespace {
+
+// Returns the id of the calling thread.
+uint32_t threadId() {
+    static thread_local uint32_t id = syscall(SYS_gettid);
+    return id;
+}
+
+// Returns the text buffer of the calling thread.
+std::string &threadBuffer() {
+    static thread_local std::string buffer;
+    buffer.clear();
+    return buffer;
+}
+
+}  // namespace
+
+// See async_log.h for documentation.
+void setLogVerbosity(int level) {
+    logging_internal::verbosity.store(level, std::memory_order_relaxed);
+}
+
+// See async_log.h for documentation.
+LogLine::LogLine(char severity, const char *file, int line) : text(threadBuffer()) {
+    record.severity = severity;
+    record.line = line;
+    record.file = file;
+}
+
+// See async_log.h for documentation.
+LogLine::~LogLine() {
+    record.length = std::min(text.size(), LogRecord::kMaxTextLength);
+    memcpy(record.text, text.data(), record.length);
+    record.threadId = threadId();
+    record.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+    AsyncLogSink::global().push(record);
+}
+
+}  // namespace ostp::servercc
@@ -0,0 +1,139 @@
+#include "async_log_sink.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+
+#include "absl/strings/str_cat.h"
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The interval at which the writer polls an empty queue.
+constexpr auto kPollInterval = std::chrono::milliseconds(1);
+
+// The size of the buffer a batch of records is formatted into.
+constexpr size_t kBatchBufferSize = 1 << 16;
+
+// Returns the base name of a path.
+absl::string_view baseName(absl::string_view path) {
+    auto slash = path.rfind('/');
+    return slash == absl::string_view::npos ? path : path.substr(slash + 1);
+}
+
+// Formats a record like absl logging does and appends it to the buffer.
+void appendRecord(std::string &buffer, const LogRecord &record) {
+    time_t seconds = record.timestamp / 1000000;
+    tm time;
+    localtime_r(&seconds, &time);
+    char prefix[32];
+    strftime(prefix, sizeof(prefix), "%m%d %H:%M:%S", &time);
+    absl::StrAppend(&buffer, absl::string_view(&record.severity, 1), prefix, ".",
+                    absl::Dec(record.timestamp % 1000000, absl::kZeroPad6), " ", record.threadId,
+                    " ", baseName(record.file), ":", record.line, "] ",
+                    absl::string_view(record.text, record.length), "\n");
+}
+
+}  // namespace
+
+// See async_log_sink.h for documentation.
+AsyncLogSink &AsyncLogSink::global() {
+    // Never destroyed so that detached threads can keep logging during exit.
+    static AsyncLogSink *sink = []() {
+        auto *sink = new AsyncLogSink();
+        atexit([]() { AsyncLogSink::global().flush(); });
+        return sink;
+    }();
+    return *sink;
+}
+
+// See async_log_sink.h for documentation.
+AsyncLogSink::AsyncLogSink()
+    : slots(std::make_unique<std::array<Slot, kCapacity>>()), outputFd(STDERR_FILENO) {
+    for (size_t i = 0; i < kCapacity; i++) {
+        (*slots)[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    writer = std::thread([this]() {
+        while (true) {
+            if (drain() == 0) {
+                std::this_thread::sleep_for(kPollInterval);
+            }
+        }
+    });
+    writer.detach();
+}
+
+// See async_log_sink.h for documentation.
+bool AsyncLogSink::push(const LogRecord &record) {
+    auto position = enqueuePosition.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &(*slots)[position & (kCapacity - 1)];
+        auto sequence = slot->sequence.load(std::memory_order_acquire);
+        auto difference = (int64_t)sequence - (int64_t)position;
+        if (difference == 0) {
+            // The slot is free, try to claim it.
+            if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                      std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The writer has not consumed the slot yet so the queue is full.
+            static auto &dropped = MetricsRegistry::global().counter("servercc_log_dropped_total");
+            dropped.add();
+            droppedRecords.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Publish the record to the writer.
+    slot->record = record;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+// See async_log_sink.h for documentation.
+void AsyncLogSink::flush() {
+    while (drain() > 0) {
+    }
+}
+
+// See async_log_sink.h for documentation.
+size_t AsyncLogSink::drain() {
+    std::lock_guard lock(drainMutex);
+    std::string buffer;
+    size_t count = 0;
+    while (true) {
+        auto &slot = (*slots)[dequeuePosition & (kCapacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+            break;
+        }
+        appendRecord(buffer, slot.record);
+        slot.sequence.store(dequeuePosition + kCapacity, std::memory_order_release);
+        dequeuePosition++;
+        count++;
+        if (buffer.size() >= kBatchBufferSize) {
+            break;
+        }
+    }
+
+    // Write the batch.
+    auto fd = outputFd.load(std::memory_order_relaxed);
+    for (size_t offset = 0; offset < buffer.size();) {
+        auto written = write(fd, buffer.data() + offset, buffer.size() - offset);
+        if (written <= 0) {
+            break;
+        }
+        offset += written;
+    }
+    return count;
+}
+
+}  // namespace ostp::servercc
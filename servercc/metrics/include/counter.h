@@ -0,0 +1,106 @@
+#ifndef SERVERCC_COUNTER_H
+#define SERVERCC_COUNTER_H
+
+#include <inttypes.h>
+#include <sched.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace ostp::servercc {
+
+// The number of shards of a sharded metric. Must be a power of two.
+constexpr size_t kMetricShards = 16;
+
+// Returns the shard of a sharded metric the calling thread should update. Threads running on
+// different cores update different shards so that hot metrics do not bounce a single cache line
+// between cores.
+inline size_t metricShardIndex() {
+    int cpu = sched_getcpu();
+    if (cpu < 0) {
+        static thread_local size_t threadShard =
+            std::hash<std::thread::id>()(std::this_thread::get_id());
+        return threadShard & (kMetricShards - 1);
+    }
+    return cpu & (kMetricShards - 1);
+}
+
+// A value sharded per core. Updates are wait-free and reads sum every shard.
+//
+// Arguments:
+//     T: The type of the value.
+template <typename T>
+class ShardedValue {
+   public:
+    // Adds the specified amount to the value.
+    //
+    // Arguments:
+    //     amount: The amount to add.
+    void add(T amount) {
+        shards[metricShardIndex()].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // Returns the current value.
+    T value() const {
+        T sum = 0;
+        for (auto &shard : shards) {
+            sum += shard.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+   private:
+    // A shard padded to its own cache line.
+    struct alignas(64) Shard {
+        std::atomic<T> value{0};
+    };
+
+    // The shards of the value.
+    std::array<Shard, kMetricShards> shards;
+};
+
+// A monotonically increasing counter.
+class Counter {
+   public:
+    // Increments the counter by the specified amount.
+    //
+    // Arguments:
+    //     amount: The amount to increment the counter by.
+    void add(uint64_t amount = 1) { value_.add(amount); }
+
+    // Returns the current value of the counter.
+    uint64_t value() const { return value_.value(); }
+
+   private:
+    // The value of the counter.
+    ShardedValue<uint64_t> value_;
+};
+
+// A value that can go up and down.
+class Gauge {
+   public:
+    // Adds the specified amount to the gauge.
+    //
+    // Arguments:
+    //     amount: The amount to add which may be negative.
+    void add(int64_t amount = 1) { value_.add(amount); }
+
+    // Subtracts the specified amount from the gauge.
+    //
+    // Arguments:
+    //     amount: The amount to subtract.
+    void sub(int64_t amount = 1) { value_.add(-amount); }
+
+    // Returns the current value of the gauge.
+    int64_t value() const { return value_.value(); }
+
+   private:
+    // The value of the gauge.
+    ShardedValue<int64_t> value_;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef SERVERCC_HISTOGRAM_H
+#define SERVERCC_HISTOGRAM_H
+
+#include <inttypes.h>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace ostp::servercc {
+
+// A point in time copy of a histogram.
+class HistogramSnapshot {
+   public:
+    // Constructs a snapshot from the bucket counts and the sum of the recorded values.
+    //
+    // Arguments:
+    //     counts: The count of every bucket.
+    //     sum: The sum of the recorded values.
+    HistogramSnapshot(std::vector<uint64_t> counts, uint64_t sum);
+
+    // Constructs an empty snapshot.
+    HistogramSnapshot() : HistogramSnapshot({}, 0) {}
+
+    // Returns the number of recorded values.
+    uint64_t count() const { return total; }
+
+    // Returns the sum of the recorded values.
+    uint64_t sum() const { return valueSum; }
+
+    // Returns the highest value equivalent to the value at the specified percentile.
+    //
+    // Arguments:
+    //     percentile: The percentile in the range [0, 100].
+    uint64_t percentile(double percentile) const;
+
+    // Returns the highest value equivalent to the highest recorded value.
+    uint64_t max() const;
+
+    // Adds the values of another snapshot to this snapshot.
+    //
+    // Arguments:
+    //     other: The snapshot to add.
+    void merge(const HistogramSnapshot &other);
+
+   private:
+    // The count of every bucket.
+    std::vector<uint64_t> counts;
+
+    // The number of recorded values.
+    uint64_t total;
+
+    // The sum of the recorded values.
+    uint64_t valueSum;
+};
+
+// A lock-free log-linear histogram of unsigned values such as latencies in nanoseconds.
+//
+// Values below 64 are recorded exactly. Every larger power of two is split into 32 linear
+// sub-buckets so any reported value is within about 3% of the recorded value. Recording is a
+// single relaxed atomic increment of the bucket and of the sum.
+class Histogram {
+   public:
+    // The number of linear sub-buckets per power of two.
+    static constexpr size_t kSubBuckets = 32;
+
+    // The number of buckets needed to cover every 64-bit value.
+    static constexpr size_t kBuckets = 60 * kSubBuckets;
+
+    // Records a value.
+    //
+    // Arguments:
+    //     value: The value to record.
+    void record(uint64_t value) {
+        buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        valueSum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Returns a snapshot of the histogram.
+    HistogramSnapshot snapshot() const;
+
+    // Returns the bucket of the specified value.
+    //
+    // Arguments:
+    //     value: The value.
+    static size_t bucketOf(uint64_t value) {
+        if (value < 2 * kSubBuckets) {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - 5;
+        return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+    }
+
+    // Returns the highest value that falls into the specified bucket.
+    //
+    // Arguments:
+    //     bucket: The bucket.
+    static uint64_t highestValueOf(size_t bucket) {
+        if (bucket < 2 * kSubBuckets) {
+            return bucket;
+        }
+        int shift = bucket / kSubBuckets - 1;
+        uint64_t low = (bucket % kSubBuckets + kSubBuckets) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+
+   private:
+    // The count of every bucket.
+    std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+
+    // The sum of the recorded values.
+    std::atomic<uint64_t> valueSum{0};
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef SERVERCC_METRICS_HANDLER_H
+#define SERVERCC_METRICS_HANDLER_H
+
+#include <memory>
+
+#include "absl/status/status.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// Handles a kMetricsRequestProtocol request by responding with a single kMetricsResponseProtocol
+// message containing every metric of the process in the text exposition format.
+//
+// Arguments:
+//     request: The request to handle.
+// Returns:
+//     The status of the operation.
+absl::Status metricsHandler(std::unique_ptr<Request> request);
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef SERVERCC_METRICS_REGISTRY_H
+#define SERVERCC_METRICS_REGISTRY_H
+
+#include <inttypes.h>
+
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "counter.h"
+#include "histogram.h"
+
+namespace ostp::servercc {
+
+// The labels of a metric as ordered key value pairs.
+typedef std::vector<std::pair<std::string, std::string>> metric_labels_t;
+
+// The type of a metric.
+enum class MetricType { kCounter, kGauge, kHistogram };
+
+// A point in time copy of a metric.
+struct MetricSnapshot {
+    // The name of the metric.
+    std::string name;
+
+    // The labels of the metric.
+    metric_labels_t labels;
+
+    // The type of the metric.
+    MetricType type;
+
+    // The value of a counter or gauge.
+    int64_t value;
+
+    // The snapshot of a histogram.
+    HistogramSnapshot histogram;
+};
+
+// A process wide registry of metrics.
+//
+// Metrics are created on first use and live for the lifetime of the registry so references
+// returned by the registry can be cached by the caller and updated without touching the registry
+// again. Lookups take a shared lock and only the creation of a new metric takes an exclusive lock.
+// A metric name must always be used with the same type.
+class MetricsRegistry {
+   public:
+    // Returns the registry of the process.
+    static MetricsRegistry &global();
+
+    // Returns the counter with the specified name and labels creating it if needed.
+    //
+    // Arguments:
+    //     name: The name of the counter.
+    //     labels: The labels of the counter.
+    Counter &counter(absl::string_view name, const metric_labels_t &labels = {});
+
+    // Returns the gauge with the specified name and labels creating it if needed.
+    //
+    // Arguments:
+    //     name: The name of the gauge.
+    //     labels: The labels of the gauge.
+    Gauge &gauge(absl::string_view name, const metric_labels_t &labels = {});
+
+    // Returns the histogram with the specified name and labels creating it if needed.
+    //
+    // Arguments:
+    //     name: The name of the histogram.
+    //     labels: The labels of the histogram.
+    Histogram &histogram(absl::string_view name, const metric_labels_t &labels = {});
+
+    // Returns a snapshot of every metric ordered by name and labels.
+    std::vector<MetricSnapshot> snapshot() const;
+
+    // Returns every metric in the Prometheus text exposition format. Histograms are exposed as
+    // summaries with the 0.5, 0.9, 0.99 and 0.999 quantiles.
+    std::string exposition() const;
+
+   private:
+    // A registered metric. Exactly one of the pointers is set.
+    struct Entry {
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    // The metrics identified by their name and labels.
+    std::map<std::pair<std::string, metric_labels_t>, Entry> metrics;
+
+    // Mutex protecting the metrics map.
+    mutable std::shared_mutex metricsMutex;
+
+    // Returns the entry with the specified name and labels creating it with the specified type if
+    // needed.
+    //
+    // Arguments:
+    //     name: The name of the metric.
+    //     labels: The labels of the metric.
+    //     type: The type of the metric.
+    Entry &entry(absl::string_view name, const metric_labels_t &labels, MetricType type);
+};
+
+// The metrics recorded for the requests of a single protocol handled by a component.
+struct RequestMetrics {
+    // The number of handled requests.
+    Counter *requests;
+
+    // The number of handlers that returned an error.
+    Counter *errors;
+
+    // The time spent in the handler in nanoseconds.
+    Histogram *latency;
+
+    // Returns the request metrics of the specified component and protocol.
+    //
+    // Arguments:
+    //     component: The component handling the requests such as "tcp" or "connector".
+    //     protocol: The protocol of the requests.
+    static RequestMetrics of(absl::string_view component, uint32_t protocol);
+};
+
+}  // namespace ostp::servercc
+
+#endif
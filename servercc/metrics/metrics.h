@@ -0,0 +1,9 @@
+#ifndef SERVERCC_METRICS_H
+#define SERVERCC_METRICS_H
+
+#include "include/counter.h"
+#include "include/histogram.h"
+#include "include/metrics_handler.h"
+#include "include/metrics_registry.h"
+
+#endif
@@ -0,0 +1,61 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ostp::servercc {
+
+// See histogram.h for documentation.
+HistogramSnapshot::HistogramSnapshot(std::vector<uint64_t> counts, uint64_t sum)
+    : counts(std::move(counts)), total(0), valueSum(sum) {
+    this->counts.resize(Histogram::kBuckets);
+    for (auto count : this->counts) {
+        total += count;
+    }
+}
+
+// See histogram.h for documentation.
+uint64_t HistogramSnapshot::percentile(double percentile) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(percentile / 100.0 * total));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            return Histogram::highestValueOf(bucket);
+        }
+    }
+    return max();
+}
+
+// See histogram.h for documentation.
+uint64_t HistogramSnapshot::max() const {
+    for (size_t bucket = counts.size(); bucket > 0; bucket--) {
+        if (counts[bucket - 1] > 0) {
+            return Histogram::highestValueOf(bucket - 1);
+        }
+    }
+    return 0;
+}
+
+// See histogram.h for documentation.
+void HistogramSnapshot::merge(const HistogramSnapshot &other) {
+    for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+        counts[bucket] += other.counts[bucket];
+    }
+    total += other.total;
+    valueSum += other.valueSum;
+}
+
+// See histogram.h for documentation.
+HistogramSnapshot Histogram::snapshot() const {
+    std::vector<uint64_t> counts(kBuckets);
+    for (size_t bucket = 0; bucket < kBuckets; bucket++) {
+        counts[bucket] = buckets[bucket].load(std::memory_order_relaxed);
+    }
+    return HistogramSnapshot(std::move(counts), valueSum.load(std::memory_order_relaxed));
+}
+
+}  // namespace ostp::servercc
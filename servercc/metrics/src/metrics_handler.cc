@@ -0,0 +1,20 @@
+#include "metrics_handler.h"
+
+#include "metrics_registry.h"
+
+namespace ostp::servercc {
+
+// See metrics_handler.h for documentation.
+absl::Status metricsHandler(std::unique_ptr<Request> request) {
+    ASSERT_OK_AND_ASSIGN(message, request->receiveMessage(), "Failed to receive metrics request");
+
+    // Respond with the exposition.
+    auto exposition = MetricsRegistry::global().exposition();
+    auto response = std::make_unique<Message>();
+    response->header.protocol = kMetricsResponseProtocol;
+    response->header.length = exposition.size();
+    response->body.data.assign(exposition.begin(), exposition.end());
+    return request->sendMessage(std::move(response));
+}
+
+}  // namespace ostp::servercc
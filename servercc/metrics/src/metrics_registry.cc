@@ -0,0 +1,153 @@
+#include "metrics_registry.h"
+
+#include <mutex>
+
+#include "absl/strings/str_cat.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// Formats the labels of a metric with an optional extra label.
+std::string formatLabels(const metric_labels_t &labels, absl::string_view extraKey = "",
+                         absl::string_view extraValue = "") {
+    if (labels.empty() && extraKey.empty()) {
+        return "";
+    }
+    std::string result = "{";
+    for (auto &[key, value] : labels) {
+        absl::StrAppend(&result, result.size() > 1 ? "," : "", key, "=\"", value, "\"");
+    }
+    if (!extraKey.empty()) {
+        absl::StrAppend(&result, result.size() > 1 ? "," : "", extraKey, "=\"", extraValue, "\"");
+    }
+    return result + "}";
+}
+
+// The name of the type of a metric in the exposition format.
+absl::string_view typeName(MetricType type) {
+    switch (type) {
+        case MetricType::kCounter:
+            return "counter";
+        case MetricType::kGauge:
+            return "gauge";
+        default:
+            return "summary";
+    }
+}
+
+}  // namespace
+
+// See metrics_registry.h for documentation.
+MetricsRegistry &MetricsRegistry::global() {
+    // Never destroyed so that detached threads can keep recording during exit.
+    static MetricsRegistry *registry = new MetricsRegistry();
+    return *registry;
+}
+
+// See metrics_registry.h for documentation.
+Counter &MetricsRegistry::counter(absl::string_view name, const metric_labels_t &labels) {
+    return *entry(name, labels, MetricType::kCounter).counter;
+}
+
+// See metrics_registry.h for documentation.
+Gauge &MetricsRegistry::gauge(absl::string_view name, const metric_labels_t &labels) {
+    return *entry(name, labels, MetricType::kGauge).gauge;
+}
+
+// See metrics_registry.h for documentation.
+Histogram &MetricsRegistry::histogram(absl::string_view name, const metric_labels_t &labels) {
+    return *entry(name, labels, MetricType::kHistogram).histogram;
+}
+
+// See metrics_registry.h for documentation.
+MetricsRegistry::Entry &MetricsRegistry::entry(absl::string_view name,
+                                               const metric_labels_t &labels, MetricType type) {
+    auto key = std::make_pair(std::string(name), labels);
+    {
+        std::shared_lock lock(metricsMutex);
+        auto it = metrics.find(key);
+        if (it != metrics.end()) {
+            return it->second;
+        }
+    }
+
+    // Create the metric if no other thread created it in the meantime.
+    std::unique_lock lock(metricsMutex);
+    auto &entry = metrics[key];
+    if (entry.counter == nullptr && entry.gauge == nullptr && entry.histogram == nullptr) {
+        switch (type) {
+            case MetricType::kCounter:
+                entry.counter = std::make_unique<Counter>();
+                break;
+            case MetricType::kGauge:
+                entry.gauge = std::make_unique<Gauge>();
+                break;
+            case MetricType::kHistogram:
+                entry.histogram = std::make_unique<Histogram>();
+                break;
+        }
+    }
+    return entry;
+}
+
+// See metrics_registry.h for documentation.
+std::vector<MetricSnapshot> MetricsRegistry::snapshot() const {
+    std::shared_lock lock(metricsMutex);
+    std::vector<MetricSnapshot> snapshots;
+    snapshots.reserve(metrics.size());
+    for (auto &[key, entry] : metrics) {
+        MetricSnapshot snapshot{key.first, key.second, MetricType::kCounter, 0, {}};
+        if (entry.counter != nullptr) {
+            snapshot.value = entry.counter->value();
+        } else if (entry.gauge != nullptr) {
+            snapshot.type = MetricType::kGauge;
+            snapshot.value = entry.gauge->value();
+        } else {
+            snapshot.type = MetricType::kHistogram;
+            snapshot.histogram = entry.histogram->snapshot();
+        }
+        snapshots.push_back(std::move(snapshot));
+    }
+    return snapshots;
+}
+
+// See metrics_registry.h for documentation.
+std::string MetricsRegistry::exposition() const {
+    std::string result;
+    absl::string_view lastName;
+    auto snapshots = snapshot();
+    for (auto &metric : snapshots) {
+        if (metric.name != lastName) {
+            absl::StrAppend(&result, "# TYPE ", metric.name, " ", typeName(metric.type), "\n");
+            lastName = metric.name;
+        }
+        if (metric.type != MetricType::kHistogram) {
+            absl::StrAppend(&result, metric.name, formatLabels(metric.labels), " ", metric.value,
+                            "\n");
+            continue;
+        }
+        for (auto quantile : {"0.5", "0.9", "0.99", "0.999"}) {
+            absl::StrAppend(&result, metric.name,
+                            formatLabels(metric.labels, "quantile", quantile), " ",
+                            metric.histogram.percentile(std::stod(quantile) * 100), "\n");
+        }
+        absl::StrAppend(&result, metric.name, "_sum", formatLabels(metric.labels), " ",
+                        metric.histogram.sum(), "\n");
+        absl::StrAppend(&result, metric.name, "_count", formatLabels(metric.labels), " ",
+                        metric.histogram.count(), "\n");
+    }
+    return result;
+}
+
+// See metrics_registry.h for documentation.
+RequestMetrics RequestMetrics::of(absl::string_view component, uint32_t protocol) {
+    auto &registry = MetricsRegistry::global();
+    metric_labels_t labels = {{"component", std::string(component)},
+                              {"protocol", absl::StrCat("0x", absl::Hex(protocol))}};
+    return {&registry.counter("servercc_requests_total", labels),
+            &registry.counter("servercc_request_errors_total", labels),
+            &registry.histogram("servercc_request_latency_ns", labels)};
+}
+
+}  // namespace ostp::servercc
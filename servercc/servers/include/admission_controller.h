@@ -0,0 +1,136 @@
+#ifndef SERVERCC_ADMISSION_CONTROLLER_H
+#define SERVERCC_ADMISSION_CONTROLLER_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/string_view.h"
+#include "metrics_registry.h"
+#include "types.h"
+
+namespace ostp::servercc {
+
+// The options of the adaptive concurrency limit of an ingress point.
+struct AdmissionOptions {
+    // The number of requests admitted at the same time before any latency was measured.
+    uint32_t initialLimit = 32;
+
+    // The bounds of the limit.
+    uint32_t minLimit = 4;
+    uint32_t maxLimit = 4096;
+
+    // A request whose latency exceeds this multiple of the minimum latency signals that requests
+    // are queueing and the limit is backed off.
+    double latencyTolerance = 2.0;
+
+    // The factor applied to the limit when it is backed off.
+    double backoffRatio = 0.9;
+
+    // The number of completed requests after which the minimum latency is measured anew so that
+    // it follows changes of the workload.
+    uint32_t minLatencyWindow = 1000;
+
+    // The protocols that may use the reserved capacity.
+    absl::flat_hash_set<protocol_t> priorityProtocols;
+
+    // The fraction of the limit that is only admitted for priority protocols.
+    double reservedFraction = 0.1;
+};
+
+// Limits the number of requests an ingress point handles at the same time. Requests above the
+// limit are shed right away instead of being queued so that an overloaded server keeps serving
+// the requests it admitted at a steady latency.
+//
+// The limit adapts to the latency of the admitted requests by additive increase and
+// multiplicative decrease: it grows by one every round of requests that complete within the
+// tolerance of the minimum latency while it is in use, and is backed off once per round when
+// requests take longer as they then queue for a resource behind the ingress. The latency of a
+// request spans from its admission until it is destroyed.
+//
+// The controller must be owned by a shared pointer as admitted requests hold it until they are
+// destroyed.
+class AdmissionController : public std::enable_shared_from_this<AdmissionController> {
+   public:
+    // Creates a controller. Its metrics are labeled with the component and the number of the
+    // controller in the process so that controllers of the same component do not share them.
+    //
+    // Arguments:
+    //     component: The ingress point such as "tcp" or "connector" used to label the metrics.
+    //     options: The options of the limit.
+    AdmissionController(absl::string_view component, AdmissionOptions options);
+
+    // Destroys the controller clearing its limit gauge.
+    ~AdmissionController();
+
+    // Admits a request if the limit allows it. An admitted request holds its share of the limit
+    // until it is destroyed and then reports its latency.
+    //
+    // Arguments:
+    //     request: The request to admit.
+    // Returns:
+    //     Whether the request was admitted. A request that was not admitted should be shed.
+    bool admit(Request &request);
+
+    // Answers a request that was not admitted with an overloaded message and drops it.
+    //
+    // Arguments:
+    //     request: The request to shed.
+    static void shed(std::unique_ptr<Request> request);
+
+    // Returns the current limit.
+    uint32_t limit();
+
+    // Returns the number of admitted requests that are not destroyed yet.
+    uint32_t inFlight();
+
+   private:
+    // The options of the limit.
+    const AdmissionOptions options;
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // The current limit.
+    double currentLimit;
+
+    // The number of admitted requests that are not destroyed yet.
+    uint32_t admitted = 0;
+
+    // The minimum latency in nanoseconds or zero if no request completed yet.
+    int64_t minLatency = 0;
+
+    // The minimum latency of the current window and the number of requests completed in it.
+    int64_t windowMinLatency = 0;
+    uint32_t windowCompletions = 0;
+
+    // The number of requests completed since the limit was last backed off.
+    uint64_t completionsSinceBackoff = 0;
+
+    // The metrics of the controller.
+    Gauge &limitGauge;
+    Gauge &inFlightGauge;
+    Counter &rejections;
+
+    // Creates a controller whose metrics have the specified labels.
+    //
+    // Arguments:
+    //     labels: The labels of the metrics.
+    //     options: The options of the limit.
+    AdmissionController(const metric_labels_t &labels, AdmissionOptions options);
+
+    // Records the completion of an admitted request and adapts the limit.
+    //
+    // Arguments:
+    //     latency: The time between the admission and the completion of the request.
+    void complete(std::chrono::nanoseconds latency);
+
+    // Sets the limit updating its gauge. Must be called with the mutex held.
+    void setLimit(double limit);
+};
+
+}  // namespace ostp::servercc
+
+#endif
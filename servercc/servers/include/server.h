@@ -4,10 +4,14 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include <chrono>
 #include <functional>
 #include <memory>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "admission_controller.h"
+#include "metrics_registry.h"
 #include "types.h"
 
 namespace ostp::servercc {
@@ -24,6 +28,15 @@ class Server {
     // The default handler used if the protocol does not have a handler.
     ostp::servercc::handler_t defaultHandler;
 
+    // The name of the server used to label its metrics.
+    const absl::string_view name;
+
+    // Maps protocols to their request metrics. Only accessed by the thread running the server.
+    absl::flat_hash_map<ostp::servercc::protocol_t, RequestMetrics> requestMetrics;
+
+    // Limits the requests handled at the same time if admission control is enabled.
+    std::shared_ptr<AdmissionController> admissionController;
+
    protected:
     // The server socket file descriptor.
     int serverSocketFd;
@@ -40,8 +53,10 @@ class Server {
     //     port: The port the server will listen on.
     //     mode: The mode the server will run in.
     //     default_processor: The default processor for the server.
-    Server(uint16_t port, ostp::servercc::handler_t defaultHandler)
-        : port(port), defaultHandler(defaultHandler){};
+    //     name: The name of the server used to label its metrics.
+    Server(uint16_t port, ostp::servercc::handler_t defaultHandler,
+           absl::string_view name = "server")
+        : port(port), defaultHandler(defaultHandler), name(name){};
 
     // Getters
 
@@ -92,6 +107,17 @@ class Server {
         return absl::OkStatus();
     }
 
+    // Enables admission control. Requests above the adaptive concurrency limit are answered with
+    // an overloaded message and dropped without calling their handler. A request counts against
+    // the limit until it is destroyed, so a connection held open for many exchanges holds its
+    // share the whole time. Must be called before the server runs.
+    //
+    // Arguments:
+    //     options: The options of the concurrency limit.
+    void setAdmissionControl(AdmissionOptions options) {
+        admissionController = std::make_shared<AdmissionController>(name, std::move(options));
+    }
+
     // Methods
 
     // Handles a request.
@@ -99,12 +125,34 @@ class Server {
     // Arguments:
     //     request: The request to handle.
     absl::Status handleRequest(std::unique_ptr<ostp::servercc::Request> request) {
+        // Find the metrics of the protocol.
+        auto protocol = request->getProtocol();
+        auto metricsIt = requestMetrics.find(protocol);
+        if (metricsIt == requestMetrics.end()) {
+            metricsIt = requestMetrics.emplace(protocol, RequestMetrics::of(name, protocol)).first;
+        }
+        auto &metrics = metricsIt->second;
+
+        // Shed the request before it takes any resource of the handler. Shedding is the expected
+        // answer to overload so it is only counted by the admission metrics.
+        if (admissionController != nullptr && !admissionController->admit(*request)) {
+            AdmissionController::shed(std::move(request));
+            return absl::OkStatus();
+        }
+
         // Execute the handler for the protocol's request or the default handler.
-        ostp::servercc::handler_t handler = handlers[request->getProtocol()];
-        if (handler == nullptr) {
-            handler = defaultHandler;
+        auto handlerIt = handlers.find(protocol);
+        auto &handler = handlerIt == handlers.end() ? defaultHandler : handlerIt->second;
+        auto start = std::chrono::steady_clock::now();
+        auto status = handler(std::move(request));
+        metrics.latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count());
+        metrics.requests->add();
+        if (!status.ok()) {
+            metrics.errors->add();
         }
-        return handler(std::move(request));
+        return status;
     }
 
     // Virtual methods
@@ -50,6 +50,9 @@ class TcpRequest : public virtual Request {
     // See request.h for documentation.
     absl::Status sendMessage(std::unique_ptr<Message> message) final;
 
+    // See request.h for documentation.
+    absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload &payload) final;
+
     // Terminates the request by closing the socket.
     void terminate() final;
 
@@ -28,6 +28,16 @@ class UdpServer : virtual public Server {
     // Destructor for the server.
     ~UdpServer();
 
+    // Sends a message in a single datagram from the socket of the server so that the receiver can
+    // answer to the port of the server.
+    //
+    // Arguments:
+    //     address: The address to send the message to.
+    //     message: The message to send.
+    // Returns:
+    //     The status of the operation.
+    absl::Status sendTo(const sockaddr &address, std::unique_ptr<Message> message);
+
     // See server.h for documentation.
     [[noreturn]] void run();
 };
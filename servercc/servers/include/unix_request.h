@@ -0,0 +1,89 @@
+#ifndef SERVERCC_UNIX_REQUEST_H
+#define SERVERCC_UNIX_REQUEST_H
+
+#include <vector>
+
+#include "types.h"
+
+namespace ostp::servercc {
+
+// Unix domain socket request class for the server extending the request class. File descriptors
+// passed by the client with its messages are kept until the handler takes them.
+class UnixRequest : public virtual Request {
+   private:
+    // The file descriptor of the client.
+    const int clientSocketFd;
+
+    // The protocol of the request.
+    const protocol_t protocol;
+
+    // The current message.
+    std::unique_ptr<Message> message;
+
+    // The file descriptors passed by the client that were not taken yet.
+    std::vector<int> descriptors;
+
+    // Whether or not the request should be kept alive.
+    bool keepAlive = false;
+
+   public:
+    // Constructor for the request.
+    //
+    // Arguments:
+    //     fd: The file descriptor of the client.
+    //     message: The message to initialize the request with.
+    //     descriptors: The file descriptors passed with the message.
+    UnixRequest(const int fd, std::unique_ptr<Message> message, std::vector<int> descriptors);
+
+    // Destructor for the request. Closes the socket by calling terminate() and the file
+    // descriptors that were not taken.
+    ~UnixRequest() final;
+
+    // Returns an address with only the AF_UNIX family set as the address of a Unix domain socket
+    // does not fit in a sockaddr.
+    sockaddr getAddr() final;
+
+    // See request.h for documentation.
+    protocol_t getProtocol() final;
+
+    // See request.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> receiveMessage() final;
+
+    // See request.h for documentation.
+    std::pair<absl::Status, std::unique_ptr<Message>> receiveMessage(int timeout) final;
+
+    // See request.h for documentation.
+    absl::Status sendMessage(std::unique_ptr<Message> message) final;
+
+    // See request.h for documentation.
+    absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload &payload) final;
+
+    // Sends a message to the client passing file descriptors with it.
+    //
+    // Arguments:
+    //     message: The message to send.
+    //     descriptors: The file descriptors to pass. The caller keeps ownership of them.
+    // Returns:
+    //     The status of the operation.
+    absl::Status sendMessage(std::unique_ptr<Message> message,
+                             const std::vector<int> &descriptors);
+
+    // Takes the file descriptors passed by the client with the messages received so far.
+    //
+    // Returns:
+    //     The file descriptors which are owned by the caller.
+    std::vector<int> takeDescriptors();
+
+    // Terminates the request by closing the socket.
+    void terminate() final;
+
+    // Keeps the request alive by not closing the socket.
+    //
+    // Returns:
+    //    The file descriptor of the socket.
+    int setKeepAlive();
+};
+
+}  // namespace ostp::servercc
+
+#endif
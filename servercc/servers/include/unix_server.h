@@ -0,0 +1,42 @@
+#ifndef SERVERCC_SERVER_UNIX_H
+#define SERVERCC_SERVER_UNIX_H
+
+#include <string>
+
+#include "server.h"
+
+namespace ostp::servercc {
+
+// A Unix domain stream socket server for processes on the same host. It uses the same framing and
+// handlers as TcpServer and passes UnixRequests to the handlers so that they can receive and send
+// file descriptors.
+class UnixServer : virtual public Server {
+   public:
+    // Constructor for the server. A stale socket file at the path is removed.
+    //
+    // Arguments:
+    //     path: The path the server will listen on. A path starting with '@' is in the abstract
+    //         namespace.
+    //     defaultHandler: The default handler for the server.
+    UnixServer(absl::string_view path, handler_t defaultHandler);
+
+    // Destructor for the server. Removes the socket file.
+    ~UnixServer();
+
+    // Gets the path the server is listening on.
+    //
+    // Returns:
+    //     The path the server is listening on.
+    const std::string &getPath() const { return path; }
+
+    // See server.h for documentation.
+    [[noreturn]] void run();
+
+   private:
+    // The path the server is listening on.
+    const std::string path;
+};
+
+}  // namespace ostp::servercc
+
+#endif
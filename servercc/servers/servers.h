@@ -1,10 +1,13 @@
 #ifndef SERVERCC_SERVERS_H
 #define SERVERCC_SERVERS_H
 
+#include "include/admission_controller.h"
 #include "include/server.h"
 #include "include/tcp_request.h"
 #include "include/tcp_server.h"
 #include "include/udp_request.h"
 #include "include/udp_server.h"
+#include "include/unix_request.h"
+#include "include/unix_server.h"
 
 #endif
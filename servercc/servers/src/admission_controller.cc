@@ -0,0 +1,134 @@
+#include "admission_controller.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+
+namespace ostp::servercc {
+
+namespace {
+
+// Returns the labels of the metrics of a new controller of the specified component. Controllers
+// are numbered in the order they are created so that controllers of the same component, such as
+// the connectors of several servers in a process, do not share their gauges.
+//
+// Arguments:
+//     component: The ingress point of the controller.
+metric_labels_t controllerLabels(absl::string_view component) {
+    static std::atomic<uint64_t> nextInstance = 0;
+    return {{"component", std::string(component)},
+            {"instance", std::to_string(nextInstance.fetch_add(1, std::memory_order_relaxed))}};
+}
+
+}  // namespace
+
+// See admission_controller.h for documentation.
+AdmissionController::AdmissionController(absl::string_view component, AdmissionOptions options)
+    : AdmissionController(controllerLabels(component), std::move(options)) {}
+
+// See admission_controller.h for documentation.
+AdmissionController::AdmissionController(const metric_labels_t &labels, AdmissionOptions options)
+    : options(std::move(options)),
+      currentLimit(std::clamp(this->options.initialLimit, this->options.minLimit,
+                              std::max(this->options.minLimit, this->options.maxLimit))),
+      limitGauge(MetricsRegistry::global().gauge("servercc_admission_limit", labels)),
+      inFlightGauge(MetricsRegistry::global().gauge("servercc_admission_in_flight", labels)),
+      rejections(MetricsRegistry::global().counter("servercc_admission_rejections_total", labels)) {
+    limitGauge.add((int64_t)currentLimit);
+}
+
+// See admission_controller.h for documentation.
+AdmissionController::~AdmissionController() { limitGauge.sub((int64_t)currentLimit); }
+
+// See admission_controller.h for documentation.
+bool AdmissionController::admit(Request &request) {
+    mutex.lock();
+
+    // Requests of other protocols leave the reserved share of the limit to the priority ones.
+    auto capacity = (uint32_t)currentLimit;
+    if (capacity > 1 && !options.priorityProtocols.contains(request.getProtocol())) {
+        auto reserved = (uint32_t)std::ceil(capacity * options.reservedFraction);
+        capacity -= std::min(capacity - 1, reserved);
+    }
+    if (admitted >= capacity) {
+        mutex.unlock();
+        rejections.add();
+        return false;
+    }
+    admitted++;
+    mutex.unlock();
+    inFlightGauge.add();
+
+    request.setCompletionCallback(
+        [controller = shared_from_this(), start = std::chrono::steady_clock::now()]() {
+            controller->complete(std::chrono::steady_clock::now() - start);
+        });
+    return true;
+}
+
+// See admission_controller.h for documentation.
+void AdmissionController::shed(std::unique_ptr<Request> request) {
+    // The answer is best effort as the request is dropped either way.
+    auto message = std::make_unique<Message>();
+    message->header.protocol = kOverloadedProtocol;
+    message->header.length = 0;
+    request->sendMessage(std::move(message)).IgnoreError();
+}
+
+// See admission_controller.h for documentation.
+uint32_t AdmissionController::limit() {
+    std::lock_guard lock(mutex);
+    return (uint32_t)currentLimit;
+}
+
+// See admission_controller.h for documentation.
+uint32_t AdmissionController::inFlight() {
+    std::lock_guard lock(mutex);
+    return admitted;
+}
+
+// See admission_controller.h for documentation.
+void AdmissionController::complete(std::chrono::nanoseconds latency) {
+    inFlightGauge.sub();
+    std::lock_guard lock(mutex);
+    auto inFlight = admitted--;
+
+    // The minimum latency approximates the latency of a request that does not queue. It is
+    // replaced by the minimum of every window so that it rises again when the requests get slower
+    // for a reason other than queueing.
+    auto sample = std::max<int64_t>(latency.count(), 1);
+    if (windowCompletions == 0 || sample < windowMinLatency) {
+        windowMinLatency = sample;
+    }
+    if (++windowCompletions >= options.minLatencyWindow) {
+        minLatency = windowMinLatency;
+        windowCompletions = 0;
+    }
+    if (minLatency == 0 || sample < minLatency) {
+        minLatency = sample;
+    }
+
+    // Back off at most once per round of requests as the requests in flight together all see the
+    // same queue. The limit only grows while it is in use so that an idle server does not admit
+    // a burst it cannot serve.
+    completionsSinceBackoff++;
+    if (sample > options.latencyTolerance * minLatency) {
+        if (completionsSinceBackoff >= currentLimit) {
+            setLimit(currentLimit * options.backoffRatio);
+            completionsSinceBackoff = 0;
+        }
+    } else if (inFlight * 2 >= currentLimit) {
+        setLimit(currentLimit + 1 / currentLimit);
+    }
+}
+
+// See admission_controller.h for documentation.
+void AdmissionController::setLimit(double limit) {
+    auto previous = (int64_t)currentLimit;
+    currentLimit = std::clamp<double>(limit, options.minLimit,
+                                      std::max(options.minLimit, options.maxLimit));
+    limitGauge.add((int64_t)currentLimit - previous);
+}
+
+}  // namespace ostp::servercc
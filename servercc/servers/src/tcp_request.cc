@@ -1,6 +1,6 @@
 #include "tcp_request.h"
 
-#include "absl/log/log.h"
+#include "async_log.h"
 
 namespace ostp::servercc {
 
@@ -8,7 +8,7 @@ namespace ostp::servercc {
 TcpRequest::TcpRequest(const int fd, const sockaddr& clientAddr, std::unique_ptr<Message> message)
     : clientSocketFd(fd),
       clientAddr(clientAddr),
-      protocol(message->header.protocol),
+      protocol(streamProtocol(message->header.protocol)),
       message(std::move(message)) {}
 
 // See tcp_request.h for documentation.
@@ -43,10 +43,15 @@ absl::Status TcpRequest::sendMessage(std::unique_ptr<Message> message) {
     return writeMessage(clientSocketFd, std::move(message));
 }
 
+// See tcp_request.h for documentation.
+absl::Status TcpRequest::sendBulkMessage(protocol_t protocol, const BulkPayload& payload) {
+    return writeBulkMessage(clientSocketFd, protocol, payload);
+}
+
 // See tcp_request.h for documentation.
 void TcpRequest::terminate() {
     if (!keepAlive) {
-        LOG(INFO) << "Closed TCP connection with socket fd " << clientSocketFd;
+        SCC_VLOG(1) << "Closed TCP connection with socket fd " << clientSocketFd;
         close(clientSocketFd);
     }
 }
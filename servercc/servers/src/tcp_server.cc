@@ -1,12 +1,25 @@
 #include "tcp_server.h"
 
 #include "absl/log/log.h"
+#include "async_log.h"
 #include "tcp_request.h"
 
 namespace ostp::servercc {
 
+namespace {
+
+// Returns the IPv4 address of the specified socket address as a string.
+std::string addressString(const sockaddr &addr) {
+    char ipStr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &((sockaddr_in *)&addr)->sin_addr, ipStr, INET_ADDRSTRLEN);
+    return ipStr;
+}
+
+}  // namespace
+
 // See tcp.h for documentation.
-TcpServer::TcpServer(int16_t port, handler_t defaultProcessor) : Server(port, defaultProcessor) {
+TcpServer::TcpServer(int16_t port, handler_t defaultProcessor)
+    : Server(port, defaultProcessor, "tcp") {
     // Setup hints.
     struct addrinfo *result = nullptr, *hints = new struct addrinfo;
     memset(hints, 0, sizeof(struct addrinfo));
@@ -85,9 +98,7 @@ TcpServer::~TcpServer() { close(serverSocketFd); }
 // See server.h for documentation.
 [[noreturn]] void TcpServer::run() {
     sockaddr clientAddr;
-    in_addr_t clientAddrIp;
     socklen_t addr_len = sizeof(clientAddr);
-    char ipStr[INET_ADDRSTRLEN];
     int clientSocketFd;
     while (true) {
         // Try to accept a connection.
@@ -97,10 +108,8 @@ TcpServer::~TcpServer() { close(serverSocketFd); }
         }
 
         // Log the connection.
-        clientAddrIp = ((sockaddr_in *)&clientAddr)->sin_addr.s_addr;
-        inet_ntop(AF_INET, &clientAddrIp, ipStr, INET_ADDRSTRLEN);
-        LOG(INFO) << "Opened TCP connection with '" << ipStr << "' with socket fd "
-                  << clientSocketFd;
+        SCC_VLOG(1) << "Opened TCP connection with '" << addressString(clientAddr)
+                    << "' with socket fd " << clientSocketFd;
 
         // Create a request checking for errors.
         auto [status, message] = readMessage(clientSocketFd);
@@ -112,7 +121,7 @@ TcpServer::~TcpServer() { close(serverSocketFd); }
         auto res = handleRequest(
             std::make_unique<TcpRequest>(clientSocketFd, clientAddr, std::move(message)));
         if (!res.ok()) {
-            LOG(ERROR) << "Failed to handle request: " << res.message();
+            SCC_LOG(ERROR) << "Failed to handle request: " << res.message();
             continue;
         }
     }
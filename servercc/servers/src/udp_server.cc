@@ -1,6 +1,9 @@
 #include "udp_server.h"
 
+#include <sys/uio.h>
+
 #include "absl/log/log.h"
+#include "async_log.h"
 #include "udp_request.h"
 
 namespace ostp::servercc {
@@ -8,7 +11,7 @@ namespace ostp::servercc {
 // See tcp.h for documentation.
 UdpServer::UdpServer(int16_t port, absl::string_view groupAddress,
                      std::vector<absl::string_view> interfaces, handler_t defaultProcessor)
-    : Server(port, defaultProcessor), groupAddress(groupAddress) {
+    : Server(port, defaultProcessor, "udp"), groupAddress(groupAddress) {
     // Setup hints for udp with multicast.
     struct addrinfo *result = nullptr, *hints = new struct addrinfo;
     memset(hints, 0, sizeof(struct addrinfo));
@@ -103,30 +106,53 @@ UdpServer::UdpServer(int16_t port, absl::string_view groupAddress,
 // See tcp.h for documentation.
 UdpServer::~UdpServer() { close(this->serverSocketFd); }
 
+// See udp_server.h for documentation.
+absl::Status UdpServer::sendTo(const sockaddr &address, std::unique_ptr<Message> message) {
+    if (message->header.length > kMaxDatagramBodyLength) {
+        return absl::InvalidArgumentError("Message too long for a datagram");
+    }
+    iovec iov[2] = {{&message->header, kMessageHeaderLength},
+                    {message->body.data.data(), message->header.length}};
+    msghdr msg = {};
+    msg.msg_name = (void *)&address;
+    msg.msg_namelen = sizeof(sockaddr_in);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (sendmsg(this->serverSocketFd, &msg, MSG_NOSIGNAL) < 0) {
+        return absl::ErrnoToStatus(errno, "Failed to send datagram");
+    }
+    return absl::OkStatus();
+}
+
 // See server.h for documentation.
 [[noreturn]] void UdpServer::run() {
     socklen_t addr_len = sizeof(struct sockaddr);
 
     while (true) {
+        // Read the header and body of the message from a single datagram.
         sockaddr addr;
-        // Create a request.
         auto message = std::make_unique<Message>();
-        int bytes_read = recvfrom(this->serverSocketFd, &message->header, kMessageHeaderLength, 0,
-                                  &addr, &addr_len);
-        if (bytes_read < kMessageHeaderLength) {
-            perror("recvfrom");
+        message->body.data.resize(kMaxDatagramBodyLength);
+        iovec iov[2] = {{&message->header, kMessageHeaderLength},
+                        {message->body.data.data(), kMaxDatagramBodyLength}};
+        msghdr msg = {};
+        msg.msg_name = &addr;
+        msg.msg_namelen = addr_len;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        auto bytes_read = recvmsg(this->serverSocketFd, &msg, 0);
+        if (bytes_read < (ssize_t)kMessageHeaderLength) {
+            perror("recvmsg");
             continue;
         }
-        message->body.data.resize(message->header.length);
-        bytes_read = recvfrom(this->serverSocketFd, message->body.data.data(),
-                              message->header.length, 0, &addr, &addr_len);
-        if (bytes_read < message->header.length) {
-            perror("recvfrom");
+        if (bytes_read - kMessageHeaderLength != message->header.length) {
+            SCC_LOG_EVERY_N(ERROR, 100) << "Dropped datagram with invalid length";
             continue;
         }
+        message->body.data.resize(message->header.length);
         auto res = handleRequest(std::make_unique<UdpRequest>(addr, std::move(message)));
         if (!res.ok()) {
-            LOG(ERROR) << "Failed to handle request: " << res.message();
+            SCC_LOG(ERROR) << "Failed to handle request: " << res.message();
         }
     }
 }
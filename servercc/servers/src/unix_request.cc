@@ -0,0 +1,99 @@
+#include "unix_request.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "async_log.h"
+
+namespace ostp::servercc {
+
+// See unix_request.h for documentation.
+UnixRequest::UnixRequest(const int fd, std::unique_ptr<Message> message,
+                         std::vector<int> descriptors)
+    : clientSocketFd(fd),
+      protocol(streamProtocol(message->header.protocol)),
+      message(std::move(message)),
+      descriptors(std::move(descriptors)) {}
+
+// See unix_request.h for documentation.
+UnixRequest::~UnixRequest() {
+    terminate();
+    for (auto descriptor : descriptors) {
+        close(descriptor);
+    }
+}
+
+// See unix_request.h for documentation.
+sockaddr UnixRequest::getAddr() {
+    sockaddr addr = {};
+    addr.sa_family = AF_UNIX;
+    return addr;
+}
+
+// See unix_request.h for documentation.
+protocol_t UnixRequest::getProtocol() { return protocol; }
+
+// See unix_request.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> UnixRequest::receiveMessage() {
+    if (message) {
+        auto temp = std::move(message);
+        return {absl::OkStatus(), std::move(temp)};
+    }
+    return readMessage(clientSocketFd, descriptors);
+}
+
+// See unix_request.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> UnixRequest::receiveMessage(int timeout) {
+    if (message) {
+        auto temp = std::move(message);
+        return {absl::OkStatus(), std::move(temp)};
+    }
+
+    // Wait for the message to start arriving. Unlike readMessage(fd, timeout) no thread is left
+    // reading the socket if the timeout expires.
+    pollfd pfd = {clientSocketFd, POLLIN, 0};
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout)) < 0 && errno == EINTR) {
+    }
+    if (ready == 0) {
+        return {absl::DeadlineExceededError("Timeout reading message"), nullptr};
+    }
+    return readMessage(clientSocketFd, descriptors);
+}
+
+// See unix_request.h for documentation.
+absl::Status UnixRequest::sendMessage(std::unique_ptr<Message> message) {
+    return writeMessage(clientSocketFd, std::move(message));
+}
+
+// See unix_request.h for documentation.
+absl::Status UnixRequest::sendBulkMessage(protocol_t protocol, const BulkPayload &payload) {
+    return writeBulkMessage(clientSocketFd, protocol, payload);
+}
+
+// See unix_request.h for documentation.
+absl::Status UnixRequest::sendMessage(std::unique_ptr<Message> message,
+                                      const std::vector<int> &descriptors) {
+    return writeMessage(clientSocketFd, std::move(message), descriptors);
+}
+
+// See unix_request.h for documentation.
+std::vector<int> UnixRequest::takeDescriptors() { return std::exchange(descriptors, {}); }
+
+// See unix_request.h for documentation.
+void UnixRequest::terminate() {
+    if (!keepAlive) {
+        SCC_VLOG(1) << "Closed Unix domain socket connection with socket fd " << clientSocketFd;
+        close(clientSocketFd);
+    }
+}
+
+// See unix_request.h for documentation.
+int UnixRequest::setKeepAlive() {
+    keepAlive = true;
+    return clientSocketFd;
+}
+
+}  // namespace ostp::servercc
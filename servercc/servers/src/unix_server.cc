@@ -0,0 +1,92 @@
+#include "unix_server.h"
+
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "absl/log/log.h"
+#include "async_log.h"
+#include "unix_request.h"
+
+namespace ostp::servercc {
+
+// See unix_server.h for documentation.
+UnixServer::UnixServer(absl::string_view path, handler_t defaultHandler)
+    : Server(0, defaultHandler, "unix"), path(path) {
+    sockaddr_un address;
+    socklen_t addressLength;
+    if (!makeUnixAddress(path, address, addressLength).ok()) {
+        throw "Invalid Unix domain socket path";
+    }
+
+    // Try to create a socket.
+    int serverSocketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (serverSocketFd < 0) {
+        perror("socket");
+        throw "Error creating socket";
+    }
+
+    // Remove the file left by a previous server and try to bind.
+    if (path[0] != '@') {
+        unlink(this->path.c_str());
+    }
+    if (bind(serverSocketFd, (sockaddr *)&address, addressLength) < 0) {
+        perror("bind");
+        close(serverSocketFd);
+        throw "Error binding to address";
+    }
+
+    // Try to listen.
+    if (listen(serverSocketFd, 100) < 0) {
+        perror("listen");
+        close(serverSocketFd);
+        throw "Error listening";
+    }
+
+    // Save the server socket.
+    this->serverSocketFd = serverSocketFd;
+    this->serverAddress = nullptr;
+
+    LOG(INFO) << "Created Unix domain socket server on '" << path << "' with socket fd "
+              << serverSocketFd;
+}
+
+// See unix_server.h for documentation.
+UnixServer::~UnixServer() {
+    close(serverSocketFd);
+    if (path[0] != '@') {
+        unlink(path.c_str());
+    }
+}
+
+// See server.h for documentation.
+[[noreturn]] void UnixServer::run() {
+    int clientSocketFd;
+    while (true) {
+        // Try to accept a connection.
+        if ((clientSocketFd = accept4(serverSocketFd, nullptr, nullptr, SOCK_CLOEXEC)) < 0) {
+            perror("accept");
+            continue;
+        }
+
+        // Log the connection.
+        SCC_VLOG(1) << "Opened Unix domain socket connection on '" << path << "' with socket fd "
+                    << clientSocketFd;
+
+        // Create a request checking for errors.
+        std::vector<int> descriptors;
+        auto [status, message] = readMessage(clientSocketFd, descriptors);
+        if (!status.ok()) {
+            perror("readMessage");
+            close(clientSocketFd);
+            continue;
+        }
+        auto res = handleRequest(std::make_unique<UnixRequest>(clientSocketFd, std::move(message),
+                                                               std::move(descriptors)));
+        if (!res.ok()) {
+            SCC_LOG(ERROR) << "Failed to handle request: " << res.message();
+            continue;
+        }
+    }
+}
+
+}  // namespace ostp::servercc
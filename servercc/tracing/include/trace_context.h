@@ -0,0 +1,47 @@
+#ifndef SERVERCC_TRACE_CONTEXT_H
+#define SERVERCC_TRACE_CONTEXT_H
+
+#include <inttypes.h>
+
+namespace ostp::servercc {
+
+// The context of a sampled span propagated between threads and processes. A zero trace ID means
+// the work is not traced.
+struct TraceContext {
+    // The ID of the trace shared by every span of a request.
+    uint64_t traceId = 0;
+
+    // The ID of the span that is the parent of any span started with this context.
+    uint64_t spanId = 0;
+
+    // Returns whether the context belongs to a sampled trace.
+    bool sampled() const { return traceId != 0; }
+};
+
+// Returns the trace context of the work running on the calling thread.
+TraceContext currentTraceContext();
+
+// Sets the trace context of the calling thread for the lifetime of the scope, restoring the
+// previous context when destroyed.
+class ScopedTraceContext {
+   public:
+    // Sets the trace context of the calling thread.
+    //
+    // Arguments:
+    //     context: The context of the work running in the scope.
+    explicit ScopedTraceContext(const TraceContext &context);
+
+    // Restores the previous trace context of the calling thread.
+    ~ScopedTraceContext();
+
+    ScopedTraceContext(const ScopedTraceContext &) = delete;
+    ScopedTraceContext &operator=(const ScopedTraceContext &) = delete;
+
+   private:
+    // The context of the thread before the scope.
+    const TraceContext previous;
+};
+
+}  // namespace ostp::servercc
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef SERVERCC_TRACER_H
+#define SERVERCC_TRACER_H
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "trace_context.h"
+
+namespace ostp::servercc {
+
+// A timed operation of a trace. A span that is not sampled holds no state and recording on it does
+// nothing, so untraced work only pays for a null check.
+class Span {
+   public:
+    // Creates a span that is not sampled.
+    Span() = default;
+
+    // Starts a span as a child of the specified context. The span is not sampled if the context is
+    // not.
+    //
+    // Arguments:
+    //     name: The name of the span. Must outlive the span such as a string literal.
+    //     parent: The context of the parent span.
+    Span(const char *name, const TraceContext &parent);
+
+    // Ends the span.
+    ~Span() { end(); }
+
+    Span(Span &&) = default;
+
+    // Ends this span and takes over the other.
+    Span &operator=(Span &&other);
+
+    // Returns whether the span is sampled.
+    bool sampled() const { return state != nullptr; }
+
+    // Returns the context to propagate to the children of the span.
+    TraceContext context() const;
+
+    // Attaches an argument to the span.
+    //
+    // Arguments:
+    //     key: The key of the argument. Must outlive the span such as a string literal.
+    //     value: The value of the argument.
+    void setArgument(const char *key, int64_t value);
+
+    // Records an instant event of the span at the current time.
+    //
+    // Arguments:
+    //     event: The name of the event. Must outlive the span such as a string literal.
+    void mark(const char *event);
+
+    // Ends the span and hands it to the tracer. Later calls do nothing.
+    void end();
+
+   private:
+    friend class Tracer;
+
+    // The state of a sampled span.
+    struct State {
+        // The name of the span.
+        const char *name;
+
+        // The context of the span.
+        TraceContext context;
+
+        // The ID of the parent span.
+        uint64_t parentSpanId;
+
+        // The thread that started the span.
+        uint32_t threadId;
+
+        // The start of the span in microseconds since the epoch.
+        uint64_t start;
+
+        // Mutex protecting the fields below as marks may come from other threads.
+        std::mutex mutex;
+
+        // The instant events of the span and their times.
+        std::vector<std::pair<const char *, uint64_t>> marks;
+
+        // The arguments of the span.
+        std::vector<std::pair<const char *, int64_t>> arguments;
+    };
+
+    // The state of the span or nullptr if the span is not sampled or has ended.
+    std::unique_ptr<State> state;
+};
+
+// Samples traces and writes finished spans of the process to a file in the Chrome trace event
+// format which can be loaded into chrome://tracing or Perfetto.
+//
+// Timestamps are wall clock times so files written by different peers can be merged into a single
+// view of a request.
+class Tracer {
+   public:
+    // Returns the tracer of the process. The sample rate and the output file are read from the
+    // SERVERCC_TRACE_SAMPLE_RATE and SERVERCC_TRACE_FILE environment variables and default to 0 and
+    // servercc_trace.<pid>.json. Buffered spans are written when the process exits.
+    static Tracer &global();
+
+    // Starts a span as a child of the trace context of the calling thread or, if the thread is not
+    // traced, as the root of a new trace sampled at the sample rate.
+    //
+    // Arguments:
+    //     name: The name of the span. Must outlive the span such as a string literal.
+    // Returns:
+    //     The span which is not sampled if the trace was not.
+    Span startSpan(const char *name);
+
+    // Sets the probability of sampling a new trace.
+    //
+    // Arguments:
+    //     rate: The sample rate between 0 and 1.
+    void setSampleRate(double rate);
+
+    // Sets the file the spans are written to closing the previous one.
+    //
+    // Arguments:
+    //     path: The path of the file.
+    // Returns:
+    //     The status of the operation.
+    absl::Status setOutputPath(absl::string_view path);
+
+    // Writes every buffered span to the file.
+    void flush();
+
+   private:
+    friend class Span;
+
+    // Creates a tracer configured from the environment.
+    Tracer();
+
+    // Threshold below which a random 64-bit number samples a new trace.
+    std::atomic<uint64_t> sampleThreshold{0};
+
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // The path of the output file.
+    std::string path;
+
+    // The output file descriptor or -1 if the file is not open.
+    int fd = -1;
+
+    // The formatted events waiting to be written.
+    std::string buffer;
+
+    // Formats the state of an ended span and buffers it for writing.
+    //
+    // Arguments:
+    //     state: The state of the span.
+    //     end: The end of the span in microseconds since the epoch.
+    void record(Span::State &state, uint64_t end);
+
+    // Writes the buffer to the file opening it if needed. Must hold the mutex.
+    void writeBuffer();
+};
+
+}  // namespace ostp::servercc
+
+#endif
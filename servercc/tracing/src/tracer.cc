@@ -0,0 +1,251 @@
+#include "tracer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+#include "absl/strings/str_cat.h"
+
+namespace ostp::servercc {
+
+namespace {
+
+// The size of the buffer at which formatted events are written to the file.
+constexpr size_t kWriteThreshold = 1 << 16;
+
+// The trace context of the calling thread.
+thread_local TraceContext threadContext;
+
+// Returns the id of the calling thread.
+uint32_t threadId() {
+    static thread_local uint32_t id = syscall(SYS_gettid);
+    return id;
+}
+
+// Returns the current wall clock time in microseconds since the epoch.
+uint64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Returns a non-zero random 64-bit number from a generator local to the calling thread.
+uint64_t randomId() {
+    static thread_local uint64_t state = std::random_device()() ^ ((uint64_t)threadId() << 32);
+    while (true) {
+        // splitmix64.
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        z ^= z >> 31;
+        if (z != 0) {
+            return z;
+        }
+    }
+}
+
+}  // namespace
+
+// Trace context.
+
+// See trace_context.h for documentation.
+TraceContext currentTraceContext() { return threadContext; }
+
+// See trace_context.h for documentation.
+ScopedTraceContext::ScopedTraceContext(const TraceContext &context) : previous(threadContext) {
+    threadContext = context;
+}
+
+// See trace_context.h for documentation.
+ScopedTraceContext::~ScopedTraceContext() { threadContext = previous; }
+
+// Span.
+
+// See tracer.h for documentation.
+Span::Span(const char *name, const TraceContext &parent) {
+    if (!parent.sampled()) {
+        return;
+    }
+    state = std::make_unique<State>();
+    state->name = name;
+    state->context = {parent.traceId, randomId()};
+    state->parentSpanId = parent.spanId;
+    state->threadId = threadId();
+    state->start = nowMicros();
+}
+
+// See tracer.h for documentation.
+Span &Span::operator=(Span &&other) {
+    end();
+    state = std::move(other.state);
+    return *this;
+}
+
+// See tracer.h for documentation.
+TraceContext Span::context() const { return state == nullptr ? TraceContext() : state->context; }
+
+// See tracer.h for documentation.
+void Span::setArgument(const char *key, int64_t value) {
+    if (state == nullptr) {
+        return;
+    }
+    std::lock_guard lock(state->mutex);
+    state->arguments.emplace_back(key, value);
+}
+
+// See tracer.h for documentation.
+void Span::mark(const char *event) {
+    if (state == nullptr) {
+        return;
+    }
+    auto timestamp = nowMicros();
+    std::lock_guard lock(state->mutex);
+    state->marks.emplace_back(event, timestamp);
+}
+
+// See tracer.h for documentation.
+void Span::end() {
+    if (state == nullptr) {
+        return;
+    }
+    auto ended = std::move(state);
+    Tracer::global().record(*ended, nowMicros());
+}
+
+// Tracer.
+
+// See tracer.h for documentation.
+Tracer &Tracer::global() {
+    // Never destroyed so that detached threads can keep tracing during exit.
+    static Tracer *tracer = []() {
+        auto *tracer = new Tracer();
+        atexit([]() { Tracer::global().flush(); });
+        return tracer;
+    }();
+    return *tracer;
+}
+
+// See tracer.h for documentation.
+Tracer::Tracer() {
+    auto rate = getenv("SERVERCC_TRACE_SAMPLE_RATE");
+    setSampleRate(rate == nullptr ? 0 : atof(rate));
+    auto file = getenv("SERVERCC_TRACE_FILE");
+    path = file != nullptr ? file : absl::StrCat("servercc_trace.", getpid(), ".json");
+}
+
+// See tracer.h for documentation.
+Span Tracer::startSpan(const char *name) {
+    auto parent = threadContext;
+    if (!parent.sampled()) {
+        auto threshold = sampleThreshold.load(std::memory_order_relaxed);
+        if (threshold == 0 || randomId() > threshold) {
+            return Span();
+        }
+        parent = {randomId(), 0};
+    }
+    return Span(name, parent);
+}
+
+// See tracer.h for documentation.
+void Tracer::setSampleRate(double rate) {
+    uint64_t threshold;
+    if (rate <= 0) {
+        threshold = 0;
+    } else if (rate >= 1) {
+        threshold = UINT64_MAX;
+    } else {
+        threshold = (uint64_t)(rate * (double)UINT64_MAX);
+    }
+    sampleThreshold.store(threshold, std::memory_order_relaxed);
+}
+
+// See tracer.h for documentation.
+absl::Status Tracer::setOutputPath(absl::string_view newPath) {
+    std::lock_guard lock(mutex);
+    writeBuffer();
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    path = std::string(newPath);
+
+    // Open the file now to report errors to the caller.
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return absl::ErrnoToStatus(errno, absl::StrCat("Failed to open trace file '", path, "'"));
+    }
+    buffer = "[\n";
+    return absl::OkStatus();
+}
+
+// See tracer.h for documentation.
+void Tracer::flush() {
+    std::lock_guard lock(mutex);
+    writeBuffer();
+}
+
+// See tracer.h for documentation.
+void Tracer::record(Span::State &state, uint64_t end) {
+    // Format the span as a complete event followed by an instant event per mark. The IDs are
+    // arguments so that the spans of a request can be found across the files of every peer.
+    std::string events;
+    auto ids = absl::StrCat("\"trace_id\":\"", absl::Hex(state.context.traceId, absl::kZeroPad16),
+                            "\",\"span_id\":\"", absl::Hex(state.context.spanId, absl::kZeroPad16),
+                            "\"");
+    auto common = absl::StrCat("\"cat\":\"servercc\",\"pid\":", getpid(),
+                               ",\"tid\":", state.threadId);
+    absl::StrAppend(&events, "{\"name\":\"", state.name, "\",\"ph\":\"X\",", common,
+                    ",\"ts\":", state.start, ",\"dur\":", end - state.start, ",\"args\":{", ids,
+                    ",\"parent_span_id\":\"", absl::Hex(state.parentSpanId, absl::kZeroPad16),
+                    "\"");
+    {
+        std::lock_guard lock(state.mutex);
+        for (const auto &[key, value] : state.arguments) {
+            absl::StrAppend(&events, ",\"", key, "\":", value);
+        }
+        absl::StrAppend(&events, "}},\n");
+        for (const auto &[event, timestamp] : state.marks) {
+            absl::StrAppend(&events, "{\"name\":\"", event, "\",\"ph\":\"i\",\"s\":\"t\",", common,
+                            ",\"ts\":", timestamp, ",\"args\":{", ids, "}},\n");
+        }
+    }
+
+    std::lock_guard lock(mutex);
+    buffer.append(events);
+    if (buffer.size() >= kWriteThreshold) {
+        writeBuffer();
+    }
+}
+
+// See tracer.h for documentation.
+void Tracer::writeBuffer() {
+    if (buffer.empty()) {
+        return;
+    }
+
+    // Open the file starting the JSON array of events. The closing bracket is optional in the
+    // trace event format so the file stays loadable if the process dies.
+    if (fd < 0) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            buffer.clear();
+            return;
+        }
+        buffer.insert(0, "[\n");
+    }
+    for (size_t offset = 0; offset < buffer.size();) {
+        auto written = write(fd, buffer.data() + offset, buffer.size() - offset);
+        if (written <= 0) {
+            break;
+        }
+        offset += written;
+    }
+    buffer.clear();
+}
+
+}  // namespace ostp::servercc
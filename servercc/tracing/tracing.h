@@ -0,0 +1,7 @@
+#ifndef SERVERCC_TRACING_H
+#define SERVERCC_TRACING_H
+
+#include "include/trace_context.h"
+#include "include/tracer.h"
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef SERVERCC_CANCELLATION_TOKEN_H
+#define SERVERCC_CANCELLATION_TOKEN_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "deadline.h"
+
+namespace ostp::servercc {
+
+// Signals that the work on a request was abandoned, either because the other end closed the
+// request, the connection to it was lost or the deadline of the request passed. Cancellation is
+// cooperative: a handler polls the token between steps of its work or waits on it, and callbacks
+// registered on the token let other code stop work it started for the request.
+//
+// A token must be owned by a shared pointer as the callbacks fired by its deadline hold it.
+class CancellationToken : public std::enable_shared_from_this<CancellationToken> {
+   public:
+    // Creates a token.
+    //
+    // Arguments:
+    //     deadline: The deadline after which the token is cancelled.
+    explicit CancellationToken(std::chrono::steady_clock::time_point deadline = kNoDeadline);
+
+    // Destroys the token removing its deadline from the timer of the deadlines.
+    ~CancellationToken();
+
+    // Returns a token that is never cancelled for requests that cannot be cancelled.
+    static std::shared_ptr<CancellationToken> never();
+
+    // Cancels the token calling every registered callback on the calling thread. Does nothing if
+    // the token was already cancelled or cannot be cancelled.
+    void cancel();
+
+    // Returns whether the token was cancelled or its deadline passed.
+    bool cancelled() const;
+
+    // Blocks until the token is cancelled.
+    void wait();
+
+    // Blocks until the token is cancelled or the timeout is reached.
+    //
+    // Arguments:
+    //     timeout: The timeout in milliseconds.
+    // Returns:
+    //     Whether the token was cancelled.
+    bool wait(int timeout);
+
+    // Registers a callback called once when the token is cancelled. The callback is called right
+    // away on the calling thread if the token already was. Callbacks run on the thread that
+    // cancels the token and must not block.
+    //
+    // Arguments:
+    //     callback: The callback to call.
+    // Returns:
+    //     The ID of the callback used to remove it.
+    uint64_t onCancel(std::function<void()> callback);
+
+    // Removes a callback that was not called yet.
+    //
+    // Arguments:
+    //     id: The ID returned when the callback was registered.
+    void removeCallback(uint64_t id);
+
+    // Returns the deadline of the token or kNoDeadline if it has none.
+    std::chrono::steady_clock::time_point deadline() const;
+
+    // Sets the deadline of the token.
+    //
+    // Arguments:
+    //     deadline: The deadline after which the token is cancelled.
+    void setDeadline(std::chrono::steady_clock::time_point deadline);
+
+   private:
+    // Whether the token can be cancelled.
+    const bool cancellable;
+
+    // Whether the token was cancelled.
+    std::atomic<bool> isCancelled = false;
+
+    // The deadline of the token in steady clock ticks.
+    std::atomic<std::chrono::steady_clock::rep> deadlineTime;
+
+    // Mutex protecting the fields below.
+    mutable std::mutex mutex;
+
+    // Signaled when the token is cancelled.
+    std::condition_variable condition;
+
+    // The callbacks to call when the token is cancelled with their IDs.
+    std::vector<std::pair<uint64_t, std::function<void()>>> callbacks;
+
+    // The ID of the next callback.
+    uint64_t nextCallbackId = 0;
+
+    // Whether the deadline is scheduled to cancel the token and the time it is scheduled for.
+    bool timerScheduled = false;
+    std::chrono::steady_clock::time_point scheduledTime;
+
+    // A token scheduled to expire by the timer of the deadlines.
+    struct ScheduledToken {
+        // The token which is valid while it is scheduled as a token removes itself when destroyed.
+        CancellationToken *token;
+
+        // The token while it is alive.
+        std::weak_ptr<CancellationToken> owner;
+    };
+
+    // The tokens scheduled to expire by the time they expire at.
+    typedef std::multimap<std::chrono::steady_clock::time_point, ScheduledToken> timers_t;
+
+    // Whether the token has an entry in the timer of the deadlines and the entry. Protected by
+    // the mutex of the timer.
+    bool hasTimerEntry = false;
+    timers_t::iterator timerEntry;
+
+    // Creates a token that cannot be cancelled.
+    struct NeverTag {};
+    explicit CancellationToken(NeverTag);
+
+    // Cancels the token if its deadline passed or schedules it again if the deadline was moved.
+    // Called by the timer of the deadlines.
+    void expire();
+
+    // Schedules the deadline to cancel the token. Must be called with the mutex held.
+    void scheduleTimer();
+
+    friend class DeadlineTimer;
+};
+
+}  // namespace ostp::servercc
+
+#endif
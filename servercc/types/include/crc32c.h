@@ -0,0 +1,36 @@
+#ifndef SERVERCC_CRC32C_H
+#define SERVERCC_CRC32C_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace ostp::servercc {
+
+// Extends the CRC32C (Castagnoli) checksum of a sequence of bytes with the bytes that follow it, so
+// that the checksum of a frame is folded over its segments without joining them.
+//
+// Uses the CRC32 instructions of SSE 4.2 or ARMv8 when the CPU has them, running three streams
+// at once to hide their latency, and a table-driven implementation otherwise. Long sequences are
+// folded 256 bytes at a time with the carry-less multiplication of VPCLMULQDQ on x86-64 CPUs with
+// AVX-512.
+//
+// Arguments:
+//     crc: The checksum of the bytes before or zero if there are none.
+//     data: The bytes that follow.
+//     length: The number of bytes that follow.
+// Returns:
+//     The checksum of all the bytes.
+uint32_t extendCrc32c(uint32_t crc, const void *data, size_t length);
+
+// Returns the CRC32C checksum of the specified bytes.
+inline uint32_t crc32c(const void *data, size_t length) { return extendCrc32c(0, data, length); }
+
+// The table-driven implementation extendCrc32c falls back to without the CRC32 instructions.
+uint32_t extendCrc32cPortable(uint32_t crc, const void *data, size_t length);
+
+// Returns whether extendCrc32c uses the CRC32 instructions of the CPU.
+bool crc32cAccelerated();
+
+}  // namespace ostp::servercc
+
+#endif
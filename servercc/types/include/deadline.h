@@ -0,0 +1,39 @@
+#ifndef SERVERCC_DEADLINE_H
+#define SERVERCC_DEADLINE_H
+
+#include <chrono>
+
+namespace ostp::servercc {
+
+// The deadline of work that has none.
+constexpr std::chrono::steady_clock::time_point kNoDeadline =
+    std::chrono::steady_clock::time_point::max();
+
+// Returns the deadline of the work running on the calling thread or kNoDeadline if it has none.
+// Internal requests sent by the work inherit it so that deadlines cascade down a fan-out tree.
+std::chrono::steady_clock::time_point currentDeadline();
+
+// Sets the deadline of the calling thread for the lifetime of the scope, restoring the previous
+// deadline when destroyed. A scope never extends the deadline of the scope it is nested in.
+class ScopedDeadline {
+   public:
+    // Sets the deadline of the calling thread.
+    //
+    // Arguments:
+    //     deadline: The deadline of the work running in the scope.
+    explicit ScopedDeadline(std::chrono::steady_clock::time_point deadline);
+
+    // Restores the previous deadline of the calling thread.
+    ~ScopedDeadline();
+
+    ScopedDeadline(const ScopedDeadline &) = delete;
+    ScopedDeadline &operator=(const ScopedDeadline &) = delete;
+
+   private:
+    // The deadline of the thread before the scope.
+    const std::chrono::steady_clock::time_point previous;
+};
+
+}  // namespace ostp::servercc
+
+#endif
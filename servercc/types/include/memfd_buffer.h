@@ -0,0 +1,76 @@
+#ifndef SERVERCC_MEMFD_BUFFER_H
+#define SERVERCC_MEMFD_BUFFER_H
+
+#include <inttypes.h>
+
+#include <memory>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace ostp::servercc {
+
+// A buffer backed by an anonymous memory file that can be handed to a process on the same host by
+// passing its file descriptor over a Unix domain socket. The receiver maps the same pages so the
+// payload is never copied through the socket.
+//
+// The size of the file is sealed before it is passed so that the sender cannot shrink it under the
+// mapping of the receiver.
+class MemfdBuffer {
+   public:
+    // Creates a writable buffer.
+    //
+    // Arguments:
+    //     name: The name of the memory file shown in /proc for debugging.
+    //     size: The size of the buffer in bytes.
+    // Returns:
+    //     The status of the operation and the buffer if successful.
+    static std::pair<absl::Status, std::unique_ptr<MemfdBuffer>> create(absl::string_view name,
+                                                                       size_t size);
+
+    // Maps a buffer received from a peer read only. The size of the memory file must be sealed.
+    //
+    // Arguments:
+    //     fd: The file descriptor of the memory file. The buffer takes ownership of it.
+    // Returns:
+    //     The status of the operation and the buffer if successful.
+    static std::pair<absl::Status, std::unique_ptr<MemfdBuffer>> map(int fd);
+
+    // Unmaps the buffer and closes its file descriptor.
+    ~MemfdBuffer();
+
+    MemfdBuffer(const MemfdBuffer &) = delete;
+    MemfdBuffer &operator=(const MemfdBuffer &) = delete;
+
+    // Returns the data of the buffer. Only writable for a buffer created by create().
+    uint8_t *data() { return address; }
+
+    // Returns the size of the buffer in bytes.
+    size_t size() const { return length; }
+
+    // Returns the file descriptor of the memory file to pass to a peer.
+    int getFd() const { return fd; }
+
+    // Seals the size of the memory file. Must be called before the buffer is passed to a peer.
+    //
+    // Returns:
+    //     The status of the operation.
+    absl::Status seal();
+
+   private:
+    // The file descriptor of the memory file.
+    const int fd;
+
+    // The address of the mapping.
+    uint8_t *const address;
+
+    // The size of the mapping.
+    const size_t length;
+
+    MemfdBuffer(int fd, uint8_t *address, size_t length)
+        : fd(fd), address(address), length(length) {}
+};
+
+}  // namespace ostp::servercc
+
+#endif
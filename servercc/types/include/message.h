@@ -2,8 +2,10 @@
 #define SERVERCC_MESSAGE_H
 
 #include <netdb.h>
+#include <sys/types.h>
 
 #include <memory>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "message_body.h"
@@ -20,15 +22,159 @@ struct Message {
     MessageBody body;
 };
 
+// The maximum number of file descriptors passed with a message.
+constexpr size_t kMaxPassedDescriptors = 16;
+
 // Reads a message from the specified file descriptor.
 std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd);
 
 // Reads a message from the specified file descriptor with a timeout.
 std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd, int timeout);
 
+// Reads a message from the specified Unix domain socket along with the file descriptors passed
+// with it.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     descriptors: Receives the passed file descriptors which are owned by the caller.
+// Returns:
+//     The status of the operation and the message if successful.
+std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd,
+                                                              std::vector<int> &descriptors);
+
 // Writes a message to the specified file descriptor.
 absl::Status writeMessage(int fd, std::unique_ptr<Message> message);
 
+// Writes a message to the specified Unix domain socket passing file descriptors with it.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     message: The message to write.
+//     descriptors: The file descriptors to pass. The peer receives duplicates and the caller keeps
+//         ownership of these. At most kMaxPassedDescriptors are passed with a message.
+// Returns:
+//     The status of the operation.
+absl::Status writeMessage(int fd, std::unique_ptr<Message> message,
+                          const std::vector<int> &descriptors);
+
+// The body of a large message sent without being copied into a Message, either from a pinned
+// buffer or from a region of a file.
+struct BulkPayload {
+    // The buffer of the body or null if the body is read from the file. Must not be modified until
+    // the message is written.
+    const uint8_t *data = nullptr;
+
+    // The file the body is read from if there is no buffer. Must support mmap, such as a regular
+    // file or a memfd.
+    int fd = -1;
+
+    // The offset of the body in the file.
+    off_t offset = 0;
+
+    // The length of the body.
+    size_t length = 0;
+
+    // Returns a payload sent from the specified buffer.
+    static BulkPayload fromBuffer(const void *data, size_t length) {
+        return {(const uint8_t *)data, -1, 0, length};
+    }
+
+    // Returns a payload sent from the specified region of a file.
+    static BulkPayload fromFile(int fd, off_t offset, size_t length) {
+        return {nullptr, fd, offset, length};
+    }
+
+    // Returns the part of the payload of the specified length starting at the specified offset.
+    BulkPayload slice(size_t start, size_t length) const {
+        return data != nullptr ? fromBuffer(data + start, length)
+                               : fromFile(fd, offset + (off_t)start, length);
+    }
+};
+
+// The default length of the chunks of a stream. Large enough for zero copy and sendfile to pay off
+// and small enough for the chunks of other channels to be interleaved often.
+constexpr size_t kStreamChunkLength = 1024 * 1024;
+
+// Returns the protocol of a message without the flags of a stream chunk.
+inline protocol_t streamProtocol(protocol_t protocol) {
+    return protocol & ~(kStreamChunkFlag | kStreamEndFlag);
+}
+
+// The length from which a buffer is sent with MSG_ZEROCOPY. Pinning the pages and waiting for the
+// completion costs more than copying smaller buffers.
+constexpr size_t kZeroCopyThreshold = 64 * 1024;
+
+// Writes a message whose body is a bulk payload followed by a trailer to the specified socket. The
+// framing is the same as writeMessage so the peer reads it with readMessage.
+//
+// A buffer of at least kZeroCopyThreshold bytes is sent with MSG_ZEROCOPY when the socket supports
+// it and the call returns once the kernel reports on the error queue that it released the pages,
+// so the buffer can be reused right away. A file region is sent with sendfile. Sockets that do not
+// support either fall back to copying the bytes.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     protocol: The protocol of the message.
+//     payload: The body of the message.
+//     trailer: The bytes sent after the payload in the body.
+// Returns:
+//     The status of the operation.
+absl::Status writeBulkMessage(int fd, protocol_t protocol, const BulkPayload &payload,
+                              const std::vector<uint8_t> &trailer = {});
+
+// Writes a frame made of a header in any framing followed by a payload and a trailer to the
+// specified socket, sending the payload like writeBulkMessage does. writeBulkMessage writes a frame
+// with the header of a message.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     header: The header of the frame.
+//     headerLength: The length of the header.
+//     payload: The start of the body of the frame.
+//     trailer: The bytes sent after the payload in the body.
+// Returns:
+//     The status of the operation.
+absl::Status sendFrame(int fd, const void *header, size_t headerLength, const BulkPayload &payload,
+                       const std::vector<uint8_t> &trailer = {});
+
+// Reads at least the specified number of bytes from the specified socket into a buffer, taking as
+// many more as are already available so that several small frames are read with one system call.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     data: The buffer to read into.
+//     minimum: The number of bytes to wait for.
+//     capacity: The length of the buffer.
+// Returns:
+//     The number of bytes read or -1 if the stream ended or failed first.
+ssize_t readAtLeast(int fd, void *data, size_t minimum, size_t capacity);
+
+// Reads the specified number of bytes from the specified socket into a buffer along with as many
+// of the bytes already available after them as fit into a second buffer, so that a large body read
+// directly into place does not leave the bytes that follow it to a system call of their own.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     data: The buffer to read the bytes into.
+//     length: The number of bytes to read into the buffer.
+//     spill: The buffer to read the bytes that follow into.
+//     spillCapacity: The length of the second buffer.
+// Returns:
+//     The number of bytes read into the second buffer or -1 if the stream ended or failed first.
+ssize_t readAtLeast(int fd, void *data, size_t length, void *spill, size_t spillCapacity);
+
+// Copies a bulk payload followed by a trailer into a message for the links that cannot send it
+// directly.
+//
+// Arguments:
+//     protocol: The protocol of the message.
+//     payload: The body of the message.
+//     trailer: The bytes appended to the payload in the body.
+// Returns:
+//     The status of the operation and the message if successful.
+std::pair<absl::Status, std::unique_ptr<Message>> makeBulkMessage(
+    protocol_t protocol, const BulkPayload &payload, const std::vector<uint8_t> &trailer = {});
+
 // Create a wrapped message with the message ID and append the header and message buffer ID to
 // the body as follows:
 //
@@ -57,6 +203,16 @@ std::unique_ptr<Message> wrapMessage(const T& value, std::unique_ptr<Message> me
     return std::move(message);
 }
 
+// Returns the bytes wrapMessage appends to the body of a message with the specified header. Used to
+// wrap a bulk payload which is not copied into a message.
+template <typename T>
+std::vector<uint8_t> wrapTrailer(const T& value, const MessageHeader& header) {
+    std::vector<uint8_t> trailer(kMessageHeaderLength + sizeof(T));
+    memcpy(trailer.data(), &header, kMessageHeaderLength);
+    memcpy(trailer.data() + kMessageHeaderLength, &value, sizeof(T));
+    return trailer;
+}
+
 // Unwraps a message.
 template <typename T>
 std::tuple<absl::Status, std::unique_ptr<T>, std::unique_ptr<Message>> unwrapMessage(
@@ -26,6 +26,9 @@ struct MessageHeader {
 // The length of the message header.
 constexpr uint32_t kMessageHeaderLength = sizeof(MessageHeader);
 
+// The maximum length of the body of a message sent in a single UDP datagram.
+constexpr uint32_t kMaxDatagramBodyLength = 65507 - kMessageHeaderLength;
+
 
 }  // namespace ostp::servercc
 
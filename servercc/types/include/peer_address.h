@@ -0,0 +1,39 @@
+#ifndef SERVERCC_PEER_ADDRESS_H
+#define SERVERCC_PEER_ADDRESS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <compare>
+#include <cstdint>
+#include <utility>
+
+namespace ostp::servercc {
+
+// Identifies a peer server by its ip address and the port it listens on so that several servers
+// on the same host are distinct peers.
+struct PeerAddress {
+    // The ip address in network byte order.
+    in_addr_t address = 0;
+
+    // The port in host byte order.
+    uint16_t port = 0;
+
+    // Returns the peer at the specified socket address.
+    static PeerAddress of(const sockaddr &addr) {
+        auto *addr_in = (const sockaddr_in *)&addr;
+        return {addr_in->sin_addr.s_addr, ntohs(addr_in->sin_port)};
+    }
+
+    auto operator<=>(const PeerAddress &other) const = default;
+
+    template <typename H>
+    friend H AbslHashValue(H h, const PeerAddress &peer) {
+        return H::combine(std::move(h), peer.address, peer.port);
+    }
+};
+
+}  // namespace ostp::servercc
+
+#endif
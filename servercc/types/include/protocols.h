@@ -14,17 +14,85 @@ typedef uint32_t protocol_t;
 // | header | port to send response to  |
 constexpr protocol_t kConnectRequestProtocol = 0x00;
 
-// Acknowledges a connection UDP request.
+// Acknowledges a connection UDP request. The body starts with the port the peer listens on which
+// identifies it together with its address. A peer on the same host may offer the name of a shared
+// memory segment to carry the internal requests of the connection. The newest wire format the peer
+// supports follows a null byte, which peers that do not know wire formats ignore along with it. A
+// peer that compresses messages then offers the set of codecs it knows, one bit per codec, and the
+// ID of its compression dictionary or zero. A peer that checksums messages follows them, even if
+// it knows no codec, with a byte set to 1 for the headers of the messages or 2 for their bodies
+// too.
 //
-// | header | body ---- |
-// | header |           |
+// | header | body ---------------------------------------------------------------------- |
+// | header | port (2B) | optional shared memory segment name | 0 | optional wire format (1B) |
+// | optional codecs (1B) | optional dictionary ID (4B) | optional checksums (1B) |
 constexpr protocol_t kConnectAckRequestProtocol = 0x01;
 
-// Responds to a connection UDP request.
+// Responds to a connection UDP request. If a shared memory segment or a wire format was offered
+// the body starts with a byte set to 1 if the segment was opened. If a wire format was offered the
+// wire format both peers use from then on follows. If codecs were offered the codec both peers
+// compress messages with, or zero for none, and the ID of the dictionary they share, or zero for
+// none, follow. If checksums were offered the fewer checksums both peers offered, or zero for
+// none, follow.
+//
+// | header | body ---------------------------------------------------------------------------- |
+// | header | optional accepted (1B) | optional wire format (1B) | optional codec (1B) |
+// | optional dictionary ID (4B) | optional checksums (1B) |
+constexpr protocol_t kConnectAckResponseProtocol = 0x02;
+
+// Probes a member of the group. The member answers with an ack.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | sequence | source | source incarnation | target | update count | updates     |
+constexpr protocol_t kMembershipPingProtocol = 0x03;
+
+// Asks a member to probe the target on behalf of the source and relay the ack.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | sequence | source | source incarnation | target | update count | updates     |
+constexpr protocol_t kMembershipPingRequestProtocol = 0x04;
+
+// Acknowledges a probe with the sequence of the probe.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | sequence | source | source incarnation | target | update count | updates     |
+constexpr protocol_t kMembershipAckProtocol = 0x05;
+
+// Sends the whole view of a member to a member that announced itself.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | sequence | source | source incarnation | target | member count | members     |
+constexpr protocol_t kMembershipSyncProtocol = 0x06;
+
+// Answers a request that a server shed because it is overloaded instead of handling it. The
+// request had no effect and can be retried later or on another server.
 //
 // | header | body ---- |
 // | header |           |
-constexpr protocol_t kConnectAckResponseProtocol = 0x02;
+constexpr protocol_t kOverloadedProtocol = 0x07;
+
+// Carries a message multicast reliably by a sender. Receivers deliver the messages of a sender in
+// the order of their sequence with their original protocol and body, and report the missing ones
+// with a NACK. A retransmission is the same message multicast again.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | sender port (2B) | session (4B) | sequence (8B) | original protocol | original body |
+constexpr protocol_t kReliableMulticastDataProtocol = 0x08;
+
+// Advertises the last sequence a sender multicast reliably while it is idle, so that receivers
+// detect the loss of its last messages, and the first sequence it still holds. Also answers a NACK
+// for messages the sender no longer holds.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | sender port (2B) | session (4B) | last sequence (8B) | first sequence (8B)      |
+constexpr protocol_t kReliableMulticastHeartbeatProtocol = 0x09;
+
+// Reports the messages of a session missing at a receiver to their sender, as ranges of
+// consecutive sequences.
+//
+// | header | body ------------------------------------------------------------------------ |
+// | header | session (4B) | range count (2B) | first sequence (8B) | count (4B) | ...        |
+constexpr protocol_t kReliableMulticastNackProtocol = 0x0a;
 
 // Starts a new internal request channel.
 //
@@ -32,7 +100,8 @@ constexpr protocol_t kConnectAckResponseProtocol = 0x02;
 // | header | original body | original header | channel ID |
 constexpr protocol_t kInternalRequestProtocol = 0x10;
 
-// Ends an internal request channel.
+// Ends an internal request channel. Sent after the last message of a single-shot request only to
+// abandon it.
 //
 // | header | body ----- |
 // | header | channel ID |
@@ -44,7 +113,9 @@ constexpr protocol_t kInternalRequestEndProtocol = 0x11;
 // | header | original body | original header | channel ID |
 constexpr protocol_t kInternalResponseProtocol = 0x13;
 
-// Ends an internal response channel.
+// Ends an internal response channel unless its last message carried kChannelEndFlag. Every
+// response channel is ended exactly once as the requesting end only reuses the channel ID after
+// that.
 //
 // | header | body ----- |
 // | header | channel ID |
@@ -56,6 +127,109 @@ constexpr protocol_t kInternalResponseEndProtocol = 0x14;
 // | header | channel ID | error message |
 constexpr protocol_t kInternalErrorProtocol = 0x15;
 
+// Proves a connector link alive to the peer's failure detector.
+//
+// | header | body ---- |
+// | header |           |
+constexpr protocol_t kInternalHeartbeatProtocol = 0x16;
+
+// Carries a batch of small requests to a peer in a single message of an internal request. Every
+// request is handled by the handler of its protocol.
+//
+// | header | body ------------------------------------------------------------- |
+// | header | protocol | length | body | protocol | length | body | ...           |
+constexpr protocol_t kInternalBatchProtocol = 0x17;
+
+// Answers a batch with the response of every request in the order of the batch. A request that
+// failed or was not answered has an entry with kInternalErrorProtocol whose body is the status
+// code (4B) followed by the status message.
+//
+// | header | body ------------------------------------------------------------- |
+// | header | protocol | length | body | protocol | length | body | ...           |
+constexpr protocol_t kInternalBatchResponseProtocol = 0x18;
+
+// Marks the first message of a sampled internal request channel. The outer protocol is the
+// channel protocol with this flag set and the trace context is appended before the channel ID.
+//
+// | header | body ------------------------------------------------------- |
+// | header | original body | original header | trace context | channel ID |
+constexpr protocol_t kTracedProtocolFlag = 0x80000000;
+
+// Marks the first message of an internal request channel whose request has a deadline. The outer
+// protocol is the channel protocol with this flag set and the time left until the deadline is
+// appended after the channel ID, including the one of a traced message. The time is relative as
+// the clocks of two hosts are not comparable.
+//
+// | header | body ---------------------------------------------------------------- |
+// | header | original body | original header | channel ID | time left in us (8B)   |
+constexpr protocol_t kDeadlineProtocolFlag = 0x10000000;
+
+// Marks the first message an end writes to an internal channel. A request message without it for
+// a channel that does not exist belongs to a request the responding end already ended, so it is
+// dropped instead of starting another request.
+constexpr protocol_t kChannelOpenFlag = 0x08000000;
+
+// Marks the last message an end writes to an internal channel in place of a separate end message.
+// A single-shot request carries it on its only message and the only message answering it carries
+// it too, ending the channel on both ends so that a request and its response take two frames. The
+// requesting end may still end a single-shot request with an end message to abandon it.
+constexpr protocol_t kChannelEndFlag = 0x04000000;
+
+// Marks a chunk of a message streamed in several messages so that a payload is neither held in a
+// single message nor limited to 4 GB. The chunks are consecutive messages of a request whose
+// protocol is the protocol of the stream with this flag set. Internal channels set it on the
+// original header.
+//
+// | header | body  |
+// | header | chunk |
+constexpr protocol_t kStreamChunkFlag = 0x40000000;
+
+// Marks the last chunk of a stream along with kStreamChunkFlag.
+constexpr protocol_t kStreamEndFlag = 0x20000000;
+
+// Requests the metrics of the process.
+//
+// | header | body ---- |
+// | header |           |
+constexpr protocol_t kMetricsRequestProtocol = 0x20;
+
+// Responds to a metrics request with the metrics in the text exposition format.
+//
+// | header | body ------------- |
+// | header | exposition text   |
+constexpr protocol_t kMetricsResponseProtocol = 0x21;
+
+// Looks up a key on the server owning it. The owner loads the key on a miss.
+//
+// | header | body |
+// | header | key  |
+constexpr protocol_t kCacheGetProtocol = 0x40;
+
+// Looks up several keys owned by the same server.
+//
+// | header | body ------------------------------------------------- |
+// | header | key length | key | key length | key | ...              |
+constexpr protocol_t kCacheMultiGetProtocol = 0x41;
+
+// Stores the value of a key on the server owning it.
+//
+// | header | body ------------------ |
+// | header | key length | key | value |
+constexpr protocol_t kCachePutProtocol = 0x42;
+
+// Removes a key from the server owning it.
+//
+// | header | body |
+// | header | key  |
+constexpr protocol_t kCacheInvalidateProtocol = 0x43;
+
+// Responds to a cache request with the result of every lookup, empty for a put or invalidate. A
+// result is a miss, a hit followed by the value, or an error followed by the status.
+//
+// | header | body ------------------------------------------------------------------ |
+// | header | result | value length | value | result | status code | message length | message |
+constexpr protocol_t kCacheResponseProtocol = 0x44;
+
 }  // namespace ostp::servercc
 
 #endif
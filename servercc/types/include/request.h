@@ -7,6 +7,8 @@
 #include <memory>
 
 #include "absl/status/status.h"
+#include "cancellation_token.h"
+#include "deadline.h"
 #include "message.h"
 
 namespace ostp::servercc {
@@ -14,8 +16,22 @@ namespace ostp::servercc {
 // A request to the server.
 class Request {
    public:
-    // Destructor of the request. Should be called when the request is no longer needed.
-    virtual ~Request() = default;
+    // Destructor of the request. Should be called when the request is no longer needed. Calls
+    // the completion callback if one was set.
+    virtual ~Request() {
+        if (completionCallback != nullptr) {
+            completionCallback();
+        }
+    }
+
+    // Sets a callback called once the request is destroyed, such as to release the capacity it
+    // was admitted with. Replaces any previous callback.
+    //
+    // Arguments:
+    //     callback: The callback to call.
+    void setCompletionCallback(std::function<void()> callback) {
+        completionCallback = std::move(callback);
+    }
 
     // Returns the socket address of the client.
     //
@@ -51,8 +67,118 @@ class Request {
     //     The status of the operation.
     virtual absl::Status sendMessage(std::unique_ptr<Message> message) = 0;
 
+    // Sends a message whose body is a bulk payload without copying it into a message when the
+    // request supports it. The payload can be reused once the call returns.
+    //
+    // Arguments:
+    //     protocol: The protocol of the message.
+    //     payload: The body of the message.
+    // Returns:
+    //     The status of the operation.
+    virtual absl::Status sendBulkMessage(protocol_t protocol, const BulkPayload &payload) {
+        auto [status, message] = makeBulkMessage(protocol, payload);
+        if (!status.ok()) {
+            return status;
+        }
+        return sendMessage(std::move(message));
+    }
+
+    // Sends a chunk of a stream. The chunks of other requests on the same connection are sent in
+    // between the chunks of the stream.
+    //
+    // Arguments:
+    //     protocol: The protocol of the stream.
+    //     chunk: The chunk to send.
+    //     last: Whether the chunk ends the stream.
+    // Returns:
+    //     The status of the operation.
+    absl::Status sendChunk(protocol_t protocol, const BulkPayload &chunk, bool last) {
+        return sendBulkMessage(protocol | kStreamChunkFlag | (last ? kStreamEndFlag : 0), chunk);
+    }
+
+    // Sends a payload of any length as a stream of chunks.
+    //
+    // Arguments:
+    //     protocol: The protocol of the stream.
+    //     payload: The payload to send.
+    //     chunkLength: The maximum length of a chunk.
+    // Returns:
+    //     The status of the operation.
+    absl::Status sendStream(protocol_t protocol, const BulkPayload &payload,
+                            size_t chunkLength = kStreamChunkLength) {
+        if (chunkLength == 0) {
+            return absl::InvalidArgumentError("Chunk length must be positive");
+        }
+        size_t offset = 0;
+        do {
+            auto length = std::min(chunkLength, payload.length - offset);
+            auto status = sendChunk(protocol, payload.slice(offset, length),
+                                    offset + length == payload.length);
+            if (!status.ok()) {
+                return status;
+            }
+            offset += length;
+        } while (offset < payload.length);
+        return absl::OkStatus();
+    }
+
+    // Receives a stream handing each chunk to the consumer as it arrives so that the payload is
+    // never held as a whole. The chunks are handed with the protocol of the stream. A message that
+    // is not a chunk is a stream of its own.
+    //
+    // Arguments:
+    //     consumer: Called with every chunk in order. Stops the stream if it fails.
+    // Returns:
+    //     The status of the operation.
+    absl::Status receiveStream(
+        const std::function<absl::Status(std::unique_ptr<Message> chunk)> &consumer) {
+        while (true) {
+            auto [status, chunk] = receiveMessage();
+            if (!status.ok()) {
+                return status;
+            }
+            auto protocol = chunk->header.protocol;
+            chunk->header.protocol = streamProtocol(protocol);
+            if (!(status = consumer(std::move(chunk))).ok()) {
+                return status;
+            }
+            if (!(protocol & kStreamChunkFlag) || (protocol & kStreamEndFlag)) {
+                return absl::OkStatus();
+            }
+        }
+    }
+
+    // Returns the time by which the client expects the request to complete or kNoDeadline if it
+    // set none. Work on a request past its deadline is wasted as the client no longer reads it.
+    virtual std::chrono::steady_clock::time_point deadline() { return kNoDeadline; }
+
+    // Sets the deadline of the request. A request sent to a peer carries it to the handler of the
+    // peer with its first message, so it must be set before the first message is sent. Messages
+    // are neither sent nor waited for past the deadline.
+    //
+    // Arguments:
+    //     deadline: The deadline of the request.
+    // Returns:
+    //     The status of the operation. Returns an Unimplemented error if the request does not
+    //     support deadlines.
+    virtual absl::Status setDeadline(std::chrono::steady_clock::time_point) {
+        return absl::UnimplementedError("Request does not support deadlines");
+    }
+
+    // Returns the token cancelled once the work on the request is abandoned, such as when the
+    // other end closes the request, the connection to it is lost or the deadline passes. A handler
+    // that computes without reading should poll or wait on it to stop early. Requests that cannot
+    // be cancelled return a token that never is.
+    virtual std::shared_ptr<CancellationToken> cancellationToken() {
+        return CancellationToken::never();
+    }
+
     // Terminates the request.
     virtual void terminate() = 0;
+
+   private:
+    // The callback called once the request is destroyed.
+    std::function<void()> completionCallback;
 };
 
 // The type of a protocol handler.
@@ -0,0 +1,42 @@
+#ifndef SERVERCC_UNIX_ADDRESS_H
+#define SERVERCC_UNIX_ADDRESS_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cstring>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace ostp::servercc {
+
+// Fills the address of a Unix domain socket. A path starting with '@' names a socket in the
+// abstract namespace which is not backed by a file and disappears with its last reference.
+//
+// Arguments:
+//     path: The path of the socket.
+//     address: The address to fill.
+//     length: Receives the length of the address.
+// Returns:
+//     The status of the operation.
+inline absl::Status makeUnixAddress(absl::string_view path, sockaddr_un &address,
+                                    socklen_t &length) {
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        return absl::InvalidArgumentError("Invalid Unix domain socket path");
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        address.sun_path[0] = '\0';
+        length = offsetof(sockaddr_un, sun_path) + path.size();
+    } else {
+        length = sizeof(address);
+    }
+    return absl::OkStatus();
+}
+
+}  // namespace ostp::servercc
+
+#endif
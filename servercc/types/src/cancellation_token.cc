@@ -0,0 +1,243 @@
+#include "cancellation_token.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace ostp::servercc {
+
+// Cancels the tokens with callbacks once their deadline passes. A single thread serves every token
+// of the process so that tokens that are never waited on cost nothing.
+class DeadlineTimer {
+   public:
+    // Returns the timer of the process which is never destroyed so that its thread can outlive
+    // the static objects during exit.
+    static DeadlineTimer &global() {
+        static DeadlineTimer *timer = new DeadlineTimer();
+        return *timer;
+    }
+
+    // Schedules a token to be expired at the specified time replacing its entry if it has one.
+    //
+    // Arguments:
+    //     time: The time at which to expire the token.
+    //     token: The token to expire.
+    void schedule(std::chrono::steady_clock::time_point time, CancellationToken &token) {
+        std::lock_guard lock(mutex);
+        if (!started) {
+            std::thread([this]() { this->run(); }).detach();
+            started = true;
+        }
+        if (token.hasTimerEntry) {
+            timers.erase(token.timerEntry);
+        }
+        token.timerEntry = timers.emplace(time, CancellationToken::ScheduledToken{
+                                                    &token, token.weak_from_this()});
+        token.hasTimerEntry = true;
+        if (token.timerEntry == timers.begin()) {
+            condition.notify_one();
+        }
+    }
+
+    // Removes a token from the timer if it is scheduled so that cancelled and destroyed tokens do
+    // not pile up until their deadline.
+    //
+    // Arguments:
+    //     token: The token to remove.
+    void unschedule(CancellationToken &token) {
+        std::lock_guard lock(mutex);
+        if (token.hasTimerEntry) {
+            timers.erase(token.timerEntry);
+            token.hasTimerEntry = false;
+        }
+    }
+
+   private:
+    // Mutex protecting the fields below.
+    std::mutex mutex;
+
+    // Signaled when a timer is scheduled before every other one.
+    std::condition_variable condition;
+
+    // The scheduled tokens by the time at which they expire.
+    CancellationToken::timers_t timers;
+
+    // Whether the thread expiring the tokens was started.
+    bool started = false;
+
+    // Expires the tokens as their time comes.
+    void run() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            if (timers.empty()) {
+                condition.wait(lock);
+                continue;
+            }
+            auto time = timers.begin()->first;
+            if (time > std::chrono::steady_clock::now()) {
+                condition.wait_until(lock, time);
+                continue;
+            }
+            timers.begin()->second.token->hasTimerEntry = false;
+            auto token = timers.begin()->second.owner.lock();
+            timers.erase(timers.begin());
+
+            // A token being destroyed before its deadline has nobody left to notify.
+            if (token != nullptr) {
+                lock.unlock();
+                token->expire();
+                token.reset();
+                lock.lock();
+            }
+        }
+    }
+};
+
+// See cancellation_token.h for documentation.
+CancellationToken::CancellationToken(std::chrono::steady_clock::time_point deadline)
+    : cancellable(true), deadlineTime(deadline.time_since_epoch().count()) {}
+
+// See cancellation_token.h for documentation.
+CancellationToken::~CancellationToken() {
+    if (timerScheduled) {
+        DeadlineTimer::global().unschedule(*this);
+    }
+}
+
+// See cancellation_token.h for documentation.
+CancellationToken::CancellationToken(NeverTag)
+    : cancellable(false), deadlineTime(kNoDeadline.time_since_epoch().count()) {}
+
+// See cancellation_token.h for documentation.
+std::shared_ptr<CancellationToken> CancellationToken::never() {
+    static auto token = std::shared_ptr<CancellationToken>(new CancellationToken(NeverTag()));
+    return token;
+}
+
+// See cancellation_token.h for documentation.
+void CancellationToken::cancel() {
+    if (!cancellable) {
+        return;
+    }
+    std::unique_lock lock(mutex);
+    if (isCancelled.exchange(true)) {
+        return;
+    }
+    auto cancelled = std::move(callbacks);
+    callbacks.clear();
+    condition.notify_all();
+    bool scheduled = timerScheduled;
+    timerScheduled = false;
+    lock.unlock();
+    if (scheduled) {
+        DeadlineTimer::global().unschedule(*this);
+    }
+
+    for (auto &[id, callback] : cancelled) {
+        callback();
+    }
+}
+
+// See cancellation_token.h for documentation.
+bool CancellationToken::cancelled() const {
+    return isCancelled.load() || std::chrono::steady_clock::now() >= deadline();
+}
+
+// See cancellation_token.h for documentation.
+void CancellationToken::wait() {
+    std::unique_lock lock(mutex);
+    while (!isCancelled.load()) {
+        auto until = deadline();
+        if (until == kNoDeadline) {
+            condition.wait(lock);
+        } else if (condition.wait_until(lock, until) == std::cv_status::timeout &&
+                   std::chrono::steady_clock::now() >= deadline()) {
+            return;
+        }
+    }
+}
+
+// See cancellation_token.h for documentation.
+bool CancellationToken::wait(int timeout) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    std::unique_lock lock(mutex);
+    while (!isCancelled.load()) {
+        auto limit = std::min(until, deadline());
+        if (condition.wait_until(lock, limit) == std::cv_status::timeout &&
+            std::chrono::steady_clock::now() >= std::min(until, deadline())) {
+            break;
+        }
+    }
+    return cancelled();
+}
+
+// See cancellation_token.h for documentation.
+uint64_t CancellationToken::onCancel(std::function<void()> callback) {
+    std::unique_lock lock(mutex);
+    if (!isCancelled.load() && std::chrono::steady_clock::now() < deadline()) {
+        auto id = nextCallbackId++;
+        callbacks.emplace_back(id, std::move(callback));
+        scheduleTimer();
+        return id;
+    }
+    auto id = nextCallbackId;
+    lock.unlock();
+    callback();
+    return id;
+}
+
+// See cancellation_token.h for documentation.
+void CancellationToken::removeCallback(uint64_t id) {
+    std::lock_guard lock(mutex);
+    std::erase_if(callbacks, [id](const auto &entry) { return entry.first == id; });
+}
+
+// See cancellation_token.h for documentation.
+std::chrono::steady_clock::time_point CancellationToken::deadline() const {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(deadlineTime.load(std::memory_order_relaxed)));
+}
+
+// See cancellation_token.h for documentation.
+void CancellationToken::setDeadline(std::chrono::steady_clock::time_point deadline) {
+    if (!cancellable) {
+        return;
+    }
+    std::lock_guard lock(mutex);
+    deadlineTime.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+
+    // Waiters and callbacks follow the new deadline.
+    condition.notify_all();
+    if (!callbacks.empty()) {
+        scheduleTimer();
+    }
+}
+
+// See cancellation_token.h for documentation.
+void CancellationToken::expire() {
+    std::unique_lock lock(mutex);
+    timerScheduled = false;
+    if (std::chrono::steady_clock::now() < deadline()) {
+        // The deadline was moved after the token was scheduled.
+        if (!callbacks.empty()) {
+            scheduleTimer();
+        }
+        return;
+    }
+    lock.unlock();
+    cancel();
+}
+
+// See cancellation_token.h for documentation.
+void CancellationToken::scheduleTimer() {
+    // The token stays scheduled for the earliest deadline it had and is scheduled again when it
+    // expires before the deadline that was moved later.
+    auto until = deadline();
+    if (until == kNoDeadline || (timerScheduled && until >= scheduledTime)) {
+        return;
+    }
+    timerScheduled = true;
+    scheduledTime = until;
+    DeadlineTimer::global().schedule(until, *this);
+}
+
+}  // namespace ostp::servercc
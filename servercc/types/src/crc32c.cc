@@ -0,0 +1,355 @@
+#include "crc32c.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+namespace ostp::servercc {
+
+namespace {
+
+// The reflected Castagnoli polynomial.
+constexpr uint32_t kPolynomial = 0x82f63b78;
+
+// The lengths of the blocks the three streams of the hardware implementation take at a time.
+// Long blocks amortize combining the streams and short blocks keep the streams going on the rest.
+constexpr size_t kLongBlock = 8192;
+constexpr size_t kShortBlock = 256;
+
+// The length from which the bytes are folded with carry-less multiplication. The 512-bit units
+// take a while to start up after the thread was switched in, which shorter sequences, such as the
+// bodies of most messages checked right after they were read, do not make up for.
+constexpr size_t kFoldThreshold = 4096;
+
+// The tables of a CRC by byte.
+template <size_t N>
+using crc_tables_t = std::array<std::array<uint32_t, 256>, N>;
+
+// A 32 by 32 matrix over GF(2) given by its columns, the linear operator on a CRC that appends a
+// number of zero bits to the bytes it covers.
+using gf2_matrix_t = std::array<uint32_t, 32>;
+
+// Returns the tables of slicing by eight: the CRC of a byte followed by zero to seven zero bytes.
+constexpr crc_tables_t<8> makeByteTables() {
+    crc_tables_t<8> tables{};
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ kPolynomial : crc >> 1;
+        }
+        tables[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (size_t k = 1; k < 8; k++) {
+            tables[k][n] = (tables[k - 1][n] >> 8) ^ tables[0][tables[k - 1][n] & 0xff];
+        }
+    }
+    return tables;
+}
+
+// Returns the product of a matrix and a vector over GF(2).
+constexpr uint32_t multiply(const gf2_matrix_t &matrix, uint32_t vector) {
+    uint32_t product = 0;
+    for (size_t i = 0; vector != 0; i++, vector >>= 1) {
+        if (vector & 1) {
+            product ^= matrix[i];
+        }
+    }
+    return product;
+}
+
+// Returns the tables by byte of the operator appending the specified number of zero bytes to a
+// CRC, which shifts the CRC of a stream past the bytes of the streams after it.
+//
+// Arguments:
+//     length: The number of zero bytes which must be a power of two.
+constexpr crc_tables_t<4> makeShiftTables(size_t length) {
+    // Start from the operator for one zero bit and square it up to the length.
+    gf2_matrix_t op{};
+    op[0] = kPolynomial;
+    for (size_t n = 1; n < 32; n++) {
+        op[n] = 1u << (n - 1);
+    }
+    for (size_t bits = 1; bits < length * 8; bits *= 2) {
+        gf2_matrix_t square{};
+        for (size_t n = 0; n < 32; n++) {
+            square[n] = multiply(op, op[n]);
+        }
+        op = square;
+    }
+
+    crc_tables_t<4> tables{};
+    for (uint32_t n = 0; n < 256; n++) {
+        for (size_t k = 0; k < 4; k++) {
+            tables[k][n] = multiply(op, n << (8 * k));
+        }
+    }
+    return tables;
+}
+
+// Returns x to the specified power modulo the polynomial, reflected.
+constexpr uint32_t powerOfX(size_t power) {
+    uint32_t value = 0x80000000;
+    for (size_t n = 0; n < power; n++) {
+        value = value & 1 ? (value >> 1) ^ kPolynomial : value >> 1;
+    }
+    return value;
+}
+
+// Returns the constant a half of a 128-bit lane is multiplied by to move it the specified number
+// of bits further: x to that power modulo the polynomial, reflected and shifted by one as the
+// product of two reflected values is.
+constexpr uint64_t foldConstant(size_t bits) { return (uint64_t)powerOfX(bits) << 1; }
+
+// The constants that move a 128-bit lane a number of bits further, the high half by the bits less
+// 32 and the low half by the bits plus 32.
+struct FoldConstants {
+    uint64_t high;
+    uint64_t low;
+};
+
+// Returns the constants that move a 128-bit lane the specified number of bytes further.
+constexpr FoldConstants foldConstants(size_t bytes) {
+    return {foldConstant(bytes * 8 - 32), foldConstant(bytes * 8 + 32)};
+}
+
+constexpr auto kFoldBlock = foldConstants(256);
+constexpr auto kFoldVector = foldConstants(64);
+constexpr auto kFoldLane1 = foldConstants(48);
+constexpr auto kFoldLane2 = foldConstants(32);
+constexpr auto kFoldLane3 = foldConstants(16);
+
+constexpr auto kByteTables = makeByteTables();
+constexpr auto kLongShift = makeShiftTables(kLongBlock);
+constexpr auto kShortShift = makeShiftTables(kShortBlock);
+
+// Appends the zero bytes of a shift table to a CRC.
+inline uint32_t shift(const crc_tables_t<4> &tables, uint32_t crc) {
+    return tables[0][crc & 0xff] ^ tables[1][(crc >> 8) & 0xff] ^ tables[2][(crc >> 16) & 0xff] ^
+           tables[3][crc >> 24];
+}
+
+// Returns the 8 bytes at the specified address.
+inline uint64_t load64(const uint8_t *data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+// See crc32c.h for documentation.
+uint32_t extendPortable(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    if constexpr (std::endian::native == std::endian::little) {
+        for (; length >= 8; data += 8, length -= 8) {
+            auto word = load64(data) ^ crc;
+            crc = kByteTables[7][word & 0xff] ^ kByteTables[6][(word >> 8) & 0xff] ^
+                  kByteTables[5][(word >> 16) & 0xff] ^ kByteTables[4][(word >> 24) & 0xff] ^
+                  kByteTables[3][(word >> 32) & 0xff] ^ kByteTables[2][(word >> 40) & 0xff] ^
+                  kByteTables[1][(word >> 48) & 0xff] ^ kByteTables[0][word >> 56];
+        }
+    }
+    for (; length > 0; data++, length--) {
+        crc = (crc >> 8) ^ kByteTables[0][(crc ^ *data) & 0xff];
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+
+#define SERVERCC_CRC32C_TARGET __attribute__((target("sse4.2")))
+
+SERVERCC_CRC32C_TARGET inline uint32_t crcByte(uint32_t crc, uint8_t byte) {
+    return _mm_crc32_u8(crc, byte);
+}
+
+SERVERCC_CRC32C_TARGET inline uint32_t crcWord(uint32_t crc, uint64_t word) {
+    return _mm_crc32_u64(crc, word);
+}
+
+// Returns whether the CPU has the CRC32 instruction.
+bool hardwareSupported() { return __builtin_cpu_supports("sse4.2"); }
+
+#define SERVERCC_CRC32C_FOLD_TARGET __attribute__((target("sse4.2,avx512f,vpclmulqdq")))
+
+// Returns whether the CPU multiplies 512-bit vectors without carries.
+bool foldingSupported() {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq");
+}
+
+#elif defined(__aarch64__)
+
+#define SERVERCC_CRC32C_TARGET __attribute__((target("+crc")))
+
+SERVERCC_CRC32C_TARGET inline uint32_t crcByte(uint32_t crc, uint8_t byte) {
+    return __crc32cb(crc, byte);
+}
+
+SERVERCC_CRC32C_TARGET inline uint32_t crcWord(uint32_t crc, uint64_t word) {
+    return __crc32cd(crc, word);
+}
+
+// Returns whether the CPU has the CRC32 instructions.
+bool hardwareSupported() { return getauxval(AT_HWCAP) & HWCAP_CRC32; }
+
+#endif
+
+#if defined(SERVERCC_CRC32C_TARGET)
+
+// Runs three streams over consecutive blocks of the specified length at a time since the CRC32
+// instruction takes three cycles and issues every cycle, then shifts the CRC of every stream past
+// the blocks of the streams after it to combine them.
+//
+// Arguments:
+//     crc: The running CRC.
+//     data: The bytes, advanced past the blocks.
+//     length: The number of bytes, reduced by the blocks.
+//     block: The length of a block.
+//     tables: The shift tables of the length of a block.
+// Returns:
+//     The running CRC past the blocks.
+SERVERCC_CRC32C_TARGET inline uint32_t extendInterleaved(uint32_t crc, const uint8_t *&data,
+                                                         size_t &length, size_t block,
+                                                         const crc_tables_t<4> &tables) {
+    for (; length >= block * 3; data += block * 3, length -= block * 3) {
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+        for (size_t offset = 0; offset < block; offset += 8) {
+            crc = crcWord(crc, load64(data + offset));
+            crc1 = crcWord(crc1, load64(data + block + offset));
+            crc2 = crcWord(crc2, load64(data + block * 2 + offset));
+        }
+        crc = shift(tables, crc) ^ crc1;
+        crc = shift(tables, crc) ^ crc2;
+    }
+    return crc;
+}
+
+// See crc32c.h for documentation.
+SERVERCC_CRC32C_TARGET uint32_t extendHardware(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (; length > 0 && ((uintptr_t)data & 7) != 0; data++, length--) {
+        crc = crcByte(crc, *data);
+    }
+    crc = extendInterleaved(crc, data, length, kLongBlock, kLongShift);
+    crc = extendInterleaved(crc, data, length, kShortBlock, kShortShift);
+    for (; length >= 8; data += 8, length -= 8) {
+        crc = crcWord(crc, load64(data));
+    }
+    for (; length > 0; data++, length--) {
+        crc = crcByte(crc, *data);
+    }
+    return ~crc;
+}
+
+#endif
+
+#if defined(SERVERCC_CRC32C_FOLD_TARGET)
+
+// Returns a vector of the specified constants for every lane.
+SERVERCC_CRC32C_FOLD_TARGET inline __m512i broadcast(FoldConstants constants) {
+    return _mm512_set_epi64(constants.low, constants.high, constants.low, constants.high,
+                            constants.low, constants.high, constants.low, constants.high);
+}
+
+// Moves the lanes of a vector further with the specified constants and adds them to the bytes
+// there.
+SERVERCC_CRC32C_FOLD_TARGET inline __m512i fold(__m512i value, __m512i constants, __m512i data) {
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(value, constants, 0x01),
+                                     _mm512_clmulepi64_epi128(value, constants, 0x10), data, 0x96);
+}
+
+// Folds four vectors of 64 bytes at a time into the bytes 256 bytes further, which is linear in
+// the bytes and keeps their remainder by the polynomial, with the carry-less multiplication
+// throughput of the CPU rather than the latency of the CRC32 instruction. The four vectors are
+// then folded into one, its lanes into the last one and the lane through the CRC32 instruction.
+// See Gopal et al., "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+//
+// Arguments:
+//     crc: The running CRC.
+//     data: The bytes.
+//     length: The number of bytes.
+// Returns:
+//     The running CRC past the bytes.
+SERVERCC_CRC32C_FOLD_TARGET uint32_t extendFolding(uint32_t crc, const uint8_t *data,
+                                                   size_t length) {
+    if (length < kFoldThreshold) {
+        return extendHardware(crc, data, length);
+    }
+
+    // The running CRC is added to the first bytes.
+    auto block = broadcast(kFoldBlock);
+    __m512i values[4];
+    for (size_t n = 0; n < 4; n++) {
+        values[n] = _mm512_loadu_si512(data + 64 * n);
+    }
+    values[0] = _mm512_xor_si512(values[0], _mm512_zextsi128_si512(_mm_cvtsi32_si128(~crc)));
+    data += 256;
+    length -= 256;
+    for (; length >= 256; data += 256, length -= 256) {
+        for (size_t n = 0; n < 4; n++) {
+            values[n] = fold(values[n], block, _mm512_loadu_si512(data + 64 * n));
+        }
+    }
+
+    auto vector = broadcast(kFoldVector);
+    auto value = fold(values[0], vector, values[1]);
+    value = fold(value, vector, values[2]);
+    value = fold(value, vector, values[3]);
+    for (; length >= 64; data += 64, length -= 64) {
+        value = fold(value, vector, _mm512_loadu_si512(data));
+    }
+
+    // The first three lanes move 48, 32 and 16 bytes further onto the last one.
+    auto lanes = _mm512_set_epi64(0, 0, kFoldLane3.low, kFoldLane3.high, kFoldLane2.low,
+                                  kFoldLane2.high, kFoldLane1.low, kFoldLane1.high);
+    alignas(64) uint64_t words[8];
+    _mm512_store_si512(words, fold(value, lanes, _mm512_maskz_mov_epi64(0xc0, value)));
+    crc = crcWord(0, words[0] ^ words[2] ^ words[4] ^ words[6]);
+    crc = crcWord(crc, words[1] ^ words[3] ^ words[5] ^ words[7]);
+    return extendHardware(~crc, data, length);
+}
+
+#endif
+
+// The implementation of extendCrc32c.
+using extend_t = uint32_t (*)(uint32_t, const uint8_t *, size_t);
+
+// Returns the fastest implementation the CPU supports.
+extend_t selectExtend() {
+#if defined(SERVERCC_CRC32C_FOLD_TARGET)
+    if (foldingSupported()) {
+        return extendFolding;
+    }
+#endif
+#if defined(SERVERCC_CRC32C_TARGET)
+    if (hardwareSupported()) {
+        return extendHardware;
+    }
+#endif
+    return extendPortable;
+}
+
+}  // namespace
+
+// See crc32c.h for documentation.
+uint32_t extendCrc32c(uint32_t crc, const void *data, size_t length) {
+    static const extend_t extend = selectExtend();
+    return extend(crc, (const uint8_t *)data, length);
+}
+
+// See crc32c.h for documentation.
+uint32_t extendCrc32cPortable(uint32_t crc, const void *data, size_t length) {
+    return extendPortable(crc, (const uint8_t *)data, length);
+}
+
+// See crc32c.h for documentation.
+bool crc32cAccelerated() { return selectExtend() != extendPortable; }
+
+}  // namespace ostp::servercc
@@ -0,0 +1,26 @@
+#include "deadline.h"
+
+#include <algorithm>
+
+namespace ostp::servercc {
+
+namespace {
+
+// The deadline of the work running on the calling thread.
+thread_local std::chrono::steady_clock::time_point threadDeadline = kNoDeadline;
+
+}  // namespace
+
+// See deadline.h for documentation.
+std::chrono::steady_clock::time_point currentDeadline() { return threadDeadline; }
+
+// See deadline.h for documentation.
+ScopedDeadline::ScopedDeadline(std::chrono::steady_clock::time_point deadline)
+    : previous(threadDeadline) {
+    threadDeadline = std::min(previous, deadline);
+}
+
+// See deadline.h for documentation.
+ScopedDeadline::~ScopedDeadline() { threadDeadline = previous; }
+
+}  // namespace ostp::servercc
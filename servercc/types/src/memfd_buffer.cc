@@ -0,0 +1,82 @@
+#include "memfd_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace ostp::servercc {
+
+// See memfd_buffer.h for documentation.
+std::pair<absl::Status, std::unique_ptr<MemfdBuffer>> MemfdBuffer::create(absl::string_view name,
+                                                                        size_t size) {
+    int fd = memfd_create(std::string(name).c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return {absl::ErrnoToStatus(errno, "Failed to create memory file"), nullptr};
+    }
+    if (ftruncate(fd, size) < 0) {
+        auto status = absl::ErrnoToStatus(errno, "Failed to size memory file");
+        close(fd);
+        return {status, nullptr};
+    }
+    void *address = nullptr;
+    if (size > 0) {
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            auto status = absl::ErrnoToStatus(errno, "Failed to map memory file");
+            close(fd);
+            return {status, nullptr};
+        }
+    }
+    return {absl::OkStatus(),
+            std::unique_ptr<MemfdBuffer>(new MemfdBuffer(fd, (uint8_t *)address, size))};
+}
+
+// See memfd_buffer.h for documentation.
+std::pair<absl::Status, std::unique_ptr<MemfdBuffer>> MemfdBuffer::map(int fd) {
+    // Refuse a file whose size the sender can still change as shrinking it would fault the
+    // receiver on access.
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+        close(fd);
+        return {absl::InvalidArgumentError("Memory file size is not sealed"), nullptr};
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) < 0) {
+        auto status = absl::ErrnoToStatus(errno, "Failed to stat memory file");
+        close(fd);
+        return {status, nullptr};
+    }
+    void *address = nullptr;
+    if (stat.st_size > 0) {
+        address = mmap(nullptr, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            auto status = absl::ErrnoToStatus(errno, "Failed to map memory file");
+            close(fd);
+            return {status, nullptr};
+        }
+    }
+    return {absl::OkStatus(),
+            std::unique_ptr<MemfdBuffer>(new MemfdBuffer(fd, (uint8_t *)address, stat.st_size))};
+}
+
+// See memfd_buffer.h for documentation.
+MemfdBuffer::~MemfdBuffer() {
+    if (address != nullptr) {
+        munmap(address, length);
+    }
+    close(fd);
+}
+
+// See memfd_buffer.h for documentation.
+absl::Status MemfdBuffer::seal() {
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        return absl::ErrnoToStatus(errno, "Failed to seal memory file");
+    }
+    return absl::OkStatus();
+}
+
+}  // namespace ostp::servercc
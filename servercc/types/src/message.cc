@@ -1,16 +1,135 @@
 #include "message.h"
 
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <unistd.h>
+
+#include <limits>
+
+#include <cstring>
 #include <future>
 
+#include "metrics_registry.h"
+
 namespace ostp::servercc {
 
-// See message.h for documentation.
-std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd) {
+namespace {
+
+// The metrics recorded when reading and writing messages.
+struct MessageMetrics {
+    Counter &messagesRead;
+    Counter &bytesRead;
+    Counter &readSyscalls;
+    Counter &shortReads;
+    Counter &messagesWritten;
+    Counter &bytesWritten;
+    Counter &writeSyscalls;
+    Counter &shortWrites;
+    Counter &bulkMessagesWritten;
+    Counter &zeroCopySends;
+    Counter &zeroCopyCopied;
+    Counter &sendfileBytes;
+};
+
+// Returns the message metrics of the process.
+MessageMetrics &messageMetrics() {
+    static auto &registry = MetricsRegistry::global();
+    static MessageMetrics metrics = {
+        registry.counter("servercc_messages_read_total"),
+        registry.counter("servercc_message_bytes_read_total"),
+        registry.counter("servercc_message_read_syscalls_total"),
+        registry.counter("servercc_message_short_reads_total"),
+        registry.counter("servercc_messages_written_total"),
+        registry.counter("servercc_message_bytes_written_total"),
+        registry.counter("servercc_message_write_syscalls_total"),
+        registry.counter("servercc_message_short_writes_total"),
+        registry.counter("servercc_bulk_messages_written_total"),
+        registry.counter("servercc_message_zerocopy_sends_total"),
+        registry.counter("servercc_message_zerocopy_copied_total"),
+        registry.counter("servercc_message_sendfile_bytes_total"),
+    };
+    return metrics;
+}
+
+// Reads exactly the specified number of bytes from the file descriptor.
+//
+// Arguments:
+//     fd: The file descriptor to read from.
+//     data: The buffer to read into.
+//     length: The number of bytes to read.
+//     descriptors: Receives the file descriptors passed with the bytes if not null.
+// Returns:
+//     Whether every byte was read before the end of the stream or an error.
+bool readFully(int fd, void *data, size_t length, std::vector<int> *descriptors = nullptr) {
+    auto &metrics = messageMetrics();
+    size_t offset = 0;
+    while (offset < length) {
+        ssize_t bytesRead;
+        if (descriptors == nullptr) {
+            bytesRead = recv(fd, (uint8_t *)data + offset, length - offset, 0);
+        } else {
+            // Collect the rights passed with the bytes. They arrive with the first byte written
+            // with them so only the first read of a message usually carries any.
+            alignas(cmsghdr) char control[CMSG_SPACE(kMaxPassedDescriptors * sizeof(int))];
+            iovec iov = {(uint8_t *)data + offset, length - offset};
+            msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            bytesRead = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+            if (bytesRead > 0) {
+                for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                        auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        for (size_t i = 0; i < count; i++) {
+                            int passed;
+                            memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                            descriptors->push_back(passed);
+                        }
+                    }
+                }
+                if (msg.msg_flags & MSG_CTRUNC) {
+                    return false;
+                }
+            }
+        }
+        metrics.readSyscalls.add();
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        if ((size_t)bytesRead < length - offset) {
+            metrics.shortReads.add();
+        }
+        offset += bytesRead;
+    }
+    metrics.bytesRead.add(length);
+    return true;
+}
+
+// Reads a message from the file descriptor.
+//
+// Arguments:
+//     fd: The file descriptor to read from.
+//     descriptors: Receives the file descriptors passed with the message if not null.
+// Returns:
+//     The status of the operation and the message if successful.
+std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd,
+                                                              std::vector<int> *descriptors) {
     std::unique_ptr<Message> message = std::make_unique<Message>();
 
     // Read the header.
-    auto bytesRead = recv(fd, &message->header, kMessageHeaderLength, 0);
-    if (bytesRead < kMessageHeaderLength) {
+    if (!readFully(fd, &message->header, kMessageHeaderLength, descriptors)) {
         return {absl::InvalidArgumentError("Error reading message header"), nullptr};
     }
 
@@ -18,16 +137,294 @@ std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd) {
         message->body.data.resize(message->header.length);
 
         // Read the body.
-        bytesRead = recv(fd, message->body.data.data(), message->header.length, 0);
-        if (bytesRead < message->header.length) {
+        if (!readFully(fd, message->body.data.data(), message->header.length, descriptors)) {
             return {absl::InvalidArgumentError("Error reading message body"), nullptr};
         }
     }
 
     // Return the message.
+    messageMetrics().messagesRead.add();
     return {absl::OkStatus(), std::move(message)};
 }
 
+// Writes the segments of a message with as many system calls as needed. File descriptors
+// attached to the message are passed with its first byte.
+//
+// Arguments:
+//     fd: The file descriptor to write to.
+//     msg: The segments to write. Updated to the segments left when a write fails.
+//     length: The total length of the segments.
+//     zeroCopy: Whether to send with MSG_ZEROCOPY. Cleared if the kernel runs out of memory to
+//         pin pages so that the rest is copied.
+//     zeroCopySends: Incremented for every successful send with MSG_ZEROCOPY.
+// Returns:
+//     The number of bytes left unwritten, zero if every byte was written.
+size_t sendFully(int fd, msghdr &msg, size_t length, bool &zeroCopy, uint32_t &zeroCopySends) {
+    auto &metrics = messageMetrics();
+    size_t remaining = length;
+    while (remaining > 0) {
+        auto bytesWritten = sendmsg(fd, &msg, MSG_NOSIGNAL | (zeroCopy ? MSG_ZEROCOPY : 0));
+        metrics.writeSyscalls.add();
+        if (bytesWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesWritten < 0 && errno == ENOBUFS && zeroCopy) {
+            zeroCopy = false;
+            continue;
+        }
+        if (bytesWritten <= 0) {
+            return remaining;
+        }
+        if (zeroCopy) {
+            zeroCopySends++;
+            metrics.zeroCopySends.add();
+        }
+        remaining -= bytesWritten;
+        if (remaining == 0) {
+            break;
+        }
+
+        // The rights were passed with the bytes written so far.
+        msg.msg_control = nullptr;
+        msg.msg_controllen = 0;
+
+        // Skip the segments that were fully written.
+        metrics.shortWrites.add();
+        while ((size_t)bytesWritten >= msg.msg_iov->iov_len) {
+            bytesWritten -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + bytesWritten;
+        msg.msg_iov->iov_len -= bytesWritten;
+    }
+    return 0;
+}
+
+// Waits until the kernel released the pages of the specified number of sends with MSG_ZEROCOPY.
+// The completions are read from the error queue of the socket and each one covers a range of
+// sends.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     sends: The number of sends to wait for.
+// Returns:
+//     The status of the operation.
+absl::Status waitForZeroCopy(int fd, uint32_t sends) {
+    auto &metrics = messageMetrics();
+    uint32_t completed = 0;
+    while (completed < sends) {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+        msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return absl::InternalError("Error reading zero copy completions");
+            }
+
+            // POLLERR is also raised by a pending socket error in which case the completions
+            // never come.
+            pollfd pollFd = {fd, 0, 0};
+            if (poll(&pollFd, 1, -1) < 0 && errno != EINTR) {
+                return absl::InternalError("Error waiting for zero copy completions");
+            }
+            int error = 0;
+            socklen_t errorLength = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 && error != 0) {
+                return absl::InternalError("Socket failed before zero copy completions");
+            }
+            continue;
+        }
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0) {
+                continue;
+            }
+            completed += error.ee_data - error.ee_info + 1;
+
+            // The kernel copied the pages instead, such as for a peer on the same host.
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                metrics.zeroCopyCopied.add();
+            }
+        }
+    }
+    return absl::OkStatus();
+}
+
+// Reads exactly the specified region of a file.
+//
+// Arguments:
+//     fd: The file descriptor of the file.
+//     data: The buffer to read into.
+//     length: The length of the region.
+//     offset: The offset of the region in the file.
+// Returns:
+//     Whether the whole region was read.
+bool preadFully(int fd, uint8_t *data, size_t length, off_t offset) {
+    while (length > 0) {
+        auto bytesRead = pread(fd, data, length, offset);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        data += bytesRead;
+        length -= bytesRead;
+        offset += bytesRead;
+    }
+    return true;
+}
+
+// Writes a frame whose body is a region of a file followed by a trailer. The header and trailer
+// are corked around the region on a TCP socket so that they leave in full segments.
+//
+// Arguments:
+//     fd: The file descriptor of the socket.
+//     header: The header of the frame.
+//     headerLength: The length of the header.
+//     payload: The region of the file.
+//     trailer: The bytes sent after the region.
+// Returns:
+//     The status of the operation.
+absl::Status writeFileFrame(int fd, const void *header, size_t headerLength,
+                            const BulkPayload &payload, const std::vector<uint8_t> &trailer) {
+    auto &metrics = messageMetrics();
+    int cork = 1;
+    bool corked = setsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) == 0;
+
+    auto status = [&]() -> absl::Status {
+        bool zeroCopy = false;
+        uint32_t zeroCopySends = 0;
+        iovec headerIov = {(void *)header, headerLength};
+        msghdr headerMsg = {};
+        headerMsg.msg_iov = &headerIov;
+        headerMsg.msg_iovlen = 1;
+        if (sendFully(fd, headerMsg, headerLength, zeroCopy, zeroCopySends) > 0) {
+            return absl::InvalidArgumentError("Error writing message header");
+        }
+
+        // A source or socket that sendfile does not support fails before writing anything.
+        off_t offset = payload.offset;
+        size_t remaining = payload.length;
+        while (remaining > 0) {
+            auto bytesWritten = sendfile(fd, payload.fd, &offset, remaining);
+            metrics.writeSyscalls.add();
+            if (bytesWritten < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesWritten < 0 && (errno == EINVAL || errno == ENOSYS) &&
+                remaining == payload.length) {
+                std::vector<uint8_t> buffer(remaining);
+                if (!preadFully(payload.fd, buffer.data(), remaining, offset)) {
+                    return absl::InvalidArgumentError("Error reading message body from file");
+                }
+                iovec bodyIov = {buffer.data(), remaining};
+                msghdr bodyMsg = {};
+                bodyMsg.msg_iov = &bodyIov;
+                bodyMsg.msg_iovlen = 1;
+                if (sendFully(fd, bodyMsg, remaining, zeroCopy, zeroCopySends) > 0) {
+                    return absl::InvalidArgumentError("Error writing message body");
+                }
+                break;
+            }
+            if (bytesWritten <= 0) {
+                return absl::InvalidArgumentError("Error writing message body from file");
+            }
+            metrics.sendfileBytes.add(bytesWritten);
+            remaining -= bytesWritten;
+        }
+
+        if (!trailer.empty()) {
+            iovec trailerIov = {(void *)trailer.data(), trailer.size()};
+            msghdr trailerMsg = {};
+            trailerMsg.msg_iov = &trailerIov;
+            trailerMsg.msg_iovlen = 1;
+            if (sendFully(fd, trailerMsg, trailer.size(), zeroCopy, zeroCopySends) > 0) {
+                return absl::InvalidArgumentError("Error writing message body");
+            }
+        }
+        return absl::OkStatus();
+    }();
+
+    // Uncorking pushes the last partial segment right away.
+    if (corked) {
+        cork = 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+    }
+    return status;
+}
+
+// Writes a message to the file descriptor passing the specified file descriptors with its first
+// byte.
+//
+// Arguments:
+//     fd: The file descriptor to write to.
+//     message: The message to write.
+//     descriptors: The file descriptors to pass.
+//     descriptorCount: The number of file descriptors to pass.
+// Returns:
+//     The status of the operation.
+absl::Status writeMessage(int fd, std::unique_ptr<Message> message, const int *descriptors,
+                          size_t descriptorCount) {
+    if (fd < 0) {
+        return absl::InvalidArgumentError("Invalid file descriptor");
+    }
+    if (descriptorCount > kMaxPassedDescriptors) {
+        return absl::InvalidArgumentError("Too many file descriptors passed with a message");
+    }
+    message->header.length = message->body.data.size();
+
+    // Write the header and the body with a single system call when possible so that the body is
+    // not held back by Nagle's algorithm waiting for the header to be acknowledged.
+    auto &metrics = messageMetrics();
+    iovec iov[2] = {{&message->header, kMessageHeaderLength},
+                    {message->body.data.data(), message->header.length}};
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = message->header.length > 0 ? 2 : 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(kMaxPassedDescriptors * sizeof(int))];
+    if (descriptorCount > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(descriptorCount * sizeof(int));
+        auto *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(descriptorCount * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), descriptors, descriptorCount * sizeof(int));
+    }
+    bool zeroCopy = false;
+    uint32_t zeroCopySends = 0;
+    auto remaining = sendFully(fd, msg, kMessageHeaderLength + message->header.length, zeroCopy,
+                               zeroCopySends);
+    if (remaining > 0) {
+        return absl::InvalidArgumentError(remaining > message->header.length
+                                              ? "Error writing message header"
+                                              : "Error writing message body");
+    }
+
+    // Return.
+    metrics.messagesWritten.add();
+    metrics.bytesWritten.add(kMessageHeaderLength + message->header.length);
+    return absl::OkStatus();
+}
+
+}  // namespace
+
+// See message.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd) {
+    return readMessage(fd, (std::vector<int> *)nullptr);
+}
+
 // See message.h for documentation.
 std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd, int timeout) {
     // Try to read the message as a future.
@@ -43,28 +440,152 @@ std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd, int timeou
     return future.get();
 }
 
+// See message.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> readMessage(int fd,
+                                                              std::vector<int> &descriptors) {
+    std::vector<int> received;
+    auto result = readMessage(fd, &received);
+    if (!result.first.ok()) {
+        for (auto passed : received) {
+            close(passed);
+        }
+        return result;
+    }
+    descriptors.insert(descriptors.end(), received.begin(), received.end());
+    return result;
+}
+
 // See message.h for documentation.
 absl::Status writeMessage(int fd, std::unique_ptr<Message> message) {
+    return writeMessage(fd, std::move(message), nullptr, 0);
+}
+
+// See message.h for documentation.
+absl::Status writeMessage(int fd, std::unique_ptr<Message> message,
+                          const std::vector<int> &descriptors) {
+    return writeMessage(fd, std::move(message), descriptors.data(), descriptors.size());
+}
+
+// See message.h for documentation.
+absl::Status writeBulkMessage(int fd, protocol_t protocol, const BulkPayload &payload,
+                              const std::vector<uint8_t> &trailer) {
+    if (payload.length + trailer.size() > std::numeric_limits<uint32_t>::max()) {
+        return absl::InvalidArgumentError("Bulk payload does not fit in a message");
+    }
+    MessageHeader header = {(uint32_t)(payload.length + trailer.size()), protocol};
+    auto status = sendFrame(fd, &header, kMessageHeaderLength, payload, trailer);
+    if (status.ok()) {
+        messageMetrics().bulkMessagesWritten.add();
+    }
+    return status;
+}
+
+// See message.h for documentation.
+absl::Status sendFrame(int fd, const void *header, size_t headerLength, const BulkPayload &payload,
+                       const std::vector<uint8_t> &trailer) {
     if (fd < 0) {
         return absl::InvalidArgumentError("Invalid file descriptor");
     }
-    message->header.length = message->body.data.size();
+    auto bodyLength = payload.length + trailer.size();
 
-    // Write the header.
-    auto bytesWritten = send(fd, &message->header, kMessageHeaderLength, 0);
-    if (bytesWritten < kMessageHeaderLength) {
-        return absl::InvalidArgumentError("Error writing message header");
-    }
+    absl::Status status;
+    if (payload.data == nullptr && payload.length > 0) {
+        status = writeFileFrame(fd, header, headerLength, payload, trailer);
+    } else {
+        // The sends are counted per socket by the kernel from the moment zero copy is enabled, so
+        // every completion read here belongs to this frame as writes are serialized.
+        int enable = 1;
+        bool zeroCopy = payload.length >= kZeroCopyThreshold &&
+                        setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0;
+        uint32_t zeroCopySends = 0;
+        iovec iov[3] = {{(void *)header, headerLength},
+                        {(void *)payload.data, payload.length},
+                        {(void *)trailer.data(), trailer.size()}};
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = trailer.empty() ? (payload.length > 0 ? 2 : 1) : 3;
+        auto remaining = sendFully(fd, msg, headerLength + bodyLength, zeroCopy, zeroCopySends);
+        if (remaining > 0) {
+            status = absl::InvalidArgumentError(remaining > bodyLength
+                                                    ? "Error writing message header"
+                                                    : "Error writing message body");
+        }
 
-    // Write the body.
-    bytesWritten = send(fd, message->body.data.data(), message->header.length, 0);
-    if (bytesWritten < message->header.length) {
-        return absl::InvalidArgumentError("Error writing message body");
+        // The pages stay pinned until the completions arrive, even when a later send failed.
+        if (zeroCopySends > 0) {
+            auto waitStatus = waitForZeroCopy(fd, zeroCopySends);
+            if (status.ok()) {
+                status = waitStatus;
+            }
+        }
+    }
+    if (!status.ok()) {
+        return status;
     }
-    fsync(fd);
 
-    // Return.
+    auto &metrics = messageMetrics();
+    metrics.messagesWritten.add();
+    metrics.bytesWritten.add(headerLength + bodyLength);
     return absl::OkStatus();
 }
 
+// See message.h for documentation.
+ssize_t readAtLeast(int fd, void *data, size_t minimum, size_t capacity) {
+    auto &metrics = messageMetrics();
+    size_t offset = 0;
+    while (offset < minimum) {
+        auto bytesRead = recv(fd, (uint8_t *)data + offset, capacity - offset, 0);
+        metrics.readSyscalls.add();
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return -1;
+        }
+        offset += bytesRead;
+    }
+    metrics.bytesRead.add(offset);
+    return offset;
+}
+
+// See message.h for documentation.
+ssize_t readAtLeast(int fd, void *data, size_t length, void *spill, size_t spillCapacity) {
+    auto &metrics = messageMetrics();
+    size_t offset = 0;
+    while (offset < length) {
+        iovec iov[2] = {{(uint8_t *)data + offset, length - offset}, {spill, spillCapacity}};
+        auto bytesRead = readv(fd, iov, 2);
+        metrics.readSyscalls.add();
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return -1;
+        }
+        offset += bytesRead;
+    }
+    metrics.bytesRead.add(offset);
+    return offset - length;
+}
+
+// See message.h for documentation.
+std::pair<absl::Status, std::unique_ptr<Message>> makeBulkMessage(
+    protocol_t protocol, const BulkPayload &payload, const std::vector<uint8_t> &trailer) {
+    if (payload.length + trailer.size() > std::numeric_limits<uint32_t>::max()) {
+        return {absl::InvalidArgumentError("Bulk payload does not fit in a message"), nullptr};
+    }
+    auto message = std::make_unique<Message>();
+    message->header.protocol = protocol;
+    message->header.length = payload.length + trailer.size();
+    message->body.data.resize(message->header.length);
+    if (payload.data != nullptr) {
+        memcpy(message->body.data.data(), payload.data, payload.length);
+    } else if (!preadFully(payload.fd, message->body.data.data(), payload.length,
+                           payload.offset)) {
+        return {absl::InvalidArgumentError("Error reading message body from file"), nullptr};
+    }
+    memcpy(message->body.data.data() + payload.length, trailer.data(), trailer.size());
+    return {absl::OkStatus(), std::move(message)};
+}
+
 }  // namespace ostp::servercc
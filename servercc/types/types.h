@@ -5,12 +5,18 @@
 
 #include <functional>
 
+#include "include/cancellation_token.h"
+#include "include/crc32c.h"
+#include "include/deadline.h"
 #include "include/macros.h"
+#include "include/memfd_buffer.h"
 #include "include/message.h"
 #include "include/message_body.h"
 #include "include/message_header.h"
+#include "include/peer_address.h"
 #include "include/protocols.h"
 #include "include/request.h"
+#include "include/unix_address.h"
 
 namespace ostp::servercc {}  // namespace ostp::servercc
 
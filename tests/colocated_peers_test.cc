@@ -0,0 +1,121 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "servercc.h"
+
+using ostp::servercc::DistributedServer;
+using ostp::servercc::HeartbeatOptions;
+using ostp::servercc::MembershipOptions;
+using ostp::servercc::Message;
+using ostp::servercc::MetricsRegistry;
+using ostp::servercc::NetworkTransport;
+using ostp::servercc::Request;
+
+namespace {
+
+// The ports of the servers and the group port they share.
+constexpr uint16_t kFirstPort = 23100;
+constexpr uint16_t kSecondPort = 23101;
+constexpr uint16_t kGroupPort = 23199;
+
+// Echoes the message of a request back.
+absl::Status echo(std::unique_ptr<Request> request) {
+    auto [status, message] = request->receiveMessage();
+    if (!status.ok()) {
+        return status;
+    }
+    return request->sendMessage(std::move(message));
+}
+
+// Returns the value of a metric of the process or zero if it is not registered.
+//
+// Arguments:
+//     name: The name of the metric.
+double metricValue(const std::string &name) {
+    auto exposition = MetricsRegistry::global().exposition();
+    auto line = "\n" + name + " ";
+    auto position = exposition.find(line);
+    if (position == std::string::npos) {
+        return 0;
+    }
+    return std::stod(exposition.substr(position + line.size()));
+}
+
+// Reports a failed check and exits as the servers can not be stopped.
+//
+// Arguments:
+//     message: The description of the failed check.
+void fail(absl::string_view message) {
+    std::cerr << "FAILED: " << message << std::endl;
+    _exit(1);
+}
+
+// Creates a server on 127.0.0.1 listening on the specified port.
+//
+// Arguments:
+//     port: The port of the server.
+std::unique_ptr<DistributedServer> makeServer(uint16_t port) {
+    MembershipOptions membershipOptions;
+    membershipOptions.protocolPeriod = std::chrono::milliseconds(100);
+    membershipOptions.probeTimeout = std::chrono::milliseconds(30);
+    return std::make_unique<DistributedServer>(
+        std::make_unique<NetworkTransport>("lo", "239.255.7.7",
+                                           std::vector<absl::string_view>{"127.0.0.1"}, port,
+                                           kGroupPort),
+        echo, nullptr, HeartbeatOptions(), membershipOptions);
+}
+
+}  // namespace
+
+// Checks that two servers sharing a host but not a port see each other and exchange internal
+// requests over shared memory.
+int main() {
+    auto first = makeServer(kFirstPort);
+    auto second = makeServer(kSecondPort);
+    if (!first->run().ok() || !second->run().ok()) {
+        fail("servers did not start");
+    }
+
+    // Wait for both servers to join each other.
+    for (int i = 0; i < 100 && (first->members().empty() || second->members().empty()); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (first->members().size() != 1 || first->members()[0].peer() != second->getLocalPeer()) {
+        fail("the first server does not see the second one");
+    }
+    if (second->members().size() != 1 || second->members()[0].peer() != first->getLocalPeer()) {
+        fail("the second server does not see the first one");
+    }
+
+    // Send an internal request from the first server to the second one.
+    auto messagesRead = metricValue("servercc_shm_messages_read_total");
+    auto [status, request] = first->sendInternalRequest(second->getLocalPeer());
+    if (!status.ok()) {
+        fail("internal request was not sent");
+    }
+    auto message = std::make_unique<Message>();
+    message->header.protocol = 0x30;
+    message->body.data = {1, 2, 3};
+    message->header.length = message->body.data.size();
+    if (!request->sendMessage(std::move(message)).ok()) {
+        fail("internal request message was not sent");
+    }
+    auto [responseStatus, response] = request->receiveMessage(2000);
+    if (!responseStatus.ok() || response->body.data != std::vector<uint8_t>{1, 2, 3}) {
+        fail("internal request was not echoed");
+    }
+    if (metricValue("servercc_shm_messages_read_total") <= messagesRead) {
+        fail("internal request was not carried over shared memory");
+    }
+
+    std::cout << "PASSED" << std::endl;
+    _exit(0);
+}
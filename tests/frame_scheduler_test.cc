@@ -0,0 +1,74 @@
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_join.h"
+#include "frame_scheduler.h"
+
+using ostp::servercc::FramePriority;
+using ostp::servercc::FrameScheduler;
+
+namespace {
+
+// The flows of the frames.
+constexpr uint64_t kClosedFlow = 1;
+constexpr uint64_t kOtherFlow = 2;
+
+// The time given to a writer to wait for its turn.
+constexpr auto kQueueDelay = std::chrono::milliseconds(100);
+
+}  // namespace
+
+// Checks that the end of a channel queued behind its bulk data is written after the data while the
+// control frames of other channels still overtake the data.
+int main() {
+    FrameScheduler scheduler;
+    std::mutex writtenMutex;
+    std::vector<std::string> written;
+    auto writeFrame = [&](uint64_t flow, FramePriority priority, const std::string &name) {
+        return std::thread([&, flow, priority, name]() {
+            scheduler
+                .write(flow, priority, 1024 * 1024,
+                       [&]() {
+                           std::lock_guard lock(writtenMutex);
+                           written.push_back(name);
+                           return absl::OkStatus();
+                       })
+                .IgnoreError();
+        });
+    };
+
+    // Keep the link busy while the frames are queued in order.
+    std::thread busy([&]() {
+        scheduler
+            .write(kOtherFlow, FramePriority::kInteractive, 1,
+                   [&]() {
+                       std::this_thread::sleep_for(4 * kQueueDelay);
+                       return absl::OkStatus();
+                   })
+            .IgnoreError();
+    });
+    std::this_thread::sleep_for(kQueueDelay);
+    auto data = writeFrame(kClosedFlow, FramePriority::kBulk, "data");
+    std::this_thread::sleep_for(kQueueDelay);
+    auto end = writeFrame(kClosedFlow, FramePriority::kControl, "end");
+    std::this_thread::sleep_for(kQueueDelay);
+    auto control = writeFrame(kOtherFlow, FramePriority::kControl, "control");
+
+    busy.join();
+    data.join();
+    end.join();
+    control.join();
+
+    auto order = absl::StrJoin(written, ",");
+    if (order != "control,data,end") {
+        std::cerr << "FAILED: frames were written in the order " << order << std::endl;
+        return 1;
+    }
+    std::cout << "PASSED" << std::endl;
+    return 0;
+}